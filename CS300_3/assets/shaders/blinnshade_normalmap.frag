@@ -7,6 +7,7 @@ in vec4 viewNormal;
 in vec4 viewTangent;
 in vec4 viewBitangent;
 in vec2 UV;
+in float occlusion;
 
 uniform vec4 globalAmbient;
 uniform vec3 vLightAttCoef; // attenuation coefficients(c1, c2, c3)
@@ -85,7 +86,7 @@ vec4 computeLightingTerm(in int lightIdx, in vec4 viewspaceNormal, in vec4 views
 		att = 1 / (vLightAttCoef.x + vLightAttCoef.y * l_length + vLightAttCoef.z * pow(l_length, 2));
 	}
 
-	vec4 ambient = light.ambient * Material.ambient;
+	vec4 ambient = light.ambient * Material.ambient * occlusion;
 	vec4 diffuse = vec4(0, 0, 0, 0);
 	vec4 specular = vec4(0, 0, 0, 0);
 	float spotlightEffect = 1;
@@ -137,7 +138,7 @@ void main()
 	if (normalMapDebugMode == NONE)
 	{
 		vec4 viewViewVec = normalize(-viewPos);
-		totalColor = Material.emissive + globalAmbient * Material.ambient;
+		totalColor = Material.emissive + globalAmbient * Material.ambient * occlusion;
 		for (int i = 0; i < LightCount; ++i)
 			totalColor += computeLightingTerm(i, viewspaceNormal, viewViewVec, viewPos, diffuse, shininess);
 		float v_length = length(viewPos);
@@ -6,23 +6,65 @@ layout(location = 1) in vec3 vNormal;
 layout(location = 2) in vec3 vTangent;
 layout(location = 3) in vec3 vBitangent;
 layout(location = 4) in vec2 vUV;
+layout(location = 5) in float vOcclusion;
+
+// Ambient occlusion baked per vertex (see AmbientOcclusionBaker.h); scales
+// the ambient terms unless UseAmbientOcclusion is off.
+uniform bool UseAmbientOcclusion;
+
+// Meshes built with VertexFormat::Packed (see inc/graphics/Vertex.h) store
+// positions quantized to [0, 1] within their bounds (undone by
+// PackedPositionTransform: xyz offset, w scale), octahedral normals and
+// tangents, and only the sign of the bitangent.
+uniform bool PackedVertex;
+uniform vec4 PackedPositionTransform;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
 
 uniform mat4 ModelViewMatrix; // local->world->view matrix
 uniform mat4 ModelViewProjectionMatrix; // local->NDC matrix [no camera support]
 
+// Instanced draws (see InstanceBatcher.h) read each instance's model matrix
+// from an attribute and combine it with ViewMatrix and ProjectionMatrix,
+// in place of the two matrices above.
+layout(location = 6) in mat4 vInstanceModel; // locations 6 to 9
+uniform bool UseInstancing;
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+
 out vec4 viewPos;
 out vec4 viewNormal;
 out vec4 viewTangent;
 out vec4 viewBitangent;
 out vec2 UV;
+out float occlusion;
 
 void main()
 {
-	viewPos = ModelViewMatrix * vec4(vVertex, 1);
-	viewNormal = normalize(ModelViewMatrix * vec4(vNormal, 0));
-	viewTangent = ModelViewMatrix * vec4(vTangent, 0);
-	viewBitangent = ModelViewMatrix * vec4(vBitangent, 0);
+	mat4 modelView = UseInstancing ? ViewMatrix * vInstanceModel : ModelViewMatrix;
+	mat4 modelViewProjection = UseInstancing ? ProjectionMatrix * modelView
+		: ModelViewProjectionMatrix;
+	vec3 vertexPosition = vVertex;
+	if (PackedVertex)
+		vertexPosition = PackedPositionTransform.xyz + vVertex * PackedPositionTransform.w;
+	vec3 vertexNormal = PackedVertex ? DecodeOctahedral(vNormal.xy) : vNormal;
+	vec3 vertexTangent = PackedVertex ? DecodeOctahedral(vTangent.xy) : vTangent;
+	vec3 vertexBitangent = PackedVertex
+		? vBitangent.x * cross(vertexNormal, vertexTangent) : vBitangent;
+
+	viewPos = modelView * vec4(vertexPosition, 1);
+	viewNormal = normalize(modelView * vec4(vertexNormal, 0));
+	viewTangent = modelView * vec4(vertexTangent, 0);
+	viewBitangent = modelView * vec4(vertexBitangent, 0);
 	UV = vUV;
 
-	gl_Position = ModelViewProjectionMatrix * vec4(vVertex, 1);
+	occlusion = UseAmbientOcclusion ? vOcclusion : 1.0;
+
+	gl_Position = modelViewProjection * vec4(vertexPosition, 1);
 }
@@ -5,6 +5,12 @@ layout(location = 0) in vec3 vVertex;
 layout(location = 1) in vec2 vertexUV;
 layout(location = 2) in vec3 vNormal;
 
+// Meshes built with VertexFormat::Packed (see inc/graphics/Vertex.h) store
+// positions quantized to [0, 1] within their bounds (undone by
+// PackedPositionTransform: xyz offset, w scale).
+uniform bool PackedVertex;
+uniform vec4 PackedPositionTransform;
+
 // Output data ; will be interpolated for each fragment.
 out vec2 UV;
 
@@ -46,10 +52,25 @@ uniform Light Lights[MaxLights]; // support UP TO 8 lights
 uniform vec3 eye;
 
 uniform mat4 ModelViewMatrix; // local->world matrix
+
+// Instanced draws (see InstanceBatcher.h) read each instance's model matrix
+// from an attribute and combine it with ViewMatrix and ProjectionMatrix,
+// in place of the two matrices above.
+layout(location = 6) in mat4 vInstanceModel; // locations 6 to 9
+uniform bool UseInstancing;
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+
 void main(){
+	mat4 modelView = UseInstancing ? ViewMatrix * vInstanceModel : ModelViewMatrix;
+	mat4 modelViewProjection = UseInstancing ? ProjectionMatrix * modelView
+		: ModelViewProjectionMatrix;
+	vec3 vertexPosition = vVertex;
+	if (PackedVertex)
+		vertexPosition = PackedPositionTransform.xyz + vVertex * PackedPositionTransform.w;
 
 	// Output position of the vertex, in clip space : ModelViewProjectionMatrix * position
-	gl_Position =  ModelViewProjectionMatrix * vec4(vVertex,1);
+	gl_Position =  modelViewProjection * vec4(vertexPosition,1);
 	
 	// UV of the vertex. No special space for this one.
 	UV = vertexUV;
@@ -57,7 +78,7 @@ void main(){
 	
     if ((shaderflag & int(512)) == int(512))
     {
-	vec4 worldVtx = ModelViewMatrix * vec4(vVertex, 1);
+	vec4 worldVtx = modelView * vec4(vertexPosition, 1);
 		vec3 halfVec = normalize(Lights[0].position+eye).xyz;
 		vec3 lightPos = Lights[0].position.xyz - worldVtx.xyz;
 		UV = (Material.diffuse * dot(vNormal, lightPos) + 
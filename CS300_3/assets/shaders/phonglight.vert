@@ -3,10 +3,38 @@
 // These two must perfectly match the structure defined in inc/graphics/Vertex.h
 layout(location = 0) in vec3 vVertex;
 layout(location = 1) in vec3 vNormal;
+layout(location = 5) in float vOcclusion;
+
+// Ambient occlusion baked per vertex (see AmbientOcclusionBaker.h); scales
+// the ambient terms unless UseAmbientOcclusion is off.
+uniform bool UseAmbientOcclusion;
+float occlusion; // set first thing in main
+
+// Meshes built with VertexFormat::Packed (see inc/graphics/Vertex.h) store
+// positions quantized to [0, 1] within their bounds (undone by
+// PackedPositionTransform: xyz offset, w scale), octahedral normals.
+uniform bool PackedVertex;
+uniform vec4 PackedPositionTransform;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
 
 uniform mat4 ModelViewMatrix; // local->world matrix
 uniform mat4 ModelViewProjectionMatrix; // local->NDC matrix [no camera support]
 
+// Instanced draws (see InstanceBatcher.h) read each instance's model matrix
+// from an attribute and combine it with ViewMatrix and ProjectionMatrix,
+// in place of the two matrices above.
+layout(location = 6) in mat4 vInstanceModel; // locations 6 to 9
+uniform bool UseInstancing;
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+
 uniform vec4 globalAmbient;
 uniform vec3 vLightAttCoef; // attenuation coefficients(c1, c2, c3)
 uniform vec3 view; // view vector
@@ -70,7 +98,7 @@ vec4 computeLightingTerm(in int lightIdx, in vec4 n, in vec4 vtx)
 		att = 1 / (vLightAttCoef.x + vLightAttCoef.y * l_length + vLightAttCoef.z * pow(l_length, 2));
 	}
 	
-	vec4 ambient = light.ambient * Material.ambient;
+	vec4 ambient = light.ambient * Material.ambient * occlusion;
 
 	float spotlightEffect = 1;
 	float l_dot_n = dot(n, l);
@@ -103,7 +131,7 @@ vec4 computeLightingTerm(in int lightIdx, in vec4 n, in vec4 vtx)
 
 vec4 computeSurfaceColor(in vec4 worldNormal, in vec4 viewVtx)
 {
-	vec4 totalColor = Material.emissive + globalAmbient * Material.ambient;
+	vec4 totalColor = Material.emissive + globalAmbient * Material.ambient * occlusion;
 	for (int i = 0; i < LightCount; ++i)
 		totalColor += computeLightingTerm(i, worldNormal, viewVtx);
 	float v_length = length(vec4(view, 1) - viewVtx);
@@ -113,16 +141,25 @@ vec4 computeSurfaceColor(in vec4 worldNormal, in vec4 viewVtx)
 
 void main()
 {
+	mat4 modelView = UseInstancing ? ViewMatrix * vInstanceModel : ModelViewMatrix;
+	mat4 modelViewProjection = UseInstancing ? ProjectionMatrix * modelView
+		: ModelViewProjectionMatrix;
+	occlusion = UseAmbientOcclusion ? vOcclusion : 1.0;
+	vec3 vertexPosition = vVertex;
+	if (PackedVertex)
+		vertexPosition = PackedPositionTransform.xyz + vVertex * PackedPositionTransform.w;
+	vec3 vertexNormal = PackedVertex ? DecodeOctahedral(vNormal.xy) : vNormal;
+
 	// deal with position and normal in world space
-	vec4 worldVtx = ModelViewMatrix * vec4(vVertex, 1);
+	vec4 worldVtx = modelView * vec4(vertexPosition, 1);
 
-	// vec4(vNormal, 0) because we don't want to translate a normal;
+	// vec4(vertexNormal, 0) because we don't want to translate a normal;
 	// NOTE: this code is wrong if we support non-uniform scaling
-	vec4 worldNorm = normalize(ModelViewMatrix * vec4(vNormal, 0));
+	vec4 worldNorm = normalize(modelView * vec4(vertexNormal, 0));
 
 	// compute the final result of passing this vertex through the transformation
 	// pipeline and yielding a coordinate in NDC space
-	gl_Position = ModelViewProjectionMatrix * vec4(vVertex, 1);
+	gl_Position = modelViewProjection * vec4(vertexPosition, 1);
 
 	// compute the contribution of lights onto this vertex and interpolate that
 	// color value across the surface of the polygon
@@ -8,10 +8,39 @@ layout(location = 1) in vec3 vNormal;
 layout(location = 2) in vec3 vTangent;
 layout(location = 3) in vec3 vBitangent;
 layout(location = 4) in vec2 vUV;
+layout(location = 5) in float vOcclusion;
+
+// Ambient occlusion baked per vertex (see AmbientOcclusionBaker.h); scales
+// the ambient terms unless UseAmbientOcclusion is off.
+uniform bool UseAmbientOcclusion;
+float occlusion; // set first thing in main
+
+// Meshes built with VertexFormat::Packed (see inc/graphics/Vertex.h) store
+// positions quantized to [0, 1] within their bounds (undone by
+// PackedPositionTransform: xyz offset, w scale), octahedral normals and
+// tangents, and only the sign of the bitangent.
+uniform bool PackedVertex;
+uniform vec4 PackedPositionTransform;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
 
 uniform mat4 ModelViewMatrix; // local->world->view matrix
 uniform mat4 ModelViewProjectionMatrix; // local->NDC matrix [no camera support]
 
+// Instanced draws (see InstanceBatcher.h) read each instance's model matrix
+// from an attribute and combine it with ViewMatrix and ProjectionMatrix,
+// in place of the two matrices above.
+layout(location = 6) in mat4 vInstanceModel; // locations 6 to 9
+uniform bool UseInstancing;
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+
 uniform vec4 globalAmbient;
 uniform vec3 vLightAttCoef; // attenuation coefficients(c1, c2, c3)
 
@@ -86,7 +115,7 @@ vec4 computeLightingTerm(in int lightIdx, in vec4 viewspaceNormal, in vec4 views
 		att = 1 / (vLightAttCoef.x + vLightAttCoef.y * l_length + vLightAttCoef.z * pow(l_length, 2));
 	}
 
-	vec4 ambient = light.ambient * Material.ambient;
+	vec4 ambient = light.ambient * Material.ambient * occlusion;
 	vec4 diffuse = vec4(0, 0, 0, 0);
 	vec4 specular = vec4(0, 0, 0, 0);
 	float spotlightEffect = 1;
@@ -119,10 +148,22 @@ out vec4 litFragColor;
 
 void main()
 {
-	vec4 viewPos = ModelViewMatrix * vec4(vVertex, 1);
-	vec4 viewNormal = normalize(ModelViewMatrix * vec4(vNormal, 0));
-	vec4 viewTangent = ModelViewMatrix * vec4(vTangent, 0);
-	vec4 viewBitangent = ModelViewMatrix * vec4(vBitangent, 0);
+	mat4 modelView = UseInstancing ? ViewMatrix * vInstanceModel : ModelViewMatrix;
+	mat4 modelViewProjection = UseInstancing ? ProjectionMatrix * modelView
+		: ModelViewProjectionMatrix;
+	occlusion = UseAmbientOcclusion ? vOcclusion : 1.0;
+	vec3 vertexPosition = vVertex;
+	if (PackedVertex)
+		vertexPosition = PackedPositionTransform.xyz + vVertex * PackedPositionTransform.w;
+	vec3 vertexNormal = PackedVertex ? DecodeOctahedral(vNormal.xy) : vNormal;
+	vec3 vertexTangent = PackedVertex ? DecodeOctahedral(vTangent.xy) : vTangent;
+	vec3 vertexBitangent = PackedVertex
+		? vBitangent.x * cross(vertexNormal, vertexTangent) : vBitangent;
+
+	vec4 viewPos = modelView * vec4(vertexPosition, 1);
+	vec4 viewNormal = normalize(modelView * vec4(vertexNormal, 0));
+	vec4 viewTangent = modelView * vec4(vertexTangent, 0);
+	vec4 viewBitangent = modelView * vec4(vertexBitangent, 0);
 	vec2 UV = vUV;
 
 	vec4 normal = normalize(viewNormal);
@@ -147,7 +188,7 @@ void main()
 	if (normalMapDebugMode == NONE)
 	{
 		vec4 viewViewVec = normalize(-viewPos);
-		totalColor = Material.emissive + globalAmbient * Material.ambient;
+		totalColor = Material.emissive + globalAmbient * Material.ambient * occlusion;
 		for (int i = 0; i < LightCount; ++i)
 			totalColor += computeLightingTerm(i, viewspaceNormal, viewViewVec, viewPos, diffuse, shininess);
 		float v_length = length(viewPos);
@@ -167,6 +208,6 @@ void main()
 		totalColor = vec4(normalmapNormal.xyz * 0.5 + 1, 1);
 	}
 
-	gl_Position = ModelViewProjectionMatrix * vec4(vVertex, 1);
+	gl_Position = modelViewProjection * vec4(vertexPosition, 1);
 	litFragColor = totalColor;
 }
@@ -5,6 +5,7 @@
 in vec4 worldVtx;
 in vec4 worldNorm;
 in vec4 smoothVertex;
+in float occlusion;
 
 uniform vec4 globalAmbient;
 uniform vec3 vLightAttCoef; // attenuation coefficients(c1, c2, c3)
@@ -100,7 +101,7 @@ vec4 computeLightingTerm(in int lightIdx, in vec4 n, in vec4 vtx, in vec4 materi
 		att = 1 / (vLightAttCoef.x + vLightAttCoef.y * l_length + vLightAttCoef.z * pow(l_length, 2));
 	}
 
-	vec4 ambient = light.ambient * Material.ambient;
+	vec4 ambient = light.ambient * Material.ambient * occlusion;
 
 	float spotlightEffect = 1;
 	float l_dot_n = dot(n, l);
@@ -143,7 +144,7 @@ vec4 computeSurfaceColor(in vec4 worldNormal, in vec4 viewVtx)
 	if (useSpecularTexture == 1)
 		specular = texture(specularTexture, uv);
 
-	vec4 totalColor = Material.emissive + globalAmbient * Material.ambient;
+	vec4 totalColor = Material.emissive + globalAmbient * Material.ambient * occlusion;
 	for (int i = 0; i < LightCount; ++i)
 		totalColor += computeLightingTerm(i, worldNormal, viewVtx, diffuse, specular);
 	float v_length = length(vec4(view, 1) - viewVtx);
@@ -5,10 +5,20 @@ uniform mat4 ModelViewProjectionMatrix; // local->NDC matrix [no camera support]
 layout(location = 0) in vec3 vVertex;
 layout(location = 1) in vec3 vNormal;
 
+// Meshes built with VertexFormat::Packed (see inc/graphics/Vertex.h) store
+// positions quantized to [0, 1] within their bounds (undone by
+// PackedPositionTransform: xyz offset, w scale).
+uniform bool PackedVertex;
+uniform vec4 PackedPositionTransform;
+
 out vec4 smoothModelPosition;
 
 void main()
 {  
-  smoothModelPosition = vec4(vVertex, 1);
-  gl_Position = ModelViewProjectionMatrix * vec4(vVertex, 1);
+	vec3 vertexPosition = vVertex;
+	if (PackedVertex)
+		vertexPosition = PackedPositionTransform.xyz + vVertex * PackedPositionTransform.w;
+
+  smoothModelPosition = vec4(vertexPosition, 1);
+  gl_Position = ModelViewProjectionMatrix * vec4(vertexPosition, 1);
 }
\ No newline at end of file
@@ -28,6 +28,8 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <mutex>
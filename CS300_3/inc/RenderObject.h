@@ -1,5 +1,6 @@
 #pragma once
 
+#include "graphics/TransformHierarchy.h"
 #include "graphics/TriangleMesh.h"
 
 class RenderObject {
@@ -10,6 +11,8 @@ public:
 	Math::Vector3 pos;
 	Math::Vector3 eulerRotate;
 	Math::Vector3 scale;
+	// node of the object in the scene's TransformHierarchy, made on first use
+	u32 transform;
 	
 	std::shared_ptr<Graphics::TriangleMesh> mesh;
 };
\ No newline at end of file
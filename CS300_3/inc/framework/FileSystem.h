@@ -0,0 +1,81 @@
+#ifndef H_FILE_SYSTEM
+#define H_FILE_SYSTEM
+
+#include "framework/Utilities.h"
+
+// Small collection of file system helpers used by the asset caches. Only the
+// handful of operations the framework needs are wrapped here: querying the
+// size and modification time of a file, creating a directory, and mapping a
+// whole file read-only into memory. Each is implemented for both Win32 and
+// POSIX in FileSystem.cpp.
+namespace FileSystem
+{
+  // Size and last modification time of a file on disk. The modification time
+  // is an opaque, platform-specific tick count; it is only meant to be compared
+  // against another value returned by GetFileInfo on the same machine.
+  struct FileInfo
+  {
+    u64 size;
+    u64 modifiedTime;
+
+    FileInfo() : size(0), modifiedTime(0) { }
+  };
+
+  // Retrieves the size and modification time of the given file. Returns false
+  // if the file does not exist or cannot be queried.
+  bool GetFileInfo(std::string const &path, FileInfo &info);
+
+  // Creates a single directory. Returns true if the directory was created or
+  // already exists.
+  bool MakeDirectory(std::string const &path);
+
+  // Writes the given bytes to a file, replacing it if it already exists. The
+  // file is written to a temporary name first and then moved into place so
+  // that a reader never observes a partially written file.
+  bool WriteFileContents(std::string const &path, void const *data,
+    size_t size);
+
+  // Overwrites size bytes of an existing file at the given offset, leaving
+  // the rest of it untouched. Unlike WriteFileContents this is not atomic; it
+  // is meant for small fixed-size fields such as a cache header's timestamp.
+  bool PatchFileContents(std::string const &path, size_t offset,
+    void const *data, size_t size);
+
+  // A read-only view of an entire file mapped into the address space of the
+  // process. Pages are faulted in by the OS as they are touched, so opening a
+  // large file is cheap and only the parts actually read cost any I/O. The
+  // mapping stays valid until Close is called or the object is destroyed.
+  class MappedFile
+  {
+  public:
+    MappedFile();
+    ~MappedFile();
+
+    // Maps the file at the given path. Returns false if the file cannot be
+    // opened or mapped. Empty files are opened successfully but have no data.
+    bool Open(std::string const &path);
+
+    // Unmaps the file and closes any handles associated with it.
+    void Close();
+
+    inline bool IsOpen() const { return isOpen_; }
+    inline u8 const *GetData() const { return data_; }
+    inline size_t GetSize() const { return size_; }
+
+  private:
+    // Disallow copying of this object.
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    u8 const *data_;
+    size_t size_;
+    bool isOpen_;
+#ifdef _WIN32
+    void *fileHandle_, *mappingHandle_;
+#else
+    int fileDescriptor_;
+#endif
+  };
+}
+
+#endif
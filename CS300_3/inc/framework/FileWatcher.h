@@ -0,0 +1,57 @@
+#ifndef H_FILE_WATCHER
+#define H_FILE_WATCHER
+
+#include "framework/Utilities.h"
+
+// Watches a directory tree for files being written, created or renamed into
+// place, using ReadDirectoryChangesW on Win32 and inotify on Linux. A
+// background thread blocks on the OS notifications, so watching costs nothing
+// while no files change.
+//
+// Editors rarely save a file in a single write (many truncate, write in
+// pieces, or write a temporary file and rename it), so changes are only
+// reported once a file has been quiet for a short settling time, and each
+// changed file is reported once no matter how many events it produced.
+class FileWatcher
+{
+public:
+  // Starts watching the given directory and all of its subdirectories.
+  explicit FileWatcher(std::string const &directory);
+  ~FileWatcher();
+
+  // Whether the directory could be watched at all.
+  bool IsWatching() const;
+
+  // Retrieves the files that changed and have settled since the last call,
+  // as paths relative to the watched directory with '/' separators (e.g.
+  // "shaders/phong.frag"). Never blocks.
+  void PollChanges(std::vector<std::string> &changes);
+
+private:
+  // Disallow copying of this object.
+  FileWatcher(FileWatcher const &) = delete;
+  FileWatcher &operator=(FileWatcher const &) = delete;
+
+  void WatchMain();
+  void RecordChange(std::string const &path);
+#ifndef _WIN32
+  void AddWatches(std::string const &relativeDirectory);
+#endif
+
+  std::string directory_;
+  bool watching_;
+  std::thread thread_;
+
+  // changed files and when they last changed; guarded by mutex_
+  std::mutex mutex_;
+  std::map<std::string, std::chrono::steady_clock::time_point> changes_;
+
+#ifdef _WIN32
+  void *directoryHandle_, *changeEvent_, *stopEvent_;
+#else
+  int inotify_, stopPipe_[2];
+  std::unordered_map<int, std::string> watches_; // watch -> relative dir
+#endif
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef H_HASH
+#define H_HASH
+
+#include "framework/Utilities.h"
+
+// 64-bit FNV-1a hashing. This is not a cryptographic hash; it is used to
+// fingerprint asset contents and processing parameters so that on-disk caches
+// can detect when they have gone stale. Hashes may be chained by passing the
+// result of one call as the seed of the next.
+namespace Hash
+{
+  static u64 const FnvOffsetBasis = 14695981039346656037ull;
+  static u64 const FnvPrime = 1099511628211ull;
+
+  inline u64 Fnv1a(void const *data, size_t size, u64 seed = FnvOffsetBasis)
+  {
+    u8 const *bytes = static_cast<u8 const *>(data);
+    u64 hash = seed;
+    for (size_t i = 0; i < size; ++i)
+    {
+      hash ^= bytes[i];
+      hash *= FnvPrime;
+    }
+    return hash;
+  }
+
+  inline u64 Fnv1a(std::string const &text, u64 seed = FnvOffsetBasis)
+  {
+    return Fnv1a(text.data(), text.size(), seed);
+  }
+
+  // Hashes the raw bytes of a trivially copyable value, such as an enum or a
+  // small parameter struct without padding.
+  template <typename T>
+  inline u64 Fnv1aValue(T const &value, u64 seed = FnvOffsetBasis)
+  {
+    return Fnv1a(&value, sizeof(T), seed);
+  }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef H_HOT_RELOADER
+#define H_HOT_RELOADER
+
+#include "framework/FileWatcher.h"
+#include "framework/Utilities.h"
+
+// Reloads individual assets while the application runs, as soon as one of
+// their source files changes on disk.
+//
+// Reloading is split in two so that rendering never waits on disk or parsing:
+// an asset's prepare function runs on a dedicated reload thread and does all
+// the CPU-side work (reading, decoding, parsing, preprocessing), returning a
+// commit function. Commits are run from Update, which the application calls
+// at a frame boundary on the thread owning the GL context; that is where GPU
+// resources are built and the new asset is swapped in, so a frame only ever
+// sees the old or the new version of an asset. A prepare function may return
+// an empty commit to keep the current asset (e.g. if the new file is
+// broken).
+class HotReloader
+{
+public:
+  typedef std::function<void()> CommitFunction;
+  typedef std::function<CommitFunction()> PrepareFunction;
+
+  // Watches the given directory tree; asset files are given relative to it.
+  explicit HotReloader(std::string const &directory);
+
+  // Waits for preparations still running; their commits are discarded.
+  ~HotReloader();
+
+  // Registers (or, if the name is already registered, replaces) an asset
+  // that is prepared again whenever one of the given files changes. Files
+  // are relative to the watched directory, with '/' separators.
+  void Watch(std::string const &name, std::vector<std::string> const &files,
+    PrepareFunction const &prepare);
+  void Unwatch(std::string const &name);
+
+  // Starts preparing the assets whose files changed, and commits the assets
+  // that have finished preparing. Never blocks on a preparation.
+  void Update();
+
+  // Number of assets reloaded (committed) so far.
+  u32 GetReloadCount() const;
+
+private:
+  struct Asset
+  {
+    std::vector<std::string> files;
+    PrepareFunction prepare;
+    u32 generation; // bumped on every Watch, to ignore stale preparations
+    bool preparing, dirty;
+  };
+
+  // A preparation queued for, or finished by, the reload thread.
+  struct Request
+  {
+    std::string name;
+    u32 generation;
+    PrepareFunction prepare;
+    CommitFunction commit;
+  };
+
+  // Disallow copying of this object.
+  HotReloader(HotReloader const &) = delete;
+  HotReloader &operator=(HotReloader const &) = delete;
+
+  void ReloadMain();
+
+  // only touched by the thread calling Watch and Update
+  FileWatcher watcher_;
+  std::map<std::string, Asset> assets_;
+  std::vector<std::string> changes_;
+  u32 nextGeneration_;
+  u32 reloadCount_;
+
+  // reload thread state; guarded by mutex_
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<Request> queued_;
+  std::vector<Request> prepared_;
+  bool quitting_;
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef H_SIMD
+#define H_SIMD
+
+// Instruction sets available to the vectorized paths, detected once for the
+// whole project. USE_SSE is set on every x86 target (MSVC always provides SSE
+// there, and GCC or Clang define __SSE__ when it is enabled) and USE_AVX where
+// the compiler generates AVX (/arch:AVX, -mavx). Code tests them with #if and
+// keeps a scalar fallback for when neither is set.
+#if defined(__AVX__)
+#define USE_AVX 1
+#define USE_SSE 1
+#include <immintrin.h>
+#elif defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#define USE_AVX 0
+#define USE_SSE 1
+#include <xmmintrin.h>
+#else
+#define USE_AVX 0
+#define USE_SSE 0
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef H_THREAD_POOL
+#define H_THREAD_POOL
+
+#include "framework/Utilities.h"
+
+// A fixed-size pool of worker threads shared by every CPU-heavy part of the
+// framework (mipmap generation, mesh processing, and so on). There is exactly
+// one pool per process, created on first use with one worker less than the
+// number of hardware threads; the thread calling into the pool always takes
+// part in the work itself, so all cores are kept busy without oversubscribing.
+//
+// The pool is meant for short, data-parallel bursts. Long-running background
+// work (such as encoding screenshots) should own a dedicated std::thread
+// instead, so that it never starves a ParallelFor issued by the main thread.
+class ThreadPool
+{
+public:
+  typedef std::function<void(size_t begin, size_t end)> RangeFunction;
+  typedef std::function<void()> TaskFunction;
+
+  static ThreadPool &GetInstance();
+
+  // Number of threads that may execute work concurrently, including the
+  // calling thread.
+  u32 GetThreadCount() const;
+
+  // Splits [begin, end) into chunks of at most 'grain' elements and invokes
+  // body(chunkBegin, chunkEnd) for each of them, in parallel. Returns once
+  // every chunk has been processed. Chunks are claimed dynamically, so uneven
+  // workloads balance themselves. Calling ParallelFor from inside a body is
+  // allowed; the nested loop simply runs with whatever threads are free.
+  void ParallelFor(size_t begin, size_t end, size_t grain,
+    RangeFunction const &body);
+
+  // Queues a standalone task to be run by some worker thread at some point.
+  void Submit(TaskFunction const &task);
+
+private:
+  struct RangeJob;
+
+  ThreadPool(u32 workerCount);
+  ~ThreadPool();
+
+  // Disallow copying of this object.
+  ThreadPool(ThreadPool const &) = delete;
+  ThreadPool &operator=(ThreadPool const &) = delete;
+
+  void WorkerMain();
+  static void RunChunks(RangeJob &job);
+
+  std::vector<std::thread> workers_;
+  std::deque<TaskFunction> tasks_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool quitting_;
+};
+
+#endif
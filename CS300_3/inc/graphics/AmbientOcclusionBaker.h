@@ -0,0 +1,46 @@
+#ifndef H_AMBIENT_OCCLUSION_BAKER
+#define H_AMBIENT_OCCLUSION_BAKER
+
+#include "framework/Utilities.h"
+
+namespace Graphics
+{
+  class Bvh;
+  struct Vertex;
+
+  // Bakes ambient occlusion offline by ray tracing: every vertex traces
+  // rayCount rays over the hemisphere around its normal against the mesh's
+  // Bvh, and keeps the fraction that escape within maxDistance as its
+  // occlusion attribute (see Vertex). The directions are cosine weighted, so
+  // that the fraction is the diffuse light an unoccluded sky would give,
+  // relative to an open surface.
+  //
+  // The directions come from a Hammersley set mapped onto the hemisphere,
+  // rotated by a different random offset at every vertex so that the error
+  // of the few samples turns into noise rather than banding. Vertices are
+  // baked in parallel on the ThreadPool; each traces its rays as packets of
+  // four (see Bvh::IntersectAny), which start at the same point and so
+  // visit mostly the same nodes.
+  class AmbientOcclusionBaker
+  {
+  public:
+    // Rays per vertex used by MeshLoader, and their length as a fraction of
+    // the diagonal of the mesh's bounds.
+    static u32 const DefaultRayCount = 64;
+    static f32 const DefaultMaxDistance;
+
+    // Bakes the occlusion of the given vertices against the hierarchy.
+    // rayCount is rounded up to a multiple of four. Rays leave from slightly
+    // above the surface, maxDistance / 1000 along the normal, so that they do
+    // not hit the triangles around their own vertex; vertices without a
+    // normal are left unoccluded.
+    static void BakeVertices(Bvh const &bvh, Vertex *vertices, size_t count,
+      u32 rayCount, f32 maxDistance);
+
+    // Loads a model from assets/models and times baking it with rayCount
+    // rays per vertex, printing rays per second and the mean occlusion.
+    static void Benchmark(std::string const &model, u32 rayCount);
+  };
+}
+
+#endif
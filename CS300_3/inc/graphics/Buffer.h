@@ -3,6 +3,16 @@
 
 namespace Graphics
 {
+  // A range of memory owned by the caller that a buffer object copies from
+  // when it is built, at offset bytes into the buffer (see
+  // VertexBufferObject::AttachVertices and IndexBufferObject::AttachPrimitives).
+  struct BufferSource
+  {
+    size_t offset;
+    void const *data;
+    size_t size;
+  };
+
   // This is an interface representing an OpenGL buffer object. Within this
   // framework, it is only used as the parent for VertexBufferObject and
   // IndexBufferObject. Since it is a pure-virtual class, it has no
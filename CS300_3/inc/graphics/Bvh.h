@@ -0,0 +1,124 @@
+#ifndef H_BVH
+#define H_BVH
+
+#include "framework/Utilities.h"
+#include "math/Vector3.h"
+
+namespace Graphics
+{
+  class TriangleMesh;
+
+  // A ray from origin along direction (which need not be unit length),
+  // covering the parameters (tMin, tMax).
+  struct Ray
+  {
+    Math::Vector3 origin;
+    Math::Vector3 direction;
+    f32 tMin;
+    f32 tMax;
+
+    Ray(Math::Vector3 const &_origin, Math::Vector3 const &_direction,
+      f32 _tMin = 0.f, f32 _tMax = std::numeric_limits<f32>::infinity())
+      : origin(_origin), direction(_direction), tMin(_tMin), tMax(_tMax) {}
+  };
+
+  // Four rays traced together by Bvh::IntersectAny, by component.
+  struct RayPacket
+  {
+    f32 originX[4], originY[4], originZ[4];
+    f32 directionX[4], directionY[4], directionZ[4];
+    f32 tMin[4], tMax[4];
+  };
+
+  // The closest intersection found along a ray: the ray parameter, the
+  // barycentric coordinates of the hit within the triangle (the weights of
+  // its second and third vertex) and the index of the triangle.
+  struct RayHit
+  {
+    f32 t;
+    f32 u, v;
+    u32 triangle;
+  };
+
+  // A node of a Bvh, 32 bytes. Interior nodes (count == 0) have their
+  // children at nodes offset and offset + 1; leaves hold count triangles
+  // (at most four), stored as the block of triangles offset.
+  struct BvhNode
+  {
+    f32 boundMin[3];
+    u32 offset;
+    f32 boundMax[3];
+    u32 count;
+  };
+
+  // A bounding volume hierarchy over the triangles of a mesh, for ray
+  // queries such as picking, occlusion tests and baking. It is built top
+  // down with the surface area heuristic, evaluated over 16 bins of the
+  // triangle centroids along each axis; large nodes are binned in parallel
+  // and large subtrees are built in parallel on the ThreadPool.
+  //
+  // The triangles of each leaf are stored together as one block of four
+  // (padded with empty triangles), laid out so that a ray is intersected
+  // with all four at once with SSE (Moller and Trumbore's test). Ray/box
+  // tests also use SSE, across the three axes. Triangles are double sided.
+  // Queries only read the hierarchy, so any number may run concurrently.
+  class Bvh
+  {
+  public:
+    static u32 const MaxLeafSize = 4;
+    static u32 const InvalidTriangle = 0xffffffffu;
+
+    Bvh();
+
+    // Builds the hierarchy over a triangle list (three indices per
+    // triangle), replacing any previous one. Hits report the index of the
+    // triangle within this list.
+    void Build(Math::Vector3 const *positions, size_t positionStride,
+      size_t vertexCount, u32 const *indices, size_t indexCount);
+
+    // Builds the hierarchy over the full triangles of a mesh.
+    void Build(TriangleMesh const &mesh);
+
+    // Finds the closest intersection of the ray with any triangle. Returns
+    // false (leaving hit.triangle as InvalidTriangle) if there is none.
+    bool IntersectClosest(Ray const &ray, RayHit &hit) const;
+
+    // Determines whether the ray hits any triangle at all, stopping at the
+    // first one found; cheaper than IntersectClosest for occlusion tests.
+    bool IntersectAny(Ray const &ray) const;
+
+    // Determines which of four rays hit any triangle: bit i of the result is
+    // set if ray i does. The rays walk the hierarchy together, each node and
+    // each block of triangles tested against all four at once with SSE, which
+    // suits coherent rays such as the hemisphere samples of a single point.
+    u32 IntersectAny(RayPacket const &packet) const;
+
+    bool IsEmpty() const { return nodes_.empty(); }
+    size_t GetNodeCount() const { return nodes_.size(); }
+    size_t GetTriangleCount() const { return triangleCount_; }
+
+    // Loads a model from assets/models, builds its hierarchy and times
+    // closest-hit and any-hit queries of rayCount random rays through its
+    // bounds, printing rays per second.
+    static void Benchmark(std::string const &model, u32 rayCount);
+
+  private:
+    // Four triangles as a vertex and two edges each, by component.
+    struct TriangleBlock
+    {
+      f32 v0x[4], v0y[4], v0z[4];
+      f32 e1x[4], e1y[4], e1z[4];
+      f32 e2x[4], e2y[4], e2z[4];
+      u32 triangle[4];
+    };
+
+    template <bool AnyHit>
+    bool traverse(Ray const &ray, RayHit &hit) const;
+
+    std::vector<BvhNode> nodes_;
+    std::vector<TriangleBlock> blocks_;
+    size_t triangleCount_;
+  };
+}
+
+#endif
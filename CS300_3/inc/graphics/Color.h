@@ -11,7 +11,7 @@ namespace Graphics
   // directly to the graphics card with RGBA format; no conversion is
   // necessary. It also has functionality to be converted to a 32-bit integral
   // ARGB packed structure, another acceptable format by OpenGL.
-  #pragma pack(1)
+  #pragma pack(push, 1)
   struct Color
   {
     union
@@ -40,6 +40,7 @@ namespace Graphics
     explicit Color(f32 r = 0.f, f32 g = 0.f, f32 b = 0.f, f32 a = 1.f);
     explicit Color(u32 argb);
     Color(Color const &rhs);
+    Color &operator=(Color const &rhs);
 
     // Retrieves the packed integral ARGB representation of this color. For
     // example, the constant Magenta above would have an ARGB value of:
@@ -72,6 +73,7 @@ namespace Graphics
     // Color result = Color(left.r + right.r, left.g + right.g, ...)
     Color operator+(Color const &rhs) const;
   };
+  #pragma pack(pop) // headers included after this one keep their own packing
 }
 
 #endif
@@ -0,0 +1,88 @@
+#ifndef H_FRAME_CAPTURE
+#define H_FRAME_CAPTURE
+
+#include "framework/Utilities.h"
+#include "graphics/FramebufferReader.h"
+#include "graphics/Image.h"
+#include "graphics/ImageWriter.h"
+
+namespace Graphics
+{
+  // Captures rendered frames to image files without ever stalling the render
+  // loop. Capturing a frame only queues an asynchronous FramebufferReader
+  // readback; one or more frames later, Update collects the pixels and hands
+  // them to a dedicated encoder thread which compresses and writes the file.
+  //
+  // If the GPU or the encoder cannot keep up (e.g. while recording every frame
+  // as PNG), frames are dropped and counted instead of blocking rendering.
+  // Image buffers are recycled between captures, so steady-state capture does
+  // not allocate.
+  //
+  // All methods must be called from the thread owning the GL context.
+  class FrameCapture
+  {
+  public:
+    // bufferCount is the number of PBOs readbacks rotate through; two allow
+    // one readback to be in flight while the next frame is captured.
+    // See FramebufferReader.
+    explicit FrameCapture(u32 bufferCount = 2);
+
+    // Finishes all pending captures and encodes (which may block). The GL
+    // context must still be current.
+    ~FrameCapture();
+
+    // Queues a readback of the lower-left width x height region of the
+    // current read buffer, to be written to the given path. Returns false if
+    // the frame had to be dropped because every PBO is still in flight.
+    bool Capture(u32 width, u32 height, std::string const &path,
+      ImageFormat format);
+
+    // Collects finished readbacks and passes them to the encoder thread. Call
+    // once per frame; never blocks.
+    void Update();
+
+    // Blocks until every queued capture has been read back and written.
+    void Flush();
+
+    void SetJpegQuality(u32 quality);
+
+    // Statistics: frames captured so far, frames dropped because the GPU or
+    // the encoder fell behind, and frames waiting to be read back or encoded.
+    u64 GetCapturedCount() const;
+    u64 GetDroppedCount() const;
+    u32 GetPendingCount();
+
+  private:
+    struct EncodeJob
+    {
+      Image image;
+      std::string path;
+      ImageFormat format;
+      u32 quality;
+    };
+
+    // Disallow copying of this object.
+    FrameCapture(FrameCapture const &) = delete;
+    FrameCapture &operator=(FrameCapture const &) = delete;
+
+    // Receives a finished readback; takes its pixels for the encoder.
+    void Enqueue(Image &image, std::string const &path, ImageFormat format);
+    void EncoderMain();
+
+    FramebufferReader reader_;
+    bool flushing_;
+    u32 jpegQuality_;
+    u64 capturedCount_, droppedCount_;
+
+    // encoder thread state; all guarded by mutex_
+    std::thread encoder_;
+    std::mutex mutex_;
+    std::condition_variable wake_, idle_;
+    std::deque<EncodeJob> jobs_;
+    std::vector<Image> freeImages_;
+    u32 encodingCount_;
+    bool quitting_;
+  };
+}
+
+#endif
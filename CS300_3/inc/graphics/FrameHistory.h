@@ -0,0 +1,150 @@
+#ifndef H_FRAME_HISTORY
+#define H_FRAME_HISTORY
+
+#include "framework/Utilities.h"
+#include "graphics/FramebufferReader.h"
+#include "graphics/Image.h"
+
+namespace Graphics
+{
+  // How frames are kept in memory by a FrameHistory. Compressed frames cost
+  // encoding time on the history thread but fit many more seconds into the
+  // same memory budget; JPEG is lossy, PNG and Raw are not.
+  enum class FrameStorage
+  {
+    Raw,
+    Png,
+    Jpeg,
+    Count
+  };
+
+  // What FrameHistory::Save writes: one image file per frame, or a single
+  // uncompressed YUV4MPEG2 (.y4m) video that most players and ffmpeg read.
+  enum class FrameDumpFormat
+  {
+    ImageSequence,
+    RawVideo,
+    Count
+  };
+
+  struct FrameHistorySettings
+  {
+    // 10 seconds at 30 frames per second, downscaled by 2 and stored as JPEG
+    // in at most 256 MB.
+    FrameHistorySettings();
+
+    f32 seconds;          // how much history to keep
+    f32 frameRate;        // frames sampled per second
+    u32 downscale;        // 1 keeps full resolution, 2 halves it, ...
+    FrameStorage storage;
+    u32 jpegQuality;
+    size_t memoryBudget;  // in bytes; the oldest frames are evicted first
+  };
+
+  // Continuously samples rendered frames into a fixed-size ring kept in
+  // memory, so that the last few seconds before something goes wrong can be
+  // saved on demand without recording to disk all the time.
+  //
+  // Sampling queues an asynchronous FramebufferReader readback; downscaling,
+  // compression and ring maintenance happen on a dedicated history thread, as
+  // does writing the frames out when Save is called. If that thread falls
+  // behind, samples are dropped rather than stalling rendering.
+  //
+  // All methods must be called from the thread owning the GL context.
+  class FrameHistory
+  {
+  public:
+    explicit FrameHistory(
+      FrameHistorySettings const &settings = FrameHistorySettings());
+
+    // Finishes pending readbacks and saves (which may block). The GL context
+    // must still be current.
+    ~FrameHistory();
+
+    // Samples the lower-left width x height region of the current read
+    // buffer, unless less than one sampling interval has passed since the
+    // last sample. time is in seconds, on any monotonic clock. Returns true if
+    // a sample was queued.
+    bool Capture(u32 width, u32 height, f64 time);
+
+    // Passes finished readbacks to the history thread. Call once per frame;
+    // never blocks.
+    void Update();
+
+    // Queues writing the most recent seconds of history into the given
+    // directory (which is created if needed), as frame000000.<ext>, ... or
+    // as history.y4m. The frames are snapshotted when the history thread
+    // reaches the request, so samples still being read back are included.
+    void Save(f32 seconds, std::string const &directory,
+      FrameDumpFormat format);
+
+    FrameHistorySettings const &GetSettings() const;
+
+    // Statistics: frames in the ring, the time they span, the memory they
+    // use, samples dropped because the history thread fell behind, and
+    // whether a Save is queued or running.
+    u32 GetFrameCount();
+    f64 GetDuration();
+    size_t GetMemoryUsed();
+    u64 GetDroppedCount();
+    bool IsSaving();
+
+  private:
+    struct StoredFrame
+    {
+      f64 time;
+      u32 width, height;
+      std::vector<u8> data; // pixels, or the PNG or JPEG file
+    };
+
+    // Either a sampled frame to store, or a request to save the history.
+    struct Job
+    {
+      Image image;
+      f64 time;
+      bool save;
+      f32 seconds;
+      std::string directory;
+      FrameDumpFormat format;
+    };
+
+    // Disallow copying of this object.
+    FrameHistory(FrameHistory const &) = delete;
+    FrameHistory &operator=(FrameHistory const &) = delete;
+
+    // Receives a finished readback; takes its pixels for the history thread.
+    void Enqueue(Image &image, f64 time);
+    void HistoryMain();
+
+    // History thread only: compresses a frame into the ring, evicting old
+    // frames, and writes the ring out.
+    void Store(Image const &image, f64 time, Image &scratch);
+    bool Write(f32 seconds, std::string const &directory,
+      FrameDumpFormat format);
+    bool WriteVideo(std::vector<StoredFrame const *> const &frames,
+      std::string const &path);
+
+    FrameHistorySettings settings_;
+    FramebufferReader reader_;
+    f64 nextSampleTime_;
+    bool flushing_;
+
+    // history thread state; guarded by mutex_ except for the ring itself,
+    // which only the history thread touches
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable wake_, idle_;
+    std::deque<Job> jobs_;
+    std::vector<Image> freeImages_;
+    std::deque<StoredFrame> frames_;
+    std::vector<u8> spareData_;
+    u32 frameCount_;
+    f64 duration_;
+    size_t memoryUsed_;
+    u64 droppedCount_;
+    u32 busyCount_, saveCount_;
+    bool quitting_;
+  };
+}
+
+#endif
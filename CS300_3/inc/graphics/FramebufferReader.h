@@ -0,0 +1,88 @@
+#ifndef H_FRAMEBUFFER_READER
+#define H_FRAMEBUFFER_READER
+
+#include "framework/Utilities.h"
+#include "graphics/Image.h"
+
+namespace Graphics
+{
+  // Reads pixels back from the current read framebuffer into an Image, always
+  // as a single bulk transfer rather than one glReadPixels call per pixel.
+  // Images come back top-down like every other Image, with 1 (red), 2 (red,
+  // green), 3 (RGB) or 4 (RGBA) channels.
+  //
+  // Read is synchronous: it stalls until the GPU has finished rendering the
+  // region. For readbacks every frame, ReadAsync instead queues the copy
+  // into a pixel-pack buffer object (PBO) behind a fence, and Update hands
+  // the finished image to a callback one or more frames later, which is where
+  // CPU-side processing (inverting, encoding, analysis) belongs.
+  //
+  // All methods must be called from the thread owning the GL context.
+  class FramebufferReader
+  {
+  public:
+    // Invoked from Update or Finish with the finished readback. The image is
+    // owned by the reader and reused for later readbacks; a callback that
+    // wants to keep the pixels should Swap them into an image of its own.
+    // The callback may queue another readback with ReadAsync; that never
+    // touches the image being delivered.
+    typedef std::function<void(Image &image)> Callback;
+
+    // Reads the width x height region whose lower-left corner is at (x, y)
+    // in window coordinates, blocking until the pixels are available.
+    static void Read(s32 x, s32 y, u32 width, u32 height, u32 channelCount,
+      Image &image);
+
+    // Reads the whole current viewport; see Read.
+    static void ReadViewport(u32 channelCount, Image &image);
+
+    // bufferCount is the number of PBOs asynchronous readbacks rotate
+    // through, which is also the most readbacks that may be in flight.
+    explicit FramebufferReader(u32 bufferCount = 2);
+
+    // Finishes all pending readbacks (invoking their callbacks), then
+    // releases the PBOs. The GL context must still be current.
+    ~FramebufferReader();
+
+    // Queues an asynchronous read of the given region; see Read. Returns
+    // false without reading if every PBO is still in flight.
+    bool ReadAsync(s32 x, s32 y, u32 width, u32 height, u32 channelCount,
+      Callback const &callback);
+
+    // Invokes the callbacks of finished readbacks, in the order they were
+    // queued. Call once per frame; never blocks.
+    void Update();
+
+    // Blocks until every queued readback has finished and been delivered.
+    void Finish();
+
+    // Readbacks queued but not yet delivered, and readbacks that failed (the
+    // fence or the buffer mapping failed) and so never reached a callback.
+    u32 GetPendingCount() const;
+    u64 GetFailedCount() const;
+
+  private:
+    // One pixel-pack buffer and the readback currently using it.
+    struct Readback
+    {
+      u32 buffer;
+      GLsync fence;
+      size_t capacity;
+      Image image;
+      Callback callback;
+      bool inFlight;
+    };
+
+    // Disallow copying of this object.
+    FramebufferReader(FramebufferReader const &) = delete;
+    FramebufferReader &operator=(FramebufferReader const &) = delete;
+
+    bool Collect(Readback &readback, bool wait);
+
+    std::vector<Readback> readbacks_;
+    u32 nextReadback_;
+    u64 failedCount_;
+  };
+}
+
+#endif
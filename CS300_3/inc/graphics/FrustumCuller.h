@@ -0,0 +1,92 @@
+#ifndef H_FRUSTUM_CULLER
+#define H_FRUSTUM_CULLER
+
+#include "framework/Utilities.h"
+#include "math/Matrix4.h"
+#include "math/Vector3.h"
+
+namespace Graphics
+{
+  // The six planes of the view frustum in the space the matrix transforms
+  // from (Gribb and Hartmann), as (normal, distance) with unit normals
+  // pointing inwards, so that a point is inside if it is in front of every
+  // plane. Built from a projection * view matrix the planes are in world
+  // space, from a model-view-projection matrix in that model's space.
+  struct FrustumPlanes
+  {
+    // left, right, bottom, top, near, far
+    f32 x[6], y[6], z[6], w[6];
+
+    explicit FrustumPlanes(Math::Matrix4 const &m);
+  };
+
+  // The box around a box carried through a model matrix (Arvo): its center
+  // is the transformed center, and each half extent sums the original ones
+  // along the absolute values of the matrix's row.
+  void TransformBox(Math::Vector3 const &minimum, Math::Vector3 const &maximum,
+    Math::Matrix4 const &model, Math::Vector3 &transformedMinimum,
+    Math::Vector3 &transformedMaximum);
+
+  // Outcome of the last FrustumCuller::Cull.
+  struct FrustumCullStats
+  {
+    u32 objectCount;
+    u32 visibleObjects;
+    u32 culledObjects; // entirely outside the view frustum
+    f64 milliseconds;
+  };
+
+  // Decides which objects of a scene intersect the view frustum, every
+  // frame. Objects are queued with their world space bounds, either an
+  // axis-aligned box (such as a mesh's GetBoundMin/GetBoundMax carried
+  // through its model matrix) or a sphere; Cull then drops the ones lying
+  // entirely behind one of the frustum planes. Bounds are kept as separate
+  // arrays of each component, a box as its center and half extent and a
+  // sphere as a center and radius, so that both take the same test and eight
+  // objects are tested at once with AVX, or four with SSE (where available).
+  // Large scenes are split over the ThreadPool.
+  //
+  // The test is conservative: an object near a corner of the frustum may be
+  // kept although it is outside, but a visible object is never dropped.
+  class FrustumCuller
+  {
+  public:
+    FrustumCuller();
+
+    // Drops every queued object; call at the start of a frame.
+    void Clear();
+
+    // Queue an object and return its index, in queue order. The second form
+    // takes a box in model space and bounds it after the model transform.
+    u32 AddBox(Math::Vector3 const &minimum, Math::Vector3 const &maximum);
+    u32 AddBox(Math::Vector3 const &minimum, Math::Vector3 const &maximum,
+      Math::Matrix4 const &model);
+    u32 AddSphere(Math::Vector3 const &center, f32 radius);
+
+    // Tests every queued object against the frustum of the given
+    // projection * view matrix.
+    FrustumCullStats const &Cull(Math::Matrix4 const &viewProjection);
+
+    // Whether an object was found to be in view by the last Cull.
+    bool IsVisible(u32 object) const { return visible_[object] != 0; }
+
+    size_t GetObjectCount() const { return count_; }
+    FrustumCullStats const &GetStats() const { return stats_; }
+
+  private:
+    u32 add(f32 centerX, f32 centerY, f32 centerZ, f32 extentX, f32 extentY,
+      f32 extentZ, f32 radius);
+
+    size_t count_;
+
+    // object bounds, padded to a multiple of eight
+    std::vector<f32> centerX_, centerY_, centerZ_;
+    std::vector<f32> extentX_, extentY_, extentZ_, radius_;
+
+    // result of the last Cull for each object
+    std::vector<u8> visible_;
+    FrustumCullStats stats_;
+  };
+}
+
+#endif
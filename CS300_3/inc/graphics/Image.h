@@ -0,0 +1,50 @@
+#ifndef H_IMAGE
+#define H_IMAGE
+
+#include "framework/Utilities.h"
+
+namespace Graphics
+{
+  // A CPU-side image: a tightly packed (no row padding), top-to-bottom grid of
+  // pixels with 1 to 4 interleaved 8-bit channels. Unlike Texture, an Image
+  // has no OpenGL counterpart; it is the common currency for image processing
+  // done on the CPU, such as mipmap pyramids and framebuffer readbacks.
+  class Image
+  {
+  public:
+    Image();
+    Image(u32 width, u32 height, u32 channelCount);
+
+    // Reallocates the image to the given dimensions. Pixel contents are
+    // undefined afterwards.
+    void Resize(u32 width, u32 height, u32 channelCount);
+
+    // Reverses the order of the rows, e.g. to convert between OpenGL's
+    // bottom-up and the usual top-down row order.
+    void FlipVertically();
+
+    // Exchanges the contents of two images without copying any pixels, so
+    // that pixel buffers can be handed between threads and recycled.
+    void Swap(Image &other);
+
+    inline bool IsEmpty() const { return pixels_.empty(); }
+    inline u32 GetWidth() const { return width_; }
+    inline u32 GetHeight() const { return height_; }
+    inline u32 GetChannelCount() const { return channelCount_; }
+    inline size_t GetRowSize() const { return size_t(width_) * channelCount_; }
+    inline size_t GetSize() const { return pixels_.size(); }
+    inline u8 *GetPixels() { return pixels_.data(); }
+    inline u8 const *GetPixels() const { return pixels_.data(); }
+    inline u8 *GetRow(u32 y) { return pixels_.data() + y * GetRowSize(); }
+    inline u8 const *GetRow(u32 y) const
+    {
+      return pixels_.data() + y * GetRowSize();
+    }
+
+  private:
+    u32 width_, height_, channelCount_;
+    std::vector<u8> pixels_;
+  };
+}
+
+#endif
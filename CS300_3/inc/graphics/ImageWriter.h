@@ -0,0 +1,50 @@
+#ifndef H_IMAGE_WRITER
+#define H_IMAGE_WRITER
+
+#include "framework/Utilities.h"
+
+namespace Graphics
+{
+  class Image;
+
+  enum class ImageFormat
+  {
+    Png,
+    Jpeg,
+    Bmp,
+    Count
+  };
+
+  // Encodes Images into common file formats without any external library.
+  // The encoders favor speed and simplicity over the smallest possible files:
+  //   PNG   lossless; per-row adaptive filtering, then deflate with LZ77 and
+  //         the fixed Huffman code.
+  //   JPEG  baseline, 4:4:4, standard quantization tables scaled by quality
+  //         and the standard Huffman tables.
+  //   BMP   uncompressed 24-bit, for tools that cannot read anything else.
+  // Every encoder is reentrant, so encoding may happen on any thread.
+  class ImageWriter
+  {
+  public:
+    // Encodes the image into the given buffer, replacing its contents.
+    // Quality (1 to 100) only affects JPEG. Returns false if the image cannot
+    // be represented in the format.
+    static bool Encode(Image const &image, ImageFormat format, u32 quality,
+      std::vector<u8> &encoded);
+
+    // Encodes the image and writes it to the given path.
+    static bool Write(std::string const &path, Image const &image,
+      ImageFormat format, u32 quality = 90);
+
+    // File extension (without dot) conventionally used by the format.
+    static char const *GetExtension(ImageFormat format);
+
+  private:
+    static bool EncodePNG(Image const &image, std::vector<u8> &encoded);
+    static bool EncodeJPEG(Image const &image, u32 quality,
+      std::vector<u8> &encoded);
+    static bool EncodeBMP(Image const &image, std::vector<u8> &encoded);
+  };
+}
+
+#endif
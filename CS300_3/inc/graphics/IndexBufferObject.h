@@ -1,6 +1,7 @@
 #ifndef H_INDEX_BUFFER_OBJECT
 #define H_INDEX_BUFFER_OBJECT
 
+#include "framework/Utilities.h"
 #include "graphics/Buffer.h"
 #include "graphics/Topology.h"
 
@@ -15,6 +16,13 @@ namespace Graphics
   // index is used as a lookup value within the VBO (see VertexBufferObject.h
   // for more) when rendering the mesh. VertexArrayObject.h has more
   // information on how these two structures are used to render geometry.
+  // Like VertexBufferObject, indices are either staged in a CPU-side buffer
+  // (allocated on the first one added) or attached and read from the caller's
+  // array by Build; either way no CPU copy is kept once built.
+  //
+  // Indices are always given as 32-bit values, but Build stores them in 16
+  // bits (GL_UNSIGNED_SHORT) whenever the largest one fits, which halves the
+  // buffer and the bandwidth spent fetching indices.
   class IndexBufferObject : public IBuffer
   {
   public:
@@ -50,6 +58,20 @@ namespace Graphics
     // GetIndexCount() / GetIndicesPerPrimitive().
     inline size_t GetIndexCount() const { return indexCount_; }
 
+    // Retrieves the size in bytes of each stored index, 2 or 4, and the
+    // matching OpenGL type; decided by Build (4 until then).
+    inline size_t GetIndexSize() const { return indexSize_; }
+    inline unsigned int GetGLIndexType() const
+    {
+      return indexSize_ == sizeof(u16) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    // Retrieves how many bytes smaller the buffer is than with 32-bit indices.
+    inline size_t GetBytesSaved() const
+    {
+      return indexCount_ * (DefaultIndexSize - indexSize_);
+    }
+
     // Adds a line primitive (per its indexes) to this IBO. Since a line only
     // has two vertices, only two indexes need to be added to represent that
     // line. This method returns false if the object has run out of room for
@@ -64,6 +86,16 @@ namespace Graphics
     // completely store the triangle.
     bool AddTriangle(int indexA, int indexB, int indexC); // CCW winding
 
+    // Adds a contiguous array of primitives (GetIndicesPerPrimitive() indices
+    // each) to this IBO with a single copy, if there is capacity for all of
+    // them. It returns false, and adds nothing, if they do not fit.
+    bool AddPrimitives(u32 const *indices, size_t primitiveCount);
+
+    // Like AddPrimitives, but without copying: the indices are uploaded from
+    // the given array by Build, which must therefore be called while the
+    // array is still alive and unchanged.
+    bool AttachPrimitives(u32 const *indices, size_t primitiveCount);
+
     virtual size_t GetBufferSize() const override;
     virtual void Build() override;
     virtual void Bind() const override;
@@ -75,9 +107,14 @@ namespace Graphics
     IndexBufferObject(IndexBufferObject const &) = delete;
     IndexBufferObject &operator=(IndexBufferObject const &) = delete;
 
+    // The staging buffer, allocated on first use.
+    char *getStaging();
+
     Topology topology_;
     size_t indexCount_, insertOffset_, bufferSize_;
-    char *buffer_;
+    size_t indexSize_; /* bytes per index stored on the GPU */
+    char *buffer_; /* staging buffer; null until used and once built */
+    std::vector<BufferSource> sources_; /* attached indices */
     unsigned int glHandle_; /* OpenGL handle to the IBO instance. */
   };
 }
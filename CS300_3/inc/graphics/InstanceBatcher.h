@@ -0,0 +1,101 @@
+#ifndef H_INSTANCE_BATCHER
+#define H_INSTANCE_BATCHER
+
+#include "framework/Utilities.h"
+#include "math/Matrix4.h"
+
+namespace Graphics
+{
+  class TriangleMesh;
+
+  // Outcome of the last InstanceBatcher::Upload.
+  struct InstanceStats
+  {
+    u32 instanceCount;
+    u32 batchCount;    // one instanced draw each (per index range of a level)
+    u32 uploadedBytes; // model matrices streamed to the instance buffer
+  };
+
+  // Draws many objects with a handful of draw calls. Every frame, objects
+  // are queued with their mesh, level of detail, material and model matrix;
+  // Upload then groups them into batches sharing all but the matrix, and
+  // streams every matrix into one instance buffer with a single
+  // glBufferData (which orphans last frame's storage, so the upload never
+  // waits for the GPU to finish reading it). Each batch is then drawn with
+  // one glDrawElementsInstanced (see TriangleMesh::RenderInstanced), its
+  // vertex shader reading the matrices as the vInstanceModel attribute, so
+  // the per object cost is 64 bytes of upload instead of a set of uniforms
+  // and a draw call.
+  //
+  // Materials are ids chosen by the caller, who sets the uniforms of a
+  // batch's material before drawing it; batches come out ordered by mesh,
+  // then material, then level, so consecutive batches tend to share state.
+  // All methods but Add, Clear and GetBatch must be called from the thread
+  // owning the GL context.
+  class InstanceBatcher
+  {
+  public:
+    // Instances sharing a mesh, material and level, which are consecutive in
+    // the instance buffer.
+    struct Batch
+    {
+      TriangleMesh *mesh;
+      u32 material;
+      u32 level;
+      u32 firstInstance;
+      u32 instanceCount;
+    };
+
+    InstanceBatcher();
+
+    // Releases the instance buffer. The GL context must still be current.
+    ~InstanceBatcher();
+
+    // Drops every queued instance and batch; call at the start of a frame.
+    void Clear();
+
+    // Queues an instance of the mesh, which must stay alive until its batch
+    // has been drawn.
+    void Add(TriangleMesh *mesh, u32 material, Math::Matrix4 const &model,
+      u32 level = 0);
+
+    // Groups the instances queued since Clear into batches, and uploads their
+    // model matrices to the instance buffer.
+    InstanceStats const &Upload();
+
+    size_t GetBatchCount() const { return batches_.size(); }
+    Batch const &GetBatch(size_t index) const { return batches_[index]; }
+
+    // Draws a batch after Upload with the currently bound program, which must
+    // have its UseInstancing, ViewMatrix and ProjectionMatrix uniforms set.
+    void Render(size_t batch);
+
+    InstanceStats const &GetStats() const { return stats_; }
+
+  private:
+    // What an instance is batched by, and its position in the queue, which
+    // is kept within a batch.
+    struct InstanceKey
+    {
+      TriangleMesh *mesh;
+      u32 material;
+      u32 level;
+      u32 index;
+
+      bool operator<(InstanceKey const &other) const;
+    };
+
+    // Disallow copying of this object.
+    InstanceBatcher(InstanceBatcher const &) = delete;
+    InstanceBatcher &operator=(InstanceBatcher const &) = delete;
+
+    std::vector<InstanceKey> keys_;
+    std::vector<Math::Matrix4> models_; // in queue order, row major
+    std::vector<f32> columns_;          // in batch order, column major
+    std::vector<Batch> batches_;
+    InstanceStats stats_;
+    u32 buffer_; // the instance buffer, made on the first Upload
+  };
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef H_MESH_CACHE
+#define H_MESH_CACHE
+
+#include "framework/Utilities.h"
+
+namespace Graphics
+{
+  class TriangleMesh;
+
+  // An on-disk cache of fully preprocessed meshes. Parsing an OBJ file and
+  // running TriangleMesh::Preprocess (centering, normalization, texture
+  // coordinate and TBN generation, simplification) is far more expensive
+  // than reading the result back, so the first load of a mesh writes its
+  // final data into assets/cache/. Later loads map that file into memory and
+  // copy each array out with a single memcpy; the vertex array is stored in
+  // exactly the interleaved layout of Vertex, so it goes on into the VBO the
+  // same way.
+  //
+  // Each cache file is named after its source model and a hash of the
+  // processing parameters (such as the texture mapping type). Validation works
+  // as in TextureCache: the size and modification time of the source are
+  // compared first, and the source is only hashed if those differ. An edited
+  // OBJ file therefore invalidates its cache, and the next load regenerates
+  // it.
+  //
+  // Layout of a cache file (all values little endian):
+  //   Header          80 bytes (magic, version, counts, source fingerprint,
+  //                   bounds)
+  //   Vertices        sizeof(Vertex) bytes per vertex, 16-byte aligned
+  //   Triangles       3 u32 indices per triangle, 16-byte aligned
+  //   Face normals    3 f32 per triangle, 16-byte aligned
+  //   Levels          TriangleMesh::LevelOfDetail per coarser level of
+  //                   detail, 16-byte aligned
+  //   LOD triangles   3 u32 indices per triangle of every coarser level,
+  //                   16-byte aligned
+  class MeshCache
+  {
+  public:
+    // Produces the parameter hash identifying one kind of processing. The
+    // cache format version and the size of Vertex are mixed in so that stale
+    // caches are never read after the processing code changes. Further
+    // parameters can be chained onto the result with Hash::Fnv1aValue.
+    static u64 HashParameters(char const *processing);
+
+    // Attempts to load a preprocessed mesh from the cache, given the path of
+    // its source model relative to assets/models and the processing parameter
+    // hash. Returns null if there is no valid cache entry.
+    static std::shared_ptr<TriangleMesh> Load(std::string const &relativePath,
+      u64 parameters);
+
+    // Writes a preprocessed mesh to the cache. Failure to write the cache is
+    // not an error; it only means the next load has to parse again.
+    static bool Store(std::string const &relativePath, u64 parameters,
+      TriangleMesh const &mesh);
+
+    // Allows the cache to be turned off, e.g. while iterating on the
+    // preprocessing code itself.
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled();
+  };
+}
+
+#endif
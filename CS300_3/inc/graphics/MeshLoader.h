@@ -25,6 +25,10 @@ namespace Graphics
     // relative path. The path is relative to all files within assets/models
     // from the root directory of the project.
     static std::shared_ptr<TriangleMesh> LoadMesh(std::string const &objFile, TextureProjectorFunction textureMappingType);
+
+    // Reads a mesh the same way, but bypasses the mesh cache and returns it
+    // as parsed, before Preprocess. Returns null if the file cannot be read.
+    static std::shared_ptr<TriangleMesh> ParseMesh(std::string const &objFile);
   };
 }
 
@@ -0,0 +1,76 @@
+#ifndef H_MESH_OPTIMIZER
+#define H_MESH_OPTIMIZER
+
+#include "framework/Utilities.h"
+#include "math/Vector3.h"
+
+namespace Graphics
+{
+  // Efficiency of a triangle list with respect to the GPU's post-transform
+  // vertex cache, simulated as a FIFO of CacheSize entries. ACMR (average
+  // cache miss ratio) is the number of vertex shader invocations per triangle:
+  // 3 at worst, around 0.5 to 0.7 for a well ordered mesh. ATVR (average
+  // transform to vertex ratio) is the invocations per referenced vertex: 1 is
+  // ideal, as every vertex is then shaded exactly once.
+  struct VertexCacheStats
+  {
+    static u32 const CacheSize = 16;
+
+    u32 triangleCount, vertexCount, missCount;
+    f32 acmr, atvr;
+  };
+
+  // Reorders triangle lists so that meshes render with fewer vertex shader
+  // invocations, less overdraw and better vertex fetch locality. Every pass
+  // works on plain 32-bit index lists (three indices per triangle), so it can
+  // be used on any mesh; TriangleMesh::Optimize applies all of them in turn.
+  // None of the passes change what is rendered, only the order in which it
+  // is.
+  class MeshOptimizer
+  {
+  public:
+    // Reorders the triangles for the post-transform vertex cache, following
+    // Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": triangles are
+    // emitted greedily, always picking the one whose vertices score highest
+    // given the simulated cache (recently used vertices and vertices with few
+    // remaining triangles score higher). Works in place.
+    static void OptimizeVertexCache(u32 *indices, size_t indexCount,
+      size_t vertexCount);
+
+    // Reorders clusters of the (already cache optimized) triangles to reduce
+    // overdraw, after Sander et al., "Fast Triangle Reordering for Vertex
+    // Locality and Reduced Overdraw": the triangle list is split into clusters
+    // where the cache would be cold anyway (and where the ACMR stays within
+    // threshold of the original), and clusters facing away from the center of
+    // the mesh (which tend to occlude the rest) are drawn first. A threshold
+    // of 1.05 allows the ACMR to get 5% worse. Works in place.
+    static void OptimizeOverdraw(u32 *indices, size_t indexCount,
+      Math::Vector3 const *positions, size_t positionStride,
+      size_t vertexCount, f32 threshold);
+
+    // Computes a remapping of the vertices into the order in which the
+    // triangles first reference them, so that vertex fetches walk through the
+    // vertex buffer linearly. remap[old] receives the new index of each vertex;
+    // unreferenced vertices get InvalidIndex. Returns the number of referenced
+    // vertices. Apply it with RemapIndices and by moving vertex old to
+    // remap[old].
+    static size_t ComputeVertexFetchRemap(u32 *remap, u32 const *indices,
+      size_t indexCount, size_t vertexCount);
+
+    // Replaces every index with remap[index].
+    static void RemapIndices(u32 *indices, size_t indexCount, u32 const *remap);
+
+    // Simulates the vertex cache on the given triangle list.
+    static VertexCacheStats AnalyzeVertexCache(u32 const *indices,
+      size_t indexCount, size_t vertexCount);
+
+    static u32 const InvalidIndex = 0xffffffffu;
+
+    // Loads a model from assets/models, welds it as Preprocess does, and
+    // times TriangleMesh::Optimize on it, printing the vertex cache
+    // statistics before and after.
+    static void Benchmark(std::string const &model);
+  };
+}
+
+#endif
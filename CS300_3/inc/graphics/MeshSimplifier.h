@@ -0,0 +1,55 @@
+#ifndef H_MESH_SIMPLIFIER
+#define H_MESH_SIMPLIFIER
+
+#include "framework/Utilities.h"
+
+namespace Graphics
+{
+  struct Vertex;
+
+  // One level of detail produced by MeshSimplifier: a triangle list over the
+  // original vertices, and the simplification error it was made with. The
+  // error is that of the worst collapse made so far: the root mean square
+  // distance (in the units of the vertex positions) from the vertex kept to
+  // the planes of the triangles merged into it.
+  struct SimplifiedLevel
+  {
+    std::vector<u32> indices;
+    f32 error;
+  };
+
+  // Simplifies triangle lists by collapsing edges in the order given by
+  // Garland and Heckbert's quadric error metric ("Surface Simplification Using
+  // Quadric Error Metrics"). Every vertex accumulates the (area weighted)
+  // planes of the triangles around it; collapsing a vertex onto a neighbor
+  // costs the squared distance of that neighbor to the planes of both. Only
+  // half-edge collapses are made (a vertex moves onto an existing one), so
+  // every level keeps using the original vertex buffer unchanged.
+  //
+  // Vertices that must not move are locked:
+  //  - seams: vertices sharing their position with another vertex (split for
+  //    different attributes), and vertices on edges across which the texture
+  //    coordinates wrap around (such as those made by cylindrical mapping);
+  //  - borders of open surfaces and non-manifold edges;
+  //  - the vertices at the extremes of the mesh along each axis, so that
+  //    every level has exactly the bounds of the original.
+  // Collapses that would flip a triangle over are rejected.
+  //
+  // Collapses are made in passes. Each pass computes the cost of all candidate
+  // collapses in parallel, then takes the cheapest ones whose neighborhoods do
+  // not overlap, so that the costs stay valid throughout the pass.
+  class MeshSimplifier
+  {
+  public:
+    // Builds levels of decreasing detail, one per entry of targetRatios (the
+    // fraction of the original triangle count to keep, in decreasing order).
+    // Each level continues from the previous one. A level may keep more
+    // triangles than requested if no further collapse is allowed. Every level
+    // is reordered for the vertex cache (see MeshOptimizer).
+    static void BuildLevels(std::vector<SimplifiedLevel> &levels,
+      u32 const *indices, size_t indexCount, Vertex const *vertices,
+      size_t vertexCount, f32 const *targetRatios, size_t levelCount);
+  };
+}
+
+#endif
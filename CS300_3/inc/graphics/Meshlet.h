@@ -0,0 +1,50 @@
+#ifndef H_MESHLET
+#define H_MESHLET
+
+#include "framework/Utilities.h"
+#include "math/Vector3.h"
+
+namespace Graphics
+{
+  // A small cluster of consecutive triangles of a mesh's index buffer, along
+  // with the bounds needed to cull it as a whole. The bounding sphere encloses
+  // every vertex of the cluster. The normal cone bounds the directions its
+  // triangles face: no face normal is further than the cone's spread from
+  // coneAxis, and coneCutoff is the sine of that spread (1 when the spread
+  // reaches 90 degrees, in which case the cone can never cull).
+  struct Meshlet
+  {
+    u32 firstTriangle;
+    u32 triangleCount;
+    u32 vertexCount; // distinct vertices referenced
+    u32 baseVertex;  // added to its indices when drawn; see TriangleMesh::Build
+    Math::Vector3 center;
+    f32 radius;
+    Math::Vector3 coneAxis;
+    f32 coneCutoff;
+  };
+
+  // Splits triangle lists into meshlets of at most MaxVertices distinct
+  // vertices and MaxTriangles triangles. The triangles are scanned in their
+  // existing order and a new meshlet is started whenever the next triangle
+  // would overflow the current one, so each meshlet is a contiguous range of
+  // the index buffer and can be drawn on its own. This relies on the order
+  // having good locality, which is what MeshOptimizer::OptimizeVertexCache
+  // produces: on an optimized mesh the meshlets come out compact and nearly
+  // full, and the optimized order (and thus the vertex cache efficiency) is
+  // kept as is.
+  class MeshletBuilder
+  {
+  public:
+    static u32 const MaxVertices = 64;
+    static u32 const MaxTriangles = 124;
+
+    // Replaces the contents of meshlets with the meshlets of the given
+    // triangle list. The bounds are computed in parallel.
+    static void Build(std::vector<Meshlet> &meshlets, u32 const *indices,
+      size_t indexCount, Math::Vector3 const *positions,
+      size_t positionStride, size_t vertexCount);
+  };
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef H_MESHLET_CULLER
+#define H_MESHLET_CULLER
+
+#include "framework/Utilities.h"
+#include "math/Matrix4.h"
+#include "math/Vector3.h"
+#include "graphics/Meshlet.h"
+#include "graphics/VertexArrayObject.h"
+
+namespace Graphics
+{
+  // Outcome of the last MeshletCuller::Cull.
+  struct MeshletCullStats
+  {
+    u32 meshletCount;
+    u32 visibleMeshlets;
+    u32 frustumCulled; // entirely outside the view frustum
+    u32 coneCulled;    // inside the frustum, but entirely back facing
+    u32 triangleCount;
+    u32 visibleTriangles;
+    u32 rangeCount;    // draw ranges emitted (after merging)
+  };
+
+  // Culls the meshlets of one mesh against a view every frame, producing the
+  // index ranges that still need to be drawn. A meshlet is dropped when its
+  // bounding sphere lies entirely outside one of the frustum planes, or when
+  // its normal cone shows that all of its triangles face away from the eye.
+  // The bounds are kept as separate arrays of each component, so four
+  // meshlets are tested at once with SSE (where available); blocks of
+  // meshlets are distributed over the ThreadPool. Runs of consecutive visible
+  // meshlets are merged into one range, as they are contiguous in the index
+  // buffer (unless their base vertices differ).
+  class MeshletCuller
+  {
+  public:
+    MeshletCuller();
+
+    // Copies the bounds of the given meshlets, replacing any previous ones.
+    void SetMeshlets(Meshlet const *meshlets, size_t count);
+
+    // Culls the meshlets given the model-view-projection matrix of the mesh
+    // and the position of the eye in the mesh's model space. Replaces the
+    // contents of ranges with the index ranges to draw. Back facing meshlets
+    // are only hidden if the mesh is closed or drawn with GL_CULL_FACE, so
+    // the cone test can be turned off with cullBackFacing.
+    MeshletCullStats Cull(Math::Matrix4 const &modelViewProjection,
+      Math::Vector3 const &eye, std::vector<IndexRange> &ranges,
+      bool cullBackFacing = true);
+
+    size_t GetMeshletCount() const { return meshletCount_; }
+
+  private:
+    size_t meshletCount_;
+
+    // meshlet bounds, padded to a multiple of four
+    std::vector<f32> centerX_, centerY_, centerZ_, radius_;
+    std::vector<f32> coneX_, coneY_, coneZ_, coneCutoff_;
+    std::vector<u32> firstTriangle_, triangleCount_, baseVertex_;
+
+    // result of the last cull for each meshlet (see the .cpp)
+    std::vector<u8> results_;
+  };
+}
+
+#endif
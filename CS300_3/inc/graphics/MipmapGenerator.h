@@ -0,0 +1,111 @@
+#ifndef H_MIPMAP_GENERATOR
+#define H_MIPMAP_GENERATOR
+
+#include "framework/Utilities.h"
+
+namespace Graphics
+{
+  class Image;
+
+  // Reconstruction filter used to resample one level of the chain into the
+  // next. Box averages exactly the footprint of each destination texel (what
+  // gluBuild2DMipmaps does for power-of-two sizes); Kaiser is a windowed sinc
+  // that keeps noticeably more detail in the smaller levels without aliasing.
+  enum class MipmapFilter
+  {
+    Box,
+    Kaiser,
+    Count
+  };
+
+  // How 8-bit channel values relate to light intensity. Color images are
+  // almost always sRGB encoded and must be filtered in linear light, otherwise
+  // every level gets darker than the one above it. Data such as height maps or
+  // masks are filtered as is. A NormalMap is decoded to vectors in [-1, 1],
+  // filtered, and renormalized.
+  enum class MipmapColorSpace
+  {
+    Linear,
+    Srgb,
+    NormalMap,
+    Count
+  };
+
+  // How filter taps outside of the image are resolved. Repeat matches the
+  // default GL_REPEAT wrap mode of textures, so tiling textures stay seamless.
+  enum class MipmapEdgeMode
+  {
+    Clamp,
+    Repeat,
+    Count
+  };
+
+  struct MipmapSettings
+  {
+    MipmapFilter filter;
+    MipmapColorSpace colorSpace;
+    MipmapEdgeMode edgeMode;
+
+    // Kaiser filter shape: radius in destination texels, and the window's
+    // alpha (larger is smoother, smaller is sharper but may ring).
+    f32 kaiserRadius, kaiserAlpha;
+
+    // Maximum number of levels to produce, including the base level. Zero
+    // produces the full chain down to 1x1.
+    u32 maxLevelCount;
+
+    // Whether to spread the work across the ThreadPool.
+    bool multithreaded;
+
+    // Kaiser filtered sRGB with repeating edges: suitable for color textures.
+    MipmapSettings();
+  };
+
+  // Placement of one level of a mip chain inside a single pixel buffer. Levels
+  // are stored back to back, starting with the full resolution image at
+  // offset 0. Each level is tightly packed (no row padding).
+  struct MipmapLevel
+  {
+    u32 width, height;
+    size_t offset, size;
+  };
+
+  // Builds mip chains on the CPU. The chain follows OpenGL's sizing rules for
+  // non-power-of-two textures (each level is floor(size / 2), at least 1), so
+  // the result can be uploaded level by level with glTexImage2D. Filtering is
+  // separable and polyphase: every destination texel gets its own set of
+  // weights, so odd sizes are resampled correctly rather than by dropping a
+  // row or column. The vertical pass, which does most of the work, uses SSE on
+  // whole rows; destination rows are distributed over the ThreadPool.
+  //
+  // Each level is filtered from the previous one, kept in linear floating
+  // point, so that no quantization error accumulates down the chain.
+  class MipmapGenerator
+  {
+  public:
+    // Number of levels in the full chain of a width x height image.
+    static u32 GetLevelCount(u32 width, u32 height);
+
+    // Fills in the dimensions and offsets of each level of the chain for an
+    // image of the given size and returns the total size of the buffer needed
+    // to hold all of them.
+    static size_t ComputeLayout(u32 width, u32 height, u32 channelCount,
+      MipmapSettings const &settings, std::vector<MipmapLevel> &levels);
+
+    // Given a buffer laid out by ComputeLayout whose first level already holds
+    // the source image, generates all remaining levels in place.
+    static void Generate(u8 *pixels, std::vector<MipmapLevel> const &levels,
+      u32 channelCount, MipmapSettings const &settings);
+
+    // Convenience for CPU-side image processing: produces the full pyramid of
+    // an image as separate images, starting with a copy of the source.
+    static std::vector<Image> BuildPyramid(Image const &source,
+      MipmapSettings const &settings);
+
+    // Times the generator on a synthetic image of the given size for every
+    // filter, both single- and multithreaded, and prints the results.
+    static void Benchmark(u32 width, u32 height, u32 iterations);
+  };
+}
+
+#endif
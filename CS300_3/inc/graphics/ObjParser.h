@@ -0,0 +1,61 @@
+#ifndef H_OBJ_PARSER
+#define H_OBJ_PARSER
+
+#include "framework/Utilities.h"
+#include "math/Vector2.h"
+#include "math/Vector3.h"
+
+namespace Graphics
+{
+  // One corner of a triangle: indices (starting at 0) into the positions,
+  // texture coordinates and normals of an ObjData. Texture coordinates and
+  // normals are optional in OBJ files; ObjCorner::None marks them absent.
+  struct ObjCorner
+  {
+    static u32 const None = 0xffffffffu;
+
+    u32 position, texCoord, normal;
+  };
+
+  // Geometry read from a Wavefront OBJ file. Every face has been
+  // triangulated, so corners holds three entries per triangle.
+  struct ObjData
+  {
+    std::vector<Math::Vector3> positions;
+    std::vector<Math::Vector2> texCoords;
+    std::vector<Math::Vector3> normals;
+    std::vector<ObjCorner> corners;
+
+    // Faces as written in the file, and faces skipped because they had fewer
+    // than three corners or an index out of range.
+    size_t faceCount, invalidFaceCount;
+
+    inline size_t GetTriangleCount() const { return corners.size() / 3; }
+  };
+
+  // Parses the geometry of Wavefront OBJ files: v, vt and vn records, and f
+  // records in all four forms (v, v/vt, v//vn, v/vt/vn) with positive or
+  // negative (relative) indices. Faces with more than three corners are
+  // triangulated: convex ones as a fan, others by ear clipping. Everything
+  // else (groups, materials, smoothing groups, lines) is skipped.
+  //
+  // Files are mapped into memory rather than read, split into chunks at line
+  // boundaries, and the chunks are parsed in parallel on the ThreadPool
+  // before being merged, so large scans load at close to disk speed.
+  class ObjParser
+  {
+  public:
+    // Parses the OBJ text in [text, text + size). Returns false (with data
+    // left empty) if there is no geometry at all.
+    static bool Parse(char const *text, size_t size, ObjData &data);
+
+    // Maps the file at the given path and parses it. Returns false if the
+    // file cannot be opened or holds no geometry.
+    static bool ParseFile(std::string const &path, ObjData &data);
+
+    // Times parsing the given file and prints the throughput.
+    static void Benchmark(std::string const &path, u32 iterations);
+  };
+}
+
+#endif
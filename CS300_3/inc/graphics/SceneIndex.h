@@ -0,0 +1,124 @@
+#ifndef H_SCENE_INDEX
+#define H_SCENE_INDEX
+
+#include "framework/Utilities.h"
+#include "math/Vector3.h"
+#include "graphics/Bvh.h"
+#include "graphics/FrustumCuller.h"
+
+namespace Graphics
+{
+  // A bounding volume hierarchy over the objects of a scene that is kept up
+  // to date as they come, go and move, rather than rebuilt (a dynamic AABB
+  // tree, as in Box2D). Each object is stored as a leaf holding its world
+  // space box enlarged by a margin; moving an object costs one containment
+  // test as long as it stays within that box, and otherwise removes its leaf
+  // and inserts it again. Leaves are inserted next to the node that grows
+  // the least in surface area, and the nodes above are refit and rebalanced
+  // with AVL rotations on the way back to the root, so the tree stays
+  // shallow however objects are added.
+  //
+  // Queries walk the tree from the root, skipping whole subtrees: frustum
+  // culling stops testing planes a subtree lies entirely in front of (and
+  // takes a subtree inside all of them as is), ray
+  // picking visits children nearest first and drops those beyond the
+  // closest hit so far, and nearest queries do the same by distance. As the
+  // boxes are enlarged, results are conservative: an object may be reported
+  // in view, or under a ray, when only its margin is. Queries only read the
+  // tree, so any number may run concurrently, but not alongside changes.
+  //
+  // Culling pays off when a small part of the scene is in view. While most
+  // objects are, a linear FrustumCuller pass is faster: with 100000 objects
+  // and a fifth of them visible, the tree takes about 2.5 times as long.
+  class SceneIndex
+  {
+  public:
+    static u32 const InvalidProxy = 0xffffffffu;
+
+    // The margin is how far, in world units, objects may move from where
+    // they were inserted before their leaf is moved in the tree.
+    explicit SceneIndex(f32 margin = 0.1f);
+
+    // Adds an object with the given world space bounds and returns the proxy
+    // naming it in the index. The object id is what queries report.
+    u32 Insert(Math::Vector3 const &minimum, Math::Vector3 const &maximum,
+      u32 object);
+
+    // Removes an object by its proxy, which may be reused by later inserts.
+    void Remove(u32 proxy);
+
+    // Updates the bounds of an object. Returns whether its leaf had to move
+    // within the tree, which only happens once it leaves its enlarged box.
+    bool Move(u32 proxy, Math::Vector3 const &minimum,
+      Math::Vector3 const &maximum);
+
+    // Appends the ids of every object that may intersect the frustum.
+    void Cull(FrustumPlanes const &planes, std::vector<u32> &objects) const;
+
+    // Finds the object whose box the ray enters first, returning its id and
+    // setting t to the ray parameter at that point, or InvalidProxy if there
+    // is none. If given, intersect refines the test against the object's
+    // actual shape: it is called with the object id and the closest t found
+    // so far, and returns whether the object is hit closer, updating t.
+    u32 Pick(Ray const &ray, f32 &t,
+      std::function<bool(u32 object, f32 &t)> const &intersect = nullptr) const;
+
+    // Finds the object whose box is nearest to a point, within maxDistance,
+    // returning its id and setting distance, or InvalidProxy if there is
+    // none. Objects stored as points (such as lights) are found exactly.
+    u32 Nearest(Math::Vector3 const &point, f32 &distance,
+      f32 maxDistance = std::numeric_limits<f32>::infinity()) const;
+
+    u32 GetProxyObject(u32 proxy) const { return nodes_[proxy].object; }
+    size_t GetProxyCount() const { return proxyCount_; }
+    size_t GetNodeCount() const { return nodes_.size() - freeCount_; }
+
+    // Length of the longest path from the root to a leaf, 0 when empty.
+    u32 GetHeight() const;
+
+    // Times inserting objectCount random boxes, moving a tenth of them per
+    // frame over a number of frames, and frustum, ray and nearest queries,
+    // against a linear FrustumCuller pass over the same boxes, printing the
+    // results.
+    static void Benchmark(u32 objectCount);
+
+  private:
+    // A leaf (height 0) holding an object, or a node over two children.
+    // Freed nodes are chained through parent, with a height of -1.
+    struct Node
+    {
+      f32 boundMin[3];
+      u32 parent;
+      f32 boundMax[3];
+      s32 height;
+      u32 child[2];
+      u32 object;
+    };
+
+    // Deepest tree the queries walk without a heap allocated stack; AVL
+    // balancing keeps the height within 1.44 log2 of the object count.
+    static u32 const MaxHeight = 64;
+
+    // Appends the objects of every leaf below a node, without testing them.
+    void appendSubtree(u32 subtree, std::vector<u32> &objects) const;
+
+    u32 allocateNode();
+    void freeNode(u32 node);
+    void insertLeaf(u32 leaf);
+    void removeLeaf(u32 leaf);
+    // Rotates the tree at a node if its children differ in height by more
+    // than one, and returns the node now at its place.
+    u32 balance(u32 node);
+    // Recomputes the bounds and heights of a node and of every node above.
+    void refitUpward(u32 node);
+
+    std::vector<Node> nodes_;
+    u32 root_;
+    u32 freeNode_; // first freed node, reused by allocateNode
+    size_t freeCount_;
+    size_t proxyCount_;
+    f32 margin_;
+  };
+}
+
+#endif
@@ -42,6 +42,12 @@ namespace Graphics
       std::string const &vertexSourceFile,
       std::string const &fragmentSourceFile);
 
+    // Associates an already loaded (and usually built) shader program with a
+    // type, replacing the program previously registered to it, if any. This
+    // is how hot reloading swaps in a rebuilt program.
+    std::shared_ptr<ShaderProgram> const &SetShader(ShaderType type,
+      std::shared_ptr<ShaderProgram> const &program);
+
     // Retreives a shader program based on its ShaderType. If the type is
     // unknown, this method returns NULL.
     std::shared_ptr<ShaderProgram> const &GetShader(ShaderType key) const;
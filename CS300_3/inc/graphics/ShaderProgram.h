@@ -55,8 +55,9 @@ namespace Graphics
     // objects for those shaders, and compiles them. Creates the shader program
     // object, attaches the compiled vertex and fragment shaders to the
     // program and links them. It finishes with validating the program and
-    // cleaning up the shader objects used to construct it.
-    void Build();
+    // cleaning up the shader objects used to construct it. Returns false if
+    // either shader failed to compile or the program failed to link.
+    bool Build();
 
     // Binds this shader program for uses including setting uniform constant
     // values and using the program to render geometry.
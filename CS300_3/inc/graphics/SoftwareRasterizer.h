@@ -0,0 +1,168 @@
+#ifndef H_SOFTWARE_RASTERIZER
+#define H_SOFTWARE_RASTERIZER
+
+#include "framework/Utilities.h"
+#include "graphics/Color.h"
+#include "graphics/Image.h"
+#include "graphics/Light.h"
+#include "math/Matrix4.h"
+#include "math/Vector3.h"
+#include "math/Vector4.h"
+
+namespace Graphics
+{
+  class TriangleMesh;
+
+  enum class RasterShadingModel
+  {
+    Phong, // phongshade.frag: specular from the reflected light direction
+    Blinn  // blinnshade.frag: specular from the half vector
+  };
+
+  // A light as the shaders receive it (see Light in phongshade.frag): already
+  // in view space, with the cosines of the spotlight angles.
+  struct RasterLight
+  {
+    LightType type;
+    Math::Vector4 position;
+    Math::Vector4 direction;
+    Color ambient;
+    Color diffuse;
+    Color specular;
+    f32 spotlightInnerCos;
+    f32 spotlightOuterCos;
+    f32 spotlightFalloff;
+
+    RasterLight();
+  };
+
+  // Everything RenderMesh sets as uniforms of phongshade or blinnshade for
+  // one mesh, so that the software path lights it the same way.
+  struct RasterShading
+  {
+    static u32 const MaxLights = 8;
+
+    RasterShadingModel model;
+    Math::Matrix4 modelView;
+    Math::Matrix4 modelViewProjection;
+    Color materialAmbient;
+    Color materialDiffuse;
+    Color materialEmissive;
+    Color materialSpecular;
+    f32 materialShininess;
+    Color globalAmbient;
+    Math::Vector3 attenuation; // vLightAttCoef
+    Math::Vector3 view;        // viewer position in view space
+    f32 fogNear;
+    f32 fogFar;
+    Color fogColor;
+    bool useAmbientOcclusion; // UseAmbientOcclusion
+    RasterLight lights[MaxLights];
+    u32 lightCount;
+
+    RasterShading();
+  };
+
+  // Outcome of one SoftwareRasterizer::Draw.
+  struct RasterStats
+  {
+    u32 triangleCount;       // triangles submitted
+    u32 rasterizedTriangles; // left after rejection and near plane clipping
+    u64 shadedPixels;        // fragments that passed the depth test
+    f64 milliseconds;
+  };
+
+  // Draws TriangleMeshes into an in-memory framebuffer without OpenGL, for
+  // headless rendering (such as render regression runs on machines without a
+  // GPU). It reproduces the fixed part of the GL pipeline RenderMesh relies
+  // on: clipping against the near plane, rasterization of both faces (culling
+  // is never enabled), a depth test with GL_LESS, and per pixel lighting
+  // ported from phongshade.frag and blinnshade.frag with perspective correct
+  // attributes. Textures are not sampled; surfaces use the material colors.
+  //
+  // Triangles are transformed and set up in parallel, then binned into tiles
+  // of TileSize pixels, keeping their submission order. Tiles are rasterized
+  // in parallel on the ThreadPool, each by a single thread, so no pixel is
+  // ever shared between threads. Coverage (from the three edge functions)
+  // and depth are evaluated with SSE for four pixels of a row at once.
+  class SoftwareRasterizer
+  {
+  public:
+    static u32 const TileSize = 64;
+
+    SoftwareRasterizer(u32 width, u32 height);
+
+    // Reallocates the framebuffer; its contents are undefined afterwards.
+    void Resize(u32 width, u32 height);
+
+    // Fills the color buffer and resets the depth buffer to the far plane.
+    void Clear(Color const &color);
+
+    // Draws the full triangles of the mesh (level of detail 0) with the given
+    // transforms and lighting.
+    RasterStats Draw(TriangleMesh const &mesh, RasterShading const &shading);
+
+    // The color buffer, top row first, with RGBA channels.
+    Image const &GetImage() const { return color_; }
+
+    u32 GetWidth() const { return width_; }
+    u32 GetHeight() const { return height_; }
+
+    // Loads a model from assets/models and draws it frameCount times at the
+    // given resolution, printing triangles and pixels per second.
+    static void Benchmark(std::string const &model, u32 width, u32 height,
+      u32 frameCount);
+
+  private:
+    // A vertex after the vertex stage: clip space position, and the view
+    // space position, normal and ambient occlusion the fragment stage
+    // interpolates.
+    struct ShadedVertex
+    {
+      f32 clip[4];
+      f32 position[3];
+      f32 normal[3];
+      f32 occlusion;
+    };
+
+    // A triangle ready to rasterize: window coordinates, 1 / w and the
+    // attributes of its vertices (in counterclockwise order on screen), and
+    // its bounds in pixels.
+    struct SetupTriangle
+    {
+      f32 x[3], y[3], z[3], inverseW[3];
+      f32 position[3][3];
+      f32 normal[3][3];
+      f32 occlusion[3];
+      s32 minX, minY, maxX, maxY;
+    };
+
+    // Projects a triangle (entirely in front of the near plane) to the
+    // window and adds it to the bins of the tiles it overlaps.
+    void binTriangle(ShadedVertex const &a, ShadedVertex const &b,
+      ShadedVertex const &c, u32 chunk);
+    // The shading parameters reduced to what each fragment needs.
+    struct FragmentShading;
+
+    // Rasterizes and shades the triangles binned into a tile, in order.
+    void rasterizeTile(u32 tile, FragmentShading const &shading,
+      u64 &shadedPixels);
+
+    u32 width_, height_;
+    u32 tileCountX_, tileCountY_;
+    Image color_;
+    // bottom row first, like OpenGL; rows are padded to a multiple of four
+    // pixels so that every group of four can be loaded at once
+    std::vector<f32> depth_;
+    u32 depthStride_;
+
+    // Per Draw: vertices after the vertex stage, then the triangles set up by
+    // each chunk of the setup pass and, for every chunk, the triangles (by
+    // index within the chunk) overlapping each tile.
+    std::vector<ShadedVertex> vertices_;
+    std::vector<std::vector<SetupTriangle>> chunkTriangles_;
+    std::vector<std::vector<std::vector<u32>>> chunkBins_;
+  };
+}
+
+#endif
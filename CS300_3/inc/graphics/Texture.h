@@ -2,6 +2,7 @@
 #define H_TEXTURE
 
 #include "framework/Utilities.h"
+#include "graphics/MipmapGenerator.h"
 
 namespace Graphics
 {
@@ -41,9 +42,26 @@ namespace Graphics
   class Texture
   {
   public:
+    // A single level of the texture's mip chain. All levels are stored back to
+    // back inside one pixel buffer, starting with the full resolution image at
+    // offset 0.
+    typedef MipmapLevel MipLevel;
+
+    // Number of 8-bit channels per pixel. The CS300 framework only handles RGB
+    // images.
+    static u32 const ChannelCount = 3;
+
+    // Owns the pixel buffer of a texture. Buffers always come from malloc,
+    // the allocator STB image decodes into, so that a decoded image can be
+    // adopted without copying it and grown into a full mip chain with
+    // realloc. The deleter is stbi_image_free for adopted decoder buffers and
+    // std::free otherwise.
+    typedef std::unique_ptr<u8, void (*)(void *)> PixelBuffer;
+
     ~Texture();
 
-    // builds the texture and uploads it to the graphics card
+    // builds the texture and uploads it to the graphics card; the CPU copy of
+    // the pixels is released afterwards, so a texture can only be built once
     void Build();
     void Bind(u8 slot); // bind texture to specific texture slot
     bool IsBound() const;
@@ -54,6 +72,16 @@ namespace Graphics
     u32 GetWidth() const;
     u32 GetHeight() const;
 
+    // Retrieves the number of mip levels stored by this texture (at least 1).
+    u32 GetLevelCount() const;
+
+    // Retrieves the dimensions and location of a mip level within the pixel
+    // buffer, as well as a pointer to that level's pixels. Pixels are only
+    // available until the texture is built.
+    MipLevel const &GetLevel(u32 level) const;
+    bool HasPixels() const;
+    u8 const *GetLevelPixels(u32 level) const;
+
     static std::shared_ptr<Texture> LoadTGA(std::string const &path);
     static std::shared_ptr<Texture> LoadPNG(std::string const &path);
 	static std::shared_ptr<Texture> LoadNormalMapFromHeightMapTGA(
@@ -63,11 +91,20 @@ namespace Graphics
 		TextureWrapType htype);
 
     friend class TextureManager;
+    friend class TextureCache;
   private:
-    Texture(u8 *pix, u32 width, u32 height);
+    Texture(PixelBuffer pixels, u32 width, u32 height);
+    Texture(PixelBuffer pixels, std::vector<MipLevel> const &levels);
+
+    // Creates a texture holding the full mip chain of the given base image,
+    // taking ownership of the buffer and growing it in place to fit the
+    // chain.
+    static Texture *CreateMipmapped(PixelBuffer pixels, u32 width, u32 height,
+      MipmapSettings const &settings);
 
-    u8 *pixels_;
+    PixelBuffer pixels_;
     u32 width_, height_;
+    std::vector<MipLevel> levels_;
     u32 textureHandle_;
     u8 boundSlot_;
   };
@@ -0,0 +1,57 @@
+#ifndef H_TEXTURE_CACHE
+#define H_TEXTURE_CACHE
+
+#include "framework/Utilities.h"
+
+namespace Graphics
+{
+  class Texture;
+
+  // An on-disk cache of fully processed textures. Decoding a TGA/PNG with STB
+  // and deriving a normal map from a height map is far more expensive than
+  // reading the result back, so the first load of a texture writes its final
+  // pixels (every mip level, in the exact format uploaded to OpenGL) into
+  // assets/cache/. Later loads map that file into memory and skip all decoding
+  // and derivation work.
+  //
+  // Each cache file is named after its source image and a hash of the
+  // processing parameters, so one source may have several cached derivatives
+  // (such as the image itself and a normal map derived from it). A cache file
+  // is considered valid when the size and modification time of the source
+  // still match the ones recorded in the cache; if they do not, the source is
+  // hashed and compared against the recorded content hash before the cache is
+  // rejected. A missing source does not invalidate the cache.
+  //
+  // Layout of a cache file (all values little endian):
+  //   Header          64 bytes (magic, version, format, source fingerprint)
+  //   Level table     24 bytes per mip level (width, height, offset, size)
+  //   Pixel data      all levels back to back, 16-byte aligned
+  class TextureCache
+  {
+  public:
+    // Produces the parameter hash identifying one kind of processing. The
+    // cache format version is mixed in so that stale caches are never read
+    // after the processing code changes. Further parameters (such as the
+    // differentiation method for normal maps) can be chained onto the result
+    // with Hash::Fnv1aValue.
+    static u64 HashParameters(char const *processing);
+
+    // Attempts to load a processed texture from the cache, given the path of
+    // its source image relative to assets/textures and the processing
+    // parameter hash. Returns null if there is no valid cache entry.
+    static std::shared_ptr<Texture> Load(std::string const &relativePath,
+      u64 parameters);
+
+    // Writes a processed texture to the cache. Failure to write the cache is
+    // not an error; it only means the next load has to decode again.
+    static bool Store(std::string const &relativePath, u64 parameters,
+      Texture const &texture);
+
+    // Allows the cache to be turned off, e.g. while iterating on the
+    // processing code itself.
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled();
+  };
+}
+
+#endif
@@ -45,6 +45,12 @@ namespace Graphics
 	std::shared_ptr<Texture> const &RegisterNormalMapTexture(TextureType type,
 	  std::string const &heightmapFilePath);
 
+    // Associates an already loaded texture with a type, replacing the texture
+    // previously registered to it, if any. Used by hot reloading to swap in a
+    // rebuilt texture; the replaced texture must not be bound.
+	std::shared_ptr<Texture> const &SetTexture(TextureType type,
+	  std::shared_ptr<Texture> const &texture);
+
     // Retreives a texture based on its TextureType. If the type is unknown,
     // this method returns NULL.
     std::shared_ptr<Texture> const &GetTexture(TextureType key) const;
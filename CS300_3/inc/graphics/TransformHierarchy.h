@@ -0,0 +1,121 @@
+#ifndef H_TRANSFORM_HIERARCHY
+#define H_TRANSFORM_HIERARCHY
+
+#include "framework/Utilities.h"
+#include "math/Matrix4.h"
+#include "math/Vector3.h"
+
+namespace Graphics
+{
+  // Outcome of the last TransformHierarchy::Update.
+  struct TransformStats
+  {
+    u32 nodeCount;
+    u32 levelCount;    // depth of the deepest node, plus one
+    u32 dirtyNodes;    // whose local transform changed since the last Update
+    u32 updatedNodes;  // whose world transform was recomputed
+    f64 milliseconds;
+  };
+
+  // The transforms of a scene graph: every node has a local transform
+  // (position, Euler rotation and scale, composed like RenderMesh does:
+  // Translate * RotateEuler(z, x, y) * Scale) relative to its parent, and a
+  // world transform, the product of its ancestors' local transforms and its
+  // own.
+  //
+  // Nodes are stored by depth, each depth as a structure of arrays (one
+  // array per component of the local values and of the 3x4 local and world
+  // matrices), so that world matrices are computed four nodes at a time with
+  // SSE (where available), one depth after another so that parents are
+  // always done before their children. Changing a local transform only marks
+  // the node dirty; Update recomputes the world matrices of dirty nodes and
+  // of everything below them, skipping every depth with nothing dirty in it
+  // or above it. A scene that does not move costs a few comparisons per
+  // depth. Large depths are split over the ThreadPool.
+  //
+  // Nodes are named by handles, which stay valid until the node is destroyed
+  // even as nodes move around within their depth.
+  class TransformHierarchy
+  {
+  public:
+    static u32 const InvalidNode = 0xffffffffu;
+
+    TransformHierarchy();
+
+    // Adds a node with an identity local transform below the given parent,
+    // or as a root, and returns its handle.
+    u32 Create(u32 parent = InvalidNode);
+
+    // Removes a node, which must not have children.
+    void Destroy(u32 node);
+
+    // Set the local transform. Rotations are Euler angles in radians about
+    // x, y and z, applied in the order of Matrix4::RotateEuler(z, x, y).
+    // Nodes are only marked dirty when a value actually changes, so these can
+    // be called every frame with unchanged values at no cost to Update.
+    void SetLocal(u32 node, Math::Vector3 const &position,
+      Math::Vector3 const &rotation, Math::Vector3 const &scale);
+    void SetPosition(u32 node, Math::Vector3 const &position);
+    void SetRotation(u32 node, Math::Vector3 const &rotation);
+    void SetScale(u32 node, Math::Vector3 const &scale);
+
+    Math::Vector3 GetPosition(u32 node) const;
+    Math::Vector3 GetRotation(u32 node) const;
+    Math::Vector3 GetScale(u32 node) const;
+    u32 GetParent(u32 node) const;
+
+    // Recomputes the world transforms that changed since the last Update.
+    TransformStats const &Update();
+
+    // The world transform of a node as of the last Update.
+    Math::Matrix4 GetWorld(u32 node) const;
+
+    size_t GetNodeCount() const { return nodeCount_; }
+    TransformStats const &GetStats() const { return stats_; }
+
+  private:
+    // Where a handle's node is stored.
+    struct Slot
+    {
+      u32 depth;
+      u32 index; // within the depth, or the next free handle once destroyed
+    };
+
+    // The nodes of one depth. Every array but handle and parent is padded to
+    // a multiple of four, so that any group of four can be loaded at once;
+    // padding uses the first parent and is never marked dirty.
+    struct Depth
+    {
+      u32 count;
+      u32 dirtyCount;   // nodes with localDirty set
+      u32 changedCount; // nodes whose world changed in the last Update
+      std::vector<u32> handle;
+      std::vector<u32> parent;     // index within the depth above
+      std::vector<u32> childCount; // children in the depth below
+      std::vector<f32> position[3], rotation[3], scale[3];
+      std::vector<f32> local[12];  // rows of the 3x4 local matrix
+      std::vector<f32> world[12];  // rows of the 3x4 world matrix
+      std::vector<u8> localDirty;
+      std::vector<u8> worldChanged;
+
+      Depth();
+    };
+
+    // Grows a depth's arrays to hold count nodes (plus padding).
+    static void resize(Depth &depth, u32 count);
+    // Marks a node's local transform as changed.
+    void markDirty(Depth &depth, u32 index);
+    // Recomputes the local matrices of dirty nodes and the world matrices of
+    // the groups of four, within [begin, end), that hold a dirty node or the
+    // child of a changed one. Returns the number of worlds recomputed.
+    u32 updateGroups(u32 depth, u32 begin, u32 end);
+
+    std::vector<Depth> depths_;
+    std::vector<Slot> slots_;
+    u32 freeSlot_; // first destroyed handle, reused by Create
+    size_t nodeCount_;
+    TransformStats stats_;
+  };
+}
+
+#endif
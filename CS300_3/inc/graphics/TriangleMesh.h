@@ -2,15 +2,22 @@
 #define H_TRIANGLE_MESH
 
 #include "framework/Utilities.h"
+#include "graphics/AmbientOcclusionBaker.h"
+#include "graphics/Bvh.h"
+#include "math/Matrix4.h"
 #include "math/Vector3.h"
 #include "math/Vector4.h"
+#include "graphics/Meshlet.h"
+#include "graphics/MeshletCuller.h"
+#include "graphics/MeshOptimizer.h"
+#include "graphics/Vertex.h"
 #include "graphics/VertexArrayObject.h"
 
 namespace Graphics
 {
+  class MeshCache;
   class ShaderProgram;
   enum class TextureProjectorFunction;
-  struct Vertex;
 
   // This class represents the data structure for storing geometry data in a
   // convenient way to use directly with OpenGL. This data structure is designed
@@ -47,6 +54,17 @@ namespace Graphics
       Triangle(u32 _a, u32 _b, u32 _c);
     };
 
+    // A simplified version of the mesh, made by Preprocess: a range of
+    // triangles over the same vertices (see MeshSimplifier.h), and the
+    // distance by which its surface may deviate from the original.
+    struct LevelOfDetail
+    {
+      u32 firstTriangle;
+      u32 triangleCount;
+      f32 error;
+      u32 reserved;
+    };
+
     TriangleMesh();
     ~TriangleMesh();
 
@@ -59,9 +77,84 @@ namespace Graphics
     // sphere.
     void AddTriangle(u32 a, u32 b, u32 c);
 
+    // Preallocates room for the given number of vertices and triangles, so
+    // that loaders adding large meshes do not reallocate repeatedly.
+    void Reserve(u32 vertexCount, u32 triangleCount);
+
+    // Merges duplicate vertices: those within positionTolerance of each other
+    // (a fraction of the diagonal of the mesh's bounds). Only positions are
+    // compared, since Preprocess() welds before any other attribute exists
+    // (the loader keeps no texture coordinates or normals, and both are
+    // generated afterwards); welding therefore also joins the seams of UV
+    // or normal discontinuities. Triangles are remapped onto the remaining
+    // vertices and those that collapse are dropped. Vertices are looked up
+    // through a spatial hash, in parallel. Returns the number of vertices
+    // removed. Called by Preprocess(); face normals and levels of detail
+    // computed before welding are discarded.
+    u32 Weld(f32 positionTolerance = 1e-6f);
+
+    // Reorders the triangles for the post-transform vertex cache and for less
+    // overdraw, then reorders the vertices into the order the triangles use
+    // them (dropping unreferenced ones). See MeshOptimizer.h. Called by
+    // Preprocess(); face normals and levels of detail computed before are
+    // discarded.
+    void Optimize();
+
+    // Number of levels of detail, including the full mesh (level 0); coarser
+    // levels follow with roughly 50%, 25% and 10% of its triangles, leaving
+    // out any that simplification could not make smaller than the last.
+    u32 GetLevelCount() const { return u32(levels_.size()) + 1; }
+
+    // Number of triangles drawn at the given level of detail.
+    u32 GetLevelTriangleCount(u32 level) const;
+
+    // Selects the coarsest level of detail whose simplification error, as
+    // projected onto the screen, stays within pixelError pixels. The
+    // projection is that of the mesh's bounding sphere at its nearest point to
+    // the eye, so small or distant meshes get coarse levels and meshes filling
+    // the view get the full one.
+    u32 SelectLevelOfDetail(Math::Matrix4 const &modelViewProjection,
+      f32 viewportHeight, f32 pixelError = 1.f) const;
+
+    // Simulates the post-transform vertex cache on the current triangle
+    // order.
+    VertexCacheStats AnalyzeVertexCache() const;
+
+    // Selects the layout of the vertex buffer made by Build (Full by
+    // default). Packed meshes need their shader's PackedVertex and
+    // PackedPositionTransform uniforms set while rendering; see
+    // GetPackedPositionTransform and PackedVertex in Vertex.h.
+    void SetVertexFormat(VertexFormat format) { vertexFormat_ = format; }
+    VertexFormat GetVertexFormat() const { return vertexFormat_; }
+
+    // The transform undoing the position quantization of a Packed mesh (xyz
+    // offset, w scale), valid once the mesh has been built.
+    Math::Vector4 const &GetPackedPositionTransform() const
+    {
+      return packedPositionTransform_;
+    }
+
+    // Lets Build store meshes with more vertices than 16-bit indices reach
+    // with 16-bit indices anyway (on by default). The meshlets are grouped
+    // into consecutive windows using at most 65536 distinct vertices, each
+    // window gets its own copy of those vertices in the VBO, and indices are
+    // stored relative to the window's first vertex, which is added back when
+    // drawing (with glMultiDrawElementsBaseVertex). Build only does so when
+    // the copied vertices take less room than the indices save. Smaller meshes
+    // always get 16-bit indices; see IndexBufferObject.
+    void SetMeshletLocalIndices(bool enabled) { meshletLocalIndices_ = enabled; }
+    bool GetMeshletLocalIndices() const { return meshletLocalIndices_; }
+
+    // The size in bytes of each index of the built mesh (2 or 4), and how
+    // many bytes its buffers save over 32-bit indices (net of the vertices
+    // copied for meshlet-local indices).
+    u32 GetIndexSize() const;
+    s32 GetIndexBytesSaved() const;
+
 	void SetTextureMappingType(TextureProjectorFunction type) { textureMappingType_ = type; }
 
-    // This performs preprocessing on the triangle mesh, such as computing
+    // This performs preprocessing on the triangle mesh, such as welding
+    // duplicate vertices; optimizing the triangle and vertex order; computing
     // normals per face and vertex; centering all vertices about the origin;
     // and normalizing vertices to live within a range of [-0.5, 0.5]. This
     // should be called by a class loading the mesh or a class creating a new
@@ -108,10 +201,49 @@ namespace Graphics
     void Build(std::shared_ptr<ShaderProgram> program);
 
     // Renders the VAO associated with this mesh, if it has been built using
-    // the TriangleMesh::Build method. See VertexArrayObject::Render for more
-    // information on how rendering meshes works.
-    void Render();
+    // the TriangleMesh::Build method, at the given level of detail. See
+    // VertexArrayObject::Render for more information on how rendering meshes
+    // works.
+    void Render(u32 level = 0);
+
+    // Renders the mesh like Render, but only the meshlets that survive
+    // culling against the view: those inside the frustum given by the
+    // model-view-projection matrix that are not entirely back facing as seen
+    // from the eye (a position in the mesh's model space), unless
+    // cullBackFacing is false. The meshlets are made by Build for every level
+    // of detail; see Meshlet.h and MeshletCuller.h.
+    void Render(Math::Matrix4 const &modelViewProjection,
+      Math::Vector3 const &eye, bool cullBackFacing = true, u32 level = 0);
+
+    // Renders instanceCount copies of the mesh at the given level of detail,
+    // each transformed by its own model matrix read from the instance buffer
+    // at the given byte offset (see InstanceBatcher.h). The shader must have
+    // UseInstancing set.
+    void RenderInstanced(unsigned int instanceBuffer, size_t offset,
+      u32 instanceCount, u32 level = 0);
+
+    // The meshlets of the built mesh (of all levels, in order), and the
+    // outcome of the last culled Render.
+    std::vector<Meshlet> const &GetMeshlets() const { return meshlets_; }
+    MeshletCullStats const &GetCullStats() const { return cullStats_; }
 
+    // The bounding volume hierarchy over the full triangles, for ray queries
+    // (see Bvh.h). Built on first use and kept until the mesh's geometry is
+    // changed by Weld, Optimize or Preprocess.
+    Bvh const &GetBvh();
+
+    // Bakes ambient occlusion into the occlusion attribute of every vertex,
+    // tracing rayCount rays per vertex against GetBvh() that reach as far as
+    // maxDistance times the diagonal of the mesh's bounds (see
+    // AmbientOcclusionBaker.h). Must be called before Build to show up in the
+    // vertex buffer. Called by MeshLoader, after Preprocess.
+    void BakeAmbientOcclusion(
+      u32 rayCount = AmbientOcclusionBaker::DefaultRayCount,
+      f32 maxDistance = AmbientOcclusionBaker::DefaultMaxDistance);
+
+	// Draw lines along the normal, tangent and bitangent of every vertex, or
+	// the normal of every triangle, with the program the mesh was built with.
+	// The lines are only made when one of these is first called after Build.
 	void RenderVertexNormals();
 	void RenderVertexTangents();
 	void RenderVertexBitangents();
@@ -126,6 +258,7 @@ namespace Graphics
 		return maximum_;
 	}
 
+    friend class MeshCache;
   private:
     // Centers the mesh's vertices about the origin. This method is adaptive as
     // more vertices are added. Called by Preprocess().
@@ -135,9 +268,40 @@ namespace Graphics
     // adaptive as more vertices are added. Called by Preprocess().
     void normalizeVertices();
 
+	// The line sets drawn by RenderVertexNormals, RenderVertexTangents,
+	// RenderVertexBitangents and RenderFaceNormals.
+	enum DebugLineSet
+	{
+		VertexNormalLines,
+		VertexTangentLines,
+		VertexBitangentLines,
+		FaceNormalLines
+	};
+
+	// Builds the VAO holding the lines of every DebugLineSet, sharing the
+	// vertices the lines start from. Called when the first set is drawn after
+	// Build, since debug lines are rarely shown.
+	void buildDebugLines();
+	void renderDebugLines(DebugLineSet set);
+
 	void generateUV();
 	void generateTBN();
 
+	// Builds the coarser levels of detail from the final triangles. Called by
+	// Preprocess().
+	void generateLevelsOfDetail();
+
+	// Index of the first triangle of a level within the IBO.
+	u32 getLevelFirstTriangle(u32 level) const;
+
+	// Assigns the meshlets, in order, to windows of at most 65536 vertices,
+	// starting a new window when the next meshlet's vertices would not fit,
+	// and sets their base vertices. Fills sourceVertices with the vertex each
+	// slot of the windows (laid one after another) copies, and localIndices
+	// with the indices of all levels relative to their window.
+	void buildMeshletLocalIndices(std::vector<u32> &sourceVertices,
+		std::vector<u32> &localIndices);
+
     std::vector<Vertex> vertices_;
     std::vector<Triangle> triangles_;
 	std::vector<Math::Vector3> triangleNormals_;
@@ -146,14 +310,33 @@ namespace Graphics
 
     /* The VAO built off of this mesh and ready for rendering. */
     std::shared_ptr<VertexArrayObject> vertexArrayObject_;
-	std::shared_ptr<VertexArrayObject> vaoVertexNormals_;
-	std::shared_ptr<VertexArrayObject> vaoVertexTangents_;
-	std::shared_ptr<VertexArrayObject> vaoVertexBitangents_;
-	std::shared_ptr<VertexArrayObject> vaoFaceNormals_;
+	/* The debug lines of all four sets, built on first use; see
+	   buildDebugLines. The program is the one given to Build. */
+	std::shared_ptr<VertexArrayObject> debugLines_;
+	std::shared_ptr<ShaderProgram> debugProgram_;
 
 	Math::Vector3 minimum_;
 	Math::Vector3 maximum_;
 	TextureProjectorFunction textureMappingType_;
+	VertexFormat vertexFormat_;
+	Math::Vector4 packedPositionTransform_;
+
+	// triangles of the coarser levels of detail, following triangles_ in the
+	// IBO; see LevelOfDetail
+	std::vector<Triangle> lodTriangles_;
+	std::vector<LevelOfDetail> levels_;
+
+	std::vector<Meshlet> meshlets_;
+	std::vector<MeshletCuller> meshletCullers_; // one per level of detail
+	// the ranges drawing each whole level, one per run of meshlets sharing a
+	// base vertex
+	std::vector<std::vector<IndexRange>> levelRanges_;
+	bool meshletLocalIndices_;
+	s32 extraVertexBytes_; // size added to the VBO by the windows' copies
+	MeshletCullStats cullStats_;
+	std::vector<IndexRange> visibleRanges_;
+
+	std::shared_ptr<Bvh> bvh_; // built by GetBvh
   };
 }
 
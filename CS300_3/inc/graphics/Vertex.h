@@ -1,7 +1,9 @@
 #ifndef H_VERTEX
 #define H_VERTEX
 
+#include "framework/Utilities.h"
 #include "math/Vector3.h"
+#include "math/Vector4.h"
 
 // WARNING: AS YOU CHANGE ANYTHING IN THIS FILE, BE AWARE THAT ONE CHANGE IN
 // Vertex WILL REQUIRE CHANGES IN AttributeElementSizes AND
@@ -18,7 +20,8 @@ namespace Graphics
     sizeof(Math::Vector3), // vNormal
 	sizeof(Math::Vector3), // vTangent
 	sizeof(Math::Vector3), // vBitangent
-	sizeof(Math::Vector2) // vUV
+	sizeof(Math::Vector2), // vUV
+    sizeof(f32) // vOcclusion
   };
 
   // This needs to have the same number of elements as the AttributeElementSizes
@@ -28,7 +31,7 @@ namespace Graphics
   // first element of this array. If the second attribute of the Vertex is a
   // UV coordinate and defined in GLSL as 'vec2 vTexCoord', then we would put a
   // 2 for the second value of this array, and so on.
-  static int AttributeElementCounts[] = { 3, 3, 3, 3, 2 };
+  static int AttributeElementCounts[] = { 3, 3, 3, 3, 2, 1 };
 
   // The number of attributes stored within the Vertex. This is computed by the
   // compiler and does not need to be changed manually. It should always be
@@ -37,6 +40,12 @@ namespace Graphics
   static size_t const AttributeCount = sizeof(AttributeElementCounts)
     / sizeof(*AttributeElementCounts);
 
+  // Instanced draws read a model matrix per instance from the locations
+  // following the vertex attributes, one for each of its four columns (see
+  // InstanceBatcher.h): layout(location = 6) in mat4 vInstanceModel;
+  static size_t const InstanceAttribute = AttributeCount;
+  static size_t const InstanceAttributeCount = 4;
+
   // This is the critical data structure of the framework. It is used directly
   // by both TriangleMesh and VertexBufferObject. You will be changing this
   // structure often. It needs to represent exactly the same structure as the
@@ -52,12 +61,89 @@ namespace Graphics
 	Math::Vector3 tangent; /* layout(location = 2) in vec3 vTangent; */
 	Math::Vector3 bitangent; /* layout(location = 3) in vec3 vBitangent; */
 	Math::Vector2 uv; /* layout(location = 4) in vec3 vUV; */
+    // fraction of the hemisphere around the normal left open, baked by
+    // TriangleMesh::BakeAmbientOcclusion; 1 (unoccluded) until then
+    f32 occlusion; /* layout(location = 5) in float vOcclusion; */
 
 
-    Vertex() : vertex(0.f), normal(0.f) { }
+    Vertex() : vertex(0.f), normal(0.f), occlusion(1.f) { }
     explicit Vertex(Math::Vector3 const &_vertex)
-      : vertex(_vertex), normal(0.f), tangent(0.f), bitangent(0.f), uv(0.f) { }
+      : vertex(_vertex), normal(0.f), tangent(0.f), bitangent(0.f), uv(0.f),
+        occlusion(1.f) { }
+  };
+
+  // Layouts a VBO can store its vertices in. Full stores Vertex as is. Packed
+  // stores PackedVertex, two fifths of the size, for meshes whose shaders
+  // decode it (see PackedVertex).
+  enum class VertexFormat
+  {
+    Full,
+    Packed,
+    Count
+  };
+
+  // A compressed Vertex of 24 bytes instead of 60. The vertex shaders decode
+  // it when the PackedVertex uniform is set:
+  //  - the position is quantized to 16 bits per axis within the bounds of the
+  //    mesh; the PackedPositionTransform uniform (xyz offset, w scale) maps
+  //    the normalized [0, 1] values back. The scale is the same on every axis
+  //    so that transforming normals is unaffected.
+  //  - the normal and tangent are unit vectors in octahedral encoding, two
+  //    normalized 16-bit components each. Tangents lose their length, which
+  //    the shaders normalize away anyway.
+  //  - the bitangent is rebuilt as cross(normal, tangent), times the sign
+  //    stored here.
+  //  - texture coordinates are half floats.
+  //  - ambient occlusion is a normalized 16-bit value.
+  // The padding keeps the stride, and so every attribute of every vertex,
+  // 4-byte aligned, which many drivers need to stay on their fast path.
+  struct PackedVertex
+  {
+    u16 position[3]; /* location 0 (vVertex), normalized */
+    s16 bitangentSign; /* location 3 (vBitangent.x), normalized to +-1 */
+    s16 normal[2]; /* location 1 (vNormal.xy), normalized */
+    s16 tangent[2]; /* location 2 (vTangent.xy), normalized */
+    u16 uv[2]; /* location 4 (vUV), half floats */
+    u16 occlusion; /* location 5 (vOcclusion), normalized */
+    u16 padding;
+  };
+
+  static_assert(sizeof(PackedVertex) % 4 == 0,
+    "PackedVertex must keep a 4-byte aligned stride.");
+
+  // How glVertexAttribPointer reads each attribute of PackedVertex, in
+  // attribute location order. Must be kept in sync with PackedVertex, like
+  // AttributeElementSizes and AttributeElementCounts are with Vertex.
+  struct PackedAttribute
+  {
+    int elementCount;
+    unsigned int glType;
+    bool normalized;
+    size_t offset;
+  };
+
+  static PackedAttribute const PackedAttributes[] = {
+    { 3, GL_UNSIGNED_SHORT, true, offsetof(PackedVertex, position) },
+    { 2, GL_SHORT, true, offsetof(PackedVertex, normal) },
+    { 2, GL_SHORT, true, offsetof(PackedVertex, tangent) },
+    { 1, GL_SHORT, true, offsetof(PackedVertex, bitangentSign) },
+    { 2, GL_HALF_FLOAT, false, offsetof(PackedVertex, uv) },
+    { 1, GL_UNSIGNED_SHORT, true, offsetof(PackedVertex, occlusion) }
   };
+
+  static_assert(sizeof(PackedAttributes) / sizeof(*PackedAttributes)
+    == sizeof(AttributeElementCounts) / sizeof(*AttributeElementCounts),
+    "PackedVertex must have the same attributes as Vertex.");
+
+  // Size in bytes of one vertex stored in the given format.
+  size_t GetVertexSize(VertexFormat format);
+
+  // Packs vertices into PackedVertex, quantizing positions within the bounds
+  // of the given vertices (in parallel, on the ThreadPool). Returns the
+  // transform undoing the quantization: xyz offset and w scale, as expected
+  // by the PackedPositionTransform uniform.
+  Math::Vector4 PackVertices(Vertex const *vertices, size_t count,
+    PackedVertex *packed);
 }
 
 #endif
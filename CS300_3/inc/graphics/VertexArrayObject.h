@@ -9,6 +9,17 @@ namespace Graphics
 {
   class ShaderProgram;
 
+  // A contiguous run of indices within an IBO, drawn by
+  // VertexArrayObject::RenderRanges, with baseVertex added to every index.
+  struct IndexRange
+  {
+    u32 firstIndex, indexCount;
+    u32 baseVertex;
+
+    IndexRange(u32 first, u32 count, u32 base = 0)
+      : firstIndex(first), indexCount(count), baseVertex(base) {}
+  };
+
   // A Vertex Array Object (VAO) is an OpenGL 3 construct which helps simplify
   // the drawing process with VBOs and IBOs. This is a gross understatement for
   // the capabilities of a VAO, but this framework keeps its usage of them
@@ -28,9 +39,11 @@ namespace Graphics
   public:
 
     // Constructs a new VAO (and respective VBO and IBO) given a vertex count,
-    // primitive count, and topology (defaulted to triangles).
+    // primitive count, topology (defaulted to triangles) and vertex format
+    // (defaulted to full vertices).
     VertexArrayObject(size_t vertexCount, size_t primitiveCount,
-      Topology topology = Topology::TRIANGLES);
+      Topology topology = Topology::TRIANGLES,
+      VertexFormat format = VertexFormat::Full);
 
     // Destroys this VAO (and the underlying VBO and IBO) and cleans up any
     // resources associated with it (both on CPU and GPU).
@@ -38,6 +51,7 @@ namespace Graphics
 
     // Retrieves the IBO used by this VAO.
     inline IndexBufferObject &GetIndexBufferObject() { return ibo_; }
+    inline IndexBufferObject const &GetIndexBufferObject() const { return ibo_; }
 
     // Retrieves the VBO used by this VAO.
     inline VertexBufferObject &GetVertexBufferObject() { return vbo_; }
@@ -71,6 +85,23 @@ namespace Graphics
     // to work correctly.
     void Render();
 
+    // Renders only the given ranges of the IBO, all with a single
+    // glMultiDrawElements (glMultiDrawElementsBaseVertex if any range has a
+    // base vertex). The VAO must be bound.
+    void RenderRanges(IndexRange const *ranges, size_t rangeCount);
+
+    // Points the per instance attributes (see InstanceAttribute in Vertex.h)
+    // at column major 4x4 matrices in the given buffer, starting at offset
+    // bytes, advancing once per instance. A buffer of 0 disables them again.
+    // The VAO must be bound.
+    void SetInstanceBuffer(unsigned int buffer, size_t offset);
+
+    // Renders the given ranges of the IBO instanceCount times, with one
+    // glDrawElementsInstanced (or glDrawElementsInstancedBaseVertex) per
+    // range. The VAO must be bound.
+    void RenderRangesInstanced(IndexRange const *ranges, size_t rangeCount,
+      u32 instanceCount);
+
     // Unbinds the VAO, disallowing it to be used for any future OpenGL calls
     // until it is bound again.
     void Unbind();
@@ -80,6 +111,12 @@ namespace Graphics
 
     IndexBufferObject ibo_;
     VertexBufferObject vbo_;
+
+    // argument arrays of glMultiDrawElements, kept to avoid reallocating them
+    // every frame
+    std::vector<GLsizei> rangeCounts_;
+    std::vector<GLvoid const *> rangeOffsets_;
+    std::vector<GLint> rangeBaseVertices_;
   };
 }
 
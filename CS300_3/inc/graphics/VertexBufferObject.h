@@ -18,6 +18,11 @@ namespace Graphics
   // vertices that are stored directly on the GPU. The memory layout is
   // basically identical to what the vertex array looks like inside
   // TriangleMesh.
+  //
+  // Vertices added with AddVertex or AddVertices are staged in a CPU-side
+  // buffer, allocated on the first one; AttachVertices instead has Build read
+  // them straight from the caller's array. Once built, the GPU holds the only
+  // copy: the staging buffer is freed and nothing more may be added.
   class VertexBufferObject : public IBuffer
   {
   public:
@@ -28,7 +33,9 @@ namespace Graphics
     // currently contains a position and normal, where both are vec3s, and a
     // VBO is constructed with capacity for 8 vertices, then this buffer will
     // have capacity for (sizeof(Vertex) = 24 bytes * 8) = 192 bytes of data.
-    VertexBufferObject(size_t vertexCount);
+    // A VBO in the Packed format stores PackedVertex instead.
+    VertexBufferObject(size_t vertexCount,
+      VertexFormat format = VertexFormat::Full);
 
     // Destroys this VBO and cleans up any CPU-side memory associated with it,
     // such as the underlying data buffer.
@@ -37,11 +44,33 @@ namespace Graphics
     // Retrieves the number of vertices storable within this VBO.
     inline size_t GetVertexCount() const { return vertexCount_; }
 
+    // Retrieves the layout the vertices of this VBO are stored in.
+    inline VertexFormat GetFormat() const { return format_; }
+
     // Adds a vertex to this VBO, if there is capacity for it. This copies the
     // data of the vertex directly into the VBO. It returns true if there was
     // room for the vertex, or false if the VBO has been filled up.
     bool AddVertex(Vertex const &vertex);
 
+    // Adds a contiguous array of vertices to this VBO with a single copy, if
+    // there is capacity for all of them. This is how whole meshes are filled
+    // (e.g. straight from a memory-mapped mesh cache). It returns false, and
+    // adds nothing, if the vertices do not fit.
+    bool AddVertices(Vertex const *vertices, size_t count);
+
+    // Same as above, for a VBO in the Packed format.
+    bool AddVertices(PackedVertex const *vertices, size_t count);
+
+    // Like AddVertices, but without copying: the vertices are uploaded from
+    // the given array by Build, which must therefore be called while the
+    // array is still alive and unchanged. A VBO filled entirely this way is
+    // uploaded with a single glBufferData and never allocates a staging
+    // buffer.
+    bool AttachVertices(Vertex const *vertices, size_t count);
+
+    // Same as above, for a VBO in the Packed format.
+    bool AttachVertices(PackedVertex const *vertices, size_t count);
+
     virtual size_t GetBufferSize() const override;
     virtual void Build() override;
     virtual void Bind() const override;
@@ -53,8 +82,14 @@ namespace Graphics
     VertexBufferObject(VertexBufferObject const &) = delete;
     VertexBufferObject &operator=(VertexBufferObject const &) = delete;
 
+    // The staging buffer, allocated on first use.
+    char *getStaging();
+    bool attach(void const *vertices, size_t count);
+
+    VertexFormat format_;
     size_t vertexCount_, insertOffset_, bufferSize_;
-    char *buffer_;
+    char *buffer_; /* staging buffer; null until used and once built */
+    std::vector<BufferSource> sources_; /* attached vertices */
     unsigned int glHandle_; /* OpenGL handle to the VBO instance. */
   };
 }
@@ -3,13 +3,27 @@
 #include "RenderObject.h"
 #include "framework/Application.h"
 #include "framework/Debug.h"
+#include "framework/FileSystem.h"
+#include "framework/HotReloader.h"
 #include "graphics/TextureManager.h"
 #include "graphics/Texture.h"
+#include "graphics/FrameCapture.h"
+#include "graphics/FrameHistory.h"
+#include "graphics/FrustumCuller.h"
+#include "graphics/ImageWriter.h"
+#include "graphics/InstanceBatcher.h"
+#include "graphics/AmbientOcclusionBaker.h"
+#include "graphics/Bvh.h"
 #include "graphics/ShaderManager.h"
 #include "graphics/ShaderProgram.h"
 #include "graphics/VertexArrayObject.h"
 #include "graphics/TriangleMesh.h"
 #include "graphics/MeshLoader.h"
+#include "graphics/MeshOptimizer.h"
+#include "graphics/ObjParser.h"
+#include "graphics/SceneIndex.h"
+#include "graphics/MipmapGenerator.h"
+#include "graphics/SoftwareRasterizer.h"
 #include "graphics/Light.h"
 #include "graphics/Color.h"
 #include "math/Math.h"
@@ -21,12 +35,72 @@ std::vector<int> RecordDirction;
 static void Initialize(Application *application, void *udata);
 static void Update(Application *application, void *udata);
 static void Cleanup(Application *application, void *udata);
+static int renderHeadless(std::string const &model, std::string const &output,
+	int width, int height);
 
 int main(int argc, char *argv[])
 {
 	static int const WindowWidth = 800;
 	static int const WindowHeight = 600;
 
+	// running with --benchmark-mipmaps only times the CPU mipmap generator
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--benchmark-mipmaps") == 0)
+		{
+			Graphics::MipmapGenerator::Benchmark(2048, 2048, 10);
+			return 0;
+		}
+		// --benchmark-obj <file> times parsing an OBJ file from assets/models
+		if (std::strcmp(argv[i], "--benchmark-obj") == 0 && i + 1 < argc)
+		{
+			Graphics::ObjParser::Benchmark(
+				std::string(ASSET_PATH "models/") + argv[i + 1], 10);
+			return 0;
+		}
+		// --benchmark-optimizer <file> times reordering a model from
+		// assets/models for the vertex cache, and reports the gain
+		if (std::strcmp(argv[i], "--benchmark-optimizer") == 0 && i + 1 < argc)
+		{
+			Graphics::MeshOptimizer::Benchmark(argv[i + 1]);
+			return 0;
+		}
+		// --benchmark-bvh <file> times building a BVH over a model from
+		// assets/models and tracing rays through it
+		if (std::strcmp(argv[i], "--benchmark-bvh") == 0 && i + 1 < argc)
+		{
+			Graphics::Bvh::Benchmark(argv[i + 1], 1 << 20);
+			return 0;
+		}
+		// --benchmark-ao <file> times baking ambient occlusion into the
+		// vertices of a model from assets/models
+		if (std::strcmp(argv[i], "--benchmark-ao") == 0 && i + 1 < argc)
+		{
+			Graphics::AmbientOcclusionBaker::Benchmark(argv[i + 1],
+				Graphics::AmbientOcclusionBaker::DefaultRayCount);
+			return 0;
+		}
+		// --benchmark-raster <file> times the software rasterizer drawing a
+		// model from assets/models
+		if (std::strcmp(argv[i], "--benchmark-raster") == 0 && i + 1 < argc)
+		{
+			Graphics::SoftwareRasterizer::Benchmark(argv[i + 1], 1280, 720, 20);
+			return 0;
+		}
+		// --benchmark-scene-index <count> times keeping a scene index over
+		// that many moving objects and querying it
+		if (std::strcmp(argv[i], "--benchmark-scene-index") == 0 && i + 1 < argc)
+		{
+			Graphics::SceneIndex::Benchmark((u32)std::max(std::atoi(argv[i + 1]), 0));
+			return 0;
+		}
+		// --render-headless <file> <image> draws a model from assets/models
+		// with the software rasterizer, without a window or OpenGL, and writes
+		// the frame to the image
+		if (std::strcmp(argv[i], "--render-headless") == 0 && i + 2 < argc)
+			return renderHeadless(argv[i + 1], argv[i + 2], WindowWidth, WindowHeight);
+	}
+
 	Application application("CS300 Assignment 3",
 		WindowWidth, WindowHeight);
 	application.Initialize(argc, argv);
@@ -83,6 +157,10 @@ enum class NormalMapDebugMode {
 static LightingScenario scenario = LightingScenario::SAME_COLOR;
 static std::unique_ptr<ShaderManager> shaderManager;
 static std::unique_ptr<TextureManager> textureManager;
+static std::unique_ptr<FrameCapture> frameCapture;
+static std::unique_ptr<FrameHistory> frameHistory;
+static std::unique_ptr<HotReloader> hotReloader;
+static std::unique_ptr<InstanceBatcher> instanceBatcher;
 
 static RenderObject renderObj;
 static RenderObject plane;
@@ -95,6 +173,15 @@ static Vector3 cameraUp;
 static Vector3 cameraMovement;
 static Vector3 RecordStartPos;
 static bool ScreenShot = false;
+static bool bRecordFrames = false;
+static int captureFormat = (int)ImageFormat::Png;
+static int captureJpegQuality = 90;
+static bool bKeepHistory = false; // opt in from the Frame History panel
+static bool bSaveHistory = false;
+static int historyStorage = (int)FrameStorage::Jpeg;
+static int historyDownscale = 2;
+static int historyDumpFormat = (int)FrameDumpFormat::ImageSequence;
+static float historySaveSeconds = 10.f;
 static bool bCameraRecord= false;
 static bool bPlayRecord = false;
 static float fov;
@@ -114,6 +201,46 @@ static bool bEnableDiffuseTexture;
 static bool bEnableSpecularTexture;
 static bool bEnableNormalMapping;
 static TextureProjectorFunction textureMappingType = TextureProjectorFunction::CYLINDRICAL;
+static VertexFormat modelVertexFormat = VertexFormat::Full;
+static bool bMeshletLocalIndices = true;
+static bool bMeshletCulling = true;
+static bool bMeshletConeCulling = false; // models are drawn double sided
+static bool bAutoLevelOfDetail = true;
+static bool bAmbientOcclusion = true;
+
+// skips whole objects outside the view; see cullScene
+static bool bFrustumCulling = true;
+// walk sceneIndex instead of the linear pass; slower while most objects are
+// in view (see SceneIndex::Benchmark), so only worth it for sparse views
+static bool bSceneIndexCulling = false;
+static FrustumCuller frustumCuller;
+// indices of the scene's objects in frustumCuller and sceneIndex, the copies
+// following
+enum CulledObject : u32 { CulledModel, CulledPlane, CulledFirstCopy };
+static std::vector<u8> objectInView; // by CulledObject, empty when not culled
+static u32 objectsInView = 0;
+static f64 cullMilliseconds = 0.0;
+
+// world bounds of the scene's objects and of the active lights, kept up to
+// date by updateSceneIndex
+static SceneIndex sceneIndex;
+static std::vector<u32> sceneProxies; // by CulledObject
+static SceneIndex lightIndex(0.f);
+static std::vector<u32> lightProxies; // by light
+static u32 objectUnderCursor = SceneIndex::InvalidProxy;
+static u32 lightNearestModel = SceneIndex::InvalidProxy;
+static f32 lightNearestDistance = 0.f;
+static u32 sceneIndexMoves = 0; // objects reinserted by the last update
+
+static float lodPixelError = 1.f;
+static int modelLevelOfDetail = 0;
+// copies of the model drawn around it with instancing; see InstanceBatcher.h
+static int instanceCopyCount = 0;
+static std::vector<u32> instanceCopyNodes; // children of the model's transform
+static int instanceCopyLayout = 0; // instanceCopyCount the grid was laid out for
+
+// local and world transforms of every object; see updateSceneTransforms
+static TransformHierarchy sceneTransforms;
 static bool rotateLights = true;
 
 static std::string modelFile = "cube.obj";
@@ -244,11 +371,30 @@ static TriangleMesh *createTriangle()
 
 static void loadRenderObjMesh()
 {
+	// reload the model whenever its file changes; parsing and preprocessing
+	// happen on the reload thread, only uploading happens between frames
+	std::string const file = modelFile;
+	TextureProjectorFunction const mapping = textureMappingType;
+	hotReloader->Watch("model", { "models/" + file },
+		[file, mapping]() -> HotReloader::CommitFunction {
+		std::shared_ptr<TriangleMesh> model = MeshLoader::LoadMesh(file, mapping);
+		if (!model)
+			return nullptr;
+		return [model]() {
+			model->SetVertexFormat(modelVertexFormat);
+			model->SetMeshletLocalIndices(bMeshletLocalIndices);
+			model->Build(shaderManager->GetShader(shaderType));
+			renderObj.mesh = model;
+		};
+	});
+
 	if (std::shared_ptr<TriangleMesh> model = MeshLoader::LoadMesh(modelFile, textureMappingType))
 	{
 		renderObj.mesh = model;
 		std::shared_ptr<ShaderProgram> const &program =
 			shaderManager->GetShader(shaderType);
+		renderObj.mesh->SetVertexFormat(modelVertexFormat);
+		renderObj.mesh->SetMeshletLocalIndices(bMeshletLocalIndices);
 		renderObj.mesh->Build(program);
 
 		plane.mesh = std::shared_ptr<TriangleMesh>(createXZPlane());
@@ -259,22 +405,39 @@ static void loadRenderObjMesh()
 	}
 }
 
+// Vertex and fragment shader source files of every ShaderType, in order.
+static char const *const ShaderSourceFiles[(int)ShaderType::COUNT][2] = {
+	{ "phonglight.vert", "phonglight.frag" },
+	{ "phongshade.vert", "phongshade.frag" },
+	{ "blinnshade.vert", "blinnshade.frag" },
+	{ "debug.vert", "debug.frag" },
+	{ "blinnshade_normalmap.vert", "blinnshade_normalmap.frag" },
+	{ "phongshade_normalmap.vert", "phongshade_normalmap.frag" },
+	{ "phonglight_normalmap.vert", "phonglight_normalmap.frag" },
+};
+
 static void loadShaders()
 {
-	shaderManager->RegisterShader(ShaderType::PHONG_LIGHT,
-		"phonglight.vert", "phonglight.frag")->Build();
-	shaderManager->RegisterShader(ShaderType::PHONG_SHADE,
-		"phongshade.vert", "phongshade.frag")->Build();
-	shaderManager->RegisterShader(ShaderType::BLINN_SHADE,
-		"blinnshade.vert", "blinnshade.frag")->Build();
-	shaderManager->RegisterShader(ShaderType::DEBUG,
-		"debug.vert", "debug.frag")->Build();
-	shaderManager->RegisterShader(ShaderType::BLINN_NORMAL,
-		"blinnshade_normalmap.vert", "blinnshade_normalmap.frag")->Build();
-	shaderManager->RegisterShader(ShaderType::PHONG_NORMAL,
-		"phongshade_normalmap.vert", "phongshade_normalmap.frag")->Build();
-	shaderManager->RegisterShader(ShaderType::PHONGLIGHT_NORMAL,
-		"phonglight_normalmap.vert", "phonglight_normalmap.frag")->Build();
+	for (int i = 0; i < (int)ShaderType::COUNT; ++i)
+	{
+		ShaderType const type = ShaderType(i);
+		std::string const vertexFile = ShaderSourceFiles[i][0];
+		std::string const fragmentFile = ShaderSourceFiles[i][1];
+		shaderManager->RegisterShader(type, vertexFile, fragmentFile)->Build();
+
+		// rebuild just this program when either of its sources changes, and
+		// keep the current one if the new sources do not compile
+		hotReloader->Watch(vertexFile + " + " + fragmentFile,
+			{ "shaders/" + vertexFile, "shaders/" + fragmentFile },
+			[type, vertexFile, fragmentFile]() -> HotReloader::CommitFunction {
+			std::shared_ptr<ShaderProgram> program =
+				ShaderProgram::LoadShaderProgram(vertexFile, fragmentFile);
+			return [type, program]() {
+				if (program->Build())
+					shaderManager->SetShader(type, program);
+			};
+		});
+	}
 }
 
 static void UpdateLighting(float time)
@@ -418,11 +581,98 @@ static void enableSampleLights(Application* application, std::shared_ptr<ShaderP
 		EnableLight(application, program.get(), i);
 }
 
+// The same lighting as enableSampleLights and the material uniforms of
+// RenderMesh, for drawing with the SoftwareRasterizer.
+static RasterShading getRasterShading(Matrix4 const &modelview, Matrix4 const &mvp)
+{
+	RasterShading shading;
+	shading.model = (shaderType == ShaderType::PHONG_SHADE || shaderType == ShaderType::PHONG_NORMAL)
+		? RasterShadingModel::Phong : RasterShadingModel::Blinn;
+	shading.modelView = modelview;
+	shading.modelViewProjection = mvp;
+	shading.materialAmbient = Material.ambient;
+	shading.materialDiffuse = Material.diffuse;
+	shading.materialEmissive = Material.emissive;
+	shading.materialSpecular = Material.specular;
+	shading.materialShininess = Material.shininess;
+	shading.globalAmbient = globalAmbient;
+	shading.attenuation = lightAttenuationCoef;
+	shading.fogNear = Fog.Near;
+	shading.fogFar = Fog.Far;
+	shading.fogColor = Fog.Color;
+	shading.useAmbientOcclusion = bAmbientOcclusion;
+	shading.lightCount = (u32)std::min(activeLightCount, (int)RasterShading::MaxLights);
+	for (u32 i = 0; i < shading.lightCount; ++i)
+	{
+		// as EnableLight transforms them
+		Matrix4 const lightModelview = Matrix4::LookAt(cameraEye, cameraTarget, cameraUp) *
+			Matrix4::Translate(lights[i].position.x, lights[i].position.y, lights[i].position.z);
+		RasterLight &light = shading.lights[i];
+		light.type = lights[i].type;
+		light.position = Transform(lightModelview, lights[i].position);
+		light.direction = Transform(lightModelview, lights[i].direction);
+		light.ambient = lights[i].ambient;
+		light.diffuse = lights[i].diffuse;
+		light.specular = lights[i].specular;
+		light.spotlightInnerCos = Math::Cos(lights[i].spotlightInnerAngleRad);
+		light.spotlightOuterCos = Math::Cos(lights[i].spotlightOuterAngleRad);
+		light.spotlightFalloff = lights[i].spotlightFalloff;
+	}
+	return shading;
+}
+
+// Reloads a texture when its file changes: decoding and mipmapping happen on
+// the reload thread, the upload and swap between frames.
+static void watchTexture(TextureType type, std::string const &file,
+	std::function<std::shared_ptr<Texture>()> const &load)
+{
+	std::stringstream name;
+	name << file << " (texture " << (int)type << ")";
+	hotReloader->Watch(name.str(), { "textures/" + file },
+		[type, load]() -> HotReloader::CommitFunction {
+		std::shared_ptr<Texture> texture = load();
+		if (!texture)
+			return nullptr;
+		return [type, texture]() {
+			texture->Build();
+			textureManager->SetTexture(type, texture);
+		};
+	});
+}
+
 void loadTextures()
 {
 	textureManager->RegisterTexture(TextureType::DIFFUSE, textureFileDiffuse)->Build();
 	textureManager->RegisterTexture(TextureType::SPECULAR, textureFileSpecular)->Build();
 	textureManager->RegisterNormalMapTexture(TextureType::NORMAL, textureFileSpecular)->Build();
+
+	std::string const diffuse = textureFileDiffuse;
+	std::string const specular = textureFileSpecular;
+	watchTexture(TextureType::DIFFUSE, diffuse,
+		[diffuse]() { return Texture::LoadTGA(diffuse); });
+	watchTexture(TextureType::SPECULAR, specular,
+		[specular]() { return Texture::LoadTGA(specular); });
+	watchTexture(TextureType::NORMAL, specular, [specular]() {
+		// same derivation as TextureManager::RegisterNormalMapTexture
+		return Texture::LoadNormalMapFromHeightMapTGA(specular,
+			DiscreteDifferentialMethod::Central, TextureWrapType::ClampToZero,
+			TextureWrapType::ClampToZero);
+	});
+}
+
+// Default light settings (everything but the mesh drawn for the light).
+static void resetLight(Light &light)
+{
+	light.type = LightType::Point;
+	light.direction = Vector4(0, 0, 1, 0);
+	light.ambient = Color::Black;
+	light.diffuse = Color(0.8f, 0.8f, 0.8f, 1);
+	light.specular = Color::White;
+	light.spotlightInnerAngleRad = Math::DegToRad(15);
+	light.spotlightOuterAngleRad = Math::DegToRad(30);
+	light.spotlightFalloff = 1;
+	light.position = Vector4(0, 0, 1, 1);
+	light.radius = 0.25f;
 }
 
 void loadLights()
@@ -431,18 +681,9 @@ void loadLights()
 		shaderManager->GetShader(ShaderType::DEBUG);
 	for (int i = 0; i < maxLightCount; ++i)
 	{
-		lights[i].type = LightType::Point;
-		lights[i].direction = Vector4(0, 0, 1, 0);
-		lights[i].ambient = Color::Black;
-		lights[i].diffuse = Color(0.8f, 0.8f, 0.8f, 1);
-		lights[i].specular = Color::White;
-		lights[i].spotlightInnerAngleRad = Math::DegToRad(15);
-		lights[i].spotlightOuterAngleRad = Math::DegToRad(30);
-		lights[i].spotlightFalloff = 1;
-		lights[i].position = Vector4(0, 0, 1, 1);
+		resetLight(lights[i]);
 		lights[i].mesh = std::shared_ptr<TriangleMesh>(createSphere());
 		lights[i].mesh->Build(program);
-		lights[i].radius = 0.25f;
 	}
 }
 
@@ -460,42 +701,58 @@ enum flag
 	HalfTone = 256,
 	WaterColor = 512,
 };
+
+// Queues the rendered scene (without the UI) to be written to a numbered
+// capture file; the readback and encoding happen in the background.
 void TakeScreenShot(Application *application)
 {
-	BITMAPFILEHEADER bf;
-	BITMAPINFOHEADER bi;
+	static u32 screenShotIndex = 0;
+	ImageFormat const format = ImageFormat(captureFormat);
+
+	char path[64];
+	sprintf(path, "capture%04u.%s", screenShotIndex++,
+		ImageWriter::GetExtension(format));
+	frameCapture->Capture(application->GetWindowWidth(),
+		application->GetWindowHeight(), path, format);
+}
 
-	unsigned char *image = (unsigned char*)malloc(sizeof(unsigned char)*application->GetWindowWidth()*application->GetWindowHeight() * 3);
-	FILE *file = fopen("capture.bmp", "wb");
+// Captures every frame into the recording directory while recording is on.
+void RecordFrame(Application *application)
+{
+	static u32 frameIndex = 0;
+	ImageFormat const format = ImageFormat(captureFormat);
+	if (frameIndex == 0)
+		FileSystem::MakeDirectory("recording");
+
+	char path[64];
+	sprintf(path, "recording/frame%06u.%s", frameIndex++,
+		ImageWriter::GetExtension(format));
+	frameCapture->Capture(application->GetWindowWidth(),
+		application->GetWindowHeight(), path, format);
+}
 
-	if (image != NULL)
-	{
-		if (file != NULL)
-		{
-			glReadPixels(0, 0, application->GetWindowWidth(), application->GetWindowHeight(), GL_BGR_EXT, GL_UNSIGNED_BYTE, image);
-
-			memset(&bf, 0, sizeof(bf));
-			memset(&bi, 0, sizeof(bi));
-
-			bf.bfType = 'MB';
-			bf.bfSize = sizeof(bf) + sizeof(bi) + application->GetWindowWidth()*application->GetWindowHeight() * 3;
-			bf.bfOffBits = sizeof(bf) + sizeof(bi);
-			bi.biSize = sizeof(bi);
-			bi.biWidth = application->GetWindowWidth();
-			bi.biHeight = application->GetWindowHeight();
-			bi.biPlanes = 1;
-			bi.biBitCount = 24;
-			bi.biSizeImage = application->GetWindowWidth()*application->GetWindowHeight() * 3;
-
-			fwrite(&bf, sizeof(bf), 1, file);
-			fwrite(&bi, sizeof(bi), 1, file);
-			fwrite(image, sizeof(unsigned char), application->GetWindowHeight()*application->GetWindowWidth() * 3, file);
-
-			fclose(file);
-		}
-		free(image);
-	}
+// Queues the last few seconds of frame history to be written to a numbered
+// directory; the frames are written by the history thread.
+void SaveFrameHistory()
+{
+	static u32 historyIndex = 0;
+	char directory[32];
+	sprintf(directory, "history%03u", historyIndex++);
+	frameHistory->Save(historySaveSeconds, directory,
+		FrameDumpFormat(historyDumpFormat));
 }
+
+// Replaces the frame history with an empty one using the settings chosen in
+// the UI.
+void ResetFrameHistory()
+{
+	FrameHistorySettings settings;
+	settings.storage = FrameStorage(historyStorage);
+	settings.downscale = u32(historyDownscale);
+	frameHistory = nullptr; // finish pending saves before starting over
+	frameHistory = std::unique_ptr<FrameHistory>(new FrameHistory(settings));
+}
+
 void PlayCameraRecord(f32 time)
 {
 	static float RecordTimer = 0;
@@ -642,6 +899,10 @@ void getKeyInput(unsigned char key, int xmouse, int ymouse)
 	{// take screenshot
 		ScreenShot = true;
 	}
+	if (key == 'o')
+	{// save the last seconds of frame history
+		bSaveHistory = true;
+	}
 	if (key == '1')
 	{// record Camera movement
 		timer = 0;
@@ -661,16 +922,165 @@ void getKeyInput(unsigned char key, int xmouse, int ymouse)
 }
 
 
-void Initialize(Application *application, void *udata)
+// Copies the placement of the scene's objects into their transforms, which
+// only marks the ones that moved, and brings the world matrices up to date.
+// The instanced copies sit on a square grid around the model as children of
+// its transform, so they follow it as it moves and turns.
+static void updateSceneTransforms()
 {
-	// create the class used to manage shader programs
-	shaderManager = std::unique_ptr<ShaderManager>(new ShaderManager);
-	textureManager = std::unique_ptr<TextureManager>(new TextureManager);
-	glClearColor(0.5f, 0.5f, 0.5f, 1.f); // set background color to medium gray
-	glEnable(GL_DEPTH_TEST); // enable the depth buffer and depth testing
-	
-	glutKeyboardFunc(getKeyInput);
+	if (renderObj.transform == TransformHierarchy::InvalidNode)
+		renderObj.transform = sceneTransforms.Create();
+	if (plane.transform == TransformHierarchy::InvalidNode)
+		plane.transform = sceneTransforms.Create();
+	sceneTransforms.SetLocal(renderObj.transform, renderObj.pos,
+		renderObj.eulerRotate, renderObj.scale);
+	sceneTransforms.SetLocal(plane.transform, plane.pos, plane.eulerRotate,
+		plane.scale);
+
+	if (instanceCopyLayout != instanceCopyCount)
+	{
+		while ((int)instanceCopyNodes.size() > instanceCopyCount)
+		{
+			sceneTransforms.Destroy(instanceCopyNodes.back());
+			instanceCopyNodes.pop_back();
+		}
+		while ((int)instanceCopyNodes.size() < instanceCopyCount)
+			instanceCopyNodes.push_back(sceneTransforms.Create(renderObj.transform));
+		int const side = (int)std::ceil(std::sqrt((float)instanceCopyCount + 1.f));
+		for (int i = 0, copy = 0; copy < instanceCopyCount; ++i)
+		{
+			int const x = i % side - side / 2;
+			int const z = i / side - side / 2;
+			if (x == 0 && z == 0)
+				continue; // the model itself
+			sceneTransforms.SetLocal(instanceCopyNodes[copy++],
+				Vector3(x * 1.5f, 0.f, z * 1.5f), Vector3(0.f, (float)i * 0.37f, 0.f),
+				Vector3(1.f, 1.f, 1.f));
+		}
+		instanceCopyLayout = instanceCopyCount;
+	}
+
+	sceneTransforms.Update();
+}
+
+// The world space box around a mesh's bounds carried through a model matrix.
+static void worldBounds(TriangleMesh const &mesh, Matrix4 const &model,
+	Vector3 &minimum, Vector3 &maximum)
+{
+	TransformBox(mesh.GetBoundMin(), mesh.GetBoundMax(), model, minimum,
+		maximum);
+}
+
+// Brings sceneIndex in line with the model, the plane and the instanced
+// copies, and lightIndex with the active lights. Objects that did not move
+// (or moved within the margin of their box) cost one containment test.
+static void updateSceneIndex()
+{
+	u32 const objectCount = renderObj.mesh && plane.mesh
+		? CulledFirstCopy + u32(instanceCopyNodes.size()) : 0;
+	while (sceneProxies.size() > objectCount)
+	{
+		sceneIndex.Remove(sceneProxies.back());
+		sceneProxies.pop_back();
+	}
+	sceneIndexMoves = 0;
+	for (u32 object = 0; object < objectCount; ++object)
+	{
+		TriangleMesh const &mesh = object == CulledPlane ? *plane.mesh
+			: *renderObj.mesh;
+		u32 const node = object == CulledModel ? renderObj.transform
+			: object == CulledPlane ? plane.transform
+			: instanceCopyNodes[object - CulledFirstCopy];
+		Vector3 minimum, maximum;
+		worldBounds(mesh, sceneTransforms.GetWorld(node), minimum, maximum);
+		if (object < sceneProxies.size())
+			sceneIndexMoves += sceneIndex.Move(sceneProxies[object], minimum,
+				maximum) ? 1 : 0;
+		else
+			sceneProxies.push_back(sceneIndex.Insert(minimum, maximum, object));
+	}
+
+	// lights are points, found exactly by nearest queries
+	while ((int)lightProxies.size() > activeLightCount)
+	{
+		lightIndex.Remove(lightProxies.back());
+		lightProxies.pop_back();
+	}
+	for (u32 i = 0; i < (u32)activeLightCount; ++i)
+	{
+		Vector3 const position(lights[i].position.x, lights[i].position.y,
+			lights[i].position.z);
+		if (i < lightProxies.size())
+			lightIndex.Move(lightProxies[i], position, position);
+		else
+			lightProxies.push_back(lightIndex.Insert(position, position, i));
+	}
+	lightNearestModel = lightIndex.Nearest(renderObj.pos, lightNearestDistance);
+}
+
+// Culls the model, the plane and the instanced copies against the view, by
+// the bounds of their meshes carried through their world transforms, either
+// walking sceneIndex or testing every object with frustumCuller.
+static void cullScene(Matrix4 const &viewProjection)
+{
+	auto const start = std::chrono::high_resolution_clock::now();
+	objectInView.clear();
+	if (!bFrustumCulling || sceneProxies.empty())
+		return;
+	objectInView.assign(sceneProxies.size(), 0);
+	if (bSceneIndexCulling)
+	{
+		std::vector<u32> visible;
+		sceneIndex.Cull(FrustumPlanes(viewProjection), visible);
+		for (u32 object : visible)
+			objectInView[object] = 1;
+		objectsInView = u32(visible.size());
+	}
+	else
+	{
+		TriangleMesh const &mesh = *renderObj.mesh;
+		frustumCuller.Clear();
+		frustumCuller.AddBox(mesh.GetBoundMin(), mesh.GetBoundMax(),
+			sceneTransforms.GetWorld(renderObj.transform));
+		frustumCuller.AddBox(plane.mesh->GetBoundMin(), plane.mesh->GetBoundMax(),
+			sceneTransforms.GetWorld(plane.transform));
+		for (u32 node : instanceCopyNodes)
+			frustumCuller.AddBox(mesh.GetBoundMin(), mesh.GetBoundMax(),
+				sceneTransforms.GetWorld(node));
+		objectsInView = frustumCuller.Cull(viewProjection).visibleObjects;
+		for (u32 object = 0; object < objectInView.size(); ++object)
+			objectInView[object] = frustumCuller.IsVisible(object) ? 1 : 0;
+	}
+	auto const stop = std::chrono::high_resolution_clock::now();
+	cullMilliseconds = std::chrono::duration<f64, std::milli>(stop - start).count();
+}
 
+// Whether the last cullScene found an object in view; everything is when
+// culling is off.
+static bool isInView(u32 object)
+{
+	return object >= objectInView.size() || objectInView[object] != 0;
+}
+
+// Finds the object whose bounds are under the mouse cursor, casting a ray
+// from the near plane through it.
+static void pickUnderCursor(Matrix4 const &viewProjection, float width,
+	float height)
+{
+	ImGuiIO const &io = ImGui::GetIO();
+	float const x = 2.f * io.MousePos.x / width - 1.f;
+	float const y = 1.f - 2.f * io.MousePos.y / height;
+	Matrix4 const inverse = viewProjection.Inverted();
+	Vector3 const nearPoint = TransformPointProjected(inverse, Vector3(x, y, -1.f));
+	Vector3 const farPoint = TransformPointProjected(inverse, Vector3(x, y, 1.f));
+	f32 t;
+	objectUnderCursor = sceneIndex.Pick(Ray(nearPoint, farPoint - nearPoint,
+		0.f, 1.f), t);
+}
+
+// Default camera, material, lighting and shading settings of the scene.
+static void resetScene()
+{
 	renderObj.pos = Vector3(0.f, 0.f, 0.f);
 	renderObj.eulerRotate = Vector3(0.f, 0.f, 0.f);
 	debugMode = NONE;
@@ -703,6 +1113,23 @@ void Initialize(Application *application, void *udata)
 	textureMappingType = TextureProjectorFunction::CYLINDRICAL;
 
 	activeLightCount = 1;
+}
+
+void Initialize(Application *application, void *udata)
+{
+	// create the class used to manage shader programs
+	shaderManager = std::unique_ptr<ShaderManager>(new ShaderManager);
+	textureManager = std::unique_ptr<TextureManager>(new TextureManager);
+	frameCapture = std::unique_ptr<FrameCapture>(new FrameCapture);
+	hotReloader = std::unique_ptr<HotReloader>(new HotReloader(ASSET_PATH));
+	instanceBatcher = std::unique_ptr<InstanceBatcher>(new InstanceBatcher);
+	ResetFrameHistory();
+	glClearColor(0.5f, 0.5f, 0.5f, 1.f); // set background color to medium gray
+	glEnable(GL_DEPTH_TEST); // enable the depth buffer and depth testing
+	
+	glutKeyboardFunc(getKeyInput);
+
+	resetScene();
 
 	loadShaders();
 	loadRenderObjMesh();
@@ -715,6 +1142,63 @@ void Initialize(Application *application, void *udata)
 	oldTime = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
 }
 
+// Draws the initial scene (the model and the plane below it) like RenderMesh
+// does, but with the SoftwareRasterizer, and writes it to an image in the
+// format given by its extension. Nothing here touches OpenGL.
+int renderHeadless(std::string const &model, std::string const &output,
+	int width, int height)
+{
+	resetScene();
+	renderObj.mesh = MeshLoader::LoadMesh(model, textureMappingType);
+	if (!renderObj.mesh)
+	{
+		std::cout << "Headless render: cannot load models/" << model << std::endl;
+		return 1;
+	}
+	plane.mesh = std::shared_ptr<TriangleMesh>(createXZPlane());
+	plane.scale = Vector3(10, 1, 10);
+	plane.pos = renderObj.pos;
+	plane.pos.y -= 5;
+	for (int i = 0; i < maxLightCount; ++i)
+		resetLight(lights[i]);
+	ResetLightingPosition();
+	ResetLightingScenario();
+
+	updateSceneTransforms();
+	Matrix4 const view = Matrix4::LookAt(cameraEye, cameraTarget, cameraUp);
+	Matrix4 const proj = Matrix4::PerspectiveProjection(fov, width, height, zNear, zFar);
+	Matrix4 const modelview = view * sceneTransforms.GetWorld(renderObj.transform);
+	Matrix4 const planeModelview = view * sceneTransforms.GetWorld(plane.transform);
+
+	SoftwareRasterizer rasterizer((u32)width, (u32)height);
+	rasterizer.Clear(Color(0.5f, 0.5f, 0.5f, 1.f));
+	RasterStats const stats = rasterizer.Draw(*renderObj.mesh,
+		getRasterShading(modelview, proj * modelview));
+	rasterizer.Draw(*plane.mesh, getRasterShading(planeModelview, proj * planeModelview));
+
+	ImageFormat format = ImageFormat::Png;
+	for (int i = 0; i < (int)ImageFormat::Count; ++i)
+	{
+		std::string const extension = std::string(".") + ImageWriter::GetExtension(ImageFormat(i));
+		if (output.size() >= extension.size() &&
+			output.compare(output.size() - extension.size(), extension.size(), extension) == 0)
+			format = ImageFormat(i);
+	}
+	if (!ImageWriter::Write(output, rasterizer.GetImage(), format))
+	{
+		std::cout << "Headless render: cannot write " << output << std::endl;
+		return 1;
+	}
+
+	char report[128];
+	sprintf(report, "%u of %u triangles, %llu pixels in %.2f ms",
+		stats.rasterizedTriangles, stats.triangleCount,
+		(unsigned long long)stats.shadedPixels, stats.milliseconds);
+	std::cout << "Headless render: models/" << model << " to " << output << ", "
+		<< report << std::endl;
+	return 0;
+}
+
 void RenderUI()
 {
 	ImGui::Begin("Debug Window");
@@ -737,6 +1221,7 @@ void RenderUI()
 		shaderManager->ClearShaders();
 		loadShaders();
 	}
+	ImGui::Text("Assets hot reloaded: %u", hotReloader->GetReloadCount());
 
 	std::vector<char const *> debugmodestrings = {
 		"None", "Vertex Normals", "Face Normals", "Both"
@@ -760,6 +1245,98 @@ void RenderUI()
 	ImGui::SliderAngle("Rotation Y", &renderObj.eulerRotate.y);
 	ImGui::SliderAngle("Rotation Z", &renderObj.eulerRotate.z);
 
+	// packed vertices are two fifths of the size; see PackedVertex in Vertex.h
+	bool packedVertices = modelVertexFormat == VertexFormat::Packed;
+	if (ImGui::Checkbox("Packed Vertices", &packedVertices))
+	{
+		modelVertexFormat = packedVertices ? VertexFormat::Packed : VertexFormat::Full;
+		if (renderObj.mesh)
+		{
+			renderObj.mesh->SetVertexFormat(modelVertexFormat);
+			renderObj.mesh->Build(shaderManager->GetShader(shaderType));
+		}
+	}
+
+	// 16-bit indices past 65536 vertices, relative to each meshlet's base
+	// vertex; see TriangleMesh::SetMeshletLocalIndices
+	if (ImGui::Checkbox("Meshlet-Local Indices", &bMeshletLocalIndices)
+		&& renderObj.mesh)
+	{
+		renderObj.mesh->SetMeshletLocalIndices(bMeshletLocalIndices);
+		renderObj.mesh->Build(shaderManager->GetShader(shaderType));
+	}
+	if (renderObj.mesh)
+		ImGui::Text("Indices: %u bits, %.1f KB saved over 32 bits",
+			renderObj.mesh->GetIndexSize() * 8,
+			renderObj.mesh->GetIndexBytesSaved() / 1024.f);
+
+	// darkens the ambient light in creases; baked by MeshLoader, see
+	// AmbientOcclusionBaker.h
+	ImGui::Checkbox("Ambient Occlusion", &bAmbientOcclusion);
+
+	// coarser levels are picked by how large their error appears on screen;
+	// see TriangleMesh::SelectLevelOfDetail
+	ImGui::Checkbox("Automatic Level Of Detail", &bAutoLevelOfDetail);
+	if (bAutoLevelOfDetail)
+		ImGui::SliderFloat("Max Pixel Error", &lodPixelError, 0.1f, 10.f);
+	else if (renderObj.mesh)
+		ImGui::SliderInt("Level Of Detail", &modelLevelOfDetail, 0,
+			(int)renderObj.mesh->GetLevelCount() - 1);
+	if (renderObj.mesh)
+		ImGui::Text("Level %d: %u triangles", modelLevelOfDetail,
+			renderObj.mesh->GetLevelTriangleCount(std::min((u32)modelLevelOfDetail,
+				renderObj.mesh->GetLevelCount() - 1)));
+
+	// many copies of the model in one draw call per level of detail; see
+	// InstanceBatcher.h
+	ImGui::SliderInt("Instanced Copies", &instanceCopyCount, 0, 20000);
+	TransformStats const &transformStats = sceneTransforms.GetStats();
+	ImGui::Text("Transforms: %u updated of %u in %.3f ms",
+		transformStats.updatedNodes, transformStats.nodeCount,
+		transformStats.milliseconds);
+	if (instanceCopyCount > 0)
+	{
+		InstanceStats const &instanceStats = instanceBatcher->GetStats();
+		ImGui::Text("%u instances in %u batches, %.1f KB uploaded",
+			instanceStats.instanceCount, instanceStats.batchCount,
+			instanceStats.uploadedBytes / 1024.f);
+	}
+
+	// skips objects outside the view; see FrustumCuller.h and SceneIndex.h
+	ImGui::Checkbox("Frustum Culling", &bFrustumCulling);
+	if (bFrustumCulling)
+	{
+		ImGui::Checkbox("Cull With Scene Index", &bSceneIndexCulling);
+		ImGui::Text("Objects: %u of %u in view in %.3f ms", objectsInView,
+			u32(objectInView.size()), cullMilliseconds);
+	}
+	ImGui::Text("Scene index: height %u, %u objects moved in the tree",
+		sceneIndex.GetHeight(), sceneIndexMoves);
+	if (objectUnderCursor == CulledModel)
+		ImGui::Text("Under cursor: model");
+	else if (objectUnderCursor == CulledPlane)
+		ImGui::Text("Under cursor: plane");
+	else if (objectUnderCursor != SceneIndex::InvalidProxy)
+		ImGui::Text("Under cursor: copy %u", objectUnderCursor - CulledFirstCopy);
+	if (lightNearestModel != SceneIndex::InvalidProxy)
+		ImGui::Text("Nearest light to the model: %u, %.2f away",
+			lightNearestModel, lightNearestDistance);
+
+	// skips meshlets outside the view or facing away; see MeshletCuller.h
+	ImGui::Checkbox("Meshlet Culling", &bMeshletCulling);
+	if (bMeshletCulling && renderObj.mesh)
+	{
+		// models are drawn double sided, so hiding back facing meshlets is only
+		// safe on closed meshes seen from outside; it is off by default
+		ImGui::Checkbox("Cull Back Facing Meshlets", &bMeshletConeCulling);
+		MeshletCullStats const &cullStats = renderObj.mesh->GetCullStats();
+		ImGui::Text("Meshlets: %u of %u (%u outside, %u back facing)",
+			cullStats.visibleMeshlets, cullStats.meshletCount,
+			cullStats.frustumCulled, cullStats.coneCulled);
+		ImGui::Text("Triangles: %u of %u in %u draw ranges",
+			cullStats.visibleTriangles, cullStats.triangleCount, cullStats.rangeCount);
+	}
+
 	if (ImGui::CollapsingHeader("Material", 0, true, true))
 	{
 		std::vector<char const *> shaderTypeStrings = {
@@ -854,6 +1431,42 @@ void RenderUI()
 			ResetLightingScenario();
 	}
 
+	if (ImGui::CollapsingHeader("Capture"))
+	{
+		std::vector<char const *> captureFormatStrings = {
+			"PNG", "JPEG", "BMP"
+		};
+		ImGui::Combo("Format", &captureFormat, captureFormatStrings.data(), (int)ImageFormat::Count);
+		if (ImGui::SliderInt("JPEG Quality", &captureJpegQuality, 1, 100))
+			frameCapture->SetJpegQuality(captureJpegQuality);
+		ImGui::Checkbox("Record Every Frame", &bRecordFrames);
+		ImGui::Text("Captured: %llu, dropped: %llu, pending: %u",
+			frameCapture->GetCapturedCount(), frameCapture->GetDroppedCount(),
+			frameCapture->GetPendingCount());
+	}
+
+	if (ImGui::CollapsingHeader("Frame History"))
+	{
+		std::vector<char const *> storageStrings = { "Raw", "PNG", "JPEG" };
+		std::vector<char const *> dumpFormatStrings = {
+			"Image Sequence", "Raw Video (y4m)"
+		};
+		ImGui::Checkbox("Keep History", &bKeepHistory);
+		bool resetHistory = ImGui::Combo("Storage", &historyStorage, storageStrings.data(), (int)FrameStorage::Count);
+		resetHistory |= ImGui::SliderInt("Downscale", &historyDownscale, 1, 4);
+		if (resetHistory)
+			ResetFrameHistory();
+		ImGui::Combo("Save As", &historyDumpFormat, dumpFormatStrings.data(), (int)FrameDumpFormat::Count);
+		ImGui::SliderFloat("Save Seconds", &historySaveSeconds, 1.f, frameHistory->GetSettings().seconds);
+		if (ImGui::Button("Save History (o)"))
+			bSaveHistory = true;
+		ImGui::Text("Frames: %u (%.1f s, %.1f MB), dropped: %llu%s",
+			frameHistory->GetFrameCount(), frameHistory->GetDuration(),
+			frameHistory->GetMemoryUsed() / (1024.0 * 1024.0),
+			frameHistory->GetDroppedCount(),
+			frameHistory->IsSaving() ? ", saving" : "");
+	}
+
 	for (int idx = 0; idx < activeLightCount; ++idx)
 	{
 		std::stringstream sstream;
@@ -900,14 +1513,45 @@ void RenderUI()
 }
 
 
+// Draws the instanced copies of the model (see updateSceneTransforms), each
+// at the level of detail it needs.
+void RenderInstancedCopies(std::shared_ptr<ShaderProgram> const &program,
+	Matrix4 const &proj, float viewportHeight)
+{
+	Matrix4 const view = Matrix4::LookAt(cameraEye, cameraTarget, cameraUp);
+	Matrix4 const viewProjection = proj * view;
+	TriangleMesh *mesh = renderObj.mesh.get();
+	instanceBatcher->Clear();
+	for (u32 copy = 0; copy < instanceCopyNodes.size(); ++copy)
+	{
+		if (!isInView(CulledFirstCopy + copy))
+			continue;
+		Matrix4 const model = sceneTransforms.GetWorld(instanceCopyNodes[copy]);
+		u32 const level = bAutoLevelOfDetail ? mesh->SelectLevelOfDetail(
+			viewProjection * model, viewportHeight, lodPixelError)
+			: (u32)modelLevelOfDetail;
+		instanceBatcher->Add(mesh, 0, model, level);
+	}
+	instanceBatcher->Upload();
+
+	// every copy shares the material set for the model
+	program->SetUniform("UseInstancing", 1U);
+	program->SetUniform("ViewMatrix", view);
+	program->SetUniform("ProjectionMatrix", proj);
+	for (size_t i = 0; i < instanceBatcher->GetBatchCount(); ++i)
+		instanceBatcher->Render(i);
+	program->SetUniform("UseInstancing", 0U);
+}
+
 void RenderMesh(Application* application)
 {
-	const Vector3& modelRotate = renderObj.eulerRotate;
-	Matrix4 modelview = Matrix4::LookAt(cameraEye, cameraTarget, cameraUp) *
-		Matrix4::Translate(renderObj.pos) *
-		Matrix4::RotateEuler(modelRotate.z, modelRotate.x, modelRotate.y);
+	Matrix4 const view = Matrix4::LookAt(cameraEye, cameraTarget, cameraUp);
+	Matrix4 modelview = view * sceneTransforms.GetWorld(renderObj.transform);
 	Matrix4 proj = Matrix4::PerspectiveProjection(fov, application->GetWindowWidth(), application->GetWindowHeight(), zNear, zFar);
 	Matrix4 mvp = proj * modelview; // model-view-projection concatenated matrix
+	cullScene(proj * view);
+	pickUnderCursor(proj * view, (float)application->GetWindowWidth(),
+		(float)application->GetWindowHeight());
 
 	// Render
 	if (shaderManager)
@@ -935,6 +1579,8 @@ void RenderMesh(Application* application)
 		// program->SetUniform("TIME", (u32)normalMapDebugMode);
 		program->SetUniform("myTextureSampler", (u32)0);
 		program->SetUniform("eye", cameraEye);
+		if (program->HasUniform("UseAmbientOcclusion"))
+			program->SetUniform("UseAmbientOcclusion", (u32)bAmbientOcclusion);
 
 		// GLuint TextureID = glGetUniformLocation(programID, "myTextureSampler");
 				
@@ -946,7 +1592,34 @@ void RenderMesh(Application* application)
 
 		if (renderObj.mesh)
 		{
-			renderObj.mesh->Render();
+			// only the model itself may be packed; the debug lines and the plane
+			// below are always full vertices
+			bool const packed = renderObj.mesh->GetVertexFormat() == VertexFormat::Packed;
+			if (program->HasUniform("PackedVertex"))
+			{
+				program->SetUniform("PackedVertex", (u32)packed);
+				program->SetUniform("PackedPositionTransform",
+					renderObj.mesh->GetPackedPositionTransform());
+			}
+			if (bAutoLevelOfDetail)
+				modelLevelOfDetail = (int)renderObj.mesh->SelectLevelOfDetail(mvp,
+					(float)m_viewport[3], lodPixelError);
+			if (isInView(CulledModel))
+			{
+				if (bMeshletCulling)
+				{
+					// the eye in model space is where the inverse model-view maps the
+					// view space origin
+					renderObj.mesh->Render(mvp, TransformPoint(modelview.Inverted(), Vector3(0.f)),
+						bMeshletConeCulling, (u32)modelLevelOfDetail);
+				}
+				else
+					renderObj.mesh->Render((u32)modelLevelOfDetail);
+			}
+			if (instanceCopyCount > 0 && program->HasUniform("UseInstancing"))
+				RenderInstancedCopies(program, proj, (float)m_viewport[3]);
+			if (packed && program->HasUniform("PackedVertex"))
+				program->SetUniform("PackedVertex", 0U);
 
 			program->SetUniform("LightCount", 0U);
 			switch (static_cast<NormalDebugMode>(debugMode))
@@ -975,12 +1648,12 @@ void RenderMesh(Application* application)
 		// render plane
 		{
 			Matrix4 modelview = Matrix4::LookAt(cameraEye, cameraTarget, cameraUp) *
-				Matrix4::Translate(plane.pos) *
-				Matrix4::Scale(plane.scale);
+				sceneTransforms.GetWorld(plane.transform);
 			Matrix4 mvp = proj * modelview; // model-view-projection concatenated matrix
 			program->SetUniform("ModelViewMatrix", modelview);
 			program->SetUniform("ModelViewProjectionMatrix", mvp);
-			plane.mesh->Render();
+			if (isInView(CulledPlane))
+				plane.mesh->Render();
 		}
 
 		textureManager->Unbind(TextureType::DIFFUSE);
@@ -1049,14 +1722,24 @@ void Update(Application *application, void *udata)
 	f32 dt = newTime - oldTime;
 	oldTime = newTime;
 
+	// swap in assets whose files changed, before anything uses them this frame
+	hotReloader->Update();
+
 	UpdateCamera(dt);
 	UpdateLighting(dt);
 
+	// hand finished frame captures over to the encoder thread
+	frameCapture->Update();
+	frameHistory->Update();
+
 	// clear the pixel and depth buffers for this frame
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	RenderUI();
-	
+
+	// after the UI, which may have moved the model
+	updateSceneTransforms();
+	updateSceneIndex();
 	RenderMesh(application);
 
 	RenderLights(application);
@@ -1066,6 +1749,16 @@ void Update(Application *application, void *udata)
 		TakeScreenShot(application);
 		ScreenShot = false;
 	}
+	if (bRecordFrames)
+		RecordFrame(application);
+	if (bKeepHistory)
+		frameHistory->Capture(application->GetWindowWidth(),
+			application->GetWindowHeight(), newTime);
+	if (bSaveHistory)
+	{
+		SaveFrameHistory();
+		bSaveHistory = false;
+	}
 	if (bPlayRecord)
 		PlayCameraRecord(dt);
 	// done creating ImGui components
@@ -1080,7 +1773,11 @@ void GetCameraMovement(int key)
 void Cleanup(Application *application, void *udata)
 {
 	// cleanup OpenGL resources and allocated memory
+	hotReloader = nullptr; // stop reloading before the managers go away
 	shaderManager = nullptr; // delete all programs
+	frameCapture = nullptr; // finish writing pending captures
+	frameHistory = nullptr; // finish writing pending history saves
+	instanceBatcher = nullptr;
 	// delete all meshes
 
 	renderObj.mesh = nullptr;
@@ -0,0 +1,215 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/FileSystem.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace FileSystem
+{
+#ifdef _WIN32
+
+  bool GetFileInfo(std::string const &path, FileInfo &info)
+  {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data))
+      return false;
+    info.size = (static_cast<u64>(data.nFileSizeHigh) << 32)
+      | data.nFileSizeLow;
+    info.modifiedTime = (static_cast<u64>(data.ftLastWriteTime.dwHighDateTime)
+      << 32) | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+  }
+
+  bool MakeDirectory(std::string const &path)
+  {
+    return CreateDirectoryA(path.c_str(), NULL)
+      || GetLastError() == ERROR_ALREADY_EXISTS;
+  }
+
+  static bool MoveIntoPlace(std::string const &from, std::string const &to)
+  {
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING)
+      != FALSE;
+  }
+
+#else // _WIN32
+
+  bool GetFileInfo(std::string const &path, FileInfo &info)
+  {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+      return false;
+    info.size = static_cast<u64>(st.st_size);
+    info.modifiedTime = static_cast<u64>(st.st_mtime) * 1000000000ull
+#if defined(__APPLE__)
+      + static_cast<u64>(st.st_mtimespec.tv_nsec);
+#else
+      + static_cast<u64>(st.st_mtim.tv_nsec);
+#endif
+    return true;
+  }
+
+  bool MakeDirectory(std::string const &path)
+  {
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+  }
+
+  static bool MoveIntoPlace(std::string const &from, std::string const &to)
+  {
+    return rename(from.c_str(), to.c_str()) == 0;
+  }
+
+#endif // _WIN32
+
+  bool WriteFileContents(std::string const &path, void const *data,
+    size_t size)
+  {
+    // write next to the destination so the final move never crosses volumes
+    std::string const temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+      return false;
+
+    bool const written = fwrite(data, 1, size, file) == size;
+    bool const closed = fclose(file) == 0;
+    if (!written || !closed || !MoveIntoPlace(temporary, path))
+    {
+      remove(temporary.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool PatchFileContents(std::string const &path, size_t offset,
+    void const *data, size_t size)
+  {
+    FILE *file = fopen(path.c_str(), "r+b");
+    if (!file)
+      return false;
+
+    bool const written = fseek(file, static_cast<long>(offset), SEEK_SET) == 0
+      && fwrite(data, 1, size, file) == size;
+    bool const closed = fclose(file) == 0;
+    return written && closed;
+  }
+
+  MappedFile::MappedFile()
+    : data_(NULL), size_(0), isOpen_(false)
+#ifdef _WIN32
+    , fileHandle_(INVALID_HANDLE_VALUE), mappingHandle_(NULL)
+#else
+    , fileDescriptor_(-1)
+#endif
+  {
+  }
+
+  MappedFile::~MappedFile()
+  {
+    Close();
+  }
+
+#ifdef _WIN32
+
+  bool MappedFile::Open(std::string const &path)
+  {
+    Close();
+
+    fileHandle_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+      NULL);
+    if (fileHandle_ == INVALID_HANDLE_VALUE)
+      return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fileHandle_, &size))
+    {
+      Close();
+      return false;
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    isOpen_ = true;
+    if (size_ == 0)
+      return true; // cannot map an empty file; nothing to read anyway
+
+    // the mapping object keeps the view alive; the file handle is only needed
+    // until the mapping exists, but closing both together keeps Close simple
+    mappingHandle_ = CreateFileMappingA(fileHandle_, NULL, PAGE_READONLY, 0, 0,
+      NULL);
+    if (mappingHandle_)
+      data_ = static_cast<u8 const *>(MapViewOfFile(mappingHandle_,
+        FILE_MAP_READ, 0, 0, 0));
+    if (!data_)
+    {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void MappedFile::Close()
+  {
+    if (data_)
+      UnmapViewOfFile(data_);
+    if (mappingHandle_)
+      CloseHandle(mappingHandle_);
+    if (fileHandle_ != INVALID_HANDLE_VALUE)
+      CloseHandle(fileHandle_);
+    data_ = NULL;
+    size_ = 0;
+    isOpen_ = false;
+    mappingHandle_ = NULL;
+    fileHandle_ = INVALID_HANDLE_VALUE;
+  }
+
+#else // _WIN32
+
+  bool MappedFile::Open(std::string const &path)
+  {
+    Close();
+
+    fileDescriptor_ = open(path.c_str(), O_RDONLY);
+    if (fileDescriptor_ < 0)
+      return false;
+
+    struct stat st;
+    if (fstat(fileDescriptor_, &st) != 0)
+    {
+      Close();
+      return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    isOpen_ = true;
+    if (size_ == 0)
+      return true; // cannot map an empty file; nothing to read anyway
+
+    void *view = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fileDescriptor_, 0);
+    if (view == MAP_FAILED)
+    {
+      Close();
+      return false;
+    }
+    data_ = static_cast<u8 const *>(view);
+    return true;
+  }
+
+  void MappedFile::Close()
+  {
+    if (data_)
+      munmap(const_cast<u8 *>(data_), size_);
+    if (fileDescriptor_ >= 0)
+      close(fileDescriptor_);
+    data_ = NULL;
+    size_ = 0;
+    isOpen_ = false;
+    fileDescriptor_ = -1;
+  }
+
+#endif // _WIN32
+}
@@ -0,0 +1,252 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/FileWatcher.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  // How long a file has to go without further events before it is reported.
+  static std::chrono::milliseconds const SettleTime(150);
+
+  std::string WithTrailingSlash(std::string const &directory)
+  {
+    if (directory.empty() || directory.back() == '/'
+      || directory.back() == '\\')
+      return directory;
+    return directory + "/";
+  }
+}
+
+#ifdef _WIN32
+
+FileWatcher::FileWatcher(std::string const &directory)
+  : directory_(WithTrailingSlash(directory)), watching_(false),
+  directoryHandle_(INVALID_HANDLE_VALUE), changeEvent_(NULL),
+  stopEvent_(NULL)
+{
+  directoryHandle_ = CreateFileA(directory_.c_str(), FILE_LIST_DIRECTORY,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+    OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+  changeEvent_ = CreateEventA(NULL, TRUE, FALSE, NULL);
+  stopEvent_ = CreateEventA(NULL, TRUE, FALSE, NULL);
+  watching_ = directoryHandle_ != INVALID_HANDLE_VALUE && changeEvent_
+    && stopEvent_;
+  WarnIf(!watching_, "Warning: unable to watch directory: %s",
+    directory_.c_str());
+  if (watching_)
+    thread_ = std::thread(&FileWatcher::WatchMain, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+  if (watching_)
+  {
+    SetEvent(stopEvent_);
+    thread_.join();
+  }
+  if (directoryHandle_ != INVALID_HANDLE_VALUE)
+    CloseHandle(directoryHandle_);
+  if (changeEvent_)
+    CloseHandle(changeEvent_);
+  if (stopEvent_)
+    CloseHandle(stopEvent_);
+}
+
+void FileWatcher::WatchMain()
+{
+  // ReadDirectoryChangesW requires a DWORD-aligned buffer
+  std::vector<DWORD> buffer(16 * 1024);
+  DWORD const filter = FILE_NOTIFY_CHANGE_FILE_NAME
+    | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+  for (;;)
+  {
+    OVERLAPPED overlapped;
+    std::memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = changeEvent_;
+    ResetEvent(changeEvent_);
+    if (!ReadDirectoryChangesW(directoryHandle_, buffer.data(),
+      static_cast<DWORD>(buffer.size() * sizeof(DWORD)), TRUE, filter, NULL,
+      &overlapped, NULL))
+      return;
+
+    HANDLE const handles[] = { changeEvent_, stopEvent_ };
+    DWORD bytes = 0;
+    if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+    {
+      // stopping: cancel the read and wait for the cancellation, since the
+      // OS writes into buffer and overlapped until then
+      CancelIo(directoryHandle_);
+      GetOverlappedResult(directoryHandle_, &overlapped, &bytes, TRUE);
+      return;
+    }
+    if (!GetOverlappedResult(directoryHandle_, &overlapped, &bytes, FALSE))
+      return;
+    if (bytes == 0)
+      continue; // too many changes at once; the OS discarded them
+
+    u8 const *entry = reinterpret_cast<u8 const *>(buffer.data());
+    for (;;)
+    {
+      FILE_NOTIFY_INFORMATION const *info =
+        reinterpret_cast<FILE_NOTIFY_INFORMATION const *>(entry);
+      if (info->Action == FILE_ACTION_ADDED
+        || info->Action == FILE_ACTION_MODIFIED
+        || info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+      {
+        int const nameLength = static_cast<int>(info->FileNameLength
+          / sizeof(WCHAR));
+        int const length = WideCharToMultiByte(CP_UTF8, 0, info->FileName,
+          nameLength, NULL, 0, NULL, NULL);
+        std::string path(length, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, info->FileName, nameLength, &path[0],
+          length, NULL, NULL);
+        std::replace(path.begin(), path.end(), '\\', '/');
+        RecordChange(path);
+      }
+      if (info->NextEntryOffset == 0)
+        break;
+      entry += info->NextEntryOffset;
+    }
+  }
+}
+
+#else // _WIN32
+
+FileWatcher::FileWatcher(std::string const &directory)
+  : directory_(WithTrailingSlash(directory)), watching_(false), inotify_(-1)
+{
+  stopPipe_[0] = stopPipe_[1] = -1;
+  inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_ >= 0 && pipe(stopPipe_) == 0)
+  {
+    AddWatches("");
+    watching_ = !watches_.empty();
+  }
+  WarnIf(!watching_, "Warning: unable to watch directory: %s",
+    directory_.c_str());
+  if (watching_)
+    thread_ = std::thread(&FileWatcher::WatchMain, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+  if (watching_)
+  {
+    char const stop = 0;
+    while (write(stopPipe_[1], &stop, 1) < 0 && errno == EINTR)
+      ;
+    thread_.join();
+  }
+  for (int fd : { inotify_, stopPipe_[0], stopPipe_[1] })
+    if (fd >= 0)
+      close(fd);
+}
+
+void FileWatcher::AddWatches(std::string const &relativeDirectory)
+{
+  // inotify is not recursive: every directory needs a watch of its own
+  std::string const path = directory_ + relativeDirectory;
+  int const watch = inotify_add_watch(inotify_, path.c_str(),
+    IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  if (watch < 0)
+    return;
+  watches_[watch] = relativeDirectory;
+
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return;
+  while (dirent *entry = readdir(dir))
+  {
+    // hidden directories (.git and the like) never hold assets
+    if (entry->d_type == DT_DIR && entry->d_name[0] != '.')
+      AddWatches(relativeDirectory + entry->d_name + "/");
+  }
+  closedir(dir);
+}
+
+void FileWatcher::WatchMain()
+{
+  // inotify_event is followed by its name, so the buffer must be aligned
+  std::vector<inotify_event> buffer(4096);
+  pollfd fds[2];
+  fds[0].fd = inotify_;
+  fds[0].events = POLLIN;
+  fds[1].fd = stopPipe_[0];
+  fds[1].events = POLLIN;
+  for (;;)
+  {
+    fds[0].revents = fds[1].revents = 0;
+    if (poll(fds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[1].revents != 0)
+      return; // stopping
+
+    ssize_t const bytes = read(inotify_, buffer.data(),
+      buffer.size() * sizeof(inotify_event));
+    if (bytes <= 0)
+      continue;
+
+    u8 const *entry = reinterpret_cast<u8 const *>(buffer.data());
+    u8 const *const end = entry + bytes;
+    while (entry < end)
+    {
+      inotify_event const *event =
+        reinterpret_cast<inotify_event const *>(entry);
+      entry += sizeof(inotify_event) + event->len;
+
+      auto const find = watches_.find(event->wd);
+      if (find == watches_.end() || event->len == 0)
+        continue;
+      std::string const path = find->second + event->name;
+      if (event->mask & IN_ISDIR)
+      {
+        if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && event->name[0] != '.')
+          AddWatches(path + "/");
+      }
+      else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        RecordChange(path);
+    }
+  }
+}
+
+#endif // _WIN32
+
+bool FileWatcher::IsWatching() const
+{
+  return watching_;
+}
+
+void FileWatcher::PollChanges(std::vector<std::string> &changes)
+{
+  changes.clear();
+  auto const now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = changes_.begin(); it != changes_.end();)
+  {
+    if (now - it->second >= SettleTime)
+    {
+      changes.push_back(it->first);
+      it = changes_.erase(it);
+    }
+    else
+      ++it;
+  }
+}
+
+void FileWatcher::RecordChange(std::string const &path)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  changes_[path] = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,121 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/HotReloader.h"
+
+HotReloader::HotReloader(std::string const &directory)
+  : watcher_(directory), nextGeneration_(0), reloadCount_(0),
+  quitting_(false)
+{
+  thread_ = std::thread(&HotReloader::ReloadMain, this);
+}
+
+HotReloader::~HotReloader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quitting_ = true;
+    queued_.clear();
+  }
+  wake_.notify_all();
+  thread_.join();
+}
+
+void HotReloader::Watch(std::string const &name,
+  std::vector<std::string> const &files, PrepareFunction const &prepare)
+{
+  // a preparation of a previous registration may still be running; the new
+  // generation makes Update discard its result
+  Asset &asset = assets_[name];
+  asset.files = files;
+  asset.prepare = prepare;
+  asset.generation = nextGeneration_++;
+  asset.preparing = false;
+  asset.dirty = false;
+}
+
+void HotReloader::Unwatch(std::string const &name)
+{
+  assets_.erase(name);
+}
+
+void HotReloader::Update()
+{
+  // mark the assets depending on changed files
+  watcher_.PollChanges(changes_);
+  for (auto const &change : changes_)
+  {
+    for (auto &asset : assets_)
+    {
+      auto const &files = asset.second.files;
+      if (std::find(files.begin(), files.end(), change) != files.end())
+        asset.second.dirty = true;
+    }
+  }
+
+  // swap in what the reload thread has finished
+  std::vector<Request> prepared;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    prepared.swap(prepared_);
+  }
+  for (auto &request : prepared)
+  {
+    auto find = assets_.find(request.name);
+    if (find == assets_.end() || find->second.generation != request.generation)
+      continue; // unwatched or replaced meanwhile
+    find->second.preparing = false;
+    if (request.commit)
+    {
+      request.commit();
+      ++reloadCount_;
+    }
+  }
+
+  // queue the changed assets, unless they are being prepared already (then
+  // they stay dirty and are prepared again once the current one commits)
+  bool queued = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &asset : assets_)
+    {
+      if (!asset.second.dirty || asset.second.preparing)
+        continue;
+      queued_.push_back(Request());
+      queued_.back().name = asset.first;
+      queued_.back().generation = asset.second.generation;
+      queued_.back().prepare = asset.second.prepare;
+      asset.second.dirty = false;
+      asset.second.preparing = true;
+      queued = true;
+    }
+  }
+  if (queued)
+    wake_.notify_one();
+}
+
+u32 HotReloader::GetReloadCount() const
+{
+  return reloadCount_;
+}
+
+void HotReloader::ReloadMain()
+{
+  for (;;)
+  {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return quitting_ || !queued_.empty(); });
+      if (quitting_)
+        return;
+      request = queued_.front();
+      queued_.pop_front();
+    }
+
+    request.commit = request.prepare();
+    request.prepare = nullptr; // release anything it captured here
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    prepared_.push_back(request);
+  }
+}
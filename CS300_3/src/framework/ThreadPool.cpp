@@ -0,0 +1,156 @@
+#include "Precompiled.h"
+#include "framework/ThreadPool.h"
+
+// Shared state of a single ParallelFor call. Helpers hold it by shared_ptr, so
+// it stays alive even if a helper only gets scheduled after the call returned
+// (it will then find no chunks left and exit immediately).
+struct ThreadPool::RangeJob
+{
+  RangeFunction body;
+  size_t begin, end, grain, chunkCount;
+  std::atomic<size_t> nextChunk;
+  std::atomic<size_t> finishedChunks;
+  std::mutex mutex;
+  std::condition_variable finished;
+};
+
+namespace
+{
+  std::once_flag instanceCreated;
+  ThreadPool *instance = nullptr;
+}
+
+ThreadPool &ThreadPool::GetInstance()
+{
+  // Not a function-local static: VS2013 does not initialize those
+  // thread-safely, and worker threads may get here concurrently.
+  std::call_once(instanceCreated, []
+  {
+    instance = new ThreadPool(std::max(std::thread::hardware_concurrency(),
+      2u) - 1);
+    std::atexit([] { delete instance; });
+  });
+  return *instance;
+}
+
+ThreadPool::ThreadPool(u32 workerCount) : quitting_(false)
+{
+  workers_.reserve(workerCount);
+  for (u32 i = 0; i < workerCount; ++i)
+    workers_.emplace_back(&ThreadPool::WorkerMain, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quitting_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+u32 ThreadPool::GetThreadCount() const
+{
+  return static_cast<u32>(workers_.size()) + 1;
+}
+
+void ThreadPool::ParallelFor(size_t begin, size_t end, size_t grain,
+  RangeFunction const &body)
+{
+  if (end <= begin)
+    return;
+  grain = std::max<size_t>(grain, 1);
+  size_t const chunkCount = (end - begin + grain - 1) / grain;
+  if (chunkCount == 1 || workers_.empty())
+  {
+    body(begin, end); // not worth waking anybody up
+    return;
+  }
+
+  std::shared_ptr<RangeJob> job = std::make_shared<RangeJob>();
+  job->body = body;
+  job->begin = begin;
+  job->end = end;
+  job->grain = grain;
+  job->chunkCount = chunkCount;
+  job->nextChunk = 0;
+  job->finishedChunks = 0;
+
+  // the calling thread takes one share of the work itself
+  size_t const helperCount = std::min(chunkCount - 1, workers_.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < helperCount; ++i)
+      tasks_.push_back([job]() { RunChunks(*job); });
+  }
+  if (helperCount == 1)
+    wake_.notify_one();
+  else
+    wake_.notify_all();
+
+  RunChunks(*job);
+
+  // wait for chunks still being processed by helpers
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->finished.wait(lock, [&job]() {
+    return job->finishedChunks.load() == job->chunkCount;
+  });
+}
+
+void ThreadPool::Submit(TaskFunction const &task)
+{
+  if (workers_.empty())
+  {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(task);
+  }
+  wake_.notify_one();
+}
+
+void ThreadPool::RunChunks(RangeJob &job)
+{
+  size_t finished = 0;
+  for (;;)
+  {
+    size_t const chunk = job.nextChunk.fetch_add(1);
+    if (chunk >= job.chunkCount)
+      break;
+    size_t const chunkBegin = job.begin + chunk * job.grain;
+    size_t const chunkEnd = std::min(chunkBegin + job.grain, job.end);
+    job.body(chunkBegin, chunkEnd);
+    ++finished;
+  }
+
+  if (finished == 0)
+    return;
+  if (job.finishedChunks.fetch_add(finished) + finished == job.chunkCount)
+  {
+    // take the lock so the waiting thread cannot miss the notification
+    // between checking the predicate and going to sleep
+    std::lock_guard<std::mutex> lock(job.mutex);
+    job.finished.notify_all();
+  }
+}
+
+void ThreadPool::WorkerMain()
+{
+  for (;;)
+  {
+    TaskFunction task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return quitting_ || !tasks_.empty(); });
+      if (tasks_.empty())
+        return; // quitting and no more work left
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
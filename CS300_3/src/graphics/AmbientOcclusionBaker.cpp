@@ -0,0 +1,175 @@
+#include "Precompiled.h"
+#include "framework/ThreadPool.h"
+#include "graphics/AmbientOcclusionBaker.h"
+#include "graphics/Bvh.h"
+#include "graphics/MeshLoader.h"
+#include "graphics/Texture.h"
+#include "graphics/TriangleMesh.h"
+#include "graphics/Vertex.h"
+
+namespace
+{
+  using Math::Vector3;
+
+  // Vertices baked per ParallelFor chunk.
+  static size_t const BakeGrain = 256;
+
+  // Van der Corput's radical inverse in base 2: the bits of index mirrored
+  // around the binary point.
+  f32 RadicalInverse(u32 index)
+  {
+    index = (index << 16) | (index >> 16);
+    index = ((index & 0x00ff00ffu) << 8) | ((index & 0xff00ff00u) >> 8);
+    index = ((index & 0x0f0f0f0fu) << 4) | ((index & 0xf0f0f0f0u) >> 4);
+    index = ((index & 0x33333333u) << 2) | ((index & 0xccccccccu) >> 2);
+    index = ((index & 0x55555555u) << 1) | ((index & 0xaaaaaaaau) >> 1);
+    return f32(index >> 8) / f32(1 << 24);
+  }
+
+  // A well mixed 32-bit hash (the finalizer of MurmurHash3), used to give
+  // every vertex its own rotation of the sample set.
+  u32 HashIndex(u32 value)
+  {
+    value ^= value >> 16;
+    value *= 0x85ebca6bu;
+    value ^= value >> 13;
+    value *= 0xc2b2ae35u;
+    value ^= value >> 16;
+    return value;
+  }
+
+  // Any two unit vectors perpendicular to the given unit normal and to each
+  // other (Frisvad's construction, made robust near -z).
+  void BuildBasis(Vector3 const &normal, Vector3 &tangent, Vector3 &bitangent)
+  {
+    f32 const sign = normal.z >= 0.f ? 1.f : -1.f;
+    f32 const a = -1.f / (sign + normal.z);
+    f32 const b = normal.x * normal.y * a;
+    tangent = Vector3(1.f + sign * normal.x * normal.x * a, sign * b,
+      -sign * normal.x);
+    bitangent = Vector3(b, sign + normal.y * normal.y * a, -normal.y);
+  }
+}
+
+namespace Graphics
+{
+  f32 const AmbientOcclusionBaker::DefaultMaxDistance = 0.25f;
+
+  void AmbientOcclusionBaker::BakeVertices(Bvh const &bvh, Vertex *vertices,
+    size_t count, u32 rayCount, f32 maxDistance)
+  {
+    rayCount = std::max(4u, (rayCount + 3u) & ~3u);
+    if (bvh.IsEmpty())
+    {
+      for (size_t i = 0; i < count; ++i)
+        vertices[i].occlusion = 1.f;
+      return;
+    }
+
+    // the Hammersley set in the unit square, shared by all vertices
+    std::vector<f32> samples(rayCount * 2);
+    for (u32 i = 0; i < rayCount; ++i)
+    {
+      samples[i * 2] = (f32(i) + 0.5f) / f32(rayCount);
+      samples[i * 2 + 1] = RadicalInverse(i);
+    }
+    f32 const offset = maxDistance * 0.001f;
+
+    ThreadPool::GetInstance().ParallelFor(0, count, BakeGrain,
+      [&](size_t begin, size_t end)
+    {
+      RayPacket packet;
+      for (u32 lane = 0; lane < 4; ++lane)
+      {
+        packet.tMin[lane] = 0.f;
+        packet.tMax[lane] = maxDistance;
+      }
+      for (size_t i = begin; i < end; ++i)
+      {
+        Vertex &vertex = vertices[i];
+        f32 const lengthSq = vertex.normal.LengthSq();
+        if (!(lengthSq > 0.f))
+        {
+          vertex.occlusion = 1.f;
+          continue;
+        }
+        Vector3 const normal = vertex.normal / std::sqrt(lengthSq);
+        Vector3 tangent, bitangent;
+        BuildBasis(normal, tangent, bitangent);
+        Vector3 const origin = vertex.vertex + normal * offset;
+        for (u32 lane = 0; lane < 4; ++lane)
+        {
+          packet.originX[lane] = origin.x;
+          packet.originY[lane] = origin.y;
+          packet.originZ[lane] = origin.z;
+        }
+
+        // Cranley-Patterson rotation of the sample set for this vertex
+        u32 const hash = HashIndex(u32(i));
+        f32 const rotateU = f32(hash & 0xffffu) / 65536.f;
+        f32 const rotateV = f32(hash >> 16) / 65536.f;
+
+        u32 escaped = 0;
+        for (u32 first = 0; first < rayCount; first += 4)
+        {
+          for (u32 lane = 0; lane < 4; ++lane)
+          {
+            f32 u = samples[(first + lane) * 2] + rotateU;
+            f32 v = samples[(first + lane) * 2 + 1] + rotateV;
+            u -= u >= 1.f ? 1.f : 0.f;
+            v -= v >= 1.f ? 1.f : 0.f;
+            // Malley's method: uniform on the disk, projected up onto the
+            // hemisphere, is cosine weighted
+            f32 const radius = std::sqrt(u);
+            f32 const angle = Math::cTwoPi * v;
+            f32 const x = radius * std::cos(angle);
+            f32 const y = radius * std::sin(angle);
+            f32 const z = std::sqrt(std::max(0.f, 1.f - u));
+            packet.directionX[lane] = tangent.x * x + bitangent.x * y
+              + normal.x * z;
+            packet.directionY[lane] = tangent.y * x + bitangent.y * y
+              + normal.y * z;
+            packet.directionZ[lane] = tangent.z * x + bitangent.z * y
+              + normal.z * z;
+          }
+          u32 const occluded = bvh.IntersectAny(packet);
+          escaped += 4 - ((occluded & 1) + ((occluded >> 1) & 1)
+            + ((occluded >> 2) & 1) + ((occluded >> 3) & 1));
+        }
+        vertex.occlusion = f32(escaped) / f32(rayCount);
+      }
+    });
+  }
+
+  void AmbientOcclusionBaker::Benchmark(std::string const &model,
+    u32 rayCount)
+  {
+    std::shared_ptr<TriangleMesh> mesh = MeshLoader::LoadMesh(model,
+      TextureProjectorFunction::CYLINDRICAL);
+    if (!mesh || mesh->GetTriangleCount() == 0)
+    {
+      std::cout << "AO benchmark: cannot load models/" << model << std::endl;
+      return;
+    }
+
+    mesh->GetBvh();
+    auto const start = std::chrono::high_resolution_clock::now();
+    mesh->BakeAmbientOcclusion(rayCount);
+    auto const stop = std::chrono::high_resolution_clock::now();
+
+    u32 const vertexCount = u32(mesh->GetVertexCount());
+    f64 total = 0.0;
+    for (u32 i = 0; i < vertexCount; ++i)
+      total += mesh->GetVertex(i).occlusion;
+    f64 const seconds = std::chrono::duration<f64>(stop - start).count();
+    f64 const rays = f64(vertexCount) * ((rayCount + 3u) & ~3u);
+    char report[256];
+    sprintf(report, "%u vertices, %u rays each, baked in %.1f ms on %u"
+      " threads: %.2f Mrays/s, mean occlusion %.3f", vertexCount, rayCount,
+      seconds * 1000.0, ThreadPool::GetInstance().GetThreadCount(),
+      rays / std::max(seconds, 1e-9) * 1e-6,
+      total / std::max(vertexCount, 1u));
+    std::cout << "AO benchmark: models/" << model << ", " << report
+      << std::endl;
+  }
+}
@@ -0,0 +1,816 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/Simd.h"
+#include "framework/ThreadPool.h"
+#include "graphics/Bvh.h"
+#include "graphics/MeshLoader.h"
+#include "graphics/Texture.h"
+#include "graphics/TriangleMesh.h"
+
+namespace
+{
+  using Graphics::BvhNode;
+  using Math::Vector3;
+
+  // Bins per axis evaluated for each split.
+  static u32 const BinCount = 16;
+
+  // Nodes with more triangles than this are binned in parallel, and their
+  // subtrees are built in parallel.
+  static size_t const ParallelBinThreshold = 64 * 1024;
+  static size_t const ParallelSubtreeThreshold = 4 * 1024;
+
+  // Triangles whose bounds are computed per ParallelFor chunk.
+  static size_t const BoundsGrain = 16 * 1024;
+
+  // Depth below which nodes are split by the surface area heuristic. SAH
+  // splits may peel off a few triangles at a time, so deeper nodes are split
+  // at their object median instead, which halves them; with fewer than 2^32
+  // triangles no leaf is deeper than MaxSahDepth + 32.
+  static u32 const MaxSahDepth = 64;
+
+  // Deepest traversal stack supported: one entry per level for single rays
+  // and at most one more for packets.
+  static u32 const MaxStackDepth = 128;
+  static_assert(MaxSahDepth + 32 + 1 <= MaxStackDepth,
+    "BVH depth cap exceeds the traversal stack");
+
+  // Rays traced per ParallelFor chunk while benchmarking.
+  static size_t const BenchmarkGrain = 4 * 1024;
+
+  // Plain arrays rather than Vector3s, whose subscript is checked and out of
+  // line, since the build loops over axes for every triangle of every node.
+  struct Box
+  {
+    f32 low[3], high[3];
+
+    Box()
+    {
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        low[axis] = std::numeric_limits<f32>::infinity();
+        high[axis] = -std::numeric_limits<f32>::infinity();
+      }
+    }
+
+    void Grow(Vector3 const &point)
+    {
+      f32 const p[3] = { point.x, point.y, point.z };
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        low[axis] = std::min(low[axis], p[axis]);
+        high[axis] = std::max(high[axis], p[axis]);
+      }
+    }
+
+    void Grow(Box const &box)
+    {
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        low[axis] = std::min(low[axis], box.low[axis]);
+        high[axis] = std::max(high[axis], box.high[axis]);
+      }
+    }
+
+    void Grow(f32 const (&point)[3])
+    {
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        low[axis] = std::min(low[axis], point[axis]);
+        high[axis] = std::max(high[axis], point[axis]);
+      }
+    }
+
+    // Half the surface area, which is all the heuristic needs.
+    f32 HalfArea() const
+    {
+      if (low[0] > high[0])
+        return 0.f; // empty
+      f32 const x = high[0] - low[0];
+      f32 const y = high[1] - low[1];
+      f32 const z = high[2] - low[2];
+      return x * y + y * z + z * x;
+    }
+  };
+
+  struct Centroid
+  {
+    f32 axis[3];
+  };
+
+  struct Bin
+  {
+    Box bounds;
+    u32 count;
+
+    Bin() : bounds(), count(0) {}
+  };
+
+  // State shared by the recursive, parallel build.
+  struct BuildContext
+  {
+    std::vector<Box> boxes;
+    std::vector<Centroid> centroids;
+    std::vector<u32> order;
+    std::vector<BvhNode> &nodes;
+    std::atomic<u32> nodeCount;
+
+    explicit BuildContext(std::vector<BvhNode> &_nodes)
+      : nodes(_nodes), nodeCount(1)
+    {
+    }
+
+    // Bounds of the triangles order[begin, end) and of their centroids.
+    void ComputeBounds(u32 begin, u32 end, Box &bounds, Box &centroidBounds)
+    {
+      auto const grow = [&](size_t first, size_t last, Box &b, Box &c)
+      {
+        for (size_t i = first; i < last; ++i)
+        {
+          b.Grow(boxes[order[i]]);
+          c.Grow(centroids[order[i]].axis);
+        }
+      };
+      if (end - begin <= ParallelBinThreshold)
+      {
+        grow(begin, end, bounds, centroidBounds);
+        return;
+      }
+      std::mutex mutex;
+      ThreadPool::GetInstance().ParallelFor(begin, end, BoundsGrain,
+        [&](size_t first, size_t last)
+      {
+        Box b, c;
+        grow(first, last, b, c);
+        std::lock_guard<std::mutex> lock(mutex);
+        bounds.Grow(b);
+        centroidBounds.Grow(c);
+      });
+    }
+
+    // Sorts the triangles order[begin, end) into the bins of every axis.
+    void FillBins(u32 begin, u32 end, Box const &centroidBounds,
+      f32 const (&binScale)[3], Bin (&bins)[3][BinCount])
+    {
+      auto const fill = [&](size_t first, size_t last, Bin (&b)[3][BinCount])
+      {
+        for (size_t i = first; i < last; ++i)
+        {
+          u32 const triangle = order[i];
+          for (u32 axis = 0; axis < 3; ++axis)
+          {
+            u32 const bin = std::min(BinCount - 1, u32((centroids[triangle]
+              .axis[axis] - centroidBounds.low[axis]) * binScale[axis]));
+            b[axis][bin].bounds.Grow(boxes[triangle]);
+            ++b[axis][bin].count;
+          }
+        }
+      };
+      if (end - begin <= ParallelBinThreshold)
+      {
+        fill(begin, end, bins);
+        return;
+      }
+      std::mutex mutex;
+      ThreadPool::GetInstance().ParallelFor(begin, end, BoundsGrain,
+        [&](size_t first, size_t last)
+      {
+        Bin local[3][BinCount];
+        fill(first, last, local);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+          for (u32 bin = 0; bin < BinCount; ++bin)
+          {
+            bins[axis][bin].bounds.Grow(local[axis][bin].bounds);
+            bins[axis][bin].count += local[axis][bin].count;
+          }
+        }
+      });
+    }
+
+    void Subdivide(u32 nodeIndex, u32 begin, u32 end, u32 depth)
+    {
+      Box bounds, centroidBounds;
+      ComputeBounds(begin, end, bounds, centroidBounds);
+      BvhNode &node = nodes[nodeIndex];
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        node.boundMin[axis] = bounds.low[axis];
+        node.boundMax[axis] = bounds.high[axis];
+      }
+
+      u32 const count = end - begin;
+      if (count <= Graphics::Bvh::MaxLeafSize)
+      {
+        node.offset = begin; // turned into a block index once built
+        node.count = count;
+        return;
+      }
+
+      u32 *first = order.data() + begin;
+      u32 *last = order.data() + end;
+      u32 *middle = first + count / 2;
+      if (depth >= MaxSahDepth)
+      {
+        // object median along the widest centroid axis
+        u32 axis = 0;
+        for (u32 a = 1; a < 3; ++a)
+        {
+          if (centroidBounds.high[a] - centroidBounds.low[a]
+            > centroidBounds.high[axis] - centroidBounds.low[axis])
+            axis = a;
+        }
+        std::nth_element(first, middle, last, [&](u32 l, u32 r)
+        {
+          return centroids[l].axis[axis] < centroids[r].axis[axis];
+        });
+        SplitNode(nodeIndex, begin, u32(middle - order.data()), end, depth);
+        return;
+      }
+
+      // Find the bin boundary minimizing the surface area heuristic, the
+      // expected cost of intersecting both children: the triangle count of
+      // each weighted by its area.
+      f32 binScale[3] = { 0.f, 0.f, 0.f };
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        f32 const extent = centroidBounds.high[axis] - centroidBounds.low[axis];
+        if (extent > 0.f)
+          binScale[axis] = f32(BinCount) / extent;
+      }
+      Bin bins[3][BinCount];
+      FillBins(begin, end, centroidBounds, binScale, bins);
+      u32 bestAxis = 0, bestBin = 0;
+      f32 bestCost = std::numeric_limits<f32>::infinity();
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        if (binScale[axis] == 0.f)
+          continue; // all centroids on one plane
+        f32 rightCost[BinCount];
+        Box right;
+        u32 rightCount = 0;
+        for (u32 bin = BinCount - 1; bin > 0; --bin)
+        {
+          right.Grow(bins[axis][bin].bounds);
+          rightCount += bins[axis][bin].count;
+          rightCost[bin] = right.HalfArea() * f32(rightCount);
+        }
+        Box left;
+        u32 leftCount = 0;
+        for (u32 bin = 0; bin + 1 < BinCount; ++bin)
+        {
+          left.Grow(bins[axis][bin].bounds);
+          leftCount += bins[axis][bin].count;
+          f32 const cost = left.HalfArea() * f32(leftCount)
+            + rightCost[bin + 1];
+          if (leftCount > 0 && leftCount < count && cost < bestCost)
+          {
+            bestCost = cost;
+            bestAxis = axis;
+            bestBin = bin;
+          }
+        }
+      }
+
+      if (bestCost < std::numeric_limits<f32>::infinity())
+      {
+        middle = std::partition(first, last, [&](u32 triangle)
+        {
+          return u32((centroids[triangle].axis[bestAxis]
+            - centroidBounds.low[bestAxis]) * binScale[bestAxis]) <= bestBin;
+        });
+      }
+      if (middle == first || middle == last)
+        middle = first + count / 2; // coincident centroids: split by order
+      SplitNode(nodeIndex, begin, u32(middle - order.data()), end, depth);
+    }
+
+    // Makes a node the parent of order[begin, middle) and [middle, end).
+    void SplitNode(u32 nodeIndex, u32 begin, u32 middle, u32 end, u32 depth)
+    {
+      u32 const left = nodeCount.fetch_add(2);
+      nodes[nodeIndex].offset = left;
+      nodes[nodeIndex].count = 0;
+      if (end - begin > ParallelSubtreeThreshold)
+      {
+        ThreadPool::GetInstance().ParallelFor(0, 2, 1,
+          [&](size_t child, size_t)
+        {
+          if (child == 0)
+            Subdivide(left, begin, middle, depth + 1);
+          else
+            Subdivide(left + 1, middle, end, depth + 1);
+        });
+      }
+      else
+      {
+        Subdivide(left, begin, middle, depth + 1);
+        Subdivide(left + 1, middle, end, depth + 1);
+      }
+    }
+  };
+
+  Vector3 const &GetPosition(Vector3 const *positions, size_t stride,
+    u32 index)
+  {
+    return *reinterpret_cast<Vector3 const *>(
+      reinterpret_cast<u8 const *>(positions) + stride * index);
+  }
+}
+
+namespace Graphics
+{
+  Bvh::Bvh()
+    : nodes_(), blocks_(), triangleCount_(0)
+  {
+  }
+
+  void Bvh::Build(Math::Vector3 const *positions, size_t positionStride,
+    size_t vertexCount, u32 const *indices, size_t indexCount)
+  {
+    nodes_.clear();
+    blocks_.clear();
+    triangleCount_ = indexCount / 3;
+    if (triangleCount_ == 0)
+      return;
+
+    // the bounds and centroid of every triangle
+    BuildContext context(nodes_);
+    context.boxes.resize(triangleCount_);
+    context.centroids.resize(triangleCount_);
+    context.order.resize(triangleCount_);
+    ThreadPool::GetInstance().ParallelFor(0, triangleCount_, BoundsGrain,
+      [&](size_t begin, size_t end)
+    {
+      for (size_t t = begin; t < end; ++t)
+      {
+        Box box;
+        for (u32 j = 0; j < 3; ++j)
+        {
+          Assert(indices[t * 3 + j] < vertexCount, "Error: index out of"
+            " bounds: %u", indices[t * 3 + j]);
+          box.Grow(GetPosition(positions, positionStride, indices[t * 3 + j]));
+        }
+        context.boxes[t] = box;
+        for (u32 axis = 0; axis < 3; ++axis)
+          context.centroids[t].axis[axis] = (box.low[axis] + box.high[axis])
+            * 0.5f;
+        context.order[t] = u32(t);
+      }
+    });
+
+    // a binary tree with at least one triangle per leaf has fewer than twice
+    // as many nodes as triangles
+    nodes_.resize(2 * triangleCount_);
+    context.Subdivide(0, 0, u32(triangleCount_), 0);
+    nodes_.resize(context.nodeCount);
+
+    // gather the triangles of each leaf into a block
+    for (auto &node : nodes_)
+    {
+      if (node.count == 0)
+        continue;
+      TriangleBlock block;
+      std::memset(&block, 0, sizeof(block));
+      for (u32 k = 0; k < MaxLeafSize; ++k)
+      {
+        if (k >= node.count)
+        {
+          block.triangle[k] = InvalidTriangle; // degenerate, never hit
+          continue;
+        }
+        u32 const triangle = context.order[node.offset + k];
+        Vector3 const &a = GetPosition(positions, positionStride,
+          indices[triangle * 3]);
+        Vector3 const e1 = GetPosition(positions, positionStride,
+          indices[triangle * 3 + 1]) - a;
+        Vector3 const e2 = GetPosition(positions, positionStride,
+          indices[triangle * 3 + 2]) - a;
+        block.v0x[k] = a.x; block.v0y[k] = a.y; block.v0z[k] = a.z;
+        block.e1x[k] = e1.x; block.e1y[k] = e1.y; block.e1z[k] = e1.z;
+        block.e2x[k] = e2.x; block.e2y[k] = e2.y; block.e2z[k] = e2.z;
+        block.triangle[k] = triangle;
+      }
+      node.offset = u32(blocks_.size());
+      blocks_.push_back(block);
+    }
+  }
+
+  void Bvh::Build(TriangleMesh const &mesh)
+  {
+    if (mesh.GetTriangleCount() == 0)
+    {
+      Build(nullptr, 0, 0, nullptr, 0);
+      return;
+    }
+    Build(&mesh.GetVertex(0).vertex, sizeof(Vertex), mesh.GetVertexCount(),
+      mesh.GetTriangle(0).indices, size_t(mesh.GetTriangleCount()) * 3);
+  }
+
+  bool Bvh::IntersectClosest(Ray const &ray, RayHit &hit) const
+  {
+    return traverse<false>(ray, hit);
+  }
+
+  bool Bvh::IntersectAny(Ray const &ray) const
+  {
+    RayHit hit;
+    return traverse<true>(ray, hit);
+  }
+
+  template <bool AnyHit>
+  bool Bvh::traverse(Ray const &ray, RayHit &hit) const
+  {
+    hit.t = ray.tMax;
+    hit.u = hit.v = 0.f;
+    hit.triangle = InvalidTriangle;
+    if (nodes_.empty())
+      return false;
+
+    Vector3 const inverse(1.f / ray.direction.x, 1.f / ray.direction.y,
+      1.f / ray.direction.z);
+    f32 tMax = ray.tMax;
+
+#if USE_SSE
+    __m128 const origin = _mm_set_ps(0.f, ray.origin.z, ray.origin.y,
+      ray.origin.x);
+    __m128 const inverseDirection = _mm_set_ps(0.f, inverse.z, inverse.y,
+      inverse.x);
+    __m128 const ox = _mm_set1_ps(ray.origin.x);
+    __m128 const oy = _mm_set1_ps(ray.origin.y);
+    __m128 const oz = _mm_set1_ps(ray.origin.z);
+    __m128 const dx = _mm_set1_ps(ray.direction.x);
+    __m128 const dy = _mm_set1_ps(ray.direction.y);
+    __m128 const dz = _mm_set1_ps(ray.direction.z);
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const one = _mm_set1_ps(1.f);
+
+    // Slab test of all three axes at once. The fourth lane holds the node's
+    // offset or count; it is replaced by the first axis before reducing.
+    auto const intersectBox = [&](BvhNode const &node, f32 &tNear)
+    {
+      __m128 const t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundMin),
+        origin), inverseDirection);
+      __m128 const t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundMax),
+        origin), inverseDirection);
+      __m128 low = _mm_min_ps(t0, t1), high = _mm_max_ps(t0, t1);
+      low = _mm_shuffle_ps(low, low, _MM_SHUFFLE(0, 2, 1, 0));
+      high = _mm_shuffle_ps(high, high, _MM_SHUFFLE(0, 2, 1, 0));
+      low = _mm_max_ps(low, _mm_movehl_ps(low, low));
+      high = _mm_min_ps(high, _mm_movehl_ps(high, high));
+      low = _mm_max_ss(low, _mm_shuffle_ps(low, low, _MM_SHUFFLE(1, 1, 1, 1)));
+      high = _mm_min_ss(high, _mm_shuffle_ps(high, high,
+        _MM_SHUFFLE(1, 1, 1, 1)));
+      tNear = std::max(_mm_cvtss_f32(low), ray.tMin);
+      return tNear <= std::min(_mm_cvtss_f32(high), tMax);
+    };
+
+    // Moller-Trumbore against the four triangles of a block; returns the
+    // mask of lanes hit within (tMin, tMax) and their parameters.
+    auto const intersectBlock = [&](TriangleBlock const &block, f32 *t,
+      f32 *u, f32 *v)
+    {
+      __m128 const e1x = _mm_loadu_ps(block.e1x);
+      __m128 const e1y = _mm_loadu_ps(block.e1y);
+      __m128 const e1z = _mm_loadu_ps(block.e1z);
+      __m128 const e2x = _mm_loadu_ps(block.e2x);
+      __m128 const e2y = _mm_loadu_ps(block.e2y);
+      __m128 const e2z = _mm_loadu_ps(block.e2z);
+      // p = d x e2
+      __m128 const px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+      __m128 const py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+      __m128 const pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+      __m128 const det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px),
+        _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+      __m128 const inverseDet = _mm_div_ps(one, det);
+      // s = o - v0
+      __m128 const sx = _mm_sub_ps(ox, _mm_loadu_ps(block.v0x));
+      __m128 const sy = _mm_sub_ps(oy, _mm_loadu_ps(block.v0y));
+      __m128 const sz = _mm_sub_ps(oz, _mm_loadu_ps(block.v0z));
+      __m128 const uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px),
+        _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDet);
+      // q = s x e1
+      __m128 const qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+      __m128 const qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+      __m128 const qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+      __m128 const vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx),
+        _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDet);
+      __m128 const tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx),
+        _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+      __m128 mask = _mm_cmpneq_ps(det, zero);
+      mask = _mm_and_ps(mask, _mm_cmpge_ps(uu, zero));
+      mask = _mm_and_ps(mask, _mm_cmpge_ps(vv, zero));
+      mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(uu, vv), one));
+      mask = _mm_and_ps(mask, _mm_cmpgt_ps(tt, _mm_set1_ps(ray.tMin)));
+      mask = _mm_and_ps(mask, _mm_cmplt_ps(tt, _mm_set1_ps(tMax)));
+      _mm_storeu_ps(t, tt);
+      _mm_storeu_ps(u, uu);
+      _mm_storeu_ps(v, vv);
+      return _mm_movemask_ps(mask);
+    };
+#else
+    f32 const origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+    f32 const inverseDirection[3] = { inverse.x, inverse.y, inverse.z };
+    auto const intersectBox = [&](BvhNode const &node, f32 &tNear)
+    {
+      f32 low = ray.tMin, high = tMax;
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        f32 const t0 = (node.boundMin[axis] - origin[axis])
+          * inverseDirection[axis];
+        f32 const t1 = (node.boundMax[axis] - origin[axis])
+          * inverseDirection[axis];
+        low = std::max(low, std::min(t0, t1));
+        high = std::min(high, std::max(t0, t1));
+      }
+      tNear = low;
+      return low <= high;
+    };
+
+    auto const intersectBlock = [&](TriangleBlock const &block, f32 *t,
+      f32 *u, f32 *v)
+    {
+      int mask = 0;
+      for (u32 k = 0; k < MaxLeafSize; ++k)
+      {
+        Vector3 const e1(block.e1x[k], block.e1y[k], block.e1z[k]);
+        Vector3 const e2(block.e2x[k], block.e2y[k], block.e2z[k]);
+        Vector3 const p = ray.direction.Cross(e2);
+        f32 const det = e1.Dot(p);
+        if (det == 0.f)
+          continue;
+        f32 const inverseDet = 1.f / det;
+        Vector3 const s = ray.origin - Vector3(block.v0x[k], block.v0y[k],
+          block.v0z[k]);
+        Vector3 const q = s.Cross(e1);
+        u[k] = s.Dot(p) * inverseDet;
+        v[k] = ray.direction.Dot(q) * inverseDet;
+        t[k] = e2.Dot(q) * inverseDet;
+        if (u[k] >= 0.f && v[k] >= 0.f && u[k] + v[k] <= 1.f
+          && t[k] > ray.tMin && t[k] < tMax)
+          mask |= 1 << k;
+      }
+      return mask;
+    };
+#endif
+
+    // Depth first, nearer child first, so that closest hits shrink tMax
+    // early and prune the farther subtrees.
+    u32 stack[MaxStackDepth];
+    f32 stackNear[MaxStackDepth];
+    u32 stackSize = 0;
+    f32 tNear;
+    if (!intersectBox(nodes_[0], tNear))
+      return false;
+    u32 nodeIndex = 0;
+    for (;;)
+    {
+      BvhNode const &node = nodes_[nodeIndex];
+      if (node.count > 0)
+      {
+        TriangleBlock const &block = blocks_[node.offset];
+        f32 t[4], u[4], v[4];
+        int const mask = intersectBlock(block, t, u, v);
+        for (u32 k = 0; k < MaxLeafSize; ++k)
+        {
+          if (!(mask & (1 << k)) || t[k] >= tMax)
+            continue;
+          tMax = t[k];
+          hit.t = t[k];
+          hit.u = u[k];
+          hit.v = v[k];
+          hit.triangle = block.triangle[k];
+          if (AnyHit)
+            return true;
+        }
+      }
+      else
+      {
+        f32 nearLeft, nearRight;
+        bool const left = intersectBox(nodes_[node.offset], nearLeft);
+        bool const right = intersectBox(nodes_[node.offset + 1], nearRight);
+        if (left && right)
+        {
+          Assert(stackSize < MaxStackDepth, "Error: BVH too deep to traverse.");
+          bool const leftFirst = nearLeft <= nearRight;
+          stack[stackSize] = node.offset + (leftFirst ? 1 : 0);
+          stackNear[stackSize++] = leftFirst ? nearRight : nearLeft;
+          nodeIndex = node.offset + (leftFirst ? 0 : 1);
+          continue;
+        }
+        if (left || right)
+        {
+          nodeIndex = node.offset + (left ? 0 : 1);
+          continue;
+        }
+      }
+
+      // next pending subtree that may still hold a closer hit
+      do
+      {
+        if (stackSize == 0)
+          return hit.triangle != InvalidTriangle;
+        --stackSize;
+      } while (stackNear[stackSize] > tMax);
+      nodeIndex = stack[stackSize];
+    }
+  }
+
+  u32 Bvh::IntersectAny(RayPacket const &packet) const
+  {
+    if (nodes_.empty())
+      return 0;
+
+#if USE_SSE
+    __m128 const ox = _mm_loadu_ps(packet.originX);
+    __m128 const oy = _mm_loadu_ps(packet.originY);
+    __m128 const oz = _mm_loadu_ps(packet.originZ);
+    __m128 const dx = _mm_loadu_ps(packet.directionX);
+    __m128 const dy = _mm_loadu_ps(packet.directionY);
+    __m128 const dz = _mm_loadu_ps(packet.directionZ);
+    __m128 const tMin = _mm_loadu_ps(packet.tMin);
+    __m128 const tMax = _mm_loadu_ps(packet.tMax);
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const one = _mm_set1_ps(1.f);
+    __m128 const ix = _mm_div_ps(one, dx);
+    __m128 const iy = _mm_div_ps(one, dy);
+    __m128 const iz = _mm_div_ps(one, dz);
+
+    // slab test of one box against the four rays
+    auto const intersectBox = [&](BvhNode const &node)
+    {
+      __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundMin[0]), ox), ix);
+      __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundMax[0]), ox), ix);
+      __m128 low = _mm_max_ps(tMin, _mm_min_ps(t0, t1));
+      __m128 high = _mm_min_ps(tMax, _mm_max_ps(t0, t1));
+      t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundMin[1]), oy), iy);
+      t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundMax[1]), oy), iy);
+      low = _mm_max_ps(low, _mm_min_ps(t0, t1));
+      high = _mm_min_ps(high, _mm_max_ps(t0, t1));
+      t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundMin[2]), oz), iz);
+      t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundMax[2]), oz), iz);
+      low = _mm_max_ps(low, _mm_min_ps(t0, t1));
+      high = _mm_min_ps(high, _mm_max_ps(t0, t1));
+      return u32(_mm_movemask_ps(_mm_cmple_ps(low, high)));
+    };
+
+    // Moller-Trumbore of one triangle of a block against the four rays
+    auto const intersectTriangle = [&](TriangleBlock const &block, u32 k)
+    {
+      __m128 const e1x = _mm_set1_ps(block.e1x[k]);
+      __m128 const e1y = _mm_set1_ps(block.e1y[k]);
+      __m128 const e1z = _mm_set1_ps(block.e1z[k]);
+      __m128 const e2x = _mm_set1_ps(block.e2x[k]);
+      __m128 const e2y = _mm_set1_ps(block.e2y[k]);
+      __m128 const e2z = _mm_set1_ps(block.e2z[k]);
+      __m128 const px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+      __m128 const py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+      __m128 const pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+      __m128 const det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px),
+        _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+      __m128 const inverseDet = _mm_div_ps(one, det);
+      __m128 const sx = _mm_sub_ps(ox, _mm_set1_ps(block.v0x[k]));
+      __m128 const sy = _mm_sub_ps(oy, _mm_set1_ps(block.v0y[k]));
+      __m128 const sz = _mm_sub_ps(oz, _mm_set1_ps(block.v0z[k]));
+      __m128 const uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px),
+        _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDet);
+      __m128 const qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+      __m128 const qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+      __m128 const qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+      __m128 const vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx),
+        _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDet);
+      __m128 const tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx),
+        _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+      __m128 mask = _mm_cmpneq_ps(det, zero);
+      mask = _mm_and_ps(mask, _mm_cmpge_ps(uu, zero));
+      mask = _mm_and_ps(mask, _mm_cmpge_ps(vv, zero));
+      mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(uu, vv), one));
+      mask = _mm_and_ps(mask, _mm_cmpgt_ps(tt, tMin));
+      mask = _mm_and_ps(mask, _mm_cmplt_ps(tt, tMax));
+      return u32(_mm_movemask_ps(mask));
+    };
+
+    // Depth first; a node is skipped once every ray that reaches it has
+    // already been found occluded.
+    u32 occluded = 0;
+    u32 stack[MaxStackDepth];
+    u32 stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+      BvhNode const &node = nodes_[stack[--stackSize]];
+      if (!(intersectBox(node) & ~occluded))
+        continue;
+      if (node.count > 0)
+      {
+        TriangleBlock const &block = blocks_[node.offset];
+        for (u32 k = 0; k < node.count; ++k)
+          occluded |= intersectTriangle(block, k);
+        if (occluded == 0xf)
+          return occluded;
+      }
+      else
+      {
+        Assert(stackSize + 2 <= MaxStackDepth,
+          "Error: BVH too deep to traverse.");
+        stack[stackSize++] = node.offset + 1;
+        stack[stackSize++] = node.offset;
+      }
+    }
+    return occluded;
+#else
+    u32 occluded = 0;
+    for (u32 i = 0; i < 4; ++i)
+    {
+      Ray const ray(Vector3(packet.originX[i], packet.originY[i],
+        packet.originZ[i]), Vector3(packet.directionX[i],
+        packet.directionY[i], packet.directionZ[i]), packet.tMin[i],
+        packet.tMax[i]);
+      if (IntersectAny(ray))
+        occluded |= 1u << i;
+    }
+    return occluded;
+#endif
+  }
+
+  void Bvh::Benchmark(std::string const &model, u32 rayCount)
+  {
+    std::shared_ptr<TriangleMesh> mesh = MeshLoader::LoadMesh(model,
+      TextureProjectorFunction::CYLINDRICAL);
+    if (!mesh || mesh->GetTriangleCount() == 0)
+    {
+      std::cout << "BVH benchmark: cannot load models/" << model << std::endl;
+      return;
+    }
+
+    Bvh bvh;
+    auto const buildStart = std::chrono::high_resolution_clock::now();
+    bvh.Build(*mesh);
+    auto const buildStop = std::chrono::high_resolution_clock::now();
+
+    // rays from a sphere around the mesh toward random points in its bounds
+    // (deterministic, so runs are comparable)
+    Vector3 const low = mesh->GetBoundMin(), high = mesh->GetBoundMax();
+    Vector3 const center = (low + high) * 0.5f;
+    f32 const radius = (high - low).Length();
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    u32 seed = 0x9e3779b9u;
+    auto const random = [&]()
+    {
+      seed = seed * 1664525u + 1013904223u;
+      return f32(seed >> 8) / f32(1 << 24);
+    };
+    for (u32 i = 0; i < rayCount; ++i)
+    {
+      Vector3 direction;
+      do
+      {
+        direction = Vector3(random(), random(), random()) * 2.f - Vector3(1.f);
+      } while (direction.LengthSq() > 1.f || direction.LengthSq() < 1e-4f);
+      Vector3 const origin = center + direction.Normalized() * radius;
+      Vector3 const target(low.x + (high.x - low.x) * random(),
+        low.y + (high.y - low.y) * random(), low.z + (high.z - low.z) * random());
+      rays.push_back(Ray(origin, target - origin));
+    }
+
+    ThreadPool &pool = ThreadPool::GetInstance();
+    std::atomic<u32> hits(0);
+    auto const closestStart = std::chrono::high_resolution_clock::now();
+    pool.ParallelFor(0, rays.size(), BenchmarkGrain,
+      [&](size_t begin, size_t end)
+    {
+      u32 count = 0;
+      RayHit hit;
+      for (size_t i = begin; i < end; ++i)
+        count += bvh.IntersectClosest(rays[i], hit) ? 1 : 0;
+      hits += count;
+    });
+    auto const anyStart = std::chrono::high_resolution_clock::now();
+    pool.ParallelFor(0, rays.size(), BenchmarkGrain,
+      [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+        bvh.IntersectAny(rays[i]);
+    });
+    auto const anyStop = std::chrono::high_resolution_clock::now();
+
+    f64 const buildSeconds = std::chrono::duration<f64>(buildStop
+      - buildStart).count();
+    f64 const closestSeconds = std::chrono::duration<f64>(anyStart
+      - closestStart).count();
+    f64 const anySeconds = std::chrono::duration<f64>(anyStop
+      - anyStart).count();
+    char report[256];
+    sprintf(report, "%d triangles, %u nodes, built in %.1f ms; %u rays on %u"
+      " threads: closest hit %.2f Mrays/s (%.1f%% hit), any hit %.2f Mrays/s",
+      mesh->GetTriangleCount(), u32(bvh.GetNodeCount()), buildSeconds * 1000.0,
+      rayCount, pool.GetThreadCount(),
+      rayCount / std::max(closestSeconds, 1e-9) * 1e-6,
+      100.0 * hits / std::max(rayCount, 1u),
+      rayCount / std::max(anySeconds, 1e-9) * 1e-6);
+    std::cout << "BVH benchmark: models/" << model << ", " << report
+      << std::endl;
+  }
+}
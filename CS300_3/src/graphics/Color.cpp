@@ -45,6 +45,15 @@ namespace Graphics
   {
   }
 
+  Color &Color::operator=(Color const &rhs)
+  {
+    r = rhs.r;
+    g = rhs.g;
+    b = rhs.b;
+    a = rhs.a;
+    return *this;
+  }
+
   // Convert the 4 component floats to a single, integral ARGB representation.
   u32 Color::GetARGB() const
   {
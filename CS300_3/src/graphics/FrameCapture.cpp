@@ -0,0 +1,151 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/FileSystem.h"
+#include "graphics/FrameCapture.h"
+
+namespace
+{
+  // Frames waiting for the encoder beyond this are dropped; this bounds the
+  // memory used when encoding cannot keep up with recording.
+  static size_t const MaxQueuedEncodes = 8;
+}
+
+namespace Graphics
+{
+  FrameCapture::FrameCapture(u32 bufferCount)
+    : reader_(bufferCount), flushing_(false), jpegQuality_(90),
+    capturedCount_(0), droppedCount_(0), encodingCount_(0), quitting_(false)
+  {
+    // at most one image per queued job, plus the ones being encoded and
+    // collected; reserving avoids copying pixels when the pool grows
+    freeImages_.reserve(MaxQueuedEncodes + 2);
+    encoder_ = std::thread(&FrameCapture::EncoderMain, this);
+  }
+
+  FrameCapture::~FrameCapture()
+  {
+    Flush();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quitting_ = true;
+    }
+    wake_.notify_all();
+    encoder_.join();
+  }
+
+  bool FrameCapture::Capture(u32 width, u32 height, std::string const &path,
+    ImageFormat format)
+  {
+    // if every PBO is still in flight the GPU is too far behind, and this
+    // frame is skipped
+    bool const queued = reader_.ReadAsync(0, 0, width, height, 3,
+      [this, path, format](Image &image) { Enqueue(image, path, format); });
+    if (!queued)
+    {
+      ++droppedCount_;
+      return false;
+    }
+    ++capturedCount_;
+    return true;
+  }
+
+  void FrameCapture::Update()
+  {
+    reader_.Update();
+  }
+
+  void FrameCapture::Flush()
+  {
+    flushing_ = true;
+    reader_.Finish();
+    flushing_ = false;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return jobs_.empty() && encodingCount_ == 0; });
+  }
+
+  void FrameCapture::SetJpegQuality(u32 quality)
+  {
+    jpegQuality_ = std::min(std::max(quality, 1u), 100u);
+  }
+
+  u64 FrameCapture::GetCapturedCount() const
+  {
+    return capturedCount_;
+  }
+
+  u64 FrameCapture::GetDroppedCount() const
+  {
+    return droppedCount_ + reader_.GetFailedCount();
+  }
+
+  u32 FrameCapture::GetPendingCount()
+  {
+    u32 const pending = reader_.GetPendingCount();
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending + static_cast<u32>(jobs_.size()) + encodingCount_;
+  }
+
+  void FrameCapture::Enqueue(Image &image, std::string const &path,
+    ImageFormat format)
+  {
+    // unless flushing, drop the frame if the encoder is too far behind
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (flushing_)
+      idle_.wait(lock, [this]() { return jobs_.size() < MaxQueuedEncodes; });
+    else if (jobs_.size() >= MaxQueuedEncodes)
+    {
+      ++droppedCount_;
+      return;
+    }
+
+    // take the pixels, and give the reader a recycled image in exchange
+    jobs_.push_back(EncodeJob());
+    jobs_.back().image.Swap(image);
+    jobs_.back().path = path;
+    jobs_.back().format = format;
+    jobs_.back().quality = jpegQuality_;
+    if (!freeImages_.empty())
+    {
+      image.Swap(freeImages_.back());
+      freeImages_.pop_back();
+    }
+    wake_.notify_one();
+  }
+
+  void FrameCapture::EncoderMain()
+  {
+    std::vector<u8> encoded; // reused between frames
+    for (;;)
+    {
+      EncodeJob job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this]() { return quitting_ || !jobs_.empty(); });
+        if (jobs_.empty())
+          return; // quitting and nothing left to encode
+        job.image.Swap(jobs_.front().image);
+        job.path = jobs_.front().path;
+        job.format = jobs_.front().format;
+        job.quality = jobs_.front().quality;
+        jobs_.pop_front();
+        ++encodingCount_;
+      }
+      idle_.notify_all(); // a queue slot became available
+
+      bool const written = ImageWriter::Encode(job.image, job.format,
+        job.quality, encoded) && FileSystem::WriteFileContents(job.path,
+        encoded.data(), encoded.size());
+      WarnIf(!written, "Warning: unable to write frame capture: %s",
+        job.path.c_str());
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        freeImages_.push_back(Image());
+        freeImages_.back().Swap(job.image);
+        --encodingCount_;
+      }
+      idle_.notify_all();
+    }
+  }
+}
@@ -0,0 +1,407 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/FileSystem.h"
+#include "graphics/FrameHistory.h"
+#include "graphics/ImageWriter.h"
+#include <STB/stb_image.h>
+
+namespace
+{
+  using Graphics::Image;
+
+  // Samples waiting for the history thread beyond this are dropped.
+  static size_t const MaxQueuedFrames = 4;
+
+  // Averages each factor x factor block of pixels into one. Pixels past the
+  // last whole block in either direction are ignored.
+  void Downscale(Image const &source, u32 factor, Image &destination)
+  {
+    u32 const channelCount = source.GetChannelCount();
+    u32 const width = std::max(source.GetWidth() / factor, 1u);
+    u32 const height = std::max(source.GetHeight() / factor, 1u);
+    u32 const blockWidth = std::min(factor, source.GetWidth());
+    u32 const blockHeight = std::min(factor, source.GetHeight());
+    u32 const area = blockWidth * blockHeight;
+    destination.Resize(width, height, channelCount);
+
+    u32 sums[4];
+    for (u32 y = 0; y < height; ++y)
+    {
+      u8 *out = destination.GetRow(y);
+      for (u32 x = 0; x < width; ++x)
+      {
+        std::fill(sums, sums + 4, area / 2);
+        for (u32 by = 0; by < blockHeight; ++by)
+        {
+          u8 const *in = source.GetRow(y * blockHeight + by) +
+            size_t(x) * blockWidth * channelCount;
+          for (u32 i = 0; i < blockWidth * channelCount; ++i)
+            sums[i % channelCount] += in[i];
+        }
+        for (u32 c = 0; c < channelCount; ++c)
+          *out++ = u8(sums[c] / area);
+      }
+    }
+  }
+
+  // Restores the pixels of a stored frame, decoding it if it was compressed.
+  bool Decode(u8 const *data, size_t size, u32 width, u32 height,
+    Graphics::FrameStorage storage, Image &image)
+  {
+    image.Resize(width, height, 3);
+    if (storage == Graphics::FrameStorage::Raw)
+    {
+      if (size != image.GetSize())
+        return false;
+      std::memcpy(image.GetPixels(), data, size);
+      return true;
+    }
+
+    int w = 0, h = 0, n = 0;
+    stbi_uc *pixels = stbi_load_from_memory(data, static_cast<int>(size), &w,
+      &h, &n, 3);
+    bool const decoded = pixels && u32(w) == width && u32(h) == height;
+    if (decoded)
+      std::memcpy(image.GetPixels(), pixels, image.GetSize());
+    stbi_image_free(pixels);
+    return decoded;
+  }
+}
+
+namespace Graphics
+{
+  FrameHistorySettings::FrameHistorySettings()
+    : seconds(10.f), frameRate(30.f), downscale(2),
+    storage(FrameStorage::Jpeg), jpegQuality(85),
+    memoryBudget(256 * 1024 * 1024)
+  {
+  }
+
+  FrameHistory::FrameHistory(FrameHistorySettings const &settings)
+    : settings_(settings), reader_(2), nextSampleTime_(0), flushing_(false),
+    frameCount_(0), duration_(0), memoryUsed_(0), droppedCount_(0),
+    busyCount_(0), saveCount_(0), quitting_(false)
+  {
+    settings_.frameRate = std::max(settings_.frameRate, 1.f);
+    settings_.downscale = std::max(settings_.downscale, 1u);
+    settings_.jpegQuality = std::min(std::max(settings_.jpegQuality, 1u), 100u);
+    freeImages_.reserve(MaxQueuedFrames + 2);
+    thread_ = std::thread(&FrameHistory::HistoryMain, this);
+  }
+
+  FrameHistory::~FrameHistory()
+  {
+    flushing_ = true;
+    reader_.Finish();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      idle_.wait(lock, [this]() { return jobs_.empty() && busyCount_ == 0; });
+      quitting_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+  }
+
+  bool FrameHistory::Capture(u32 width, u32 height, f64 time)
+  {
+    if (time < nextSampleTime_)
+      return false;
+
+    bool const queued = reader_.ReadAsync(0, 0, width, height, 3,
+      [this, time](Image &image) { Enqueue(image, time); });
+    if (!queued)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++droppedCount_;
+      return false; // try again next frame
+    }
+
+    // keep the average rate without sampling twice in a row to catch up
+    nextSampleTime_ = std::max(nextSampleTime_ + 1.0 / settings_.frameRate,
+      time);
+    return true;
+  }
+
+  void FrameHistory::Update()
+  {
+    reader_.Update();
+  }
+
+  void FrameHistory::Save(f32 seconds, std::string const &directory,
+    FrameDumpFormat format)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(Job());
+      jobs_.back().time = 0;
+      jobs_.back().save = true;
+      jobs_.back().seconds = seconds;
+      jobs_.back().directory = directory;
+      jobs_.back().format = format;
+      ++saveCount_;
+    }
+    wake_.notify_one();
+  }
+
+  FrameHistorySettings const &FrameHistory::GetSettings() const
+  {
+    return settings_;
+  }
+
+  u32 FrameHistory::GetFrameCount()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frameCount_;
+  }
+
+  f64 FrameHistory::GetDuration()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return duration_;
+  }
+
+  size_t FrameHistory::GetMemoryUsed()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return memoryUsed_;
+  }
+
+  u64 FrameHistory::GetDroppedCount()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return droppedCount_ + reader_.GetFailedCount();
+  }
+
+  bool FrameHistory::IsSaving()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return saveCount_ > 0;
+  }
+
+  void FrameHistory::Enqueue(Image &image, f64 time)
+  {
+    // unless shutting down, drop the sample if the history thread is behind
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (flushing_)
+      idle_.wait(lock, [this]() { return jobs_.size() < MaxQueuedFrames; });
+    else if (jobs_.size() >= MaxQueuedFrames)
+    {
+      ++droppedCount_;
+      return;
+    }
+
+    // take the pixels, and give the reader a recycled image in exchange
+    jobs_.push_back(Job());
+    jobs_.back().image.Swap(image);
+    jobs_.back().time = time;
+    jobs_.back().save = false;
+    if (!freeImages_.empty())
+    {
+      image.Swap(freeImages_.back());
+      freeImages_.pop_back();
+    }
+    wake_.notify_one();
+  }
+
+  void FrameHistory::HistoryMain()
+  {
+    Image scratch; // downscaled or decoded pixels, reused between frames
+    for (;;)
+    {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this]() { return quitting_ || !jobs_.empty(); });
+        if (jobs_.empty())
+          return; // quitting and nothing left to do
+        job.image.Swap(jobs_.front().image);
+        job.time = jobs_.front().time;
+        job.save = jobs_.front().save;
+        job.seconds = jobs_.front().seconds;
+        job.directory = jobs_.front().directory;
+        job.format = jobs_.front().format;
+        jobs_.pop_front();
+        ++busyCount_;
+      }
+      idle_.notify_all(); // a queue slot became available
+
+      if (job.save)
+      {
+        bool const written = Write(job.seconds, job.directory, job.format);
+        WarnIf(!written, "Warning: unable to save frame history to %s",
+          job.directory.c_str());
+      }
+      else
+        Store(job.image, job.time, scratch);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (job.save)
+          --saveCount_;
+        else
+        {
+          freeImages_.push_back(Image());
+          freeImages_.back().Swap(job.image);
+        }
+        --busyCount_;
+      }
+      idle_.notify_all();
+    }
+  }
+
+  void FrameHistory::Store(Image const &image, f64 time, Image &scratch)
+  {
+    Image const *source = &image;
+    if (settings_.downscale > 1)
+    {
+      Downscale(image, settings_.downscale, scratch);
+      source = &scratch;
+    }
+
+    // encode into the buffer of the last evicted frame, if there is one
+    StoredFrame frame;
+    frame.time = time;
+    frame.width = source->GetWidth();
+    frame.height = source->GetHeight();
+    frame.data.swap(spareData_);
+    bool stored = true;
+    switch (settings_.storage)
+    {
+    case FrameStorage::Raw:
+      frame.data.assign(source->GetPixels(),
+        source->GetPixels() + source->GetSize());
+      break;
+    case FrameStorage::Png:
+      stored = ImageWriter::Encode(*source, ImageFormat::Png, 0, frame.data);
+      break;
+    case FrameStorage::Jpeg:
+      stored = ImageWriter::Encode(*source, ImageFormat::Jpeg,
+        settings_.jpegQuality, frame.data);
+      break;
+    default:
+      stored = false;
+    }
+    WarnIf(!stored, "Warning: unable to compress frame history sample.");
+
+    size_t memoryUsed = memoryUsed_;
+    if (stored)
+    {
+      memoryUsed += frame.data.size();
+      frames_.push_back(StoredFrame());
+      frames_.back().time = frame.time;
+      frames_.back().width = frame.width;
+      frames_.back().height = frame.height;
+      frames_.back().data.swap(frame.data);
+    }
+    else
+      spareData_.swap(frame.data);
+
+    // evict from the front until both the time span and the memory fit
+    while (frames_.size() > 1 && (memoryUsed > settings_.memoryBudget ||
+      frames_.back().time - frames_.front().time > settings_.seconds))
+    {
+      memoryUsed -= frames_.front().data.size();
+      spareData_.swap(frames_.front().data);
+      frames_.pop_front();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    frameCount_ = static_cast<u32>(frames_.size());
+    duration_ = frames_.empty() ? 0 :
+      frames_.back().time - frames_.front().time;
+    memoryUsed_ = memoryUsed;
+    droppedCount_ += stored ? 0 : 1;
+  }
+
+  bool FrameHistory::Write(f32 seconds, std::string const &directory,
+    FrameDumpFormat format)
+  {
+    if (frames_.empty())
+      return false;
+
+    std::vector<StoredFrame const *> frames;
+    f64 const start = frames_.back().time - seconds;
+    for (auto const &frame : frames_)
+      if (frame.time >= start)
+        frames.push_back(&frame);
+
+    if (!FileSystem::MakeDirectory(directory))
+      return false;
+    if (format == FrameDumpFormat::RawVideo)
+      return WriteVideo(frames, directory + "/history.y4m");
+
+    // compressed frames already are image files; raw ones become PNGs
+    ImageFormat const imageFormat = settings_.storage == FrameStorage::Jpeg ?
+      ImageFormat::Jpeg : ImageFormat::Png;
+    Image image;
+    bool written = true;
+    for (size_t i = 0; i < frames.size() && written; ++i)
+    {
+      StoredFrame const &frame = *frames[i];
+      char name[32];
+      sprintf(name, "/frame%06u.%s", static_cast<u32>(i),
+        ImageWriter::GetExtension(imageFormat));
+      std::string const path = directory + name;
+
+      if (settings_.storage == FrameStorage::Raw)
+        written = Decode(frame.data.data(), frame.data.size(), frame.width,
+          frame.height, settings_.storage, image) &&
+          ImageWriter::Write(path, image, imageFormat);
+      else
+        written = FileSystem::WriteFileContents(path, frame.data.data(),
+          frame.data.size());
+    }
+    return written;
+  }
+
+  bool FrameHistory::WriteVideo(
+    std::vector<StoredFrame const *> const &frames, std::string const &path)
+  {
+    // YUV4MPEG2 needs one size for the whole video; the first frame decides
+    // (frames sampled across a window resize are skipped). Frames are played
+    // back at the nominal sampling rate, even if some samples were dropped.
+    u32 const width = frames.front()->width;
+    u32 const height = frames.front()->height;
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+
+    char header[96];
+    sprintf(header, "YUV4MPEG2 W%u H%u F%u:1000 Ip A1:1 C444\n", width,
+      height, static_cast<u32>(settings_.frameRate * 1000.f + 0.5f));
+    file << header;
+
+    // full resolution planes (4:4:4), BT.601 limited range
+    size_t const planeSize = size_t(width) * height;
+    std::vector<u8> planes(planeSize * 3);
+    Image image;
+    u32 skipped = 0;
+    for (auto frame : frames)
+    {
+      if (frame->width != width || frame->height != height ||
+        !Decode(frame->data.data(), frame->data.size(), width, height,
+        settings_.storage, image))
+      {
+        ++skipped;
+        continue;
+      }
+
+      u8 const *pixel = image.GetPixels();
+      for (size_t i = 0; i < planeSize; ++i, pixel += 3)
+      {
+        s32 const r = pixel[0], g = pixel[1], b = pixel[2];
+        planes[i] = u8(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        planes[planeSize + i] =
+          u8(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        planes[2 * planeSize + i] =
+          u8(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+      }
+      file << "FRAME\n";
+      file.write(reinterpret_cast<char const *>(planes.data()),
+        planes.size());
+    }
+    WarnIf(skipped != 0, "Warning: %u frames of a different size were left "
+      "out of %s", skipped, path.c_str());
+    return static_cast<bool>(file);
+  }
+}
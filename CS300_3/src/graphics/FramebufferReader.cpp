@@ -0,0 +1,188 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "graphics/FramebufferReader.h"
+
+namespace
+{
+  // Only used when waiting: how long a single glClientWaitSync may block.
+  static GLuint64 const FenceWaitNanoseconds = 100000000; // 100 ms
+
+  GLenum GetPixelFormat(u32 channelCount)
+  {
+    static GLenum const Formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    Assert(channelCount >= 1 && channelCount <= 4,
+      "Error: cannot read back %d channels.", channelCount);
+    return Formats[channelCount - 1];
+  }
+
+  // Issues the one glReadPixels call for a region, into client memory or,
+  // with a pixel-pack buffer bound, into that buffer at offset 0. Rows are
+  // tightly packed so that they match Image.
+  void ReadPixels(s32 x, s32 y, u32 width, u32 height, u32 channelCount,
+    void *destination)
+  {
+    GLint packAlignment = 4;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(x, y, width, height, GetPixelFormat(channelCount),
+      GL_UNSIGNED_BYTE, destination);
+    glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+  }
+}
+
+namespace Graphics
+{
+  void FramebufferReader::Read(s32 x, s32 y, u32 width, u32 height,
+    u32 channelCount, Image &image)
+  {
+    image.Resize(width, height, channelCount);
+    if (image.IsEmpty())
+      return;
+    ReadPixels(x, y, width, height, channelCount, image.GetPixels());
+    image.FlipVertically(); // OpenGL returns rows bottom-up
+  }
+
+  void FramebufferReader::ReadViewport(u32 channelCount, Image &image)
+  {
+    GLint viewport[4] = { 0 };
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    Read(viewport[0], viewport[1], viewport[2], viewport[3], channelCount,
+      image);
+  }
+
+  FramebufferReader::FramebufferReader(u32 bufferCount)
+    : readbacks_(std::max(bufferCount, 1u)), nextReadback_(0), failedCount_(0)
+  {
+    for (auto &readback : readbacks_)
+    {
+      glGenBuffers(1, &readback.buffer);
+      readback.fence = NULL;
+      readback.capacity = 0;
+      readback.inFlight = false;
+    }
+  }
+
+  FramebufferReader::~FramebufferReader()
+  {
+    Finish();
+    for (auto &readback : readbacks_)
+      glDeleteBuffers(1, &readback.buffer);
+  }
+
+  bool FramebufferReader::ReadAsync(s32 x, s32 y, u32 width, u32 height,
+    u32 channelCount, Callback const &callback)
+  {
+    // the next buffer in the ring is also the oldest one; if its readback has
+    // not finished yet, the GPU is too far behind to accept another
+    Readback &readback = readbacks_[nextReadback_];
+    if (readback.inFlight && !Collect(readback, false))
+      return false;
+
+    readback.image.Resize(width, height, channelCount);
+    size_t const size = readback.image.GetSize();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    if (readback.capacity != size)
+    {
+      glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+      readback.capacity = size;
+    }
+
+    // with a pack buffer bound, glReadPixels only records the copy
+    ReadPixels(x, y, width, height, channelCount, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.callback = callback;
+    readback.inFlight = true;
+    nextReadback_ = (nextReadback_ + 1) % readbacks_.size();
+    return true;
+  }
+
+  void FramebufferReader::Update()
+  {
+    // deliver in queue order, stopping at the first unfinished readback
+    for (size_t i = 0; i < readbacks_.size(); ++i)
+    {
+      Readback &readback =
+        readbacks_[(nextReadback_ + i) % readbacks_.size()];
+      if (readback.inFlight && !Collect(readback, false))
+        break;
+    }
+  }
+
+  void FramebufferReader::Finish()
+  {
+    for (size_t i = 0; i < readbacks_.size(); ++i)
+    {
+      Readback &readback =
+        readbacks_[(nextReadback_ + i) % readbacks_.size()];
+      if (readback.inFlight)
+        Collect(readback, true);
+    }
+  }
+
+  u32 FramebufferReader::GetPendingCount() const
+  {
+    u32 pending = 0;
+    for (auto const &readback : readbacks_)
+      pending += readback.inFlight ? 1 : 0;
+    return pending;
+  }
+
+  u64 FramebufferReader::GetFailedCount() const
+  {
+    return failedCount_;
+  }
+
+  bool FramebufferReader::Collect(Readback &readback, bool wait)
+  {
+    GLenum status = glClientWaitSync(readback.fence,
+      wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? FenceWaitNanoseconds : 0);
+    while (wait && status == GL_TIMEOUT_EXPIRED)
+      status = glClientWaitSync(readback.fence, 0, FenceWaitNanoseconds);
+    if (status == GL_TIMEOUT_EXPIRED)
+      return false; // still in flight
+
+    glDeleteSync(readback.fence);
+    readback.fence = NULL;
+    readback.inFlight = false;
+
+    // the callback is moved out first, so that it may queue another readback
+    Callback callback;
+    callback.swap(readback.callback);
+    if (status == GL_WAIT_FAILED)
+    {
+      ++failedCount_;
+      return true;
+    }
+
+    // The image is swapped out of the slot for the callback, so that a
+    // readback the callback queues into this same slot cannot resize or
+    // overwrite it; it is handed back afterwards for reuse if the slot is
+    // still free. OpenGL returns rows bottom-up; flip them while copying out
+    // of the PBO.
+    Image image;
+    image.Swap(readback.image);
+    u32 const height = image.GetHeight();
+    size_t const rowSize = image.GetRowSize();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    u8 const *pixels = static_cast<u8 const *>(glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0, readback.capacity, GL_MAP_READ_BIT));
+    if (pixels)
+    {
+      for (u32 y = 0; y < height; ++y)
+        std::memcpy(image.GetRow(height - 1 - y), pixels + y * rowSize,
+          rowSize);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    WarnIf(!pixels, "Warning: unable to map framebuffer readback buffer.");
+
+    if (!pixels)
+      ++failedCount_;
+    else if (callback)
+      callback(image);
+    if (!readback.inFlight)
+      readback.image.Swap(image);
+    return true;
+  }
+}
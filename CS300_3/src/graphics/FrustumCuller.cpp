@@ -0,0 +1,258 @@
+#include "Precompiled.h"
+#include "framework/Simd.h"
+#include "framework/ThreadPool.h"
+#include "graphics/FrustumCuller.h"
+
+namespace
+{
+  using Math::Matrix4;
+  using Math::Vector3;
+
+  // Objects culled per ParallelFor chunk; a multiple of eight, so that every
+  // chunk starts on a group of eight.
+  static size_t const CullGrain = 4 * 1024;
+
+  size_t RoundUpToEight(size_t value)
+  {
+    return (value + 7) & ~size_t(7);
+  }
+}
+
+namespace Graphics
+{
+  FrustumPlanes::FrustumPlanes(Matrix4 const &m)
+  {
+    f32 const rows[4][4] = {
+      { m.m00, m.m01, m.m02, m.m03 },
+      { m.m10, m.m11, m.m12, m.m13 },
+      { m.m20, m.m21, m.m22, m.m23 },
+      { m.m30, m.m31, m.m32, m.m33 }
+    };
+    for (u32 i = 0; i < 6; ++i)
+    {
+      f32 const sign = (i & 1) ? -1.f : 1.f;
+      f32 const *row = rows[i / 2];
+      f32 plane[4];
+      for (u32 j = 0; j < 4; ++j)
+        plane[j] = rows[3][j] + sign * row[j];
+      f32 const length = std::sqrt(plane[0] * plane[0]
+        + plane[1] * plane[1] + plane[2] * plane[2]);
+      f32 const scale = length > 0.f ? 1.f / length : 0.f;
+      x[i] = plane[0] * scale;
+      y[i] = plane[1] * scale;
+      z[i] = plane[2] * scale;
+      w[i] = plane[3] * scale;
+    }
+  }
+
+  void TransformBox(Vector3 const &minimum, Vector3 const &maximum,
+    Matrix4 const &model, Vector3 &transformedMinimum,
+    Vector3 &transformedMaximum)
+  {
+    Vector3 const c = (minimum + maximum) * 0.5f;
+    Vector3 const e = (maximum - minimum) * 0.5f;
+    Vector3 const center(
+      model.m00 * c.x + model.m01 * c.y + model.m02 * c.z + model.m03,
+      model.m10 * c.x + model.m11 * c.y + model.m12 * c.z + model.m13,
+      model.m20 * c.x + model.m21 * c.y + model.m22 * c.z + model.m23);
+    Vector3 const extent(
+      std::abs(model.m00) * e.x + std::abs(model.m01) * e.y
+        + std::abs(model.m02) * e.z,
+      std::abs(model.m10) * e.x + std::abs(model.m11) * e.y
+        + std::abs(model.m12) * e.z,
+      std::abs(model.m20) * e.x + std::abs(model.m21) * e.y
+        + std::abs(model.m22) * e.z);
+    transformedMinimum = center - extent;
+    transformedMaximum = center + extent;
+  }
+
+  FrustumCuller::FrustumCuller()
+    : count_(0)
+  {
+    std::memset(&stats_, 0, sizeof(stats_));
+  }
+
+  void FrustumCuller::Clear()
+  {
+    count_ = 0;
+    centerX_.clear();
+    centerY_.clear();
+    centerZ_.clear();
+    extentX_.clear();
+    extentY_.clear();
+    extentZ_.clear();
+    radius_.clear();
+  }
+
+  u32 FrustumCuller::AddBox(Vector3 const &minimum, Vector3 const &maximum)
+  {
+    Vector3 const center = (minimum + maximum) * 0.5f;
+    Vector3 const extent = (maximum - minimum) * 0.5f;
+    return add(center.x, center.y, center.z, extent.x, extent.y, extent.z,
+      0.f);
+  }
+
+  u32 FrustumCuller::AddBox(Vector3 const &minimum, Vector3 const &maximum,
+    Matrix4 const &model)
+  {
+    Vector3 low, high;
+    TransformBox(minimum, maximum, model, low, high);
+    return AddBox(low, high);
+  }
+
+  u32 FrustumCuller::AddSphere(Vector3 const &center, f32 radius)
+  {
+    return add(center.x, center.y, center.z, 0.f, 0.f, 0.f, radius);
+  }
+
+  u32 FrustumCuller::add(f32 centerX, f32 centerY, f32 centerZ, f32 extentX,
+    f32 extentY, f32 extentZ, f32 radius)
+  {
+    // drop the padding left behind by a Cull, so that the new object lands
+    // at the index returned
+    if (centerX_.size() != count_)
+    {
+      centerX_.resize(count_);
+      centerY_.resize(count_);
+      centerZ_.resize(count_);
+      extentX_.resize(count_);
+      extentY_.resize(count_);
+      extentZ_.resize(count_);
+      radius_.resize(count_);
+    }
+    centerX_.push_back(centerX);
+    centerY_.push_back(centerY);
+    centerZ_.push_back(centerZ);
+    extentX_.push_back(extentX);
+    extentY_.push_back(extentY);
+    extentZ_.push_back(extentZ);
+    radius_.push_back(radius);
+    return u32(count_++);
+  }
+
+  FrustumCullStats const &FrustumCuller::Cull(Matrix4 const &viewProjection)
+  {
+    auto const start = std::chrono::high_resolution_clock::now();
+    std::memset(&stats_, 0, sizeof(stats_));
+    stats_.objectCount = u32(count_);
+
+    // padding is tested like any object, but its result is never read
+    size_t const padded = RoundUpToEight(count_);
+    centerX_.resize(padded, 0.f);
+    centerY_.resize(padded, 0.f);
+    centerZ_.resize(padded, 0.f);
+    extentX_.resize(padded, 0.f);
+    extentY_.resize(padded, 0.f);
+    extentZ_.resize(padded, 0.f);
+    radius_.resize(padded, 0.f);
+    visible_.resize(padded);
+
+    // an object is outside when even its corner (or point of its sphere)
+    // furthest along a plane's normal is behind that plane:
+    // dot(n, center) + w + dot(|n|, extent) + radius < 0
+    FrustumPlanes const planes(viewProjection);
+    std::atomic<u32> visibleCount(0);
+    ThreadPool::GetInstance().ParallelFor(0, padded, CullGrain,
+      [&](size_t begin, size_t end)
+    {
+      u32 visible = 0;
+#if USE_AVX
+      __m256 const signMask = _mm256_set1_ps(-0.f);
+      for (size_t i = begin; i < end; i += 8)
+      {
+        __m256 const cx = _mm256_loadu_ps(&centerX_[i]);
+        __m256 const cy = _mm256_loadu_ps(&centerY_[i]);
+        __m256 const cz = _mm256_loadu_ps(&centerZ_[i]);
+        __m256 const ex = _mm256_loadu_ps(&extentX_[i]);
+        __m256 const ey = _mm256_loadu_ps(&extentY_[i]);
+        __m256 const ez = _mm256_loadu_ps(&extentZ_[i]);
+        __m256 const r = _mm256_loadu_ps(&radius_[i]);
+        __m256 outside = _mm256_setzero_ps();
+        for (u32 p = 0; p < 6; ++p)
+        {
+          __m256 const nx = _mm256_set1_ps(planes.x[p]);
+          __m256 const ny = _mm256_set1_ps(planes.y[p]);
+          __m256 const nz = _mm256_set1_ps(planes.z[p]);
+          __m256 distance = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(cx, nx), _mm256_mul_ps(cy, ny)),
+            _mm256_add_ps(_mm256_mul_ps(cz, nz), _mm256_set1_ps(planes.w[p])));
+          __m256 const reach = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(ex, _mm256_andnot_ps(signMask, nx)),
+            _mm256_mul_ps(ey, _mm256_andnot_ps(signMask, ny))),
+            _mm256_add_ps(_mm256_mul_ps(ez, _mm256_andnot_ps(signMask, nz)), r));
+          distance = _mm256_add_ps(distance, reach);
+          outside = _mm256_or_ps(outside,
+            _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        int const outsideMask = _mm256_movemask_ps(outside);
+        for (u32 k = 0; k < 8; ++k)
+        {
+          visible_[i + k] = u8(~(outsideMask >> k) & 1);
+          if (i + k < count_)
+            visible += visible_[i + k];
+        }
+      }
+#elif USE_SSE
+      __m128 const signMask = _mm_set1_ps(-0.f);
+      for (size_t i = begin; i < end; i += 4)
+      {
+        __m128 const cx = _mm_loadu_ps(&centerX_[i]);
+        __m128 const cy = _mm_loadu_ps(&centerY_[i]);
+        __m128 const cz = _mm_loadu_ps(&centerZ_[i]);
+        __m128 const ex = _mm_loadu_ps(&extentX_[i]);
+        __m128 const ey = _mm_loadu_ps(&extentY_[i]);
+        __m128 const ez = _mm_loadu_ps(&extentZ_[i]);
+        __m128 const r = _mm_loadu_ps(&radius_[i]);
+        __m128 outside = _mm_setzero_ps();
+        for (u32 p = 0; p < 6; ++p)
+        {
+          __m128 const nx = _mm_set1_ps(planes.x[p]);
+          __m128 const ny = _mm_set1_ps(planes.y[p]);
+          __m128 const nz = _mm_set1_ps(planes.z[p]);
+          __m128 distance = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(cx, nx), _mm_mul_ps(cy, ny)),
+            _mm_add_ps(_mm_mul_ps(cz, nz), _mm_set1_ps(planes.w[p])));
+          __m128 const reach = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(ex, _mm_andnot_ps(signMask, nx)),
+            _mm_mul_ps(ey, _mm_andnot_ps(signMask, ny))),
+            _mm_add_ps(_mm_mul_ps(ez, _mm_andnot_ps(signMask, nz)), r));
+          distance = _mm_add_ps(distance, reach);
+          outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+        }
+        int const outsideMask = _mm_movemask_ps(outside);
+        for (u32 k = 0; k < 4; ++k)
+        {
+          visible_[i + k] = u8(~(outsideMask >> k) & 1);
+          if (i + k < count_)
+            visible += visible_[i + k];
+        }
+      }
+#else
+      for (size_t i = begin; i < end; ++i)
+      {
+        u8 inside = 1;
+        for (u32 p = 0; p < 6 && inside; ++p)
+        {
+          if (centerX_[i] * planes.x[p] + centerY_[i] * planes.y[p]
+            + centerZ_[i] * planes.z[p] + planes.w[p]
+            + extentX_[i] * std::abs(planes.x[p])
+            + extentY_[i] * std::abs(planes.y[p])
+            + extentZ_[i] * std::abs(planes.z[p]) + radius_[i] < 0.f)
+            inside = 0;
+        }
+        visible_[i] = inside;
+        if (i < count_)
+          visible += inside;
+      }
+#endif
+      visibleCount += visible;
+    });
+
+    stats_.visibleObjects = visibleCount;
+    stats_.culledObjects = stats_.objectCount - stats_.visibleObjects;
+    auto const stop = std::chrono::high_resolution_clock::now();
+    stats_.milliseconds = std::chrono::duration<f64, std::milli>(
+      stop - start).count();
+    return stats_;
+  }
+}
@@ -0,0 +1,43 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "graphics/Image.h"
+
+namespace Graphics
+{
+  Image::Image() : width_(0), height_(0), channelCount_(0), pixels_()
+  {
+  }
+
+  Image::Image(u32 width, u32 height, u32 channelCount)
+    : width_(0), height_(0), channelCount_(0), pixels_()
+  {
+    Resize(width, height, channelCount);
+  }
+
+  void Image::Resize(u32 width, u32 height, u32 channelCount)
+  {
+    Assert(channelCount >= 1 && channelCount <= 4,
+      "Error: images must have 1 to 4 channels, not %d", channelCount);
+    width_ = width;
+    height_ = height;
+    channelCount_ = channelCount;
+    pixels_.resize(size_t(width) * height * channelCount);
+  }
+
+  void Image::FlipVertically()
+  {
+    if (height_ < 2)
+      return;
+    size_t const rowSize = GetRowSize();
+    for (u32 top = 0, bottom = height_ - 1; top < bottom; ++top, --bottom)
+      std::swap_ranges(GetRow(top), GetRow(top) + rowSize, GetRow(bottom));
+  }
+
+  void Image::Swap(Image &other)
+  {
+    std::swap(width_, other.width_);
+    std::swap(height_, other.height_);
+    std::swap(channelCount_, other.channelCount_);
+    pixels_.swap(other.pixels_);
+  }
+}
@@ -0,0 +1,800 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/FileSystem.h"
+#include "graphics/Image.h"
+#include "graphics/ImageWriter.h"
+
+namespace
+{
+  using Graphics::Image;
+
+  static void PutU16LE(std::vector<u8> &out, u32 value)
+  {
+    out.push_back(static_cast<u8>(value));
+    out.push_back(static_cast<u8>(value >> 8));
+  }
+
+  static void PutU32LE(std::vector<u8> &out, u32 value)
+  {
+    PutU16LE(out, value & 0xFFFF);
+    PutU16LE(out, value >> 16);
+  }
+
+  static void PutU16BE(std::vector<u8> &out, u32 value)
+  {
+    out.push_back(static_cast<u8>(value >> 8));
+    out.push_back(static_cast<u8>(value));
+  }
+
+  static void PutU32BE(std::vector<u8> &out, u32 value)
+  {
+    PutU16BE(out, value >> 16);
+    PutU16BE(out, value & 0xFFFF);
+  }
+
+  // Reads the pixel at the given index as RGB, expanding gray images.
+  static void GetRGB(Image const &image, u8 const *pixel, u8 rgb[3])
+  {
+    if (image.GetChannelCount() >= 3)
+    {
+      rgb[0] = pixel[0];
+      rgb[1] = pixel[1];
+      rgb[2] = pixel[2];
+    }
+    else
+      rgb[0] = rgb[1] = rgb[2] = pixel[0];
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // PNG
+
+  struct CrcTable
+  {
+    u32 entries[256];
+
+    CrcTable()
+    {
+      for (u32 n = 0; n < 256; ++n)
+      {
+        u32 c = n;
+        for (u32 k = 0; k < 8; ++k)
+          c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        entries[n] = c;
+      }
+    }
+  };
+
+  static CrcTable const Crc;
+
+  static u32 UpdateCrc(u32 crc, u8 const *data, size_t size)
+  {
+    for (size_t i = 0; i < size; ++i)
+      crc = Crc.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+  }
+
+  static u32 Adler32(u8 const *data, size_t size)
+  {
+    u32 a = 1, b = 0;
+    while (size > 0)
+    {
+      // 5552 is the largest block for which b cannot overflow before the modulo
+      size_t const block = std::min<size_t>(size, 5552);
+      for (size_t i = 0; i < block; ++i)
+      {
+        a += data[i];
+        b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+      data += block;
+      size -= block;
+    }
+    return (b << 16) | a;
+  }
+
+  // Writes a deflate stream bit by bit, least significant bit first.
+  class DeflateWriter
+  {
+  public:
+    DeflateWriter(std::vector<u8> &out) : out_(out), bits_(0), bitCount_(0)
+    {
+    }
+
+    void WriteBits(u32 bits, u32 count)
+    {
+      bits_ |= bits << bitCount_;
+      bitCount_ += count;
+      while (bitCount_ >= 8)
+      {
+        out_.push_back(static_cast<u8>(bits_));
+        bits_ >>= 8;
+        bitCount_ -= 8;
+      }
+    }
+
+    // Huffman codes are defined most significant bit first.
+    void WriteCode(u32 code, u32 length)
+    {
+      u32 reversed = 0;
+      for (u32 i = 0; i < length; ++i)
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+      WriteBits(reversed, length);
+    }
+
+    // Literal/length symbol using the fixed Huffman code (RFC 1951, 3.2.6).
+    void WriteSymbol(u32 symbol)
+    {
+      if (symbol <= 143)
+        WriteCode(0x30 + symbol, 8);
+      else if (symbol <= 255)
+        WriteCode(0x190 + symbol - 144, 9);
+      else if (symbol <= 279)
+        WriteCode(symbol - 256, 7);
+      else
+        WriteCode(0xC0 + symbol - 280, 8);
+    }
+
+    void WriteMatch(u32 length, u32 distance)
+    {
+      static u16 const LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13,
+        15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195,
+        227, 258 };
+      static u8 const LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1,
+        2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+      static u16 const DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25,
+        33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577 };
+      static u8 const DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4,
+        4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+      u32 l = 28;
+      while (LengthBase[l] > length)
+        --l;
+      WriteSymbol(257 + l);
+      WriteBits(length - LengthBase[l], LengthExtra[l]);
+
+      u32 d = 29;
+      while (DistanceBase[d] > distance)
+        --d;
+      WriteCode(d, 5);
+      WriteBits(distance - DistanceBase[d], DistanceExtra[d]);
+    }
+
+    void Flush()
+    {
+      if (bitCount_ > 0)
+        out_.push_back(static_cast<u8>(bits_));
+      bits_ = 0;
+      bitCount_ = 0;
+    }
+
+  private:
+    DeflateWriter &operator=(DeflateWriter const &) = delete;
+
+    std::vector<u8> &out_;
+    u32 bits_, bitCount_;
+  };
+
+  // Compresses data into a zlib stream: a single deflate block using the
+  // fixed Huffman code, with matches found through hash chains.
+  static void Deflate(u8 const *data, size_t size, std::vector<u8> &out)
+  {
+    static u32 const HashBits = 15;
+    static u32 const WindowSize = 32768;
+    static u32 const MaxChainLength = 32;
+    static u32 const MinMatch = 3, MaxMatch = 258;
+
+    out.push_back(0x78); // deflate, 32K window
+    out.push_back(0x01); // fastest compression level, no dictionary
+
+    DeflateWriter writer(out);
+    writer.WriteBits(1, 1); // final block
+    writer.WriteBits(1, 2); // fixed Huffman code
+
+    std::vector<s64> head(size_t(1) << HashBits, -1);
+    std::vector<s64> previous(WindowSize, -1);
+    auto hash = [data](size_t i) {
+      u32 const key = (u32(data[i]) << 16) | (u32(data[i + 1]) << 8)
+        | data[i + 2];
+      return (key * 2654435761u) >> (32 - HashBits);
+    };
+    auto insert = [&](size_t i) {
+      if (i + MinMatch > size)
+        return;
+      u32 const h = hash(i);
+      previous[i & (WindowSize - 1)] = head[h];
+      head[h] = static_cast<s64>(i);
+    };
+
+    size_t i = 0;
+    while (i < size)
+    {
+      u32 bestLength = 0, bestDistance = 0;
+      if (i + MinMatch <= size)
+      {
+        size_t const maxLength = std::min<size_t>(MaxMatch, size - i);
+        s64 candidate = head[hash(i)];
+        for (u32 chain = 0; chain < MaxChainLength && candidate >= 0; ++chain)
+        {
+          size_t const distance = i - static_cast<size_t>(candidate);
+          if (distance > WindowSize)
+            break;
+          u8 const *a = data + i, *b = data + candidate;
+          u32 length = 0;
+          while (length < maxLength && a[length] == b[length])
+            ++length;
+          if (length > bestLength)
+          {
+            bestLength = length;
+            bestDistance = static_cast<u32>(distance);
+            if (length == maxLength)
+              break;
+          }
+          s64 const next = previous[candidate & (WindowSize - 1)];
+          if (next >= candidate)
+            break; // the slot was reused by a newer position
+          candidate = next;
+        }
+      }
+
+      if (bestLength >= MinMatch)
+      {
+        writer.WriteMatch(bestLength, bestDistance);
+        for (u32 k = 0; k < bestLength; ++k)
+          insert(i + k);
+        i += bestLength;
+      }
+      else
+      {
+        writer.WriteSymbol(data[i]);
+        insert(i);
+        ++i;
+      }
+    }
+    writer.WriteSymbol(256); // end of block
+    writer.Flush();
+
+    PutU32BE(out, Adler32(data, size));
+  }
+
+  static u8 Paeth(u8 a, u8 b, u8 c)
+  {
+    s32 const p = s32(a) + b - c;
+    s32 const pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+      return a;
+    return pb <= pc ? b : c;
+  }
+
+  static void WriteChunk(std::vector<u8> &out, char const *type,
+    u8 const *data, size_t size)
+  {
+    PutU32BE(out, static_cast<u32>(size));
+    size_t const start = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (size > 0)
+      out.insert(out.end(), data, data + size);
+    u32 const crc = UpdateCrc(0xFFFFFFFFu, out.data() + start, size + 4);
+    PutU32BE(out, crc ^ 0xFFFFFFFFu);
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // JPEG
+
+  static u8 const ZigZag[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+  };
+
+  // Annex K quantization tables, in natural order.
+  static u8 const LuminanceQuantization[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+  };
+
+  static u8 const ChrominanceQuantization[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+  };
+
+  // Annex K Huffman tables: code counts per length (1-16), then symbols.
+  static u8 const DcLuminanceCounts[16] = {
+    0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+  static u8 const DcChrominanceCounts[16] = {
+    0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+  static u8 const DcSymbols[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+  static u8 const AcLuminanceCounts[16] = {
+    0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D };
+  static u8 const AcLuminanceSymbols[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+    0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08,
+    0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0, 0x24, 0x33, 0x62, 0x72,
+    0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45,
+    0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x73, 0x74, 0x75,
+    0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3,
+    0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6,
+    0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9,
+    0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4,
+    0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA
+  };
+
+  static u8 const AcChrominanceCounts[16] = {
+    0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+  static u8 const AcChrominanceSymbols[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+    0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0, 0x15, 0x62, 0x72, 0xD1,
+    0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+    0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x73, 0x74,
+    0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A,
+    0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4,
+    0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7,
+    0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+    0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4,
+    0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA
+  };
+
+  struct HuffmanTable
+  {
+    u8 const *counts, *symbols;
+    u16 codes[256];
+    u8 lengths[256];
+
+    // Assigns canonical codes to the symbols (JPEG Annex C).
+    HuffmanTable(u8 const *counts, u8 const *symbols)
+      : counts(counts), symbols(symbols)
+    {
+      std::memset(codes, 0, sizeof(codes));
+      std::memset(lengths, 0, sizeof(lengths));
+      u32 code = 0, k = 0;
+      for (u32 length = 1; length <= 16; ++length)
+      {
+        for (u32 i = 0; i < counts[length - 1]; ++i, ++k)
+        {
+          codes[symbols[k]] = static_cast<u16>(code++);
+          lengths[symbols[k]] = static_cast<u8>(length);
+        }
+        code <<= 1;
+      }
+    }
+
+    u32 GetSymbolCount() const
+    {
+      u32 count = 0;
+      for (u32 i = 0; i < 16; ++i)
+        count += counts[i];
+      return count;
+    }
+  };
+
+  static HuffmanTable const DcLuminance(DcLuminanceCounts, DcSymbols);
+  static HuffmanTable const DcChrominance(DcChrominanceCounts, DcSymbols);
+  static HuffmanTable const AcLuminance(AcLuminanceCounts,
+    AcLuminanceSymbols);
+  static HuffmanTable const AcChrominance(AcChrominanceCounts,
+    AcChrominanceSymbols);
+
+  // DCT basis: Basis[u][x] = c(u) * cos((2x + 1) u pi / 16)
+  struct DctBasis
+  {
+    f32 values[8][8];
+
+    DctBasis()
+    {
+      for (u32 u = 0; u < 8; ++u)
+        for (u32 x = 0; x < 8; ++x)
+          values[u][x] = static_cast<f32>((u == 0 ? std::sqrt(0.125)
+            : 0.5) * std::cos((2.0 * x + 1.0) * u * 3.14159265358979 / 16.0));
+    }
+  };
+
+  static DctBasis const Dct;
+
+  // Writes entropy coded data most significant bit first, stuffing a zero
+  // byte after every 0xFF as required by the JPEG format.
+  class JpegBitWriter
+  {
+  public:
+    JpegBitWriter(std::vector<u8> &out) : out_(out), bits_(0), bitCount_(0)
+    {
+    }
+
+    void WriteBits(u32 bits, u32 count)
+    {
+      bits_ = (bits_ << count) | (bits & ((1u << count) - 1));
+      bitCount_ += count;
+      while (bitCount_ >= 8)
+      {
+        u8 const byte = static_cast<u8>(bits_ >> (bitCount_ - 8));
+        out_.push_back(byte);
+        if (byte == 0xFF)
+          out_.push_back(0);
+        bitCount_ -= 8;
+      }
+    }
+
+    void Flush()
+    {
+      if (bitCount_ > 0)
+        WriteBits(0x7F, 8 - bitCount_); // pad with one bits
+    }
+
+  private:
+    JpegBitWriter &operator=(JpegBitWriter const &) = delete;
+
+    std::vector<u8> &out_;
+    u32 bits_, bitCount_;
+  };
+
+  static void BuildQuantizationTable(u8 const *base, u32 quality, u8 *table)
+  {
+    quality = std::min(std::max(quality, 1u), 100u);
+    u32 const scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (u32 i = 0; i < 64; ++i)
+      table[i] = static_cast<u8>(std::min(std::max((base[i] * scale + 50)
+        / 100, 1u), 255u));
+  }
+
+  static void EncodeBlock(f32 const block[64], u8 const *quantization,
+    HuffmanTable const &dc, HuffmanTable const &ac, s32 &previousDc,
+    JpegBitWriter &writer)
+  {
+    // separable forward DCT: C * block * C^T
+    f32 rows[64], transformed[64];
+    for (u32 y = 0; y < 8; ++y)
+      for (u32 u = 0; u < 8; ++u)
+      {
+        f32 sum = 0.f;
+        for (u32 x = 0; x < 8; ++x)
+          sum += block[y * 8 + x] * Dct.values[u][x];
+        rows[y * 8 + u] = sum;
+      }
+    for (u32 v = 0; v < 8; ++v)
+      for (u32 u = 0; u < 8; ++u)
+      {
+        f32 sum = 0.f;
+        for (u32 y = 0; y < 8; ++y)
+          sum += rows[y * 8 + u] * Dct.values[v][y];
+        transformed[v * 8 + u] = sum;
+      }
+
+    s32 coefficients[64];
+    for (u32 i = 0; i < 64; ++i)
+    {
+      u32 const natural = ZigZag[i];
+      f32 const q = transformed[natural] / quantization[natural];
+      coefficients[i] = static_cast<s32>(q < 0.f ? q - 0.5f : q + 0.5f);
+    }
+
+    // values are sent as a size category followed by that many bits
+    auto category = [](s32 value) {
+      u32 magnitude = static_cast<u32>(value < 0 ? -value : value), bits = 0;
+      while (magnitude)
+      {
+        ++bits;
+        magnitude >>= 1;
+      }
+      return bits;
+    };
+    auto writeValue = [&writer](s32 value, u32 bits) {
+      if (bits)
+        writer.WriteBits(static_cast<u32>(value < 0 ? value - 1 : value), bits);
+    };
+
+    s32 const difference = coefficients[0] - previousDc;
+    previousDc = coefficients[0];
+    u32 const dcBits = category(difference);
+    writer.WriteBits(dc.codes[dcBits], dc.lengths[dcBits]);
+    writeValue(difference, dcBits);
+
+    u32 run = 0;
+    for (u32 i = 1; i < 64; ++i)
+    {
+      if (coefficients[i] == 0)
+      {
+        ++run;
+        continue;
+      }
+      for (; run > 15; run -= 16) // sixteen zeros
+        writer.WriteBits(ac.codes[0xF0], ac.lengths[0xF0]);
+      u32 const bits = category(coefficients[i]);
+      u32 const symbol = (run << 4) | bits;
+      writer.WriteBits(ac.codes[symbol], ac.lengths[symbol]);
+      writeValue(coefficients[i], bits);
+      run = 0;
+    }
+    if (run > 0) // end of block
+      writer.WriteBits(ac.codes[0x00], ac.lengths[0x00]);
+  }
+
+  static void WriteHuffmanTable(std::vector<u8> &out, u8 tableClass,
+    HuffmanTable const &table)
+  {
+    u32 const symbolCount = table.GetSymbolCount();
+    out.push_back(tableClass);
+    out.insert(out.end(), table.counts, table.counts + 16);
+    out.insert(out.end(), table.symbols, table.symbols + symbolCount);
+  }
+}
+
+namespace Graphics
+{
+  bool ImageWriter::Encode(Image const &image, ImageFormat format, u32 quality,
+    std::vector<u8> &encoded)
+  {
+    encoded.clear();
+    if (image.IsEmpty())
+      return false;
+    switch (format)
+    {
+    case ImageFormat::Png: return EncodePNG(image, encoded);
+    case ImageFormat::Jpeg: return EncodeJPEG(image, quality, encoded);
+    case ImageFormat::Bmp: return EncodeBMP(image, encoded);
+    default: break;
+    }
+    Assert(false, "Error: unknown image format %d", int(format));
+    return false;
+  }
+
+  bool ImageWriter::Write(std::string const &path, Image const &image,
+    ImageFormat format, u32 quality)
+  {
+    std::vector<u8> encoded;
+    if (!Encode(image, format, quality, encoded))
+      return false;
+    bool const written = FileSystem::WriteFileContents(path, encoded.data(),
+      encoded.size());
+    WarnIf(!written, "Warning: unable to write image: %s", path.c_str());
+    return written;
+  }
+
+  char const *ImageWriter::GetExtension(ImageFormat format)
+  {
+    switch (format)
+    {
+    case ImageFormat::Png: return "png";
+    case ImageFormat::Jpeg: return "jpg";
+    case ImageFormat::Bmp: return "bmp";
+    default: return "";
+    }
+  }
+
+  bool ImageWriter::EncodePNG(Image const &image, std::vector<u8> &encoded)
+  {
+    static u8 const Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A,
+      '\n' };
+    static u8 const ColorTypes[5] = { 0, 0, 4, 2, 6 }; // by channel count
+
+    u32 const width = image.GetWidth(), height = image.GetHeight();
+    u32 const channels = image.GetChannelCount();
+    size_t const rowSize = image.GetRowSize();
+
+    // Filter every row with each of the five PNG filters and keep the one
+    // with the smallest sum of absolute (signed) residuals, which is a good
+    // predictor of how well the row will compress.
+    std::vector<u8> filtered((rowSize + 1) * height);
+    std::vector<u8> candidate(rowSize);
+    std::vector<u8> zeroRow(rowSize, 0);
+    for (u32 y = 0; y < height; ++y)
+    {
+      u8 const *row = image.GetRow(y);
+      u8 const *above = y > 0 ? image.GetRow(y - 1) : zeroRow.data();
+      u8 *out = filtered.data() + y * (rowSize + 1);
+      u64 bestCost = ~0ull;
+      for (u8 filter = 0; filter < 5; ++filter)
+      {
+        u64 cost = 0;
+        for (size_t i = 0; i < rowSize; ++i)
+        {
+          u8 const a = i >= channels ? row[i - channels] : 0;
+          u8 const b = above[i];
+          u8 const c = i >= channels ? above[i - channels] : 0;
+          u8 predictor = 0;
+          switch (filter)
+          {
+          case 1: predictor = a; break;
+          case 2: predictor = b; break;
+          case 3: predictor = static_cast<u8>((u32(a) + b) / 2); break;
+          case 4: predictor = Paeth(a, b, c); break;
+          }
+          candidate[i] = static_cast<u8>(row[i] - predictor);
+          cost += std::abs(static_cast<s32>(static_cast<s8>(candidate[i])));
+        }
+        if (cost < bestCost)
+        {
+          bestCost = cost;
+          out[0] = filter;
+          std::memcpy(out + 1, candidate.data(), rowSize);
+        }
+      }
+    }
+
+    std::vector<u8> header;
+    PutU32BE(header, width);
+    PutU32BE(header, height);
+    header.push_back(8); // bit depth
+    header.push_back(ColorTypes[channels]);
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // not interlaced
+
+    std::vector<u8> compressed;
+    Deflate(filtered.data(), filtered.size(), compressed);
+
+    encoded.insert(encoded.end(), Signature, Signature + 8);
+    WriteChunk(encoded, "IHDR", header.data(), header.size());
+    WriteChunk(encoded, "IDAT", compressed.data(), compressed.size());
+    WriteChunk(encoded, "IEND", NULL, 0);
+    return true;
+  }
+
+  bool ImageWriter::EncodeJPEG(Image const &image, u32 quality,
+    std::vector<u8> &encoded)
+  {
+    u32 const width = image.GetWidth(), height = image.GetHeight();
+    if (width > 0xFFFF || height > 0xFFFF)
+      return false;
+    u32 const channels = image.GetChannelCount();
+    bool const color = channels >= 3;
+    u32 const componentCount = color ? 3 : 1;
+
+    u8 quantization[2][64];
+    BuildQuantizationTable(LuminanceQuantization, quality, quantization[0]);
+    BuildQuantizationTable(ChrominanceQuantization, quality, quantization[1]);
+
+    // SOI and JFIF APP0
+    static u8 const Preamble[20] = { 0xFF, 0xD8, 0xFF, 0xE0, 0, 16, 'J', 'F',
+      'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    encoded.insert(encoded.end(), Preamble, Preamble + 20);
+
+    // DQT (tables are stored in zigzag order)
+    for (u8 t = 0; t < (color ? 2 : 1); ++t)
+    {
+      PutU16BE(encoded, 0xFFDB);
+      PutU16BE(encoded, 67);
+      encoded.push_back(t);
+      for (u32 i = 0; i < 64; ++i)
+        encoded.push_back(quantization[t][ZigZag[i]]);
+    }
+
+    // SOF0: baseline, 8-bit, no subsampling
+    PutU16BE(encoded, 0xFFC0);
+    PutU16BE(encoded, 8 + 3 * componentCount);
+    encoded.push_back(8);
+    PutU16BE(encoded, height);
+    PutU16BE(encoded, width);
+    encoded.push_back(static_cast<u8>(componentCount));
+    for (u8 c = 0; c < componentCount; ++c)
+    {
+      encoded.push_back(c + 1);
+      encoded.push_back(0x11);
+      encoded.push_back(c == 0 ? 0 : 1);
+    }
+
+    // DHT
+    std::vector<u8> tables;
+    WriteHuffmanTable(tables, 0x00, DcLuminance);
+    WriteHuffmanTable(tables, 0x10, AcLuminance);
+    if (color)
+    {
+      WriteHuffmanTable(tables, 0x01, DcChrominance);
+      WriteHuffmanTable(tables, 0x11, AcChrominance);
+    }
+    PutU16BE(encoded, 0xFFC4);
+    PutU16BE(encoded, static_cast<u32>(2 + tables.size()));
+    encoded.insert(encoded.end(), tables.begin(), tables.end());
+
+    // SOS
+    PutU16BE(encoded, 0xFFDA);
+    PutU16BE(encoded, 6 + 2 * componentCount);
+    encoded.push_back(static_cast<u8>(componentCount));
+    for (u8 c = 0; c < componentCount; ++c)
+    {
+      encoded.push_back(c + 1);
+      encoded.push_back(c == 0 ? 0x00 : 0x11);
+    }
+    encoded.push_back(0);
+    encoded.push_back(63);
+    encoded.push_back(0);
+
+    // entropy coded data, one 8x8 block of each component at a time
+    JpegBitWriter writer(encoded);
+    s32 previousDc[3] = { 0, 0, 0 };
+    f32 blocks[3][64];
+    for (u32 by = 0; by < height; by += 8)
+    {
+      for (u32 bx = 0; bx < width; bx += 8)
+      {
+        for (u32 y = 0; y < 8; ++y)
+        {
+          u8 const *row = image.GetRow(std::min(by + y, height - 1));
+          for (u32 x = 0; x < 8; ++x)
+          {
+            // edge blocks repeat the last row/column of the image
+            u8 rgb[3];
+            GetRGB(image, row + std::min(bx + x, width - 1) * channels, rgb);
+            f32 const r = rgb[0], g = rgb[1], b = rgb[2];
+            u32 const i = y * 8 + x;
+            if (color)
+            {
+              blocks[0][i] = 0.299f * r + 0.587f * g + 0.114f * b - 128.f;
+              blocks[1][i] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+              blocks[2][i] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+            }
+            else
+              blocks[0][i] = r - 128.f;
+          }
+        }
+
+        EncodeBlock(blocks[0], quantization[0], DcLuminance, AcLuminance,
+          previousDc[0], writer);
+        for (u32 c = 1; c < componentCount; ++c)
+          EncodeBlock(blocks[c], quantization[1], DcChrominance,
+            AcChrominance, previousDc[c], writer);
+      }
+    }
+    writer.Flush();
+
+    PutU16BE(encoded, 0xFFD9); // EOI
+    return true;
+  }
+
+  bool ImageWriter::EncodeBMP(Image const &image, std::vector<u8> &encoded)
+  {
+    u32 const width = image.GetWidth(), height = image.GetHeight();
+    u32 const channels = image.GetChannelCount();
+    u32 const rowSize = (width * 3 + 3) & ~3u; // rows are 4-byte aligned
+    u32 const imageSize = rowSize * height;
+
+    // BITMAPFILEHEADER
+    PutU16LE(encoded, 0x4D42); // 'BM'
+    PutU32LE(encoded, 14 + 40 + imageSize);
+    PutU32LE(encoded, 0);
+    PutU32LE(encoded, 14 + 40);
+
+    // BITMAPINFOHEADER
+    PutU32LE(encoded, 40);
+    PutU32LE(encoded, width);
+    PutU32LE(encoded, height); // positive: rows are stored bottom-up
+    PutU16LE(encoded, 1);
+    PutU16LE(encoded, 24);
+    PutU32LE(encoded, 0); // BI_RGB
+    PutU32LE(encoded, imageSize);
+    PutU32LE(encoded, 2835); // 72 DPI
+    PutU32LE(encoded, 2835);
+    PutU32LE(encoded, 0);
+    PutU32LE(encoded, 0);
+
+    size_t const start = encoded.size();
+    encoded.resize(start + imageSize, 0);
+    for (u32 y = 0; y < height; ++y)
+    {
+      u8 const *row = image.GetRow(height - 1 - y);
+      u8 *out = encoded.data() + start + size_t(y) * rowSize;
+      for (u32 x = 0; x < width; ++x)
+      {
+        u8 rgb[3];
+        GetRGB(image, row + x * channels, rgb);
+        out[x * 3 + 0] = rgb[2];
+        out[x * 3 + 1] = rgb[1];
+        out[x * 3 + 2] = rgb[0];
+      }
+    }
+    return true;
+  }
+}
@@ -14,14 +14,14 @@ namespace Graphics
   // Size of the default type used to store indices.
   size_t const IndexBufferObject::DefaultIndexSize = sizeof(IndexType);
 
-  // Constructs a new IBO given all of these parameters, including the actual
-  // data buffer used to store the indices. IBOs are fixed in size and this
-  // framework does not allow resizing them.
+  // Constructs a new IBO given all of these parameters. IBOs are fixed in size
+  // and this framework does not allow resizing them. The data buffer used to
+  // stage indices is only allocated once one is added (see getStaging).
   IndexBufferObject::IndexBufferObject(Topology indexType,
     size_t primitiveCount) : topology_(indexType),
     indexCount_(static_cast<int>(indexType) * primitiveCount),
     insertOffset_(0), bufferSize_(DefaultIndexSize * indexCount_),
-    buffer_(new char[bufferSize_]), glHandle_(0)
+    indexSize_(DefaultIndexSize), buffer_(nullptr), sources_(), glHandle_(0)
   {
   }
 
@@ -39,7 +39,7 @@ namespace Graphics
       return false;
 
     // store the indices using the default index type
-    IndexType *indexBuffer = reinterpret_cast<IndexType *>(buffer_);
+    IndexType *indexBuffer = reinterpret_cast<IndexType *>(getStaging());
     indexBuffer[insertOffset_++] = static_cast<IndexType>(fromIndex);
     indexBuffer[insertOffset_++] = static_cast<IndexType>(toIndex);
     return true;
@@ -52,16 +52,59 @@ namespace Graphics
       return false;
 
     // store the indices using the default index type
-    IndexType *indexBuffer = reinterpret_cast<IndexType *>(buffer_);
+    IndexType *indexBuffer = reinterpret_cast<IndexType *>(getStaging());
     indexBuffer[insertOffset_++] = static_cast<IndexType>(indexA);
     indexBuffer[insertOffset_++] = static_cast<IndexType>(indexB);
     indexBuffer[insertOffset_++] = static_cast<IndexType>(indexC);
     return true;
   }
 
+  bool IndexBufferObject::AddPrimitives(u32 const *indices,
+    size_t primitiveCount)
+  {
+    // can the buffer fit all of the primitives?
+    size_t const count = primitiveCount * GetIndicesPerPrimitive();
+    if (count > indexCount_ - insertOffset_)
+      return false;
+
+    // the indices are already in the default index type; copy them at once
+    static_assert(sizeof(IndexType) == sizeof(u32),
+      "Bulk index copies assume 32-bit indices.");
+    std::memcpy(getStaging() + insertOffset_ * DefaultIndexSize, indices,
+      count * DefaultIndexSize);
+    insertOffset_ += count;
+    return true;
+  }
+
+  bool IndexBufferObject::AttachPrimitives(u32 const *indices,
+    size_t primitiveCount)
+  {
+    Assert(!glHandle_, "Error: attaching indices to a built index buffer.");
+    size_t const count = primitiveCount * GetIndicesPerPrimitive();
+    if (count > indexCount_ - insertOffset_)
+      return false;
+
+    // only remember where they are; Build copies them to the GPU
+    BufferSource source = { insertOffset_ * DefaultIndexSize, indices,
+      count * DefaultIndexSize };
+    sources_.push_back(source);
+    insertOffset_ += count;
+    return true;
+  }
+
+  char *IndexBufferObject::getStaging()
+  {
+    Assert(!glHandle_, "Error: adding indices to a built index buffer.");
+    // zeroed, so that slots left for attached indices never read as large
+    // indices in Build
+    if (!buffer_)
+      buffer_ = new char[bufferSize_]();
+    return buffer_;
+  }
+
   size_t IndexBufferObject::GetBufferSize() const
   {
-    return bufferSize_;
+    return indexCount_ * indexSize_;
   }
 
   void IndexBufferObject::Build()
@@ -77,6 +120,23 @@ namespace Graphics
     if (!glHandle_)
       return;
 
+    // 16-bit indices are enough if every index fits; they are narrowed into
+    // a temporary array, which is uploaded instead.
+    u32 largest = 0;
+    if (buffer_)
+    {
+      IndexType const *staged = reinterpret_cast<IndexType const *>(buffer_);
+      for (size_t i = 0; i < indexCount_; ++i)
+        largest = std::max(largest, staged[i]);
+    }
+    for (auto const &source : sources_)
+    {
+      IndexType const *attached = static_cast<IndexType const *>(source.data);
+      for (size_t i = 0; i < source.size / DefaultIndexSize; ++i)
+        largest = std::max(largest, attached[i]);
+    }
+    indexSize_ = largest <= 0xffffu ? sizeof(u16) : DefaultIndexSize;
+
     // This uploads the current buffer to the bound buffer object; this must be
     // done after all of the indices have been added to the buffer. It also
     // initializes the buffer object to be an ELEMENT_ARRAY_BUFFER.
@@ -84,8 +144,46 @@ namespace Graphics
     // rendering and not mutation, so it might store the contents of the buffer
     // directly on the graphics card (not guaranteed).
     Bind();
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, bufferSize_, buffer_, GL_STATIC_DRAW);
+    if (indexSize_ == sizeof(u16))
+    {
+      std::vector<u16> narrow(indexCount_, 0);
+      if (buffer_)
+      {
+        IndexType const *staged = reinterpret_cast<IndexType const *>(buffer_);
+        for (size_t i = 0; i < indexCount_; ++i)
+          narrow[i] = static_cast<u16>(staged[i]);
+      }
+      for (auto const &source : sources_)
+      {
+        IndexType const *attached = static_cast<IndexType const *>(source.data);
+        u16 *out = narrow.data() + source.offset / DefaultIndexSize;
+        for (size_t i = 0; i < source.size / DefaultIndexSize; ++i)
+          out[i] = static_cast<u16>(attached[i]);
+      }
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, GetBufferSize(), narrow.data(),
+        GL_STATIC_DRAW);
+    }
+    else
+    {
+      // attached arrays are uploaded as in VertexBufferObject::Build
+      bool const direct = !buffer_ && sources_.size() == 1
+        && sources_[0].size == bufferSize_;
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, bufferSize_,
+        direct ? sources_[0].data : buffer_, GL_STATIC_DRAW);
+      if (!direct)
+      {
+        for (auto const &source : sources_)
+          glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, source.offset, source.size,
+            source.data);
+      }
+    }
     CheckGL();
+
+    // the GPU now holds the only copy needed
+    delete[] buffer_;
+    buffer_ = nullptr;
+    sources_.clear();
+    sources_.shrink_to_fit();
   }
 
   void IndexBufferObject::Bind() const
@@ -0,0 +1,120 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/ThreadPool.h"
+#include "graphics/InstanceBatcher.h"
+#include "graphics/TriangleMesh.h"
+
+namespace
+{
+  // Model matrices transposed per ParallelFor chunk.
+  static size_t const TransposeGrain = 4 * 1024;
+}
+
+namespace Graphics
+{
+  bool InstanceBatcher::InstanceKey::operator<(InstanceKey const &other) const
+  {
+    if (mesh != other.mesh)
+      return std::less<TriangleMesh *>()(mesh, other.mesh);
+    if (material != other.material)
+      return material < other.material;
+    if (level != other.level)
+      return level < other.level;
+    return index < other.index;
+  }
+
+  InstanceBatcher::InstanceBatcher()
+    : buffer_(0)
+  {
+    std::memset(&stats_, 0, sizeof(stats_));
+  }
+
+  InstanceBatcher::~InstanceBatcher()
+  {
+    if (buffer_)
+      glDeleteBuffers(1, &buffer_);
+  }
+
+  void InstanceBatcher::Clear()
+  {
+    keys_.clear();
+    models_.clear();
+    batches_.clear();
+  }
+
+  void InstanceBatcher::Add(TriangleMesh *mesh, u32 material,
+    Math::Matrix4 const &model, u32 level)
+  {
+    Assert(mesh, "Error: cannot batch an instance without a mesh.");
+    InstanceKey const key = { mesh, material, level, u32(keys_.size()) };
+    keys_.push_back(key);
+    models_.push_back(model);
+  }
+
+  InstanceStats const &InstanceBatcher::Upload()
+  {
+    // scenes usually queue objects of the same kind together, in which case
+    // the keys are already in batch order
+    batches_.clear();
+    if (!std::is_sorted(keys_.begin(), keys_.end()))
+      std::sort(keys_.begin(), keys_.end());
+
+    for (u32 i = 0; i < u32(keys_.size()); ++i)
+    {
+      InstanceKey const &key = keys_[i];
+      if (!batches_.empty() && batches_.back().mesh == key.mesh
+        && batches_.back().material == key.material
+        && batches_.back().level == key.level)
+      {
+        ++batches_.back().instanceCount;
+        continue;
+      }
+      Batch const batch = { key.mesh, key.material, key.level, i, 1 };
+      batches_.push_back(batch);
+    }
+
+    // GLSL reads a mat4 attribute column by column, while Matrix4 is stored
+    // by rows
+    columns_.resize(keys_.size() * 16);
+    ThreadPool::GetInstance().ParallelFor(0, keys_.size(), TransposeGrain,
+      [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+      {
+        f32 const *source = models_[keys_[i].index].array;
+        f32 *destination = &columns_[i * 16];
+        for (u32 row = 0; row < 4; ++row)
+          for (u32 column = 0; column < 4; ++column)
+            destination[column * 4 + row] = source[row * 4 + column];
+      }
+    });
+
+    stats_.instanceCount = u32(keys_.size());
+    stats_.batchCount = u32(batches_.size());
+    stats_.uploadedBytes = u32(columns_.size() * sizeof(f32));
+    if (columns_.empty())
+      return stats_;
+
+    if (!buffer_)
+    {
+      glGenBuffers(1, &buffer_);
+      Assert(buffer_, "Failed to create the instance buffer.");
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+    glBufferData(GL_ARRAY_BUFFER, columns_.size() * sizeof(f32),
+      columns_.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    CheckGL();
+    return stats_;
+  }
+
+  void InstanceBatcher::Render(size_t batch)
+  {
+    Assert(batch < batches_.size(), "Error: batch index out of bounds: %u",
+      u32(batch));
+    Batch const &instances = batches_[batch];
+    instances.mesh->RenderInstanced(buffer_,
+      size_t(instances.firstInstance) * 16 * sizeof(f32),
+      instances.instanceCount, instances.level);
+  }
+}
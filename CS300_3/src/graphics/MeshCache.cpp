@@ -0,0 +1,299 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/FileSystem.h"
+#include "framework/Hash.h"
+#include "graphics/MeshCache.h"
+#include "graphics/TriangleMesh.h"
+#include "graphics/Vertex.h"
+
+namespace
+{
+  using Graphics::TriangleMesh;
+  using Graphics::Vertex;
+
+  // Bump CacheVersion whenever the file layout, the layout of Vertex or any
+  // mesh preprocessing changes; old cache files are then ignored and
+  // rewritten.
+  static u32 const CacheMagic = 0x3148534d; // "MSH1"
+  static u32 const CacheVersion = 6;
+  static size_t const SectionAlignment = 16;
+
+  static bool CacheEnabled = true;
+
+  struct CacheHeader
+  {
+    u32 magic;
+    u32 version;
+    u32 vertexSize;
+    u32 vertexCount;
+    u32 triangleCount;
+    u32 levelCount; // coarser levels of detail
+    u64 parameters;
+    u64 sourceSize;
+    u64 sourceModifiedTime;
+    u64 sourceHash;
+    f32 boundMin[3];
+    f32 boundMax[3];
+  };
+
+  static_assert(sizeof(CacheHeader) == 80, "Mesh cache header must be packed.");
+  static_assert(sizeof(TriangleMesh::Triangle) == 3 * sizeof(u32),
+    "Triangles must be laid out as consecutive indices.");
+  static_assert(sizeof(Math::Vector3) == 3 * sizeof(f32),
+    "Face normals must be laid out as consecutive floats.");
+  static_assert(sizeof(TriangleMesh::LevelOfDetail) == 16,
+    "Levels of detail must be packed.");
+
+  // Byte offsets of the arrays following the header.
+  struct CacheSections
+  {
+    size_t vertices, triangles, normals, levels, lodTriangles, end;
+
+    CacheSections(u64 vertexCount, u64 triangleCount, u64 levelCount,
+      u64 lodTriangleCount)
+    {
+      vertices = AlignUp(sizeof(CacheHeader));
+      triangles = AlignUp(vertices
+        + static_cast<size_t>(vertexCount) * sizeof(Vertex));
+      normals = AlignUp(triangles + static_cast<size_t>(triangleCount)
+        * sizeof(TriangleMesh::Triangle));
+      levels = AlignUp(normals + static_cast<size_t>(triangleCount)
+        * sizeof(Math::Vector3));
+      lodTriangles = AlignUp(levels + static_cast<size_t>(levelCount)
+        * sizeof(TriangleMesh::LevelOfDetail));
+      end = lodTriangles + static_cast<size_t>(lodTriangleCount)
+        * sizeof(TriangleMesh::Triangle);
+    }
+
+    static size_t AlignUp(size_t value)
+    {
+      return (value + SectionAlignment - 1) & ~(SectionAlignment - 1);
+    }
+  };
+
+  static std::string GetSourcePath(std::string const &relativePath)
+  {
+    std::stringstream strstr;
+    strstr << ASSET_PATH << "models/" << relativePath;
+    return strstr.str();
+  }
+
+  static std::string GetCacheDirectory()
+  {
+    std::stringstream strstr;
+    strstr << ASSET_PATH << "cache/";
+    return strstr.str();
+  }
+
+  // Flattens the relative source path into a single file name and appends the
+  // parameter hash so that every variant of a model gets its own file.
+  static std::string GetCachePath(std::string const &relativePath,
+    u64 parameters)
+  {
+    std::string name = relativePath;
+    for (auto &c : name)
+      if (c == '/' || c == '\\' || c == ':')
+        c = '_';
+
+    char suffix[32];
+    sprintf(suffix, ".%016llx.meshcache", parameters);
+    return GetCacheDirectory() + name + suffix;
+  }
+
+  // Hashes the full contents of a file. Returns false if it cannot be read.
+  static bool HashFile(std::string const &path, u64 &hash)
+  {
+    FileSystem::MappedFile file;
+    if (!file.Open(path))
+      return false;
+    hash = Hash::Fnv1a(file.GetData(), file.GetSize());
+    return true;
+  }
+}
+
+namespace Graphics
+{
+  u64 MeshCache::HashParameters(char const *processing)
+  {
+    u64 hash = Hash::Fnv1aValue(CacheVersion);
+    hash = Hash::Fnv1aValue(u32(sizeof(Vertex)), hash);
+    return Hash::Fnv1a(processing, std::strlen(processing), hash);
+  }
+
+  std::shared_ptr<TriangleMesh> MeshCache::Load(
+    std::string const &relativePath, u64 parameters)
+  {
+    if (!CacheEnabled)
+      return nullptr;
+
+    FileSystem::MappedFile file;
+    if (!file.Open(GetCachePath(relativePath, parameters)))
+      return nullptr; // never cached
+
+    // validate the header and section sizes before trusting any counts
+    u8 const *data = file.GetData();
+    size_t const fileSize = file.GetSize();
+    if (fileSize < sizeof(CacheHeader))
+      return nullptr;
+    CacheHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != CacheMagic || header.version != CacheVersion
+      || header.parameters != parameters
+      || header.vertexSize != sizeof(Vertex)
+      || header.vertexCount == 0 || header.triangleCount == 0)
+      return nullptr;
+    // the levels table gives the number of simplified triangles that follow
+    CacheSections const levelSections(header.vertexCount, header.triangleCount,
+      header.levelCount, 0);
+    if (fileSize < levelSections.end)
+      return nullptr;
+    TriangleMesh::LevelOfDetail const *levels =
+      reinterpret_cast<TriangleMesh::LevelOfDetail const *>(
+        data + levelSections.levels);
+    u64 lodTriangleCount = 0;
+    for (u32 i = 0; i < header.levelCount; ++i)
+    {
+      if (levels[i].firstTriangle != lodTriangleCount)
+        return nullptr; // corrupt
+      lodTriangleCount += levels[i].triangleCount;
+    }
+    CacheSections const sections(header.vertexCount, header.triangleCount,
+      header.levelCount, lodTriangleCount);
+    if (fileSize < sections.end)
+      return nullptr;
+
+    // make sure the source has not changed since the cache was written (see
+    // TextureCache::Load)
+    std::string const sourcePath = GetSourcePath(relativePath);
+    FileSystem::FileInfo info;
+    bool touched = false;
+    if (FileSystem::GetFileInfo(sourcePath, info)
+      && (info.size != header.sourceSize
+        || info.modifiedTime != header.sourceModifiedTime))
+    {
+      u64 sourceHash = 0;
+      if (info.size != header.sourceSize
+        || !HashFile(sourcePath, sourceHash)
+        || sourceHash != header.sourceHash)
+        return nullptr; // stale
+      touched = true;
+    }
+
+    // the sections are aligned within a page-aligned mapping, so they can be
+    // read in place as arrays
+    Vertex const *vertices = reinterpret_cast<Vertex const *>(
+      data + sections.vertices);
+    TriangleMesh::Triangle const *triangles =
+      reinterpret_cast<TriangleMesh::Triangle const *>(
+        data + sections.triangles);
+    Math::Vector3 const *normals = reinterpret_cast<Math::Vector3 const *>(
+      data + sections.normals);
+
+    TriangleMesh::Triangle const *lodTriangles =
+      reinterpret_cast<TriangleMesh::Triangle const *>(
+        data + sections.lodTriangles);
+
+    for (u32 i = 0; i < header.triangleCount; ++i)
+    {
+      for (u32 j = 0; j < 3; ++j)
+        if (triangles[i].indices[j] >= header.vertexCount)
+          return nullptr; // corrupt
+    }
+    for (u64 i = 0; i < lodTriangleCount; ++i)
+    {
+      for (u32 j = 0; j < 3; ++j)
+        if (lodTriangles[i].indices[j] >= header.vertexCount)
+          return nullptr; // corrupt
+    }
+
+    TriangleMesh *mesh = new TriangleMesh;
+    mesh->vertices_.assign(vertices, vertices + header.vertexCount);
+    mesh->triangles_.assign(triangles, triangles + header.triangleCount);
+    mesh->triangleNormals_.assign(normals, normals + header.triangleCount);
+    mesh->levels_.assign(levels, levels + header.levelCount);
+    mesh->lodTriangles_.assign(lodTriangles, lodTriangles + lodTriangleCount);
+    mesh->minimum_ = Math::Vector3(header.boundMin[0], header.boundMin[1],
+      header.boundMin[2]);
+    mesh->maximum_ = Math::Vector3(header.boundMax[0], header.boundMax[1],
+      header.boundMax[2]);
+
+    // unchanged contents: record the new timestamp, as TextureCache::Load does
+    if (touched)
+    {
+      file.Close();
+      FileSystem::PatchFileContents(GetCachePath(relativePath, parameters),
+        offsetof(CacheHeader, sourceModifiedTime), &info.modifiedTime,
+        sizeof(info.modifiedTime));
+    }
+    return std::shared_ptr<TriangleMesh>(mesh);
+  }
+
+  bool MeshCache::Store(std::string const &relativePath, u64 parameters,
+    TriangleMesh const &mesh)
+  {
+    if (!CacheEnabled)
+      return false;
+    if (mesh.vertices_.empty() || mesh.triangles_.empty()
+      || mesh.triangleNormals_.size() != mesh.triangles_.size())
+      return false; // not preprocessed
+
+    // fingerprint the source the mesh was produced from
+    std::string const sourcePath = GetSourcePath(relativePath);
+    FileSystem::FileInfo info;
+    u64 sourceHash = 0;
+    if (!FileSystem::GetFileInfo(sourcePath, info)
+      || !HashFile(sourcePath, sourceHash))
+      return false;
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = CacheMagic;
+    header.version = CacheVersion;
+    header.vertexSize = sizeof(Vertex);
+    header.vertexCount = static_cast<u32>(mesh.vertices_.size());
+    header.triangleCount = static_cast<u32>(mesh.triangles_.size());
+    header.levelCount = static_cast<u32>(mesh.levels_.size());
+    header.parameters = parameters;
+    header.sourceSize = info.size;
+    header.sourceModifiedTime = info.modifiedTime;
+    header.sourceHash = sourceHash;
+    for (u32 i = 0; i < 3; ++i)
+    {
+      header.boundMin[i] = mesh.minimum_[i];
+      header.boundMax[i] = mesh.maximum_[i];
+    }
+
+    CacheSections const sections(header.vertexCount, header.triangleCount,
+      header.levelCount, mesh.lodTriangles_.size());
+    std::vector<u8> buffer(sections.end, 0);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    std::memcpy(buffer.data() + sections.vertices, mesh.vertices_.data(),
+      mesh.vertices_.size() * sizeof(Vertex));
+    std::memcpy(buffer.data() + sections.triangles, mesh.triangles_.data(),
+      mesh.triangles_.size() * sizeof(TriangleMesh::Triangle));
+    std::memcpy(buffer.data() + sections.normals, mesh.triangleNormals_.data(),
+      mesh.triangleNormals_.size() * sizeof(Math::Vector3));
+    std::memcpy(buffer.data() + sections.levels, mesh.levels_.data(),
+      mesh.levels_.size() * sizeof(TriangleMesh::LevelOfDetail));
+    std::memcpy(buffer.data() + sections.lodTriangles,
+      mesh.lodTriangles_.data(),
+      mesh.lodTriangles_.size() * sizeof(TriangleMesh::Triangle));
+
+    FileSystem::MakeDirectory(GetCacheDirectory());
+    bool const written = FileSystem::WriteFileContents(
+      GetCachePath(relativePath, parameters), buffer.data(), buffer.size());
+    WarnIf(!written, "Warning: unable to write mesh cache for models/%s",
+      relativePath.c_str());
+    return written;
+  }
+
+  void MeshCache::SetEnabled(bool enabled)
+  {
+    CacheEnabled = enabled;
+  }
+
+  bool MeshCache::IsEnabled()
+  {
+    return CacheEnabled;
+  }
+}
@@ -1,63 +1,67 @@
 #include "Precompiled.h"
 #include "framework/Debug.h"
+#include "framework/Hash.h"
 #include "framework/Utilities.h"
+#include "graphics/AmbientOcclusionBaker.h"
+#include "graphics/MeshCache.h"
 #include "graphics/MeshLoader.h"
+#include "graphics/ObjParser.h"
 #include "graphics/TriangleMesh.h"
 
 namespace Graphics
 {
-	//////////////////////////////////////////////////////////////////////////
-	// TODO(student): implement a Wavefront OBJ loader in this file, assemble
-	// an instance of TriangleMesh using the data read in, and return it
-
-	// NOTE: the 'input' stream above is ready to being reading the text lines
-	// of OBJ files; it already is setup to correctly find the object file
-	// under the assets/models directory.
-	//////////////////////////////////////////////////////////////////////////
 	std::shared_ptr<TriangleMesh> MeshLoader::LoadMesh(std::string const &objFile, TextureProjectorFunction textureMappingType)
 	{
-		std::stringstream strstr;
-		strstr << ASSET_PATH << "models/" << objFile;
-		std::ifstream input = std::ifstream(strstr.str());
-		Assert(input.good(), "Cannot load mesh: assets/models/%s", objFile.c_str());
-		if (!input.good())
-		  return nullptr;
-
-		TriangleMesh *mesh = new TriangleMesh;
-		std::string line;
-		std::string flag;
-		while (std::getline(input, line))
+		// a warm cache skips parsing, preprocessing and baking entirely; the
+		// mapping type changes the generated texture coordinates and TBN
+		// vectors, and the ambient occlusion settings the baked occlusion
+		u64 parameters = Hash::Fnv1aValue(textureMappingType,
+			MeshCache::HashParameters("preprocessed-ao"));
+		parameters = Hash::Fnv1aValue(u32(AmbientOcclusionBaker::DefaultRayCount),
+			parameters);
+		parameters = Hash::Fnv1aValue(AmbientOcclusionBaker::DefaultMaxDistance,
+			parameters);
+		if (std::shared_ptr<TriangleMesh> cached = MeshCache::Load(objFile,
+			parameters))
 		{
-			if(line.length() == 0)
-				continue;
-
-			switch (line[0])
-			{
-			case 'v':
-			{
-				float x, y, z;
-				std::istringstream iss(line);
-				iss >> flag >> x >> y >> z;
-				mesh->AddVertex(x, y, z);
-				break;
-			}
-			case 'f':
-			{
-				int v[3];
-				std::istringstream iss(line);
-				iss >> flag >> v[0] >> v[1] >> v[2];
-				mesh->AddTriangle(v[0]-1, v[1]-1, v[2]-1);
-				break;
-			}
-			default:
-			{
-				break;
-			}
-			}
+			cached->SetTextureMappingType(textureMappingType);
+			return cached;
 		}
 
+		std::shared_ptr<TriangleMesh> mesh = ParseMesh(objFile);
+		if (!mesh)
+			return nullptr;
 		mesh->SetTextureMappingType(textureMappingType);
 		mesh->Preprocess();
-		return std::shared_ptr<TriangleMesh>(mesh);
+		mesh->BakeAmbientOcclusion();
+		MeshCache::Store(objFile, parameters, *mesh);
+		return mesh;
+	}
+
+	std::shared_ptr<TriangleMesh> MeshLoader::ParseMesh(std::string const &objFile)
+	{
+		std::stringstream strstr;
+		strstr << ASSET_PATH << "models/" << objFile;
+
+		// the parser maps the file and parses it in parallel; see ObjParser.h
+		ObjData data;
+		bool const parsed = ObjParser::ParseFile(strstr.str(), data);
+		Assert(parsed, "Cannot load mesh: assets/models/%s", objFile.c_str());
+		if (!parsed)
+		  return nullptr;
+		WarnIf(data.invalidFaceCount != 0, "Warning: skipped %d invalid faces"
+			" in assets/models/%s", (int)data.invalidFaceCount, objFile.c_str());
+
+		// TriangleMesh has one vertex per position: texture coordinates and
+		// normals are generated by Preprocess, so those read from the file are
+		// not used here
+		std::shared_ptr<TriangleMesh> mesh(new TriangleMesh);
+		mesh->Reserve(u32(data.positions.size()), u32(data.GetTriangleCount()));
+		for (auto const &position : data.positions)
+			mesh->AddVertex(position.x, position.y, position.z);
+		for (size_t i = 0; i < data.corners.size(); i += 3)
+			mesh->AddTriangle(data.corners[i].position,
+				data.corners[i + 1].position, data.corners[i + 2].position);
+		return mesh;
 	}
-}
\ No newline at end of file
+}
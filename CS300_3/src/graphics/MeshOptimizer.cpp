@@ -0,0 +1,405 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "graphics/MeshLoader.h"
+#include "graphics/MeshOptimizer.h"
+#include "graphics/TriangleMesh.h"
+
+namespace
+{
+  using Math::Vector3;
+
+  // Size of the LRU cache simulated while scoring vertices, and the scoring
+  // constants, as given by Forsyth. The scoring cache is deliberately larger
+  // than the hardware cache; the ordering it produces is good across a wide
+  // range of actual cache sizes.
+  static u32 const ScoringCacheSize = 32;
+  static f32 const CacheDecayPower = 1.5f;
+  static f32 const LastTriangleScore = 0.75f;
+  static f32 const ValenceBoostScale = 2.f;
+  static f32 const ValenceBoostPower = 0.5f;
+  static u32 const MaxScoredValence = 32;
+
+  // Scores of a vertex by its position in the scoring cache and by the number
+  // of triangles still using it (capped at MaxScoredValence).
+  struct ScoreTables
+  {
+    f32 cache[ScoringCacheSize];
+    f32 valence[MaxScoredValence + 1];
+
+    ScoreTables()
+    {
+      // the vertices of the last triangle are scored equally, so that the
+      // next triangle is not biased toward any one of its edges
+      for (u32 i = 0; i < ScoringCacheSize; ++i)
+      {
+        if (i < 3)
+          cache[i] = LastTriangleScore;
+        else
+          cache[i] = std::pow(1.f - f32(i - 3) / f32(ScoringCacheSize - 3),
+            CacheDecayPower);
+      }
+      // vertices with few triangles left are boosted to get rid of them
+      valence[0] = 0.f;
+      for (u32 i = 1; i <= MaxScoredValence; ++i)
+        valence[i] = ValenceBoostScale * std::pow(f32(i), -ValenceBoostPower);
+    }
+
+    f32 Score(s32 cachePosition, u32 remaining) const
+    {
+      if (remaining == 0)
+        return -1.f; // no triangles left to emit
+      f32 score = cachePosition < 0 ? 0.f : cache[cachePosition];
+      return score + valence[std::min(remaining, MaxScoredValence)];
+    }
+  };
+
+  // Vertex -> triangle adjacency in flat arrays. triangles[offsets[v],
+  // offsets[v] + counts[v]) are the triangles still using vertex v; Forsyth's
+  // pass removes triangles from that range as they are emitted.
+  struct Adjacency
+  {
+    std::vector<u32> offsets, counts, triangles;
+
+    Adjacency(u32 const *indices, size_t indexCount, size_t vertexCount)
+      : offsets(vertexCount + 1, 0), counts(vertexCount, 0),
+      triangles(indexCount)
+    {
+      for (size_t i = 0; i < indexCount; ++i)
+        ++counts[indices[i]];
+      for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] = offsets[v] + counts[v];
+      std::vector<u32> insert(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < indexCount; ++i)
+        triangles[insert[indices[i]]++] = u32(i / 3);
+    }
+
+    void Remove(u32 vertex, u32 triangle)
+    {
+      u32 *begin = triangles.data() + offsets[vertex];
+      u32 *end = begin + counts[vertex];
+      u32 *find = std::find(begin, end, triangle);
+      Assert(find != end, "Error: triangle %d is not adjacent to vertex %d",
+        triangle, vertex);
+      std::swap(*find, *(end - 1));
+      --counts[vertex];
+    }
+  };
+
+  // Simulates a FIFO cache with timestamps: a vertex is cached if it was
+  // loaded within the last Size misses. Access returns the number of misses.
+  struct FifoCache
+  {
+    static u32 const Size = Graphics::VertexCacheStats::CacheSize;
+
+    std::vector<u32> loadedAt;
+    u32 time;
+
+    explicit FifoCache(size_t vertexCount)
+      : loadedAt(vertexCount, 0), time(Size + 1)
+    {
+    }
+
+    // Empties the cache without touching every vertex.
+    void Flush()
+    {
+      time += Size + 1;
+    }
+
+    u32 Access(u32 vertex)
+    {
+      if (time - loadedAt[vertex] <= Size)
+        return 0;
+      loadedAt[vertex] = time++;
+      return 1;
+    }
+
+    u32 AccessTriangle(u32 const *triangle)
+    {
+      return Access(triangle[0]) + Access(triangle[1]) + Access(triangle[2]);
+    }
+  };
+
+  Vector3 const &GetPosition(Vector3 const *positions, size_t stride,
+    u32 index)
+  {
+    return *reinterpret_cast<Vector3 const *>(
+      reinterpret_cast<u8 const *>(positions) + index * stride);
+  }
+
+  // A run of triangles reordered as a whole by OptimizeOverdraw.
+  struct Cluster
+  {
+    size_t begin, end;
+    f32 sortKey;
+  };
+}
+
+namespace Graphics
+{
+  void MeshOptimizer::OptimizeVertexCache(u32 *indices, size_t indexCount,
+    size_t vertexCount)
+  {
+    size_t const triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+      return;
+    ScoreTables const tables;
+    std::vector<u32> const input(indices, indices + triangleCount * 3);
+    Adjacency adjacency(input.data(), triangleCount * 3, vertexCount);
+
+    std::vector<s32> cachePosition(vertexCount, -1);
+    std::vector<f32> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+      vertexScore[v] = tables.Score(-1, adjacency.counts[v]);
+
+    std::vector<f32> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+      u32 const *tri = &input[t * 3];
+      triangleScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]]
+        + vertexScore[tri[2]];
+    }
+
+    // the cache holds up to three extra entries while a triangle is added
+    std::vector<u32> cache, nextCache;
+    cache.reserve(ScoringCacheSize + 3);
+    nextCache.reserve(ScoringCacheSize + 3);
+
+    size_t best = 0, nextInOrder = 0;
+    for (size_t t = 1; t < triangleCount; ++t)
+      if (triangleScore[t] > triangleScore[best])
+        best = t;
+
+    for (size_t output = 0; output < triangleCount; ++output)
+    {
+      if (best == InvalidIndex)
+      {
+        // dead end: nothing in the cache has triangles left, so continue with
+        // the next triangle in input order
+        while (emitted[nextInOrder])
+          ++nextInOrder;
+        best = nextInOrder;
+      }
+
+      u32 const *tri = &input[best * 3];
+      std::memcpy(indices + output * 3, tri, 3 * sizeof(u32));
+      emitted[best] = true;
+      for (u32 i = 0; i < 3; ++i)
+        adjacency.Remove(tri[i], u32(best));
+
+      // the triangle's vertices move to the front of the LRU cache
+      nextCache.assign(tri, tri + 3);
+      for (u32 vertex : cache)
+        if (vertex != tri[0] && vertex != tri[1] && vertex != tri[2])
+          nextCache.push_back(vertex);
+      cache.swap(nextCache);
+
+      // rescore the cached vertices (and those just pushed out), then the
+      // triangles still using them, and pick the best of those
+      for (size_t i = 0; i < cache.size(); ++i)
+      {
+        u32 const vertex = cache[i];
+        cachePosition[vertex] = i < ScoringCacheSize ? s32(i) : -1;
+        f32 const score = tables.Score(cachePosition[vertex],
+          adjacency.counts[vertex]);
+        f32 const delta = score - vertexScore[vertex];
+        vertexScore[vertex] = score;
+        u32 const *adjacent = adjacency.triangles.data()
+          + adjacency.offsets[vertex];
+        for (u32 j = 0; j < adjacency.counts[vertex]; ++j)
+          triangleScore[adjacent[j]] += delta;
+      }
+      if (cache.size() > ScoringCacheSize)
+        cache.resize(ScoringCacheSize);
+
+      best = InvalidIndex;
+      f32 bestScore = -1.f;
+      for (u32 vertex : cache)
+      {
+        u32 const *adjacent = adjacency.triangles.data()
+          + adjacency.offsets[vertex];
+        for (u32 j = 0; j < adjacency.counts[vertex]; ++j)
+        {
+          if (triangleScore[adjacent[j]] > bestScore)
+          {
+            bestScore = triangleScore[adjacent[j]];
+            best = adjacent[j];
+          }
+        }
+      }
+    }
+  }
+
+  void MeshOptimizer::OptimizeOverdraw(u32 *indices, size_t indexCount,
+    Math::Vector3 const *positions, size_t positionStride,
+    size_t vertexCount, f32 threshold)
+  {
+    size_t const triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+      return;
+
+    // Hard boundaries: triangles missing the cache with all three vertices,
+    // where reordering costs nothing.
+    std::vector<size_t> hard;
+    {
+      FifoCache cache(vertexCount);
+      for (size_t t = 0; t < triangleCount; ++t)
+        if (cache.AccessTriangle(indices + t * 3) == 3)
+          hard.push_back(t);
+    }
+    hard.push_back(triangleCount);
+    if (hard.front() != 0)
+      hard.insert(hard.begin(), 0);
+
+    // Soft boundaries: within each hard cluster, a new cluster starts as soon
+    // as the triangles since the last boundary, shaded from a cold cache,
+    // reach the cluster's own ACMR (within threshold).
+    std::vector<Cluster> clusters;
+    FifoCache cache(vertexCount);
+    for (size_t h = 0; h + 1 < hard.size(); ++h)
+    {
+      size_t const begin = hard[h], end = hard[h + 1];
+      cache.Flush();
+      u32 misses = 0;
+      for (size_t t = begin; t < end; ++t)
+        misses += cache.AccessTriangle(indices + t * 3);
+      f32 const clusterThreshold = threshold * f32(misses) / f32(end - begin);
+
+      cache.Flush();
+      size_t start = begin;
+      u32 runningMisses = 0;
+      for (size_t t = begin; t < end; ++t)
+      {
+        runningMisses += cache.AccessTriangle(indices + t * 3);
+        if (t + 1 < end && f32(runningMisses) / f32(t + 1 - start)
+          <= clusterThreshold)
+        {
+          Cluster cluster = { start, t + 1, 0.f };
+          clusters.push_back(cluster);
+          start = t + 1;
+          runningMisses = 0;
+          cache.Flush();
+        }
+      }
+      Cluster cluster = { start, end, 0.f };
+      clusters.push_back(cluster);
+    }
+    if (clusters.size() < 2)
+      return;
+
+    // Clusters whose area-weighted normal points away from the center of the
+    // mesh sit on its outside and occlude the rest, so they go first.
+    Vector3 meshCenter(0.f);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+      meshCenter += GetPosition(positions, positionStride, indices[i]);
+    meshCenter /= f32(triangleCount * 3);
+    for (auto &cluster : clusters)
+    {
+      Vector3 center(0.f), normal(0.f);
+      f32 area = 0.f;
+      for (size_t t = cluster.begin; t < cluster.end; ++t)
+      {
+        Vector3 const &a = GetPosition(positions, positionStride,
+          indices[t * 3]);
+        Vector3 const &b = GetPosition(positions, positionStride,
+          indices[t * 3 + 1]);
+        Vector3 const &c = GetPosition(positions, positionStride,
+          indices[t * 3 + 2]);
+        Vector3 const cross = (b - a).Cross(c - a);
+        f32 const triangleArea = cross.Length();
+        center += (a + b + c) * (triangleArea / 3.f);
+        normal += cross;
+        area += triangleArea;
+      }
+      if (area > 0.f)
+        center /= area;
+      normal.AttemptNormalize();
+      cluster.sortKey = (center - meshCenter).Dot(normal);
+    }
+    std::stable_sort(clusters.begin(), clusters.end(),
+      [](Cluster const &a, Cluster const &b) { return a.sortKey > b.sortKey; });
+
+    std::vector<u32> const input(indices, indices + triangleCount * 3);
+    size_t output = 0;
+    for (auto const &cluster : clusters)
+    {
+      size_t const count = (cluster.end - cluster.begin) * 3;
+      std::memcpy(indices + output, &input[cluster.begin * 3],
+        count * sizeof(u32));
+      output += count;
+    }
+  }
+
+  size_t MeshOptimizer::ComputeVertexFetchRemap(u32 *remap,
+    u32 const *indices, size_t indexCount, size_t vertexCount)
+  {
+    std::fill(remap, remap + vertexCount, InvalidIndex);
+    u32 next = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+      if (remap[indices[i]] == InvalidIndex)
+        remap[indices[i]] = next++;
+    }
+    return next;
+  }
+
+  void MeshOptimizer::RemapIndices(u32 *indices, size_t indexCount,
+    u32 const *remap)
+  {
+    for (size_t i = 0; i < indexCount; ++i)
+      indices[i] = remap[indices[i]];
+  }
+
+  VertexCacheStats MeshOptimizer::AnalyzeVertexCache(u32 const *indices,
+    size_t indexCount, size_t vertexCount)
+  {
+    VertexCacheStats stats;
+    std::memset(&stats, 0, sizeof(stats));
+    stats.triangleCount = u32(indexCount / 3);
+
+    FifoCache cache(vertexCount);
+    std::vector<bool> referenced(vertexCount, false);
+    for (size_t i = 0; i < stats.triangleCount * 3; ++i)
+    {
+      stats.missCount += cache.Access(indices[i]);
+      if (!referenced[indices[i]])
+      {
+        referenced[indices[i]] = true;
+        ++stats.vertexCount;
+      }
+    }
+    if (stats.triangleCount)
+      stats.acmr = f32(stats.missCount) / f32(stats.triangleCount);
+    if (stats.vertexCount)
+      stats.atvr = f32(stats.missCount) / f32(stats.vertexCount);
+    return stats;
+  }
+
+  void MeshOptimizer::Benchmark(std::string const &model)
+  {
+    std::shared_ptr<TriangleMesh> mesh = MeshLoader::ParseMesh(model);
+    if (!mesh || mesh->GetTriangleCount() == 0)
+    {
+      std::cout << "Optimizer benchmark: cannot load models/" << model
+        << std::endl;
+      return;
+    }
+
+    // the baseline is taken after welding, so that only the reordering is
+    // credited to the optimizer
+    mesh->Weld();
+    VertexCacheStats const before = mesh->AnalyzeVertexCache();
+    auto const start = std::chrono::high_resolution_clock::now();
+    mesh->Optimize();
+    auto const stop = std::chrono::high_resolution_clock::now();
+    VertexCacheStats const after = mesh->AnalyzeVertexCache();
+
+    char report[256];
+    sprintf(report, "ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%u -> %u vertices)"
+      ", optimized in %.1f ms", before.acmr, after.acmr, before.atvr,
+      after.atvr, before.vertexCount, after.vertexCount,
+      std::chrono::duration<f64, std::milli>(stop - start).count());
+    std::cout << "Optimizer benchmark: models/" << model << ", " << report
+      << std::endl;
+  }
+}
@@ -0,0 +1,370 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/ThreadPool.h"
+#include "graphics/MeshOptimizer.h"
+#include "graphics/MeshSimplifier.h"
+#include "graphics/Vertex.h"
+
+namespace
+{
+  using Graphics::Vertex;
+  using Math::Vector3;
+
+  // Vertices or candidate collapses handled per ParallelFor chunk.
+  static size_t const SimplifyGrain = 4096;
+
+  // Only the cheapest of every PassCandidateDivisor candidate collapses are
+  // considered in a pass. Most candidates are blocked by an earlier collapse
+  // nearby, so without a limit a pass would go on to take expensive
+  // collapses while cheaper ones wait for the next pass.
+  static size_t const PassCandidateDivisor = 4;
+
+  // Texture coordinates differing by more than this across an edge are taken
+  // to wrap around, making the edge a seam.
+  static f32 const TextureWrapThreshold = 0.5f;
+
+  // A symmetric 4x4 quadric, Q(p) = p'Ap + 2b'p + c, along with the total
+  // area of the planes accumulated into it. Q(p) / weight is the area
+  // weighted mean squared distance of p to those planes.
+  struct Quadric
+  {
+    f32 a00, a11, a22, a01, a02, a12;
+    f32 b0, b1, b2;
+    f32 c;
+    f32 weight;
+
+    Quadric()
+      : a00(0.f), a11(0.f), a22(0.f), a01(0.f), a02(0.f), a12(0.f),
+      b0(0.f), b1(0.f), b2(0.f), c(0.f), weight(0.f)
+    {
+    }
+
+    // The plane through point with the given unit normal, weighted by area.
+    void AddPlane(Vector3 const &normal, Vector3 const &point, f32 area)
+    {
+      f32 const d = -normal.Dot(point);
+      a00 += area * normal.x * normal.x;
+      a11 += area * normal.y * normal.y;
+      a22 += area * normal.z * normal.z;
+      a01 += area * normal.x * normal.y;
+      a02 += area * normal.x * normal.z;
+      a12 += area * normal.y * normal.z;
+      b0 += area * d * normal.x;
+      b1 += area * d * normal.y;
+      b2 += area * d * normal.z;
+      c += area * d * d;
+      weight += area;
+    }
+
+    void Add(Quadric const &rhs)
+    {
+      a00 += rhs.a00; a11 += rhs.a11; a22 += rhs.a22;
+      a01 += rhs.a01; a02 += rhs.a02; a12 += rhs.a12;
+      b0 += rhs.b0; b1 += rhs.b1; b2 += rhs.b2;
+      c += rhs.c;
+      weight += rhs.weight;
+    }
+
+    f32 Evaluate(Vector3 const &p) const
+    {
+      f32 const value = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+        + 2.f * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+        + 2.f * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+      return std::max(0.f, value); // rounding can make it slightly negative
+    }
+  };
+
+  // A vertex collapsing onto a neighbor, and the error of doing so.
+  struct Collapse
+  {
+    u32 from, to;
+    f32 error;
+
+    bool operator<(Collapse const &rhs) const { return error < rhs.error; }
+  };
+
+  // Vertex -> triangle adjacency of a triangle list, in flat arrays:
+  // triangles[offsets[v], offsets[v + 1]) use vertex v.
+  struct TriangleAdjacency
+  {
+    std::vector<u32> offsets, triangles;
+
+    void Build(u32 const *indices, size_t indexCount, size_t vertexCount)
+    {
+      offsets.assign(vertexCount + 1, 0);
+      triangles.resize(indexCount);
+      for (size_t i = 0; i < indexCount; ++i)
+        ++offsets[indices[i] + 1];
+      for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+      std::vector<u32> insert(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < indexCount; ++i)
+        triangles[insert[indices[i]]++] = u32(i / 3);
+    }
+  };
+
+  // Marks the vertices that may not be collapsed; see MeshSimplifier.
+  void LockVertices(std::vector<u8> &locked, u32 const *indices,
+    size_t indexCount, Vertex const *vertices, size_t vertexCount)
+  {
+    locked.assign(vertexCount, 0);
+    std::vector<u8> referenced(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; ++i)
+      referenced[indices[i]] = 1;
+
+    // vertices split at the same position; sorting brings them together
+    std::vector<u32> byPosition;
+    byPosition.reserve(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+      if (referenced[v])
+        byPosition.push_back(u32(v));
+    std::sort(byPosition.begin(), byPosition.end(), [&](u32 a, u32 b)
+    {
+      Vector3 const &p = vertices[a].vertex, &q = vertices[b].vertex;
+      if (p.x != q.x)
+        return p.x < q.x;
+      if (p.y != q.y)
+        return p.y < q.y;
+      return p.z < q.z;
+    });
+    for (size_t i = 1; i < byPosition.size(); ++i)
+    {
+      if (vertices[byPosition[i]].vertex == vertices[byPosition[i - 1]].vertex)
+        locked[byPosition[i]] = locked[byPosition[i - 1]] = 1;
+    }
+
+    // Edges used by one triangle (borders) or more than two (non-manifold),
+    // and edges across which the texture coordinates wrap. Sorting the edges
+    // as (lower, higher) index pairs brings the uses of each one together.
+    std::vector<u64> edges(indexCount);
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+      u32 const a = indices[i];
+      u32 const b = indices[i - i % 3 + (i + 1) % 3];
+      edges[i] = (u64(std::min(a, b)) << 32) | std::max(a, b);
+      if (std::abs(vertices[a].uv.x - vertices[b].uv.x) > TextureWrapThreshold
+        || std::abs(vertices[a].uv.y - vertices[b].uv.y) > TextureWrapThreshold)
+        locked[a] = locked[b] = 1;
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();)
+    {
+      size_t j = i + 1;
+      while (j < edges.size() && edges[j] == edges[i])
+        ++j;
+      if (j - i != 2)
+        locked[u32(edges[i] >> 32)] = locked[u32(edges[i])] = 1;
+      i = j;
+    }
+
+    // the extremes along each axis, which define the bounds
+    if (byPosition.empty())
+      return;
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+      u32 low = byPosition[0], high = byPosition[0];
+      for (u32 v : byPosition)
+      {
+        if (vertices[v].vertex[axis] < vertices[low].vertex[axis])
+          low = v;
+        if (vertices[v].vertex[axis] > vertices[high].vertex[axis])
+          high = v;
+      }
+      locked[low] = locked[high] = 1;
+    }
+  }
+
+  // Whether moving vertex from onto vertex to turns any triangle around from
+  // over (or makes it degenerate), other than those using both, which vanish.
+  bool CollapseFlips(u32 from, u32 to, u32 const *indices,
+    TriangleAdjacency const &adjacency, Vertex const *vertices)
+  {
+    for (u32 i = adjacency.offsets[from]; i < adjacency.offsets[from + 1]; ++i)
+    {
+      u32 const *triangle = indices + adjacency.triangles[i] * 3;
+      if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+        continue;
+      Vector3 before[3], after[3];
+      for (u32 j = 0; j < 3; ++j)
+      {
+        before[j] = vertices[triangle[j]].vertex;
+        after[j] = triangle[j] == from ? vertices[to].vertex : before[j];
+      }
+      Vector3 const oldNormal = (before[1] - before[0]).Cross(before[2]
+        - before[0]);
+      Vector3 const newNormal = (after[1] - after[0]).Cross(after[2]
+        - after[0]);
+      if (oldNormal.Dot(newNormal) <= 0.f)
+        return true;
+    }
+    return false;
+  }
+
+  void FinishLevel(Graphics::SimplifiedLevel &level,
+    std::vector<u32> const &indices, f32 squaredError, size_t vertexCount)
+  {
+    level.indices = indices;
+    level.error = std::sqrt(squaredError);
+    Graphics::MeshOptimizer::OptimizeVertexCache(level.indices.data(),
+      level.indices.size(), vertexCount);
+  }
+}
+
+namespace Graphics
+{
+  void MeshSimplifier::BuildLevels(std::vector<SimplifiedLevel> &levels,
+    u32 const *indices, size_t indexCount, Vertex const *vertices,
+    size_t vertexCount, f32 const *targetRatios, size_t levelCount)
+  {
+    levels.clear();
+    levels.resize(levelCount);
+    if (levelCount == 0)
+      return;
+
+    size_t const originalTriangles = indexCount / 3;
+    std::vector<u32> current(indices, indices + originalTriangles * 3);
+    std::vector<u8> locked;
+    LockVertices(locked, current.data(), current.size(), vertices,
+      vertexCount);
+
+    // every vertex starts with the planes of the triangles around it
+    ThreadPool &pool = ThreadPool::GetInstance();
+    TriangleAdjacency adjacency;
+    adjacency.Build(current.data(), current.size(), vertexCount);
+    std::vector<Quadric> quadrics(vertexCount);
+    pool.ParallelFor(0, vertexCount, SimplifyGrain,
+      [&](size_t begin, size_t end)
+    {
+      for (size_t v = begin; v < end; ++v)
+      {
+        for (u32 i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; ++i)
+        {
+          u32 const *triangle = &current[adjacency.triangles[i] * 3];
+          Vector3 const &a = vertices[triangle[0]].vertex;
+          Vector3 normal = (vertices[triangle[1]].vertex - a).Cross(
+            vertices[triangle[2]].vertex - a);
+          f32 const length = normal.Length();
+          if (length > 0.f)
+            quadrics[v].AddPlane(normal / length, a, 0.5f * length);
+        }
+      }
+    });
+
+    std::vector<u32> collapseTo(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+      collapseTo[v] = u32(v);
+    std::vector<u8> touched(vertexCount);
+    std::vector<Collapse> candidates;
+    f32 squaredError = 0.f;
+    size_t level = 0;
+    bool adjacencyCurrent = true;
+    while (level < levelCount)
+    {
+      size_t const triangleCount = current.size() / 3;
+      size_t const target = std::max<size_t>(1,
+        size_t(targetRatios[level] * f32(originalTriangles)));
+      if (triangleCount <= target)
+      {
+        FinishLevel(levels[level++], current, squaredError, vertexCount);
+        continue;
+      }
+      if (!adjacencyCurrent)
+        adjacency.Build(current.data(), current.size(), vertexCount);
+      adjacencyCurrent = false;
+
+      // every half-edge is a candidate to collapse its first vertex onto its
+      // second; on a closed surface, each edge is thus tried both ways once
+      candidates.clear();
+      for (size_t i = 0; i < current.size(); ++i)
+      {
+        u32 const from = current[i];
+        if (!locked[from])
+        {
+          Collapse const collapse = { from, current[i - i % 3 + (i + 1) % 3],
+            0.f };
+          candidates.push_back(collapse);
+        }
+      }
+      pool.ParallelFor(0, candidates.size(), SimplifyGrain,
+        [&](size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; ++i)
+        {
+          Collapse &collapse = candidates[i];
+          if (CollapseFlips(collapse.from, collapse.to, current.data(),
+            adjacency, vertices))
+          {
+            collapse.error = std::numeric_limits<f32>::infinity();
+            continue;
+          }
+          Quadric combined = quadrics[collapse.from];
+          combined.Add(quadrics[collapse.to]);
+          collapse.error = combined.Evaluate(vertices[collapse.to].vertex)
+            / std::max(combined.weight, 1e-20f);
+        }
+      });
+      candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+        [](Collapse const &collapse)
+      {
+        return collapse.error == std::numeric_limits<f32>::infinity();
+      }), candidates.end());
+      size_t const examined = (candidates.size() + PassCandidateDivisor - 1)
+        / PassCandidateDivisor;
+      std::nth_element(candidates.begin(), candidates.begin() + examined,
+        candidates.end());
+      std::sort(candidates.begin(), candidates.begin() + examined);
+
+      // Take the cheapest collapses first. A collapse changes the triangles
+      // around its vertex, so all their vertices are left alone for the rest
+      // of the pass; the costs and flip tests computed above then still hold.
+      std::fill(touched.begin(), touched.end(), 0);
+      size_t const goal = triangleCount - target;
+      size_t removed = 0, applied = 0;
+      for (size_t c = 0; c < examined && removed < goal; ++c)
+      {
+        Collapse const &collapse = candidates[c];
+        if (touched[collapse.from] || touched[collapse.to])
+          continue;
+        for (u32 i = adjacency.offsets[collapse.from];
+          i < adjacency.offsets[collapse.from + 1]; ++i)
+        {
+          u32 const *triangle = &current[adjacency.triangles[i] * 3];
+          bool shared = false;
+          for (u32 j = 0; j < 3; ++j)
+          {
+            touched[triangle[j]] = 1;
+            shared = shared || triangle[j] == collapse.to;
+          }
+          if (shared)
+            ++removed;
+        }
+        collapseTo[collapse.from] = collapse.to;
+        quadrics[collapse.to].Add(quadrics[collapse.from]);
+        squaredError = std::max(squaredError, collapse.error);
+        ++applied;
+      }
+      if (applied == 0)
+        break; // nothing more may collapse
+
+      // move the collapsed vertices and drop the triangles that vanish
+      size_t kept = 0;
+      for (size_t t = 0; t < triangleCount; ++t)
+      {
+        u32 const a = collapseTo[current[t * 3]];
+        u32 const b = collapseTo[current[t * 3 + 1]];
+        u32 const c = collapseTo[current[t * 3 + 2]];
+        if (a == b || b == c || c == a)
+          continue;
+        current[kept * 3] = a;
+        current[kept * 3 + 1] = b;
+        current[kept * 3 + 2] = c;
+        ++kept;
+      }
+      current.resize(kept * 3);
+    }
+
+    // levels that could not be reached get the simplest mesh there is
+    for (; level < levelCount; ++level)
+      FinishLevel(levels[level], current, squaredError, vertexCount);
+  }
+}
@@ -0,0 +1,148 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/ThreadPool.h"
+#include "graphics/Meshlet.h"
+
+namespace
+{
+  using Graphics::Meshlet;
+  using Math::Vector3;
+
+  // Meshlets whose bounds are computed per ParallelFor chunk.
+  static size_t const BoundsGrain = 256;
+
+  Vector3 const &GetPosition(Vector3 const *positions, size_t stride,
+    u32 index)
+  {
+    return *reinterpret_cast<Vector3 const *>(
+      reinterpret_cast<u8 const *>(positions) + stride * index);
+  }
+
+  // Bounding sphere around the center of the bounding box of the meshlet's
+  // vertices; not minimal, but tight enough for culling and cheap.
+  void ComputeSphere(Meshlet &meshlet, u32 const *indices,
+    Vector3 const *positions, size_t stride)
+  {
+    u32 const *first = indices + meshlet.firstTriangle * 3;
+    u32 const *last = first + meshlet.triangleCount * 3;
+    Vector3 low = GetPosition(positions, stride, *first), high = low;
+    for (u32 const *index = first; index != last; ++index)
+    {
+      Vector3 const &p = GetPosition(positions, stride, *index);
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        low[axis] = std::min(low[axis], p[axis]);
+        high[axis] = std::max(high[axis], p[axis]);
+      }
+    }
+    meshlet.center = (low + high) * 0.5f;
+    f32 radiusSq = 0.f;
+    for (u32 const *index = first; index != last; ++index)
+      radiusSq = std::max(radiusSq,
+        (GetPosition(positions, stride, *index) - meshlet.center).LengthSq());
+    meshlet.radius = std::sqrt(radiusSq);
+  }
+
+  // Normal cone: the axis is the average of the unit face normals, and the
+  // spread is that of the normal furthest from it. Degenerate triangles have
+  // no direction and are ignored.
+  void ComputeCone(Meshlet &meshlet, u32 const *indices,
+    Vector3 const *positions, size_t stride)
+  {
+    u32 const *first = indices + meshlet.firstTriangle * 3;
+    Vector3 normals[Graphics::MeshletBuilder::MaxTriangles];
+    u32 normalCount = 0;
+    Vector3 axis(0.f);
+    for (u32 i = 0; i < meshlet.triangleCount; ++i)
+    {
+      Vector3 const &a = GetPosition(positions, stride, first[i * 3]);
+      Vector3 const &b = GetPosition(positions, stride, first[i * 3 + 1]);
+      Vector3 const &c = GetPosition(positions, stride, first[i * 3 + 2]);
+      Vector3 const normal = (b - a).Cross(c - a);
+      f32 const length = normal.Length();
+      if (length <= 0.f)
+        continue;
+      normals[normalCount] = normal / length;
+      axis += normals[normalCount++];
+    }
+
+    meshlet.coneAxis = Vector3(0.f, 0.f, 1.f);
+    meshlet.coneCutoff = 1.f;
+    f32 const axisLength = axis.Length();
+    if (normalCount == 0 || axisLength <= 1e-6f)
+      return; // no usable direction; never cone culled
+
+    axis /= axisLength;
+    f32 minimumDot = 1.f;
+    for (u32 i = 0; i < normalCount; ++i)
+      minimumDot = std::min(minimumDot, normals[i].Dot(axis));
+    meshlet.coneAxis = axis;
+    if (minimumDot > 0.f)
+      meshlet.coneCutoff = std::sqrt(1.f - minimumDot * minimumDot);
+  }
+}
+
+namespace Graphics
+{
+  void MeshletBuilder::Build(std::vector<Meshlet> &meshlets,
+    u32 const *indices, size_t indexCount, Math::Vector3 const *positions,
+    size_t positionStride, size_t vertexCount)
+  {
+    meshlets.clear();
+    size_t const triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+      return;
+    meshlets.reserve(triangleCount / MaxTriangles + 1);
+
+    // Which meshlet (plus one) last referenced each vertex; a vertex is new to
+    // the current meshlet unless it holds the current meshlet's number.
+    std::vector<u32> lastMeshlet(vertexCount, 0);
+    Meshlet current = Meshlet();
+    u32 currentNumber = 1;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+      u32 const *triangle = indices + t * 3;
+      u32 newVertices = 0;
+      for (u32 j = 0; j < 3; ++j)
+      {
+        Assert(triangle[j] < vertexCount, "Error: index out of bounds: %u",
+          triangle[j]);
+        if (lastMeshlet[triangle[j]] != currentNumber
+          && (j < 1 || triangle[j] != triangle[0])
+          && (j < 2 || triangle[j] != triangle[1]))
+          ++newVertices;
+      }
+
+      if (current.vertexCount + newVertices > MaxVertices
+        || current.triangleCount + 1 > MaxTriangles)
+      {
+        meshlets.push_back(current);
+        current.firstTriangle = static_cast<u32>(t);
+        current.triangleCount = 0;
+        current.vertexCount = 0;
+        ++currentNumber;
+        newVertices = 0;
+        for (u32 j = 0; j < 3; ++j)
+          if ((j < 1 || triangle[j] != triangle[0])
+            && (j < 2 || triangle[j] != triangle[1]))
+            ++newVertices;
+      }
+
+      for (u32 j = 0; j < 3; ++j)
+        lastMeshlet[triangle[j]] = currentNumber;
+      current.vertexCount += newVertices;
+      ++current.triangleCount;
+    }
+    meshlets.push_back(current);
+
+    ThreadPool::GetInstance().ParallelFor(0, meshlets.size(), BoundsGrain,
+      [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+      {
+        ComputeSphere(meshlets[i], indices, positions, positionStride);
+        ComputeCone(meshlets[i], indices, positions, positionStride);
+      }
+    });
+  }
+}
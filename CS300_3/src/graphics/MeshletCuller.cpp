@@ -0,0 +1,182 @@
+#include "Precompiled.h"
+#include "framework/Simd.h"
+#include "framework/ThreadPool.h"
+#include "graphics/FrustumCuller.h"
+#include "graphics/MeshletCuller.h"
+
+namespace
+{
+  using Math::Matrix4;
+  using Math::Vector3;
+
+  // Meshlets culled per ParallelFor chunk; a multiple of four, so that every
+  // chunk starts on a group of four.
+  static size_t const CullGrain = 1024;
+
+  // Per meshlet results of a cull.
+  enum CullResult : u8
+  {
+    Visible = 0,
+    OutsideFrustum = 1,
+    BackFacing = 2
+  };
+
+  size_t RoundUpToFour(size_t value)
+  {
+    return (value + 3) & ~size_t(3);
+  }
+}
+
+namespace Graphics
+{
+  MeshletCuller::MeshletCuller()
+    : meshletCount_(0)
+  {
+  }
+
+  void MeshletCuller::SetMeshlets(Meshlet const *meshlets, size_t count)
+  {
+    meshletCount_ = count;
+    size_t const padded = RoundUpToFour(count);
+
+    // padding never culls anything and is never drawn
+    centerX_.assign(padded, 0.f);
+    centerY_.assign(padded, 0.f);
+    centerZ_.assign(padded, 0.f);
+    radius_.assign(padded, 0.f);
+    coneX_.assign(padded, 0.f);
+    coneY_.assign(padded, 0.f);
+    coneZ_.assign(padded, 1.f);
+    coneCutoff_.assign(padded, 1.f);
+    firstTriangle_.resize(count);
+    triangleCount_.resize(count);
+    baseVertex_.resize(count);
+    results_.assign(padded, Visible);
+    for (size_t i = 0; i < count; ++i)
+    {
+      Meshlet const &meshlet = meshlets[i];
+      centerX_[i] = meshlet.center.x;
+      centerY_[i] = meshlet.center.y;
+      centerZ_[i] = meshlet.center.z;
+      radius_[i] = meshlet.radius;
+      coneX_[i] = meshlet.coneAxis.x;
+      coneY_[i] = meshlet.coneAxis.y;
+      coneZ_[i] = meshlet.coneAxis.z;
+      coneCutoff_[i] = meshlet.coneCutoff;
+      firstTriangle_[i] = meshlet.firstTriangle;
+      triangleCount_[i] = meshlet.triangleCount;
+      baseVertex_[i] = meshlet.baseVertex;
+    }
+  }
+
+  MeshletCullStats MeshletCuller::Cull(Math::Matrix4 const &modelViewProjection,
+    Math::Vector3 const &eye, std::vector<IndexRange> &ranges,
+    bool cullBackFacing)
+  {
+    MeshletCullStats stats;
+    std::memset(&stats, 0, sizeof(stats));
+    ranges.clear();
+    if (meshletCount_ == 0)
+      return stats;
+
+    FrustumPlanes const planes(modelViewProjection);
+    ThreadPool::GetInstance().ParallelFor(0, RoundUpToFour(meshletCount_),
+      CullGrain, [&](size_t begin, size_t end)
+    {
+#if USE_SSE
+      __m128 const eyeX = _mm_set1_ps(eye.x);
+      __m128 const eyeY = _mm_set1_ps(eye.y);
+      __m128 const eyeZ = _mm_set1_ps(eye.z);
+      for (size_t i = begin; i < end; i += 4)
+      {
+        __m128 const cx = _mm_loadu_ps(&centerX_[i]);
+        __m128 const cy = _mm_loadu_ps(&centerY_[i]);
+        __m128 const cz = _mm_loadu_ps(&centerZ_[i]);
+        __m128 const r = _mm_loadu_ps(&radius_[i]);
+        __m128 const negativeR = _mm_sub_ps(_mm_setzero_ps(), r);
+
+        // sphere behind any of the planes
+        __m128 outside = _mm_setzero_ps();
+        for (u32 p = 0; p < 6; ++p)
+        {
+          __m128 distance = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes.x[p])),
+            _mm_mul_ps(cy, _mm_set1_ps(planes.y[p])));
+          distance = _mm_add_ps(distance, _mm_add_ps(
+            _mm_mul_ps(cz, _mm_set1_ps(planes.z[p])), _mm_set1_ps(planes.w[p])));
+          outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeR));
+        }
+
+        // dot(center - eye, axis) >= cutoff * |center - eye| + radius
+        __m128 const dx = _mm_sub_ps(cx, eyeX);
+        __m128 const dy = _mm_sub_ps(cy, eyeY);
+        __m128 const dz = _mm_sub_ps(cz, eyeZ);
+        __m128 const along = _mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(dx, _mm_loadu_ps(&coneX_[i])),
+          _mm_mul_ps(dy, _mm_loadu_ps(&coneY_[i]))),
+          _mm_mul_ps(dz, _mm_loadu_ps(&coneZ_[i])));
+        __m128 const distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        __m128 const backFacing = _mm_cmpge_ps(along, _mm_add_ps(
+          _mm_mul_ps(_mm_loadu_ps(&coneCutoff_[i]), distance), r));
+
+        int const outsideMask = _mm_movemask_ps(outside);
+        int const backFacingMask = cullBackFacing
+          ? _mm_movemask_ps(backFacing) : 0;
+        for (u32 k = 0; k < 4; ++k)
+          results_[i + k] = (outsideMask >> k) & 1 ? OutsideFrustum
+            : (backFacingMask >> k) & 1 ? BackFacing : Visible;
+      }
+#else
+      for (size_t i = begin; i < end; ++i)
+      {
+        CullResult result = Visible;
+        for (u32 p = 0; p < 6 && result == Visible; ++p)
+        {
+          if (centerX_[i] * planes.x[p] + centerY_[i] * planes.y[p]
+            + centerZ_[i] * planes.z[p] + planes.w[p] < -radius_[i])
+            result = OutsideFrustum;
+        }
+        if (result == Visible && cullBackFacing)
+        {
+          Vector3 const toCenter = Vector3(centerX_[i], centerY_[i],
+            centerZ_[i]) - eye;
+          if (toCenter.Dot(Vector3(coneX_[i], coneY_[i], coneZ_[i]))
+            >= coneCutoff_[i] * toCenter.Length() + radius_[i])
+            result = BackFacing;
+        }
+        results_[i] = result;
+      }
+#endif
+    });
+
+    // merge runs of visible meshlets, which are adjacent in the index buffer
+    stats.meshletCount = static_cast<u32>(meshletCount_);
+    for (size_t i = 0; i < meshletCount_; ++i)
+    {
+      stats.triangleCount += triangleCount_[i];
+      if (results_[i] == OutsideFrustum)
+      {
+        ++stats.frustumCulled;
+        continue;
+      }
+      if (results_[i] == BackFacing)
+      {
+        ++stats.coneCulled;
+        continue;
+      }
+
+      ++stats.visibleMeshlets;
+      stats.visibleTriangles += triangleCount_[i];
+      u32 const firstIndex = firstTriangle_[i] * 3;
+      u32 const indexCount = triangleCount_[i] * 3;
+      if (!ranges.empty() && ranges.back().firstIndex
+        + ranges.back().indexCount == firstIndex
+        && ranges.back().baseVertex == baseVertex_[i])
+        ranges.back().indexCount += indexCount;
+      else
+        ranges.push_back(IndexRange(firstIndex, indexCount, baseVertex_[i]));
+    }
+    stats.rangeCount = static_cast<u32>(ranges.size());
+    return stats;
+  }
+}
@@ -0,0 +1,450 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/Simd.h"
+#include "framework/ThreadPool.h"
+#include "graphics/Image.h"
+#include "graphics/MipmapGenerator.h"
+
+namespace
+{
+  using namespace Graphics;
+
+  static f64 const Pi = 3.14159265358979323846;
+
+  // How a single 8-bit channel is mapped to and from the floating point
+  // values that are actually filtered.
+  enum class ChannelEncoding
+  {
+    Linear, // [0, 255] -> [0, 1]
+    Srgb,   // [0, 255] -> linear light in [0, 1]
+    Signed  // [0, 255] -> [-1, 1], used for normal vectors
+  };
+
+  // Conversion tables between sRGB encoded bytes and linear light. Decoding
+  // is a direct lookup; encoding quantizes linear light to 16 bits first,
+  // which is fine enough to round to the same byte as the exact formula even
+  // in the steep part of the curve near black.
+  struct SrgbTables
+  {
+    f32 toLinear[256];
+    u8 fromLinear[65536];
+
+    SrgbTables()
+    {
+      for (u32 i = 0; i < 256; ++i)
+      {
+        f64 const c = i / 255.0;
+        toLinear[i] = static_cast<f32>(c <= 0.04045 ? c / 12.92
+          : std::pow((c + 0.055) / 1.055, 2.4));
+      }
+      for (u32 i = 0; i < 65536; ++i)
+      {
+        f64 const l = i / 65535.0;
+        f64 const c = l <= 0.0031308 ? l * 12.92
+          : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+        fromLinear[i] = static_cast<u8>(std::min(c * 255.0 + 0.5, 255.0));
+      }
+    }
+  };
+
+  // built during static initialization, before any worker could read it
+  static SrgbTables const Srgb;
+
+  // The filter taps of one axis: every destination texel reads tapCount source
+  // texels. Indices already have the edge mode applied; destinations needing
+  // fewer taps are padded with zero weights.
+  struct FilterTaps
+  {
+    u32 tapCount;
+    std::vector<u32> indices;
+    std::vector<f32> weights;
+  };
+
+  static f64 Sinc(f64 x)
+  {
+    if (std::abs(x) < 1e-6)
+      return 1.0;
+    return std::sin(Pi * x) / (Pi * x);
+  }
+
+  // Zeroth order modified Bessel function of the first kind (power series).
+  static f64 BesselI0(f64 x)
+  {
+    f64 sum = 1.0, term = 1.0;
+    f64 const halfX = x * 0.5;
+    for (u32 k = 1; k < 64; ++k)
+    {
+      term *= (halfX / k) * (halfX / k);
+      sum += term;
+      if (term < sum * 1e-12)
+        break;
+    }
+    return sum;
+  }
+
+  static f64 Kaiser(f64 x, f64 radius, f64 alpha)
+  {
+    if (std::abs(x) >= radius)
+      return 0.0;
+    f64 const t = x / radius;
+    return Sinc(x) * BesselI0(alpha * std::sqrt(1.0 - t * t))
+      / BesselI0(alpha);
+  }
+
+  static u32 ResolveIndex(s64 index, u32 size, MipmapEdgeMode edgeMode)
+  {
+    if (edgeMode == MipmapEdgeMode::Repeat)
+      return static_cast<u32>(((index % size) + size) % size);
+    return static_cast<u32>(std::max<s64>(0, std::min<s64>(index, size - 1)));
+  }
+
+  static void ComputeTaps(u32 sourceSize, u32 destinationSize,
+    MipmapSettings const &settings, FilterTaps &taps)
+  {
+    f64 const scale = f64(sourceSize) / destinationSize;
+    std::vector<std::vector<std::pair<u32, f64> > > perTexel(destinationSize);
+    taps.tapCount = 1;
+    for (u32 d = 0; d < destinationSize; ++d)
+    {
+      // the destination texel's center and footprint in source texel space
+      f64 const center = (d + 0.5) * scale;
+      f64 const support = settings.filter == MipmapFilter::Box ? scale * 0.5
+        : settings.kaiserRadius * scale;
+      s64 const first = static_cast<s64>(std::floor(center - support));
+      s64 const last = static_cast<s64>(std::ceil(center + support));
+
+      auto &texelTaps = perTexel[d];
+      f64 total = 0.0;
+      for (s64 s = first; s < last; ++s)
+      {
+        f64 weight;
+        if (settings.filter == MipmapFilter::Box) // coverage of the footprint
+          weight = std::max(0.0, std::min(s + 1.0, center + support)
+            - std::max(f64(s), center - support));
+        else
+          weight = Kaiser((s + 0.5 - center) / scale, settings.kaiserRadius,
+            settings.kaiserAlpha);
+        if (std::abs(weight) < 1e-8)
+          continue;
+        texelTaps.push_back(std::make_pair(
+          ResolveIndex(s, sourceSize, settings.edgeMode), weight));
+        total += weight;
+      }
+
+      if (texelTaps.empty() || std::abs(total) < 1e-8)
+      {
+        // degenerate filter: fall back to the nearest texel
+        texelTaps.assign(1, std::make_pair(ResolveIndex(
+          static_cast<s64>(center), sourceSize, settings.edgeMode), 1.0));
+        total = 1.0;
+      }
+      for (auto &tap : texelTaps)
+        tap.second /= total; // weights of each texel sum to exactly one
+      taps.tapCount = std::max(taps.tapCount, u32(texelTaps.size()));
+    }
+
+    taps.indices.assign(size_t(destinationSize) * taps.tapCount, 0);
+    taps.weights.assign(size_t(destinationSize) * taps.tapCount, 0.f);
+    for (u32 d = 0; d < destinationSize; ++d)
+    {
+      for (size_t t = 0; t < perTexel[d].size(); ++t)
+      {
+        taps.indices[d * taps.tapCount + t] = perTexel[d][t].first;
+        taps.weights[d * taps.tapCount + t] =
+          static_cast<f32>(perTexel[d][t].second);
+      }
+    }
+  }
+
+  // dst[i] += src[i] * weight over a whole row of floats
+  static void AccumulateRow(f32 *dst, f32 const *src, f32 weight, size_t count)
+  {
+    size_t i = 0;
+#if USE_SSE
+    __m128 const w = _mm_set1_ps(weight);
+    for (; i + 8 <= count; i += 8)
+    {
+      __m128 a = _mm_loadu_ps(dst + i), b = _mm_loadu_ps(dst + i + 4);
+      a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(src + i), w));
+      b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(src + i + 4), w));
+      _mm_storeu_ps(dst + i, a);
+      _mm_storeu_ps(dst + i + 4, b);
+    }
+    for (; i + 4 <= count; i += 4)
+      _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+        _mm_mul_ps(_mm_loadu_ps(src + i), w)));
+#endif
+    for (; i < count; ++i)
+      dst[i] += src[i] * weight;
+  }
+
+  static void GetChannelEncodings(u32 channelCount,
+    MipmapColorSpace colorSpace, ChannelEncoding encodings[4])
+  {
+    for (u32 c = 0; c < 4; ++c)
+    {
+      encodings[c] = ChannelEncoding::Linear; // alpha is always linear
+      if (c == 3 || c >= channelCount)
+        continue;
+      if (colorSpace == MipmapColorSpace::Srgb)
+        encodings[c] = ChannelEncoding::Srgb;
+      else if (colorSpace == MipmapColorSpace::NormalMap && channelCount >= 3)
+        encodings[c] = ChannelEncoding::Signed;
+    }
+  }
+
+  static f32 Decode(u8 value, ChannelEncoding encoding)
+  {
+    switch (encoding)
+    {
+    case ChannelEncoding::Srgb: return Srgb.toLinear[value];
+    case ChannelEncoding::Signed: return value * (2.f / 255.f) - 1.f;
+    default: return value * (1.f / 255.f);
+    }
+  }
+
+  static u8 Encode(f32 value, ChannelEncoding encoding)
+  {
+    if (encoding == ChannelEncoding::Signed)
+      value = value * 0.5f + 0.5f;
+    value = std::min(std::max(value, 0.f), 1.f); // sinc lobes may overshoot
+    if (encoding == ChannelEncoding::Srgb)
+      return Srgb.fromLinear[static_cast<u32>(value * 65535.f + 0.5f)];
+    return static_cast<u8>(value * 255.f + 0.5f);
+  }
+
+  static void ForEachRow(u32 rowCount, size_t rowCost, bool multithreaded,
+    ThreadPool::RangeFunction const &body)
+  {
+    // aim for chunks of roughly 64K multiply-adds so scheduling stays cheap
+    size_t const grain = multithreaded
+      ? std::max<size_t>(1, (size_t(1) << 16) / std::max<size_t>(rowCost, 1))
+      : rowCount;
+    ThreadPool::GetInstance().ParallelFor(0, rowCount, grain, body);
+  }
+
+  // Produces every level after the first. 'targets' receives the quantized
+  // pixels of level i at targets[i]; targets[0] is the source image.
+  static void GenerateLevels(std::vector<MipmapLevel> const &levels,
+    std::vector<u8 *> const &targets, u32 channelCount,
+    MipmapSettings const &settings)
+  {
+    if (levels.size() < 2)
+      return;
+    Assert(channelCount >= 1 && channelCount <= 4,
+      "Error: cannot build mipmaps with %d channels", channelCount);
+
+    ChannelEncoding encodings[4];
+    GetChannelEncodings(channelCount, settings.colorSpace, encodings);
+    bool const renormalize = settings.colorSpace == MipmapColorSpace::NormalMap
+      && channelCount >= 3;
+
+    // decode the base level into linear floating point
+    std::vector<f32> current(size_t(levels[0].width) * levels[0].height
+      * channelCount);
+    {
+      size_t const rowSize = size_t(levels[0].width) * channelCount;
+      u8 const *source = targets[0];
+      ForEachRow(levels[0].height, rowSize, settings.multithreaded,
+        [&](size_t begin, size_t end) {
+          for (size_t i = begin * rowSize; i < end * rowSize; ++i)
+            current[i] = Decode(source[i], encodings[i % channelCount]);
+        });
+    }
+
+    std::vector<f32> next;
+    FilterTaps horizontal, vertical;
+    for (size_t level = 1; level < levels.size(); ++level)
+    {
+      u32 const sourceWidth = levels[level - 1].width;
+      u32 const sourceHeight = levels[level - 1].height;
+      u32 const width = levels[level].width;
+      u32 const height = levels[level].height;
+      ComputeTaps(sourceWidth, width, settings, horizontal);
+      ComputeTaps(sourceHeight, height, settings, vertical);
+
+      size_t const sourceRowSize = size_t(sourceWidth) * channelCount;
+      size_t const rowSize = size_t(width) * channelCount;
+      next.resize(rowSize * height);
+      u8 *target = targets[level];
+
+      ForEachRow(height, sourceRowSize * vertical.tapCount,
+        settings.multithreaded, [&](size_t begin, size_t end) {
+        std::vector<f32> filtered(sourceRowSize);
+        for (size_t y = begin; y < end; ++y)
+        {
+          // vertical pass: blend whole source rows into one (SIMD)
+          std::fill(filtered.begin(), filtered.end(), 0.f);
+          for (u32 t = 0; t < vertical.tapCount; ++t)
+          {
+            f32 const weight = vertical.weights[y * vertical.tapCount + t];
+            if (weight != 0.f)
+              AccumulateRow(filtered.data(), current.data()
+                + vertical.indices[y * vertical.tapCount + t] * sourceRowSize,
+                weight, sourceRowSize);
+          }
+
+          // horizontal pass: resample the blended row to the new width
+          f32 *out = next.data() + y * rowSize;
+          for (u32 x = 0; x < width; ++x)
+          {
+            f32 texel[4] = { 0.f, 0.f, 0.f, 0.f };
+            for (u32 t = 0; t < horizontal.tapCount; ++t)
+            {
+              f32 const weight = horizontal.weights[x * horizontal.tapCount + t];
+              f32 const *in = filtered.data()
+                + horizontal.indices[x * horizontal.tapCount + t] * channelCount;
+              for (u32 c = 0; c < channelCount; ++c)
+                texel[c] += in[c] * weight;
+            }
+
+            if (renormalize)
+            {
+              f32 const length = std::sqrt(texel[0] * texel[0]
+                + texel[1] * texel[1] + texel[2] * texel[2]);
+              if (length > 1e-8f)
+              {
+                texel[0] /= length;
+                texel[1] /= length;
+                texel[2] /= length;
+              }
+              else
+              {
+                texel[0] = texel[1] = 0.f;
+                texel[2] = 1.f;
+              }
+            }
+
+            for (u32 c = 0; c < channelCount; ++c)
+            {
+              out[x * channelCount + c] = texel[c];
+              target[y * rowSize + x * channelCount + c] =
+                Encode(texel[c], encodings[c]);
+            }
+          }
+        }
+      });
+
+      current.swap(next);
+    }
+  }
+}
+
+namespace Graphics
+{
+  MipmapSettings::MipmapSettings()
+    : filter(MipmapFilter::Kaiser), colorSpace(MipmapColorSpace::Srgb),
+    edgeMode(MipmapEdgeMode::Repeat), kaiserRadius(3.f), kaiserAlpha(4.f),
+    maxLevelCount(0), multithreaded(true)
+  {
+  }
+
+  u32 MipmapGenerator::GetLevelCount(u32 width, u32 height)
+  {
+    u32 count = 1;
+    for (u32 size = std::max(width, height); size > 1; size >>= 1)
+      ++count;
+    return count;
+  }
+
+  size_t MipmapGenerator::ComputeLayout(u32 width, u32 height,
+    u32 channelCount, MipmapSettings const &settings,
+    std::vector<MipmapLevel> &levels)
+  {
+    u32 count = GetLevelCount(width, height);
+    if (settings.maxLevelCount != 0)
+      count = std::min(count, settings.maxLevelCount);
+
+    levels.resize(count);
+    size_t offset = 0;
+    for (u32 i = 0; i < count; ++i)
+    {
+      levels[i].width = std::max(width >> i, 1u);
+      levels[i].height = std::max(height >> i, 1u);
+      levels[i].offset = offset;
+      levels[i].size = size_t(levels[i].width) * levels[i].height
+        * channelCount;
+      offset += levels[i].size;
+    }
+    return offset;
+  }
+
+  void MipmapGenerator::Generate(u8 *pixels,
+    std::vector<MipmapLevel> const &levels, u32 channelCount,
+    MipmapSettings const &settings)
+  {
+    std::vector<u8 *> targets(levels.size());
+    for (size_t i = 0; i < levels.size(); ++i)
+      targets[i] = pixels + levels[i].offset;
+    GenerateLevels(levels, targets, channelCount, settings);
+  }
+
+  std::vector<Image> MipmapGenerator::BuildPyramid(Image const &source,
+    MipmapSettings const &settings)
+  {
+    std::vector<MipmapLevel> levels;
+    ComputeLayout(source.GetWidth(), source.GetHeight(),
+      source.GetChannelCount(), settings, levels);
+
+    std::vector<Image> pyramid(levels.size());
+    std::vector<u8 *> targets(levels.size());
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+      pyramid[i].Resize(levels[i].width, levels[i].height,
+        source.GetChannelCount());
+      targets[i] = pyramid[i].GetPixels();
+    }
+    std::memcpy(pyramid[0].GetPixels(), source.GetPixels(), source.GetSize());
+    GenerateLevels(levels, targets, source.GetChannelCount(), settings);
+    return pyramid;
+  }
+
+  void MipmapGenerator::Benchmark(u32 width, u32 height, u32 iterations)
+  {
+    static char const *FilterNames[] = { "box", "kaiser" };
+    u32 const channelCount = 3;
+
+    MipmapSettings settings;
+    std::vector<MipmapLevel> levels;
+    std::vector<u8> pixels(ComputeLayout(width, height, channelCount, settings,
+      levels));
+
+    // deterministic noise: the worst case for quality, irrelevant for speed
+    u32 seed = 0x9e3779b9u;
+    for (size_t i = 0; i < levels[0].size; ++i)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      pixels[i] = static_cast<u8>(seed >> 24);
+    }
+
+    size_t texelCount = 0;
+    for (auto const &level : levels)
+      texelCount += size_t(level.width) * level.height;
+
+    std::cout << "Mipmap benchmark: " << width << "x" << height << " RGB, "
+      << levels.size() << " levels, " << iterations << " iterations"
+      << std::endl;
+    for (u32 filter = 0; filter < u32(MipmapFilter::Count); ++filter)
+    {
+      for (u32 threaded = 0; threaded < 2; ++threaded)
+      {
+        settings.filter = MipmapFilter(filter);
+        settings.multithreaded = threaded != 0;
+
+        auto const start = std::chrono::high_resolution_clock::now();
+        for (u32 i = 0; i < iterations; ++i)
+          Generate(pixels.data(), levels, channelCount, settings);
+        auto const stop = std::chrono::high_resolution_clock::now();
+
+        f64 const seconds = std::chrono::duration<f64>(stop - start).count()
+          / std::max(iterations, 1u);
+        u32 const threads = threaded
+          ? ThreadPool::GetInstance().GetThreadCount() : 1;
+        std::cout << "  " << FilterNames[filter] << ", " << threads
+          << (threads == 1 ? " thread: " : " threads: ")
+          << seconds * 1000.0 << " ms/chain, "
+          << texelCount / seconds / 1e6 << " Mtexel/s" << std::endl;
+      }
+    }
+  }
+}
@@ -0,0 +1,519 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/FileSystem.h"
+#include "framework/ThreadPool.h"
+#include "graphics/ObjParser.h"
+
+namespace
+{
+  using Graphics::ObjCorner;
+  using Math::Vector2;
+  using Math::Vector3;
+
+  // Files are split into chunks of at least this size for parallel parsing;
+  // smaller ones would not pay for the merge.
+  static size_t const MinChunkSize = 1 << 20;
+
+  // A face corner as written in the file. Positive indices count from 1 at
+  // the start of the file and are kept as is; negative (relative) indices
+  // are converted to 0-based indices local to the chunk, which may still be
+  // negative if they refer back into an earlier chunk, and flagged.
+  struct RawCorner
+  {
+    s32 indices[3]; // position, texture coordinate, normal; 0 = absent
+    u8 localMask;   // bit i set: indices[i] is chunk-local
+  };
+
+  struct Chunk
+  {
+    char const *begin, *end;
+    std::vector<Vector3> positions;
+    std::vector<Vector2> texCoords;
+    std::vector<Vector3> normals;
+    std::vector<RawCorner> rawCorners;
+    std::vector<u32> faceSizes;
+
+    // filled in after merging
+    size_t bases[3]; // positions, texture coordinates, normals before chunk
+    std::vector<ObjCorner> corners;
+    size_t triangleCount, triangleOffset, invalidFaceCount;
+  };
+
+  inline bool IsSpace(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  inline void SkipSpaces(char const *&p, char const *end)
+  {
+    while (p < end && IsSpace(*p))
+      ++p;
+  }
+
+  inline bool IsDigit(char c)
+  {
+    return static_cast<unsigned>(c - '0') < 10u;
+  }
+
+  // Parses a signed decimal integer. Returns false if there are no digits.
+  bool ParseInt(char const *&p, char const *end, s32 &value)
+  {
+    char const *q = p;
+    bool const negative = q < end && *q == '-';
+    if (q < end && (*q == '-' || *q == '+'))
+      ++q;
+    if (q == end || !IsDigit(*q))
+      return false;
+    s64 result = 0;
+    while (q < end && IsDigit(*q))
+      result = std::min<s64>(result * 10 + (*q++ - '0'), 0x7fffffff);
+    value = static_cast<s32>(negative ? -result : result);
+    p = q;
+    return true;
+  }
+
+  // Parses a decimal floating point number with optional fraction and
+  // exponent, skipping leading spaces; a stand-in for std::from_chars, which
+  // the compilers this framework supports do not provide for floats. Up to
+  // 19 significant digits are accumulated exactly, then scaled once by a
+  // power of ten, which is far more precise than a float needs.
+  bool ParseFloat(char const *&p, char const *end, f32 &value)
+  {
+    static f64 const Powers[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+      1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    SkipSpaces(p, end);
+    char const *q = p;
+    bool const negative = q < end && *q == '-';
+    if (q < end && (*q == '-' || *q == '+'))
+      ++q;
+
+    u64 mantissa = 0;
+    s32 exponent = 0, digitCount = 0;
+    for (; q < end && IsDigit(*q); ++q, ++digitCount)
+    {
+      if (mantissa < 1000000000000000000ull)
+        mantissa = mantissa * 10 + (*q - '0');
+      else
+        ++exponent; // digits beyond what u64 holds only scale the value
+    }
+    if (q < end && *q == '.')
+    {
+      for (++q; q < end && IsDigit(*q); ++q, ++digitCount)
+      {
+        if (mantissa < 1000000000000000000ull)
+        {
+          mantissa = mantissa * 10 + (*q - '0');
+          --exponent;
+        }
+      }
+    }
+    if (digitCount == 0)
+      return false;
+
+    if (q < end && (*q == 'e' || *q == 'E'))
+    {
+      char const *e = q + 1;
+      s32 written = 0;
+      if (ParseInt(e, end, written))
+      {
+        exponent += std::max(std::min(written, 400), -400);
+        q = e;
+      }
+    }
+
+    f64 result = static_cast<f64>(mantissa);
+    if (mantissa != 0 && exponent != 0)
+    {
+      s32 const magnitude = std::abs(exponent);
+      f64 const scale = magnitude <= 22 ? Powers[magnitude]
+        : std::pow(10.0, magnitude);
+      result = exponent < 0 ? result / scale : result * scale;
+    }
+    value = static_cast<f32>(negative ? -result : result);
+    p = q;
+    return true;
+  }
+
+  // Parses up to count floats into values (left untouched when missing).
+  void ParseFloats(char const *p, char const *end, f32 *values, u32 count)
+  {
+    for (u32 i = 0; i < count && ParseFloat(p, end, values[i]); ++i)
+      ;
+  }
+
+  // Parses one "v", "v/vt", "v//vn" or "v/vt/vn" face corner.
+  bool ParseCorner(char const *&p, char const *end, Chunk const &chunk,
+    RawCorner &corner)
+  {
+    SkipSpaces(p, end);
+    corner.indices[0] = corner.indices[1] = corner.indices[2] = 0;
+    corner.localMask = 0;
+    if (!ParseInt(p, end, corner.indices[0]))
+      return false;
+    if (p < end && *p == '/')
+    {
+      ++p;
+      if (p < end && *p != '/')
+        ParseInt(p, end, corner.indices[1]);
+      if (p < end && *p == '/')
+      {
+        ++p;
+        ParseInt(p, end, corner.indices[2]);
+      }
+    }
+
+    size_t const counts[] = { chunk.positions.size(),
+      chunk.texCoords.size(), chunk.normals.size() };
+    for (u32 i = 0; i < 3; ++i)
+    {
+      if (corner.indices[i] < 0)
+      {
+        corner.indices[i] += static_cast<s32>(counts[i]);
+        corner.localMask |= u8(1 << i);
+      }
+    }
+    return true;
+  }
+
+  void ParseChunk(Chunk &chunk)
+  {
+    char const *p = chunk.begin;
+    char const *const end = chunk.end;
+    while (p < end)
+    {
+      SkipSpaces(p, end);
+      char const *lineEnd = static_cast<char const *>(
+        std::memchr(p, '\n', end - p));
+      if (!lineEnd)
+        lineEnd = end;
+
+      if (lineEnd - p >= 2 && p[0] == 'v')
+      {
+        if (IsSpace(p[1]))
+        {
+          chunk.positions.push_back(Vector3(0.f));
+          ParseFloats(p + 2, lineEnd, chunk.positions.back().ToFloats(), 3);
+        }
+        else if (p[1] == 't' && lineEnd - p >= 3 && IsSpace(p[2]))
+        {
+          chunk.texCoords.push_back(Vector2(0.f));
+          ParseFloats(p + 3, lineEnd, chunk.texCoords.back().ToFloats(), 2);
+        }
+        else if (p[1] == 'n' && lineEnd - p >= 3 && IsSpace(p[2]))
+        {
+          chunk.normals.push_back(Vector3(0.f));
+          ParseFloats(p + 3, lineEnd, chunk.normals.back().ToFloats(), 3);
+        }
+      }
+      else if (lineEnd - p >= 2 && p[0] == 'f' && IsSpace(p[1]))
+      {
+        char const *q = p + 2;
+        u32 size = 0;
+        RawCorner corner;
+        while (ParseCorner(q, lineEnd, chunk, corner))
+        {
+          chunk.rawCorners.push_back(corner);
+          ++size;
+        }
+        chunk.faceSizes.push_back(size);
+      }
+      p = lineEnd + 1;
+    }
+  }
+
+  // Converts the raw corners of a chunk to final indices, validating them;
+  // faces with an invalid corner get their size set to 0.
+  void ResolveChunk(Chunk &chunk, size_t const totals[3])
+  {
+    chunk.corners.resize(chunk.rawCorners.size());
+    chunk.triangleCount = 0;
+    chunk.invalidFaceCount = 0;
+    size_t corner = 0;
+    for (auto &size : chunk.faceSizes)
+    {
+      bool valid = size >= 3;
+      for (u32 i = 0; i < size; ++i, ++corner)
+      {
+        RawCorner const &raw = chunk.rawCorners[corner];
+        u32 *resolved = &chunk.corners[corner].position;
+        for (u32 j = 0; j < 3; ++j)
+        {
+          s64 index = raw.indices[j];
+          if (raw.localMask & (1 << j))
+            index += static_cast<s64>(chunk.bases[j]);
+          else if (index == 0)
+          {
+            valid &= j != 0; // only texture coordinates and normals are optional
+            resolved[j] = ObjCorner::None;
+            continue;
+          }
+          else
+            index -= 1;
+          valid &= index >= 0 && index < static_cast<s64>(totals[j]);
+          resolved[j] = static_cast<u32>(index);
+        }
+      }
+      if (valid)
+        chunk.triangleCount += size - 2;
+      else
+      {
+        ++chunk.invalidFaceCount;
+        size = 0;
+      }
+    }
+    chunk.rawCorners.clear();
+    chunk.rawCorners.shrink_to_fit();
+  }
+
+  // Twice the signed area of the 2D triangle (a, b, c).
+  inline f32 Cross2D(Vector2 const &a, Vector2 const &b, Vector2 const &c)
+  {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  }
+
+  bool IsInsideTriangle(Vector2 const &p, Vector2 const &a, Vector2 const &b,
+    Vector2 const &c)
+  {
+    return Cross2D(a, b, p) >= 0.f && Cross2D(b, c, p) >= 0.f
+      && Cross2D(c, a, p) >= 0.f;
+  }
+
+  // Splits a polygon of n >= 3 corners into n - 2 triangles written to out.
+  // Convex polygons become a fan; concave ones are ear clipped in the plane
+  // that the polygon's (Newell) normal is most aligned with.
+  void Triangulate(ObjCorner const *polygon, u32 n,
+    std::vector<Vector3> const &positions, ObjCorner *out,
+    std::vector<Vector2> &projected, std::vector<u32> &remaining)
+  {
+    if (n > 3)
+    {
+      Vector3 normal(0.f);
+      for (u32 i = 0; i < n; ++i)
+      {
+        Vector3 const &a = positions[polygon[i].position];
+        Vector3 const &b = positions[polygon[(i + 1) % n].position];
+        normal.x += (a.y - b.y) * (a.z + b.z);
+        normal.y += (a.z - b.z) * (a.x + b.x);
+        normal.z += (a.x - b.x) * (a.y + b.y);
+      }
+
+      // drop the dominant axis, keeping the winding counter-clockwise
+      u32 const axis = std::abs(normal.x) > std::abs(normal.y)
+        ? (std::abs(normal.x) > std::abs(normal.z) ? 0 : 2)
+        : (std::abs(normal.y) > std::abs(normal.z) ? 1 : 2);
+      u32 const u = (axis + 1) % 3, v = (axis + 2) % 3;
+      f32 const flip = normal[axis] < 0.f ? -1.f : 1.f;
+      projected.resize(n);
+      for (u32 i = 0; i < n; ++i)
+      {
+        Vector3 const &position = positions[polygon[i].position];
+        projected[i] = Vector2(position[u], flip * position[v]);
+      }
+
+      bool convex = true;
+      for (u32 i = 0; i < n && convex; ++i)
+        convex = Cross2D(projected[(i + n - 1) % n], projected[i],
+          projected[(i + 1) % n]) >= 0.f;
+
+      if (!convex)
+      {
+        remaining.resize(n);
+        for (u32 i = 0; i < n; ++i)
+          remaining[i] = i;
+
+        u32 count = n;
+        for (u32 i = 0, misses = 0; count > 3 && misses < count;)
+        {
+          u32 const prev = remaining[(i + count - 1) % count];
+          u32 const curr = remaining[i % count];
+          u32 const next = remaining[(i + 1) % count];
+          bool ear = Cross2D(projected[prev], projected[curr],
+            projected[next]) > 0.f;
+          for (u32 j = 0; j < count && ear; ++j)
+          {
+            u32 const other = remaining[j];
+            ear = other == prev || other == curr || other == next
+              || !IsInsideTriangle(projected[other], projected[prev],
+                projected[curr], projected[next]);
+          }
+
+          if (ear)
+          {
+            *out++ = polygon[prev];
+            *out++ = polygon[curr];
+            *out++ = polygon[next];
+            remaining.erase(remaining.begin() + i % count);
+            --count;
+            misses = 0;
+          }
+          else
+          {
+            i = (i + 1) % count;
+            ++misses;
+          }
+        }
+
+        // whatever is left (a triangle, or a degenerate polygon that has no
+        // ear) is fanned, which always yields the right triangle count
+        for (u32 i = 1; i + 1 < count; ++i)
+        {
+          *out++ = polygon[remaining[0]];
+          *out++ = polygon[remaining[i]];
+          *out++ = polygon[remaining[i + 1]];
+        }
+        return;
+      }
+    }
+
+    for (u32 i = 1; i + 1 < n; ++i)
+    {
+      *out++ = polygon[0];
+      *out++ = polygon[i];
+      *out++ = polygon[i + 1];
+    }
+  }
+}
+
+namespace Graphics
+{
+  bool ObjParser::Parse(char const *text, size_t size, ObjData &data)
+  {
+    data.positions.clear();
+    data.texCoords.clear();
+    data.normals.clear();
+    data.corners.clear();
+    data.faceCount = data.invalidFaceCount = 0;
+
+    // split at line boundaries into about four chunks per thread
+    ThreadPool &pool = ThreadPool::GetInstance();
+    size_t const chunkSize = std::max(MinChunkSize,
+      size / (pool.GetThreadCount() * 4) + 1);
+    std::vector<Chunk> chunks;
+    for (char const *begin = text, *end = text + size; begin < end;)
+    {
+      char const *split = begin + std::min(chunkSize, size_t(end - begin));
+      if (split < end)
+      {
+        char const *newline = static_cast<char const *>(
+          std::memchr(split, '\n', end - split));
+        split = newline ? newline + 1 : end;
+      }
+      chunks.push_back(Chunk());
+      chunks.back().begin = begin;
+      chunks.back().end = split;
+      begin = split;
+    }
+
+    pool.ParallelFor(0, chunks.size(), 1, [&chunks](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+        ParseChunk(chunks[i]);
+    });
+
+    // each chunk's elements start where the previous chunks' end
+    size_t totals[3] = { 0, 0, 0 };
+    for (auto &chunk : chunks)
+    {
+      chunk.bases[0] = totals[0];
+      chunk.bases[1] = totals[1];
+      chunk.bases[2] = totals[2];
+      totals[0] += chunk.positions.size();
+      totals[1] += chunk.texCoords.size();
+      totals[2] += chunk.normals.size();
+      data.faceCount += chunk.faceSizes.size();
+    }
+    if (totals[0] == 0)
+      return false;
+
+    data.positions.resize(totals[0]);
+    data.texCoords.resize(totals[1]);
+    data.normals.resize(totals[2]);
+    pool.ParallelFor(0, chunks.size(), 1,
+      [&chunks, &data, &totals](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+      {
+        Chunk &chunk = chunks[i];
+        std::copy(chunk.positions.begin(), chunk.positions.end(),
+          data.positions.begin() + chunk.bases[0]);
+        std::copy(chunk.texCoords.begin(), chunk.texCoords.end(),
+          data.texCoords.begin() + chunk.bases[1]);
+        std::copy(chunk.normals.begin(), chunk.normals.end(),
+          data.normals.begin() + chunk.bases[2]);
+        ResolveChunk(chunk, totals);
+      }
+    });
+
+    // triangulate straight into the merged corner array
+    size_t triangleCount = 0;
+    for (auto &chunk : chunks)
+    {
+      chunk.triangleOffset = triangleCount;
+      triangleCount += chunk.triangleCount;
+      data.invalidFaceCount += chunk.invalidFaceCount;
+    }
+    data.corners.resize(triangleCount * 3);
+    pool.ParallelFor(0, chunks.size(), 1,
+      [&chunks, &data](size_t begin, size_t end)
+    {
+      std::vector<Vector2> projected;
+      std::vector<u32> remaining;
+      for (size_t i = begin; i < end; ++i)
+      {
+        Chunk const &chunk = chunks[i];
+        ObjCorner *out = data.corners.data() + chunk.triangleOffset * 3;
+        ObjCorner const *polygon = chunk.corners.data();
+        for (u32 size : chunk.faceSizes)
+        {
+          if (size >= 3)
+          {
+            Triangulate(polygon, size, data.positions, out, projected,
+              remaining);
+            out += (size - 2) * 3;
+          }
+          polygon += size;
+        }
+      }
+    });
+    return true;
+  }
+
+  bool ObjParser::ParseFile(std::string const &path, ObjData &data)
+  {
+    FileSystem::MappedFile file;
+    if (!file.Open(path))
+      return false;
+    return Parse(reinterpret_cast<char const *>(file.GetData()),
+      file.GetSize(), data);
+  }
+
+  void ObjParser::Benchmark(std::string const &path, u32 iterations)
+  {
+    FileSystem::MappedFile file;
+    if (!file.Open(path))
+    {
+      std::cout << "OBJ benchmark: cannot open " << path << std::endl;
+      return;
+    }
+
+    ObjData data;
+    auto const start = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < iterations; ++i)
+      Parse(reinterpret_cast<char const *>(file.GetData()), file.GetSize(),
+        data);
+    auto const stop = std::chrono::high_resolution_clock::now();
+
+    f64 const seconds = std::chrono::duration<f64>(stop - start).count()
+      / std::max(iterations, 1u);
+    std::cout << "OBJ benchmark: " << path << ", "
+      << file.GetSize() / (1024.0 * 1024.0) << " MB, "
+      << data.positions.size() << " positions, " << data.GetTriangleCount()
+      << " triangles, " << ThreadPool::GetInstance().GetThreadCount()
+      << " threads: " << seconds * 1000.0 << " ms ("
+      << file.GetSize() / (1024.0 * 1024.0) / seconds << " MB/s)"
+      << std::endl;
+  }
+}
@@ -0,0 +1,630 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "graphics/SceneIndex.h"
+
+namespace
+{
+  using Math::Matrix4;
+  using Math::Vector3;
+
+  static u32 const InvalidNode = Graphics::SceneIndex::InvalidProxy;
+
+  // Half the surface area of a box, which is what insertion costs compare.
+  f32 HalfArea(f32 const *low, f32 const *high)
+  {
+    f32 const x = high[0] - low[0], y = high[1] - low[1], z = high[2] - low[2];
+    return x * y + y * z + z * x;
+  }
+
+  // Half the surface area of the union of two boxes.
+  f32 UnionHalfArea(f32 const *lowA, f32 const *highA, f32 const *lowB,
+    f32 const *highB)
+  {
+    f32 low[3], high[3];
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+      low[axis] = std::min(lowA[axis], lowB[axis]);
+      high[axis] = std::max(highA[axis], highB[axis]);
+    }
+    return HalfArea(low, high);
+  }
+
+  // Squared distance from a point to a box, 0 inside it.
+  f32 DistanceSq(f32 const *low, f32 const *high, Vector3 const &point)
+  {
+    f32 const p[3] = { point.x, point.y, point.z };
+    f32 distance = 0.f;
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+      f32 const d = std::max(std::max(low[axis] - p[axis], 0.f),
+        p[axis] - high[axis]);
+      distance += d * d;
+    }
+    return distance;
+  }
+
+  // Objects moved per frame by the benchmark, as a fraction of all.
+  static u32 const BenchmarkMoveDivisor = 10;
+  static u32 const BenchmarkFrames = 60;
+  static u32 const BenchmarkQueries = 100 * 1000;
+  static u32 const BenchmarkCullRuns = 20;
+}
+
+namespace Graphics
+{
+  SceneIndex::SceneIndex(f32 margin)
+    : root_(InvalidNode), freeNode_(InvalidNode), freeCount_(0),
+    proxyCount_(0), margin_(margin)
+  {
+  }
+
+  u32 SceneIndex::Insert(Vector3 const &minimum, Vector3 const &maximum,
+    u32 object)
+  {
+    u32 const leaf = allocateNode();
+    Node &node = nodes_[leaf];
+    node.boundMin[0] = minimum.x - margin_;
+    node.boundMin[1] = minimum.y - margin_;
+    node.boundMin[2] = minimum.z - margin_;
+    node.boundMax[0] = maximum.x + margin_;
+    node.boundMax[1] = maximum.y + margin_;
+    node.boundMax[2] = maximum.z + margin_;
+    node.height = 0;
+    node.child[0] = node.child[1] = InvalidNode;
+    node.object = object;
+    insertLeaf(leaf);
+    ++proxyCount_;
+    return leaf;
+  }
+
+  void SceneIndex::Remove(u32 proxy)
+  {
+    Assert(proxy < nodes_.size() && nodes_[proxy].height == 0,
+      "Error: invalid scene index proxy: %d", proxy);
+    removeLeaf(proxy);
+    freeNode(proxy);
+    --proxyCount_;
+  }
+
+  bool SceneIndex::Move(u32 proxy, Vector3 const &minimum,
+    Vector3 const &maximum)
+  {
+    Assert(proxy < nodes_.size() && nodes_[proxy].height == 0,
+      "Error: invalid scene index proxy: %d", proxy);
+    Node &node = nodes_[proxy];
+    f32 const low[3] = { minimum.x, minimum.y, minimum.z };
+    f32 const high[3] = { maximum.x, maximum.y, maximum.z };
+
+    // stay put while within the enlarged box, unless the object has shrunk
+    // so much that the box no longer fits it well
+    bool contained = true, loose = false;
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+      contained = contained && node.boundMin[axis] <= low[axis]
+        && high[axis] <= node.boundMax[axis];
+      loose = loose || node.boundMin[axis] < low[axis] - 4.f * margin_
+        || high[axis] + 4.f * margin_ < node.boundMax[axis];
+    }
+    if (contained && !loose)
+      return false;
+
+    removeLeaf(proxy);
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+      node.boundMin[axis] = low[axis] - margin_;
+      node.boundMax[axis] = high[axis] + margin_;
+    }
+    insertLeaf(proxy);
+    return true;
+  }
+
+  void SceneIndex::Cull(FrustumPlanes const &planes,
+    std::vector<u32> &objects) const
+  {
+    if (root_ == InvalidNode)
+      return;
+
+    // the tree is height balanced, so a depth first walk never holds more
+    // than one pending node per level
+    u32 const height = u32(nodes_[root_].height);
+    Assert(height < MaxHeight, "Error: scene index too deep to walk.");
+    if (height >= MaxHeight)
+      return;
+
+    // each entry carries the planes its subtree may still cross; a node in
+    // front of a plane needs no child of it tested against that plane again
+    struct Entry
+    {
+      u32 node;
+      u32 planeMask;
+    };
+    Entry stack[MaxHeight + 1];
+    u32 stackSize = 0;
+    Entry const root = { root_, 0x3fu };
+    stack[stackSize++] = root;
+    f32 absX[6], absY[6], absZ[6];
+    for (u32 p = 0; p < 6; ++p)
+    {
+      absX[p] = std::abs(planes.x[p]);
+      absY[p] = std::abs(planes.y[p]);
+      absZ[p] = std::abs(planes.z[p]);
+    }
+    while (stackSize > 0)
+    {
+      Entry const entry = stack[--stackSize];
+      Node const &node = nodes_[entry.node];
+
+      u32 planeMask = entry.planeMask;
+      bool outside = false;
+      f32 const cx = (node.boundMin[0] + node.boundMax[0]) * 0.5f;
+      f32 const cy = (node.boundMin[1] + node.boundMax[1]) * 0.5f;
+      f32 const cz = (node.boundMin[2] + node.boundMax[2]) * 0.5f;
+      f32 const ex = node.boundMax[0] - cx;
+      f32 const ey = node.boundMax[1] - cy;
+      f32 const ez = node.boundMax[2] - cz;
+      for (u32 p = 0; p < 6 && !outside; ++p)
+      {
+        if (!(planeMask & (1u << p)))
+          continue;
+        f32 const distance = cx * planes.x[p] + cy * planes.y[p]
+          + cz * planes.z[p] + planes.w[p];
+        f32 const reach = ex * absX[p] + ey * absY[p] + ez * absZ[p];
+        if (distance + reach < 0.f)
+          outside = true;
+        else if (distance - reach >= 0.f)
+          planeMask &= ~(1u << p);
+      }
+      if (outside)
+        continue;
+
+      if (node.height == 0)
+      {
+        objects.push_back(node.object);
+        continue;
+      }
+      if (planeMask == 0)
+      {
+        appendSubtree(entry.node, objects);
+        continue;
+      }
+      for (u32 c = 0; c < 2; ++c)
+      {
+        Entry const child = { node.child[c], planeMask };
+        stack[stackSize++] = child;
+      }
+    }
+  }
+
+  void SceneIndex::appendSubtree(u32 subtree, std::vector<u32> &objects) const
+  {
+    u32 stack[MaxHeight + 1];
+    u32 stackSize = 0;
+    stack[stackSize++] = subtree;
+    while (stackSize > 0)
+    {
+      Node const &node = nodes_[stack[--stackSize]];
+      if (node.height == 0)
+      {
+        objects.push_back(node.object);
+        continue;
+      }
+      stack[stackSize++] = node.child[1];
+      stack[stackSize++] = node.child[0];
+    }
+  }
+
+  u32 SceneIndex::Pick(Ray const &ray, f32 &t,
+    std::function<bool(u32 object, f32 &t)> const &intersect) const
+  {
+    u32 result = InvalidProxy;
+    t = ray.tMax;
+    if (root_ == InvalidNode)
+      return result;
+
+    f32 const origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+    f32 const inverseDirection[3] = { 1.f / ray.direction.x,
+      1.f / ray.direction.y, 1.f / ray.direction.z };
+    auto const intersectBox = [&](Node const &node, f32 &tNear)
+    {
+      f32 low = ray.tMin, high = t;
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        f32 const t0 = (node.boundMin[axis] - origin[axis])
+          * inverseDirection[axis];
+        f32 const t1 = (node.boundMax[axis] - origin[axis])
+          * inverseDirection[axis];
+        low = std::max(low, std::min(t0, t1));
+        high = std::min(high, std::max(t0, t1));
+      }
+      tNear = low;
+      return low <= high;
+    };
+
+    std::vector<std::pair<u32, f32> > stack;
+    stack.reserve(64);
+    f32 tNear;
+    if (!intersectBox(nodes_[root_], tNear))
+      return result;
+    stack.push_back(std::make_pair(root_, tNear));
+    while (!stack.empty())
+    {
+      std::pair<u32, f32> const entry = stack.back();
+      stack.pop_back();
+      if (entry.second > t)
+        continue; // a closer hit was found since it was pushed
+      Node const &node = nodes_[entry.first];
+
+      if (node.height == 0)
+      {
+        if (intersect)
+        {
+          f32 tHit = t;
+          if (intersect(node.object, tHit) && tHit < t)
+          {
+            t = tHit;
+            result = node.object;
+          }
+        }
+        else if (entry.second < t)
+        {
+          t = entry.second;
+          result = node.object;
+        }
+        continue;
+      }
+
+      // the nearer child goes on top, so it is visited first
+      f32 tChild[2];
+      bool const hit0 = intersectBox(nodes_[node.child[0]], tChild[0]);
+      bool const hit1 = intersectBox(nodes_[node.child[1]], tChild[1]);
+      u32 const nearer = hit0 && hit1 && tChild[1] < tChild[0] ? 1 : 0;
+      bool const hits[2] = { hit0, hit1 };
+      if (hits[1 - nearer])
+        stack.push_back(std::make_pair(node.child[1 - nearer],
+          tChild[1 - nearer]));
+      if (hits[nearer])
+        stack.push_back(std::make_pair(node.child[nearer], tChild[nearer]));
+    }
+    return result;
+  }
+
+  u32 SceneIndex::Nearest(Vector3 const &point, f32 &distance,
+    f32 maxDistance) const
+  {
+    u32 result = InvalidProxy;
+    f32 best = maxDistance * maxDistance;
+    distance = maxDistance;
+    if (root_ == InvalidNode)
+      return result;
+
+    std::vector<std::pair<u32, f32> > stack;
+    stack.reserve(64);
+    stack.push_back(std::make_pair(root_, DistanceSq(nodes_[root_].boundMin,
+      nodes_[root_].boundMax, point)));
+    while (!stack.empty())
+    {
+      std::pair<u32, f32> const entry = stack.back();
+      stack.pop_back();
+      if (entry.second >= best)
+        continue;
+      Node const &node = nodes_[entry.first];
+
+      if (node.height == 0)
+      {
+        best = entry.second;
+        result = node.object;
+        continue;
+      }
+
+      f32 const d0 = DistanceSq(nodes_[node.child[0]].boundMin,
+        nodes_[node.child[0]].boundMax, point);
+      f32 const d1 = DistanceSq(nodes_[node.child[1]].boundMin,
+        nodes_[node.child[1]].boundMax, point);
+      u32 const nearer = d1 < d0 ? 1 : 0;
+      f32 const d[2] = { d0, d1 };
+      if (d[1 - nearer] < best)
+        stack.push_back(std::make_pair(node.child[1 - nearer], d[1 - nearer]));
+      if (d[nearer] < best)
+        stack.push_back(std::make_pair(node.child[nearer], d[nearer]));
+    }
+    if (result != InvalidProxy)
+      distance = std::sqrt(best);
+    return result;
+  }
+
+  u32 SceneIndex::GetHeight() const
+  {
+    return root_ == InvalidNode ? 0 : u32(nodes_[root_].height);
+  }
+
+  u32 SceneIndex::allocateNode()
+  {
+    if (freeNode_ == InvalidNode)
+    {
+      nodes_.push_back(Node());
+      return u32(nodes_.size() - 1);
+    }
+    u32 const node = freeNode_;
+    freeNode_ = nodes_[node].parent;
+    --freeCount_;
+    return node;
+  }
+
+  void SceneIndex::freeNode(u32 node)
+  {
+    nodes_[node].parent = freeNode_;
+    nodes_[node].height = -1;
+    freeNode_ = node;
+    ++freeCount_;
+  }
+
+  void SceneIndex::insertLeaf(u32 leaf)
+  {
+    if (root_ == InvalidNode)
+    {
+      root_ = leaf;
+      nodes_[leaf].parent = InvalidNode;
+      return;
+    }
+
+    // descend toward the sibling whose pairing with the leaf adds the least
+    // surface area, counting the growth it causes in every node above
+    f32 const *leafMin = nodes_[leaf].boundMin;
+    f32 const *leafMax = nodes_[leaf].boundMax;
+    u32 index = root_;
+    while (nodes_[index].height > 0)
+    {
+      Node const &node = nodes_[index];
+      f32 const area = HalfArea(node.boundMin, node.boundMax);
+      f32 const combinedArea = UnionHalfArea(node.boundMin, node.boundMax,
+        leafMin, leafMax);
+      // pairing with this node makes a new parent of the combined area
+      f32 const cost = 2.f * combinedArea;
+      // every node below this one grows by at least as much
+      f32 const inheritedCost = 2.f * (combinedArea - area);
+
+      f32 childCost[2];
+      for (u32 c = 0; c < 2; ++c)
+      {
+        Node const &child = nodes_[node.child[c]];
+        f32 const childArea = UnionHalfArea(child.boundMin, child.boundMax,
+          leafMin, leafMax);
+        childCost[c] = (child.height == 0 ? childArea
+          : childArea - HalfArea(child.boundMin, child.boundMax))
+          + inheritedCost;
+      }
+      if (cost < childCost[0] && cost < childCost[1])
+        break;
+      index = node.child[childCost[1] < childCost[0] ? 1 : 0];
+    }
+
+    // a new parent over the sibling and the leaf takes the sibling's place;
+    // allocating may move the nodes, so they are only referred to after
+    u32 const sibling = index;
+    u32 const parent = allocateNode();
+    u32 const oldParent = nodes_[sibling].parent;
+    Node &newParent = nodes_[parent];
+    newParent.parent = oldParent;
+    newParent.height = nodes_[sibling].height + 1;
+    newParent.child[0] = sibling;
+    newParent.child[1] = leaf;
+    newParent.object = InvalidProxy;
+    if (oldParent == InvalidNode)
+      root_ = parent;
+    else
+    {
+      Node &above = nodes_[oldParent];
+      above.child[above.child[0] == sibling ? 0 : 1] = parent;
+    }
+    nodes_[sibling].parent = parent;
+    nodes_[leaf].parent = parent;
+    refitUpward(parent);
+  }
+
+  void SceneIndex::removeLeaf(u32 leaf)
+  {
+    if (leaf == root_)
+    {
+      root_ = InvalidNode;
+      return;
+    }
+
+    // the leaf's sibling takes the place of their parent
+    u32 const parent = nodes_[leaf].parent;
+    u32 const grandParent = nodes_[parent].parent;
+    u32 const sibling = nodes_[parent].child[nodes_[parent].child[0] == leaf
+      ? 1 : 0];
+    nodes_[sibling].parent = grandParent;
+    freeNode(parent);
+    if (grandParent == InvalidNode)
+    {
+      root_ = sibling;
+      return;
+    }
+    Node &above = nodes_[grandParent];
+    above.child[above.child[0] == parent ? 0 : 1] = sibling;
+    refitUpward(grandParent);
+  }
+
+  void SceneIndex::refitUpward(u32 node)
+  {
+    while (node != InvalidNode)
+    {
+      node = balance(node);
+      Node &current = nodes_[node];
+      Node const &a = nodes_[current.child[0]];
+      Node const &b = nodes_[current.child[1]];
+      current.height = 1 + std::max(a.height, b.height);
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        current.boundMin[axis] = std::min(a.boundMin[axis], b.boundMin[axis]);
+        current.boundMax[axis] = std::max(a.boundMax[axis], b.boundMax[axis]);
+      }
+      node = current.parent;
+    }
+  }
+
+  u32 SceneIndex::balance(u32 indexA)
+  {
+    Node &a = nodes_[indexA];
+    if (a.height < 2)
+      return indexA;
+
+    // lift the taller child (b) into a's place; a keeps the shorter child
+    // and takes the shorter of b's children, b keeps the taller one
+    u32 const taller = nodes_[a.child[1]].height > nodes_[a.child[0]].height
+      ? 1 : 0;
+    u32 const indexB = a.child[taller];
+    u32 const indexC = a.child[1 - taller];
+    Node &b = nodes_[indexB];
+    Node const &c = nodes_[indexC];
+    if (b.height - c.height <= 1)
+      return indexA;
+
+    u32 const indexD = b.child[0], indexE = b.child[1];
+    u32 const keep = nodes_[indexD].height > nodes_[indexE].height ? 0 : 1;
+    u32 const indexKeep = b.child[keep];
+    u32 const indexGive = b.child[1 - keep];
+
+    // b replaces a below a's parent
+    b.parent = a.parent;
+    if (b.parent == InvalidNode)
+      root_ = indexB;
+    else
+    {
+      Node &above = nodes_[b.parent];
+      above.child[above.child[0] == indexA ? 0 : 1] = indexB;
+    }
+    b.child[1 - keep] = indexA;
+    a.parent = indexB;
+    a.child[taller] = indexGive;
+    nodes_[indexGive].parent = indexA;
+
+    Node const &give = nodes_[indexGive];
+    Node const &kept = nodes_[indexKeep];
+    a.height = 1 + std::max(c.height, give.height);
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+      a.boundMin[axis] = std::min(c.boundMin[axis], give.boundMin[axis]);
+      a.boundMax[axis] = std::max(c.boundMax[axis], give.boundMax[axis]);
+    }
+    b.height = 1 + std::max(a.height, kept.height);
+    for (u32 axis = 0; axis < 3; ++axis)
+    {
+      b.boundMin[axis] = std::min(a.boundMin[axis], kept.boundMin[axis]);
+      b.boundMax[axis] = std::max(a.boundMax[axis], kept.boundMax[axis]);
+    }
+    return indexB;
+  }
+
+  void SceneIndex::Benchmark(u32 objectCount)
+  {
+    // boxes of random sizes spread through a cube, about a unit apart
+    // (deterministic, so runs are comparable)
+    u32 seed = 0x9e3779b9u;
+    auto const random = [&]()
+    {
+      seed = seed * 1664525u + 1013904223u;
+      return f32(seed >> 8) / f32(1 << 24);
+    };
+    f32 const side = std::pow(f32(std::max(objectCount, 1u)), 1.f / 3.f);
+    std::vector<Vector3> centers(objectCount), extents(objectCount);
+    for (u32 i = 0; i < objectCount; ++i)
+    {
+      centers[i] = Vector3(random(), random(), random()) * side;
+      extents[i] = Vector3(random(), random(), random()) * 0.4f
+        + Vector3(0.1f);
+    }
+
+    SceneIndex index;
+    std::vector<u32> proxies(objectCount);
+    auto const insertStart = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < objectCount; ++i)
+      proxies[i] = index.Insert(centers[i] - extents[i],
+        centers[i] + extents[i], i);
+    auto const insertStop = std::chrono::high_resolution_clock::now();
+
+    // every frame a tenth of the objects take a small step
+    u32 moved = 0, reinserted = 0;
+    auto const moveStart = std::chrono::high_resolution_clock::now();
+    for (u32 frame = 0; frame < BenchmarkFrames; ++frame)
+    {
+      for (u32 i = frame % BenchmarkMoveDivisor; i < objectCount;
+        i += BenchmarkMoveDivisor)
+      {
+        centers[i] += (Vector3(random(), random(), random()) - Vector3(0.5f))
+          * 0.1f;
+        reinserted += index.Move(proxies[i], centers[i] - extents[i],
+          centers[i] + extents[i]) ? 1 : 0;
+        ++moved;
+      }
+    }
+    auto const moveStop = std::chrono::high_resolution_clock::now();
+
+    // a view from outside a corner of the cube, toward its center
+    Vector3 const center(side * 0.5f);
+    Matrix4 const viewProjection = Matrix4::PerspectiveProjection(1.f, 16.f,
+      9.f, 0.1f, side * 4.f) * Matrix4::LookAt(Vector3(-0.25f * side),
+      center, Vector3(0.f, 1.f, 0.f));
+    // both culls are repeated and the fastest run kept, as a single one is
+    // too short to time reliably
+    std::vector<u32> visible;
+    f64 cullMilliseconds = std::numeric_limits<f64>::infinity();
+    FrustumCuller linear;
+    for (u32 i = 0; i < objectCount; ++i)
+      linear.AddBox(centers[i] - extents[i], centers[i] + extents[i]);
+    f64 linearMilliseconds = std::numeric_limits<f64>::infinity();
+    for (u32 run = 0; run < BenchmarkCullRuns; ++run)
+    {
+      visible.clear();
+      auto const cullStart = std::chrono::high_resolution_clock::now();
+      index.Cull(FrustumPlanes(viewProjection), visible);
+      auto const cullStop = std::chrono::high_resolution_clock::now();
+      cullMilliseconds = std::min(cullMilliseconds,
+        std::chrono::duration<f64, std::milli>(cullStop - cullStart).count());
+      linearMilliseconds = std::min(linearMilliseconds,
+        linear.Cull(viewProjection).milliseconds);
+    }
+    FrustumCullStats const &linearStats = linear.GetStats();
+
+    // rays from outside the cube through it, and points within it
+    u32 hits = 0;
+    auto const pickStart = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < BenchmarkQueries; ++i)
+    {
+      Vector3 const target = Vector3(random(), random(), random()) * side;
+      f32 t;
+      hits += index.Pick(Ray(Vector3(-side), target + Vector3(side)), t)
+        != InvalidProxy ? 1 : 0;
+    }
+    auto const nearestStart = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < BenchmarkQueries; ++i)
+    {
+      f32 distance;
+      index.Nearest(Vector3(random(), random(), random()) * side, distance);
+    }
+    auto const nearestStop = std::chrono::high_resolution_clock::now();
+
+    auto const milliseconds = [](
+      std::chrono::high_resolution_clock::time_point start,
+      std::chrono::high_resolution_clock::time_point stop)
+    {
+      return std::chrono::duration<f64, std::milli>(stop - start).count();
+    };
+    char report[512];
+    sprintf(report, "%u objects, %u nodes, height %u; inserted in %.1f ms; "
+      "%u moves over %u frames in %.2f ms per frame (%.1f%% reinserted); "
+      "cull %.3f ms (%u visible) against %.3f ms linear (%u visible); "
+      "%u picks in %.1f ms (%.1f%% hit), %u nearest in %.1f ms",
+      objectCount, u32(index.GetNodeCount()), index.GetHeight(),
+      milliseconds(insertStart, insertStop), moved, BenchmarkFrames,
+      milliseconds(moveStart, moveStop) / BenchmarkFrames,
+      100.0 * reinserted / std::max(moved, 1u),
+      cullMilliseconds, u32(visible.size()),
+      linearMilliseconds, linearStats.visibleObjects,
+      BenchmarkQueries, milliseconds(pickStart, nearestStart),
+      100.0 * hits / BenchmarkQueries, BenchmarkQueries,
+      milliseconds(nearestStart, nearestStop));
+    std::cout << "Scene index benchmark: " << report << std::endl;
+  }
+}
@@ -26,9 +26,14 @@ namespace Graphics
     // load the shader program given the specified source files; save the shader
     // given the specified type or, if one is already associated with that type,
     // replace it with the newly loaded shader program
+    return SetShader(type, ShaderProgram::LoadShaderProgram(vertexSourceFile,
+      fragmentSourceFile));
+  }
+
+  std::shared_ptr<ShaderProgram> const &ShaderManager::SetShader(
+    ShaderType type, std::shared_ptr<ShaderProgram> const &program)
+  {
     auto find = shaders_.find(type);
-    auto program = ShaderProgram::LoadShaderProgram(vertexSourceFile,
-      fragmentSourceFile);
     if (find != shaders_.end())
     {
       find->second = program; // replace program
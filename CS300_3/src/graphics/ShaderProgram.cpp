@@ -216,7 +216,7 @@ namespace Graphics
 		return location;
 	}
 
-	void ShaderProgram::Build()
+	bool ShaderProgram::Build()
 	{
 		// creates a new shader program; programs represent linked and compiled
 		// shaders and are used to actually render geometry
@@ -240,11 +240,11 @@ namespace Graphics
 
 		// compile and verify the vertex shader
 		glCompileShader(vertexShader);
-		VerifyShaderCompilation(vertexShaderPath_, vertexShader);
+		bool built = VerifyShaderCompilation(vertexShaderPath_, vertexShader);
 
 		// compile and verify the fragment shader
 		glCompileShader(fragmentShader);
-		VerifyShaderCompilation(fragmentShaderPath_, fragmentShader);
+		built &= VerifyShaderCompilation(fragmentShaderPath_, fragmentShader);
 
 		// attach the compiled shaders to the program
 		glAttachShader(program, vertexShader);
@@ -252,7 +252,8 @@ namespace Graphics
 
 		// link the program together so that it can be used to render
 		glLinkProgram(program);
-		VerifyProgramLinking(vertexShaderPath_, fragmentShaderPath_, program);
+		built &= VerifyProgramLinking(vertexShaderPath_, fragmentShaderPath_,
+			program);
 
 		// validate the program is operational in the current OpenGL state
 		glValidateProgram(program);
@@ -266,6 +267,7 @@ namespace Graphics
 		glDeleteShader(fragmentShader);
 
 		program_ = program;
+		return built;
 	}
 
 	void ShaderProgram::Bind() const
@@ -0,0 +1,693 @@
+#include "Precompiled.h"
+#include "framework/Simd.h"
+#include "framework/ThreadPool.h"
+#include "graphics/MeshLoader.h"
+#include "graphics/SoftwareRasterizer.h"
+#include "graphics/Texture.h"
+#include "graphics/TriangleMesh.h"
+
+namespace
+{
+  using Math::Matrix4;
+  using Math::Vector3;
+  using Math::Vector4;
+
+  // Vertices transformed and triangles set up per ParallelFor chunk. Each
+  // setup chunk bins its triangles separately; tiles then walk the chunks in
+  // order, which keeps the submission order without any synchronization.
+  static size_t const VertexGrain = 4 * 1024;
+  static size_t const SetupGrain = 2 * 1024;
+
+  // Bits of a clip space position outside each of the frustum planes.
+  enum ClipOutcode : u32
+  {
+    ClipLeft = 1,
+    ClipRight = 2,
+    ClipBottom = 4,
+    ClipTop = 8,
+    ClipNear = 16,
+    ClipFar = 32
+  };
+
+  u32 ComputeOutcode(f32 const (&clip)[4])
+  {
+    f32 const w = clip[3];
+    u32 outcode = 0;
+    if (clip[0] < -w) outcode |= ClipLeft;
+    if (clip[0] > w) outcode |= ClipRight;
+    if (clip[1] < -w) outcode |= ClipBottom;
+    if (clip[1] > w) outcode |= ClipTop;
+    if (clip[2] < -w) outcode |= ClipNear;
+    if (clip[2] > w) outcode |= ClipFar;
+    return outcode;
+  }
+
+  // Interpolates every attribute of two vertices after the vertex stage.
+  template <typename ShadedVertex>
+  void LerpVertex(ShadedVertex const &a, ShadedVertex const &b, f32 t,
+    ShadedVertex &result)
+  {
+    for (u32 i = 0; i < 4; ++i)
+      result.clip[i] = a.clip[i] + (b.clip[i] - a.clip[i]) * t;
+    for (u32 i = 0; i < 3; ++i)
+    {
+      result.position[i] = a.position[i] + (b.position[i] - a.position[i]) * t;
+      result.normal[i] = a.normal[i] + (b.normal[i] - a.normal[i]) * t;
+    }
+    result.occlusion = a.occlusion + (b.occlusion - a.occlusion) * t;
+  }
+
+  // Scales a vector of the given size to unit length, like GLSL's normalize.
+  template <u32 Size>
+  void Normalize(f32 (&v)[Size])
+  {
+    f32 lengthSq = 0.f;
+    for (u32 i = 0; i < Size; ++i)
+      lengthSq += v[i] * v[i];
+    f32 const scale = 1.f / std::sqrt(lengthSq);
+    for (u32 i = 0; i < Size; ++i)
+      v[i] *= scale;
+  }
+
+  u8 ToUnorm8(f32 value)
+  {
+    return u8(std::min(std::max(value, 0.f), 1.f) * 255.f + 0.5f);
+  }
+}
+
+namespace Graphics
+{
+  RasterLight::RasterLight()
+    : type(LightType::Point), position(0.f, 0.f, 0.f, 1.f),
+    direction(0.f, 0.f, -1.f, 0.f), ambient(), diffuse(), specular(),
+    spotlightInnerCos(1.f), spotlightOuterCos(1.f), spotlightFalloff(1.f)
+  {
+  }
+
+  RasterShading::RasterShading()
+    : model(RasterShadingModel::Blinn), modelView(Math::Matrix4::cIdentity),
+    modelViewProjection(Math::Matrix4::cIdentity), materialAmbient(),
+    materialDiffuse(), materialEmissive(), materialSpecular(),
+    materialShininess(1.f), globalAmbient(), attenuation(1.f, 0.f, 0.f),
+    view(0.f, 0.f, 0.f), fogNear(0.f),
+    fogFar(std::numeric_limits<f32>::max()), fogColor(),
+    useAmbientOcclusion(true), lightCount(0)
+  {
+  }
+
+  // The uniforms of phongshade.frag and blinnshade.frag as plain floats, with
+  // the material folded into the light colors (nothing is textured).
+  struct SoftwareRasterizer::FragmentShading
+  {
+    struct Light
+    {
+      LightType type;
+      f32 position[4];
+      f32 direction[4];
+      f32 toLight[4]; // -normalize(direction), for directional lights
+      f32 ambient[4];
+      f32 diffuse[4];
+      f32 specular[4];
+      f32 innerCos, outerCos, falloff;
+    };
+
+    bool blinn;
+    f32 emissive[4];
+    f32 ambient[4]; // globalAmbient * ambient
+    f32 attenuation[3];
+    f32 view[3];
+    f32 shininess;
+    f32 fogNear, fogFar;
+    f32 fogColor[4];
+    Light lights[RasterShading::MaxLights];
+    u32 lightCount;
+
+    explicit FragmentShading(RasterShading const &shading)
+      : blinn(shading.model == RasterShadingModel::Blinn),
+      shininess(shading.materialShininess), fogNear(shading.fogNear),
+      fogFar(shading.fogFar),
+      lightCount(std::min(shading.lightCount, u32(RasterShading::MaxLights)))
+    {
+      for (u32 i = 0; i < 4; ++i)
+      {
+        emissive[i] = shading.materialEmissive.components[i];
+        ambient[i] = shading.globalAmbient.components[i]
+          * shading.materialAmbient.components[i];
+        fogColor[i] = shading.fogColor.components[i];
+      }
+      for (u32 i = 0; i < 3; ++i)
+      {
+        attenuation[i] = shading.attenuation[i];
+        view[i] = shading.view[i];
+      }
+      for (u32 l = 0; l < lightCount; ++l)
+      {
+        RasterLight const &source = shading.lights[l];
+        Light &light = lights[l];
+        light.type = source.type;
+        for (u32 i = 0; i < 4; ++i)
+        {
+          light.position[i] = source.position[i];
+          light.direction[i] = source.direction[i];
+          light.toLight[i] = -source.direction[i];
+          light.ambient[i] = source.ambient.components[i]
+            * shading.materialAmbient.components[i];
+          light.diffuse[i] = source.diffuse.components[i]
+            * shading.materialDiffuse.components[i];
+          light.specular[i] = source.specular.components[i]
+            * shading.materialSpecular.components[i];
+        }
+        Normalize(light.toLight);
+        light.innerCos = source.spotlightInnerCos;
+        light.outerCos = source.spotlightOuterCos;
+        light.falloff = source.spotlightFalloff;
+      }
+    }
+
+    // computeSurfaceColor: the lit and fogged color of a fragment at a view
+    // space position with a unit normal (both with w = 1 and w = 0), whose
+    // ambient terms are scaled by its occlusion.
+    void Shade(f32 const (&position)[3], f32 const (&normal)[3],
+      f32 occlusion, f32 (&color)[4]) const
+    {
+      for (u32 i = 0; i < 4; ++i)
+        color[i] = emissive[i] + ambient[i] * occlusion;
+
+      f32 v[3] = { view[0] - position[0], view[1] - position[1],
+        view[2] - position[2] };
+      f32 const viewDistance = std::sqrt(v[0] * v[0] + v[1] * v[1]
+        + v[2] * v[2]);
+      Normalize(v);
+
+      // computeLightingTerm
+      for (u32 l = 0; l < lightCount; ++l)
+      {
+        Light const &light = lights[l];
+        f32 toLight[4];
+        f32 attenuated = 1.f;
+        if (light.type == LightType::Directional)
+        {
+          for (u32 i = 0; i < 4; ++i)
+            toLight[i] = light.toLight[i];
+        }
+        else
+        {
+          for (u32 i = 0; i < 3; ++i)
+            toLight[i] = light.position[i] - position[i];
+          toLight[3] = light.position[3] - 1.f;
+          f32 const distance = std::sqrt(toLight[0] * toLight[0]
+            + toLight[1] * toLight[1] + toLight[2] * toLight[2]
+            + toLight[3] * toLight[3]);
+          for (u32 i = 0; i < 4; ++i)
+            toLight[i] /= distance;
+          attenuated = 1.f / (attenuation[0] + attenuation[1] * distance
+            + attenuation[2] * distance * distance);
+        }
+
+        f32 lit[4] = { 0.f, 0.f, 0.f, 0.f };
+        f32 spotlightEffect = 1.f;
+        f32 const lDotN = normal[0] * toLight[0] + normal[1] * toLight[1]
+          + normal[2] * toLight[2];
+        if (lDotN >= 0.f)
+        {
+          f32 specularAmount;
+          if (blinn)
+          {
+            f32 half[4] = { (v[0] + toLight[0]) * 0.5f,
+              (v[1] + toLight[1]) * 0.5f, (v[2] + toLight[2]) * 0.5f,
+              toLight[3] * 0.5f };
+            Normalize(half);
+            specularAmount = normal[0] * half[0] + normal[1] * half[1]
+              + normal[2] * half[2];
+          }
+          else
+          {
+            f32 reflected[4] = { 2.f * lDotN * normal[0] - toLight[0],
+              2.f * lDotN * normal[1] - toLight[1],
+              2.f * lDotN * normal[2] - toLight[2], -toLight[3] };
+            Normalize(reflected);
+            specularAmount = v[0] * reflected[0] + v[1] * reflected[1]
+              + v[2] * reflected[2];
+          }
+          specularAmount = std::pow(std::max(specularAmount, 0.f), shininess);
+          for (u32 i = 0; i < 4; ++i)
+            lit[i] = lDotN * light.diffuse[i] + specularAmount * light.specular[i];
+
+          if (light.type == LightType::Spot)
+          {
+            f32 const dDotL = -(light.direction[0] * toLight[0]
+              + light.direction[1] * toLight[1]
+              + light.direction[2] * toLight[2]
+              + light.direction[3] * toLight[3]);
+            if (dDotL < light.outerCos)
+              spotlightEffect = 0.f;
+            else if (dDotL > light.innerCos)
+              spotlightEffect = 1.f;
+            else
+              spotlightEffect = std::pow((dDotL - light.outerCos)
+                / (light.innerCos - light.outerCos), light.falloff);
+          }
+        }
+        for (u32 i = 0; i < 4; ++i)
+          color[i] += attenuated * (light.ambient[i] * occlusion
+            + spotlightEffect * lit[i]);
+      }
+
+      f32 const fog = std::min((fogFar - viewDistance) / (fogFar - fogNear), 1.f);
+      for (u32 i = 0; i < 4; ++i)
+        color[i] = fog * color[i] + (1.f - fog) * fogColor[i];
+    }
+  };
+
+  SoftwareRasterizer::SoftwareRasterizer(u32 width, u32 height)
+    : width_(0), height_(0), tileCountX_(0), tileCountY_(0), depthStride_(0)
+  {
+    Resize(width, height);
+  }
+
+  void SoftwareRasterizer::Resize(u32 width, u32 height)
+  {
+    width_ = width;
+    height_ = height;
+    tileCountX_ = (width + TileSize - 1) / TileSize;
+    tileCountY_ = (height + TileSize - 1) / TileSize;
+    color_.Resize(width, height, 4);
+    depthStride_ = (width + 3) & ~3u;
+    depth_.resize(size_t(depthStride_) * height);
+    chunkBins_.clear(); // sized for the old tile count
+  }
+
+  void SoftwareRasterizer::Clear(Color const &color)
+  {
+    u8 const value[4] = { ToUnorm8(color.r), ToUnorm8(color.g),
+      ToUnorm8(color.b), ToUnorm8(color.a) };
+    u8 *pixels = color_.GetPixels();
+    for (size_t i = 0; i < color_.GetSize(); i += 4)
+      std::memcpy(pixels + i, value, 4);
+    std::fill(depth_.begin(), depth_.end(), 1.f);
+  }
+
+  RasterStats SoftwareRasterizer::Draw(TriangleMesh const &mesh,
+    RasterShading const &shading)
+  {
+    auto const start = std::chrono::high_resolution_clock::now();
+    RasterStats stats;
+    std::memset(&stats, 0, sizeof(stats));
+    u32 const triangleCount = u32(mesh.GetTriangleCount());
+    stats.triangleCount = triangleCount;
+    if (triangleCount == 0 || width_ == 0 || height_ == 0)
+      return stats;
+    ThreadPool &pool = ThreadPool::GetInstance();
+
+    // vertex stage (phongshade.vert): clip position, view space position
+    // and unit normal
+    Matrix4 const &mvp = shading.modelViewProjection;
+    Matrix4 const &mv = shading.modelView;
+    vertices_.resize(mesh.GetVertexCount());
+    pool.ParallelFor(0, vertices_.size(), VertexGrain,
+      [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+      {
+        Vertex const &vertex = mesh.GetVertex(u32(i));
+        Vector3 const &p = vertex.vertex;
+        Vector3 const &n = vertex.normal;
+        ShadedVertex &out = vertices_[i];
+        out.clip[0] = mvp.m00 * p.x + mvp.m01 * p.y + mvp.m02 * p.z + mvp.m03;
+        out.clip[1] = mvp.m10 * p.x + mvp.m11 * p.y + mvp.m12 * p.z + mvp.m13;
+        out.clip[2] = mvp.m20 * p.x + mvp.m21 * p.y + mvp.m22 * p.z + mvp.m23;
+        out.clip[3] = mvp.m30 * p.x + mvp.m31 * p.y + mvp.m32 * p.z + mvp.m33;
+        out.position[0] = mv.m00 * p.x + mv.m01 * p.y + mv.m02 * p.z + mv.m03;
+        out.position[1] = mv.m10 * p.x + mv.m11 * p.y + mv.m12 * p.z + mv.m13;
+        out.position[2] = mv.m20 * p.x + mv.m21 * p.y + mv.m22 * p.z + mv.m23;
+        f32 normal[4] = {
+          mv.m00 * n.x + mv.m01 * n.y + mv.m02 * n.z,
+          mv.m10 * n.x + mv.m11 * n.y + mv.m12 * n.z,
+          mv.m20 * n.x + mv.m21 * n.y + mv.m22 * n.z,
+          mv.m30 * n.x + mv.m31 * n.y + mv.m32 * n.z
+        };
+        Normalize(normal);
+        for (u32 j = 0; j < 3; ++j)
+          out.normal[j] = normal[j];
+        out.occlusion = shading.useAmbientOcclusion ? vertex.occlusion : 1.f;
+      }
+    });
+
+    // triangle setup and binning: reject triangles outside the frustum,
+    // clip those crossing the near plane
+    u32 const chunkCount = u32((triangleCount + SetupGrain - 1) / SetupGrain);
+    u32 const tileCount = tileCountX_ * tileCountY_;
+    chunkTriangles_.resize(chunkCount);
+    chunkBins_.resize(chunkCount);
+    for (auto &bins : chunkBins_)
+      bins.resize(tileCount);
+    pool.ParallelFor(0, triangleCount, SetupGrain,
+      [&](size_t begin, size_t end)
+    {
+      u32 const chunk = u32(begin / SetupGrain);
+      chunkTriangles_[chunk].clear();
+      for (auto &bin : chunkBins_[chunk])
+        bin.clear();
+      for (size_t t = begin; t < end; ++t)
+      {
+        TriangleMesh::Triangle const &triangle = mesh.GetTriangle(u32(t));
+        ShadedVertex const *corners[3] = { &vertices_[triangle.a],
+          &vertices_[triangle.b], &vertices_[triangle.c] };
+        u32 const outcodes[3] = { ComputeOutcode(corners[0]->clip),
+          ComputeOutcode(corners[1]->clip), ComputeOutcode(corners[2]->clip) };
+        if (outcodes[0] & outcodes[1] & outcodes[2])
+          continue; // entirely outside one plane
+        if (!((outcodes[0] | outcodes[1] | outcodes[2]) & ClipNear))
+        {
+          binTriangle(*corners[0], *corners[1], *corners[2], chunk);
+          continue;
+        }
+
+        // Sutherland-Hodgman against z >= -w leaves at most four vertices;
+        // the other planes are handled by the bounds in pixels
+        ShadedVertex polygon[4];
+        u32 polygonSize = 0;
+        for (u32 i = 0; i < 3; ++i)
+        {
+          ShadedVertex const &current = *corners[i];
+          ShadedVertex const &next = *corners[(i + 1) % 3];
+          f32 const currentDistance = current.clip[2] + current.clip[3];
+          f32 const nextDistance = next.clip[2] + next.clip[3];
+          if (currentDistance >= 0.f)
+            polygon[polygonSize++] = current;
+          if ((currentDistance >= 0.f) != (nextDistance >= 0.f))
+            LerpVertex(current, next, currentDistance
+              / (currentDistance - nextDistance), polygon[polygonSize++]);
+        }
+        for (u32 i = 1; i + 1 < polygonSize; ++i)
+          binTriangle(polygon[0], polygon[i], polygon[i + 1], chunk);
+      }
+    });
+
+    // rasterization and shading, one tile at a time per thread
+    FragmentShading const fragmentShading(shading);
+    std::atomic<u64> shadedPixels(0);
+    pool.ParallelFor(0, tileCount, 1, [&](size_t begin, size_t end)
+    {
+      u64 shaded = 0;
+      for (size_t tile = begin; tile < end; ++tile)
+        rasterizeTile(u32(tile), fragmentShading, shaded);
+      shadedPixels += shaded;
+    });
+
+    for (auto const &triangles : chunkTriangles_)
+      stats.rasterizedTriangles += u32(triangles.size());
+    stats.shadedPixels = shadedPixels;
+    stats.milliseconds = std::chrono::duration<f64, std::milli>(
+      std::chrono::high_resolution_clock::now() - start).count();
+    return stats;
+  }
+
+  void SoftwareRasterizer::binTriangle(ShadedVertex const &a,
+    ShadedVertex const &b, ShadedVertex const &c, u32 chunk)
+  {
+    // perspective division and the viewport transform
+    ShadedVertex const *corners[3] = { &a, &b, &c };
+    f32 x[3], y[3], z[3], inverseW[3];
+    for (u32 i = 0; i < 3; ++i)
+    {
+      f32 const *clip = corners[i]->clip;
+      inverseW[i] = 1.f / clip[3];
+      x[i] = (clip[0] * inverseW[i] + 1.f) * 0.5f * f32(width_);
+      y[i] = (clip[1] * inverseW[i] + 1.f) * 0.5f * f32(height_);
+      z[i] = (clip[2] * inverseW[i] + 1.f) * 0.5f;
+    }
+
+    // both faces are drawn; clockwise triangles are flipped so that the
+    // edge functions are positive inside every triangle
+    f32 const area = (x[1] - x[0]) * (y[2] - y[0])
+      - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(area > 0.f || area < 0.f))
+      return; // degenerate (or not a number)
+    u32 const order[3] = { 0, area > 0.f ? 1u : 2u, area > 0.f ? 2u : 1u };
+
+    // pixels whose centers may be covered, within the viewport
+    f32 const minX = std::min(std::min(x[0], x[1]), x[2]);
+    f32 const maxX = std::max(std::max(x[0], x[1]), x[2]);
+    f32 const minY = std::min(std::min(y[0], y[1]), y[2]);
+    f32 const maxY = std::max(std::max(y[0], y[1]), y[2]);
+    SetupTriangle triangle;
+    triangle.minX = s32(std::ceil(std::max(minX - 0.5f, 0.f)));
+    triangle.maxX = s32(std::floor(std::min(maxX - 0.5f, f32(width_ - 1))));
+    triangle.minY = s32(std::ceil(std::max(minY - 0.5f, 0.f)));
+    triangle.maxY = s32(std::floor(std::min(maxY - 0.5f, f32(height_ - 1))));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+      return;
+
+    for (u32 i = 0; i < 3; ++i)
+    {
+      u32 const k = order[i];
+      triangle.x[i] = x[k];
+      triangle.y[i] = y[k];
+      triangle.z[i] = z[k];
+      triangle.inverseW[i] = inverseW[k];
+      for (u32 j = 0; j < 3; ++j)
+      {
+        triangle.position[i][j] = corners[k]->position[j];
+        triangle.normal[i][j] = corners[k]->normal[j];
+      }
+      triangle.occlusion[i] = corners[k]->occlusion;
+    }
+
+    std::vector<SetupTriangle> &triangles = chunkTriangles_[chunk];
+    u32 const index = u32(triangles.size());
+    triangles.push_back(triangle);
+    std::vector<std::vector<u32>> &bins = chunkBins_[chunk];
+    for (u32 ty = u32(triangle.minY) / TileSize;
+      ty <= u32(triangle.maxY) / TileSize; ++ty)
+    {
+      for (u32 tx = u32(triangle.minX) / TileSize;
+        tx <= u32(triangle.maxX) / TileSize; ++tx)
+        bins[ty * tileCountX_ + tx].push_back(index);
+    }
+  }
+
+  void SoftwareRasterizer::rasterizeTile(u32 tile,
+    FragmentShading const &shading, u64 &shadedPixels)
+  {
+    s32 const tileMinX = s32((tile % tileCountX_) * TileSize);
+    s32 const tileMinY = s32((tile / tileCountX_) * TileSize);
+    s32 const tileMaxX = std::min(tileMinX + s32(TileSize), s32(width_)) - 1;
+    s32 const tileMaxY = std::min(tileMinY + s32(TileSize), s32(height_)) - 1;
+
+    for (size_t chunk = 0; chunk < chunkTriangles_.size(); ++chunk)
+    {
+      std::vector<SetupTriangle> const &triangles = chunkTriangles_[chunk];
+      for (u32 index : chunkBins_[chunk][tile])
+      {
+        SetupTriangle const &triangle = triangles[index];
+        s32 const minX = std::max(triangle.minX, tileMinX);
+        s32 const maxX = std::min(triangle.maxX, tileMaxX);
+        s32 const minY = std::max(triangle.minY, tileMinY);
+        s32 const maxY = std::min(triangle.maxY, tileMaxY);
+
+        // Edge i (opposite vertex i) is A x + B y + C, positive inside. A
+        // pixel center exactly on an edge belongs to only one of the two
+        // triangles sharing it (those see the edge in opposite directions).
+        f32 edgeA[3], edgeB[3], edgeC[3];
+        bool onEdge[3];
+        for (u32 i = 0; i < 3; ++i)
+        {
+          u32 const from = (i + 1) % 3, to = (i + 2) % 3;
+          edgeA[i] = triangle.y[from] - triangle.y[to];
+          edgeB[i] = triangle.x[to] - triangle.x[from];
+          edgeC[i] = -(edgeA[i] * triangle.x[from] + edgeB[i] * triangle.y[from]);
+          onEdge[i] = edgeA[i] > 0.f || (edgeA[i] == 0.f && edgeB[i] > 0.f);
+        }
+        f32 const inverseArea = 1.f / ((triangle.x[1] - triangle.x[0])
+          * (triangle.y[2] - triangle.y[0]) - (triangle.x[2] - triangle.x[0])
+          * (triangle.y[1] - triangle.y[0]));
+        f32 const dz1 = (triangle.z[1] - triangle.z[0]) * inverseArea;
+        f32 const dz2 = (triangle.z[2] - triangle.z[0]) * inverseArea;
+
+        // groups of four pixels start at multiples of four, where depth rows
+        // can always be loaded whole
+        s32 const startX = tileMinX + ((minX - tileMinX) & ~3);
+#if USE_SSE
+        __m128 const laneOffsets = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+        __m128 const half = _mm_set1_ps(0.5f);
+        __m128 const zero = _mm_setzero_ps();
+        __m128 const laneMin = _mm_set1_ps(f32(minX));
+        __m128 const laneMax = _mm_set1_ps(f32(maxX));
+        __m128 a[3], onEdgeMask[3];
+        for (u32 i = 0; i < 3; ++i)
+        {
+          a[i] = _mm_set1_ps(edgeA[i]);
+          onEdgeMask[i] = _mm_cmpneq_ps(_mm_set1_ps(onEdge[i] ? 1.f : 0.f),
+            zero);
+        }
+#endif
+        for (s32 py = minY; py <= maxY; ++py)
+        {
+          f32 *depthRow = &depth_[size_t(py) * depthStride_];
+          f32 const centerY = f32(py) + 0.5f;
+          f32 rowEdge[3];
+          for (u32 i = 0; i < 3; ++i)
+            rowEdge[i] = edgeB[i] * centerY + edgeC[i];
+          for (s32 px = startX; px <= maxX; px += 4)
+          {
+            f32 e[3][4];
+            int covered;
+#if USE_SSE
+            __m128 const lanes = _mm_add_ps(_mm_set1_ps(f32(px)), laneOffsets);
+            __m128 const centers = _mm_add_ps(lanes, half);
+            __m128 mask = _mm_and_ps(_mm_cmpge_ps(lanes, laneMin),
+              _mm_cmple_ps(lanes, laneMax));
+            __m128 edge[3];
+            for (u32 i = 0; i < 3; ++i)
+            {
+              edge[i] = _mm_add_ps(_mm_mul_ps(a[i], centers),
+                _mm_set1_ps(rowEdge[i]));
+              mask = _mm_and_ps(mask, _mm_or_ps(_mm_cmpgt_ps(edge[i], zero),
+                _mm_and_ps(_mm_cmpeq_ps(edge[i], zero), onEdgeMask[i])));
+            }
+            if (!_mm_movemask_ps(mask))
+              continue;
+
+            // depth is affine in window space
+            __m128 const z = _mm_add_ps(_mm_set1_ps(triangle.z[0]), _mm_add_ps(
+              _mm_mul_ps(edge[1], _mm_set1_ps(dz1)),
+              _mm_mul_ps(edge[2], _mm_set1_ps(dz2))));
+            __m128 const depth = _mm_loadu_ps(depthRow + px);
+            mask = _mm_and_ps(mask, _mm_cmplt_ps(z, depth));
+            covered = _mm_movemask_ps(mask);
+            if (!covered)
+              continue;
+            _mm_storeu_ps(depthRow + px, _mm_or_ps(_mm_and_ps(mask, z),
+              _mm_andnot_ps(mask, depth)));
+            for (u32 i = 0; i < 3; ++i)
+              _mm_storeu_ps(e[i], edge[i]);
+#else
+            covered = 0;
+            for (s32 k = 0; k < 4; ++k)
+            {
+              s32 const x = px + k;
+              f32 const centerX = f32(x) + 0.5f;
+              bool inside = x >= minX && x <= maxX;
+              for (u32 i = 0; i < 3 && inside; ++i)
+              {
+                e[i][k] = edgeA[i] * centerX + rowEdge[i];
+                inside = e[i][k] > 0.f || (e[i][k] == 0.f && onEdge[i]);
+              }
+              if (!inside)
+                continue;
+              f32 const z = triangle.z[0] + e[1][k] * dz1 + e[2][k] * dz2;
+              if (z < depthRow[x])
+              {
+                depthRow[x] = z;
+                covered |= 1 << k;
+              }
+            }
+#endif
+            // shade the fragments that passed, with perspective correct
+            // attributes
+            u8 *row = color_.GetRow(height_ - 1 - u32(py));
+            for (u32 k = 0; k < 4; ++k)
+            {
+              if (!(covered & (1 << k)))
+                continue;
+              f32 weight[3];
+              for (u32 i = 0; i < 3; ++i)
+                weight[i] = e[i][k] * triangle.inverseW[i];
+              f32 const scale = 1.f / (weight[0] + weight[1] + weight[2]);
+              f32 position[3], normal[3];
+              for (u32 j = 0; j < 3; ++j)
+              {
+                position[j] = (weight[0] * triangle.position[0][j]
+                  + weight[1] * triangle.position[1][j]
+                  + weight[2] * triangle.position[2][j]) * scale;
+                normal[j] = weight[0] * triangle.normal[0][j]
+                  + weight[1] * triangle.normal[1][j]
+                  + weight[2] * triangle.normal[2][j];
+              }
+              Normalize(normal);
+              f32 const occlusion = (weight[0] * triangle.occlusion[0]
+                + weight[1] * triangle.occlusion[1]
+                + weight[2] * triangle.occlusion[2]) * scale;
+              f32 color[4];
+              shading.Shade(position, normal, occlusion, color);
+              u8 *pixel = row + (px + k) * 4;
+              for (u32 i = 0; i < 4; ++i)
+                pixel[i] = ToUnorm8(color[i]);
+              ++shadedPixels;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  void SoftwareRasterizer::Benchmark(std::string const &model, u32 width,
+    u32 height, u32 frameCount)
+  {
+    std::shared_ptr<TriangleMesh> mesh = MeshLoader::LoadMesh(model,
+      TextureProjectorFunction::CYLINDRICAL);
+    if (!mesh || mesh->GetTriangleCount() == 0)
+    {
+      std::cout << "Raster benchmark: cannot load models/" << model
+        << std::endl;
+      return;
+    }
+
+    // the default scene of the application: the camera two units in front
+    // of the model and one point light beside it
+    Vector3 const eye(0.f, 0.f, -2.f);
+    Matrix4 const view = Matrix4::LookAt(eye, Vector3(0.f, 0.f, 0.f),
+      Vector3(0.f, 1.f, 0.f));
+    RasterShading shading;
+    shading.model = RasterShadingModel::Blinn;
+    shading.modelView = view;
+    shading.modelViewProjection = Matrix4::PerspectiveProjection(1.f,
+      int(width), int(height), 0.1f, 100.f) * view;
+    shading.materialAmbient = Color(0.25f, 0.25f, 0.25f);
+    shading.materialDiffuse = Color(0.25f, 0.25f, 0.25f);
+    shading.materialSpecular = Color(0.25f, 0.25f, 0.25f);
+    shading.materialEmissive = Color::Black;
+    shading.materialShininess = 50.f;
+    shading.globalAmbient = Color(0.2f, 0.2f, 0.2f, 1.f);
+    shading.attenuation = Vector3(1.f, 0.1f, 0.f);
+    shading.fogNear = (100.f - 0.1f) * 0.5f;
+    shading.fogFar = 100.f;
+    shading.fogColor = Color::White;
+    Vector3 const extent = mesh->GetBoundMax() - mesh->GetBoundMin();
+    f32 const lightDistance = std::sqrt(extent.x * extent.x
+      + extent.z * extent.z) * 1.5f;
+    shading.lights[0].type = LightType::Point;
+    shading.lights[0].position = Math::Transform(view, Vector4(lightDistance,
+      mesh->GetBoundMax().y, 0.f, 1.f));
+    shading.lights[0].diffuse = Color(0.8f, 0.8f, 0.8f, 1.f);
+    shading.lights[0].specular = Color::White;
+    shading.lightCount = 1;
+
+    SoftwareRasterizer rasterizer(width, height);
+    RasterStats total;
+    std::memset(&total, 0, sizeof(total));
+    for (u32 frame = 0; frame < frameCount; ++frame)
+    {
+      rasterizer.Clear(Color(0.5f, 0.5f, 0.5f, 1.f));
+      RasterStats const stats = rasterizer.Draw(*mesh, shading);
+      total.triangleCount += stats.triangleCount;
+      total.rasterizedTriangles += stats.rasterizedTriangles;
+      total.shadedPixels += stats.shadedPixels;
+      total.milliseconds += stats.milliseconds;
+    }
+
+    f64 const seconds = std::max(total.milliseconds * 0.001, 1e-9);
+    char report[256];
+    sprintf(report, "%d triangles at %ux%u on %u threads: %.2f Mtri/s,"
+      " %.2f Mpix/s (%.2f ms per frame, %u triangles rasterized and %.0f"
+      " pixels shaded per frame)", mesh->GetTriangleCount(), width, height,
+      ThreadPool::GetInstance().GetThreadCount(),
+      total.triangleCount / seconds * 1e-6, total.shadedPixels / seconds * 1e-6,
+      total.milliseconds / std::max(frameCount, 1u),
+      total.rasterizedTriangles / std::max(frameCount, 1u),
+      f64(total.shadedPixels) / std::max(frameCount, 1u));
+    std::cout << "Raster benchmark: models/" << model << ", " << report
+      << std::endl;
+  }
+}
@@ -1,7 +1,9 @@
 #include "Precompiled.h"
 #include "framework/Debug.h"
+#include "framework/Hash.h"
 #include "graphics/ShaderProgram.h"
 #include "graphics/Texture.h"
+#include "graphics/TextureCache.h"
 #include "math/Vector3.h"
 
 #include <STB/stb_image.h>
@@ -20,35 +22,85 @@ static std::string GetFilePath(std::string const &relativePath)
 
 namespace Graphics
 {
-	Texture::Texture(u8 *pixels, u32 width, u32 height)
-	  : pixels_(pixels), width_(width), height_(height),
+	Texture::Texture(PixelBuffer pixels, u32 width, u32 height)
+	  : pixels_(std::move(pixels)), width_(width), height_(height), levels_(1),
 	  textureHandle_(UnbuiltTexture), boundSlot_(UnboundTexture)
 	{
+		levels_[0].width = width;
+		levels_[0].height = height;
+		levels_[0].offset = 0;
+		levels_[0].size = size_t(width) * height * ChannelCount;
+	}
+
+	Texture::Texture(PixelBuffer pixels, std::vector<MipLevel> const &levels)
+	  : pixels_(std::move(pixels)), width_(levels.front().width),
+	  height_(levels.front().height), levels_(levels),
+	  textureHandle_(UnbuiltTexture), boundSlot_(UnboundTexture)
+	{
+	}
+
+	Texture *Texture::CreateMipmapped(PixelBuffer pixels, u32 width, u32 height,
+	  MipmapSettings const &settings)
+	{
+		// lay out the whole chain in one buffer; the base image already is the
+		// first level, so the buffer only has to grow (realloc only moves it if
+		// the block cannot be extended) before the generator fills in the rest
+		std::vector<MipLevel> levels;
+		size_t const size = MipmapGenerator::ComputeLayout(width, height,
+		  ChannelCount, settings, levels);
+		u8 *chain = static_cast<u8 *>(std::realloc(pixels.get(), size));
+		Assert(chain, "Error: unable to allocate a %dx%d mip chain.", width,
+		  height);
+		if (!chain)
+		  return nullptr; // the original buffer is still owned and freed
+		pixels.release();
+		PixelBuffer owned(chain, pixels.get_deleter());
+		MipmapGenerator::Generate(chain, levels, ChannelCount, settings);
+		return new Texture(std::move(owned), levels);
 	}
 
 	Texture::~Texture()
 	{
 		Destroy();
-		delete[] pixels_;
 	}
 
 	void Texture::Build()
 	{
 		Assert(textureHandle_ == UnbuiltTexture,
 		  "Cannot build already built texture.");
+		Assert(pixels_, "Cannot build texture without pixels.");
 
 		// create a new texture
 		glGenTextures(1, &textureHandle_);
 
-		// bind the generated texture and upload its image contents to OpenGL
+		// bind the generated texture and upload its image contents to OpenGL;
+		// every stored mip level is uploaded, and trilinear filtering is only
+		// enabled if the whole chain is present
+		u32 const levelCount = GetLevelCount();
 		glBindTexture(GL_TEXTURE_2D, textureHandle_);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		  levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width_, height_, 0, GL_RGB,
-		  GL_UNSIGNED_BYTE, pixels_);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+		// levels are tightly packed, and the rows of small RGB levels are not
+		// 4-byte aligned like OpenGL expects by default
+		GLint unpackAlignment = 4;
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (u32 i = 0; i < levelCount; ++i)
+		{
+			MipLevel const &level = levels_[i];
+			glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, level.width, level.height, 0,
+			  GL_RGB, GL_UNSIGNED_BYTE, pixels_.get() + level.offset);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
 
 		// unbind the texture
 		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// OpenGL has its own copy now; keeping ours would only double the memory
+		pixels_.reset();
 	}
 
 	void Texture::Bind(u8 slot)
@@ -109,6 +161,29 @@ namespace Graphics
 		return height_;
 	}
 
+	u32 Texture::GetLevelCount() const
+	{
+		return static_cast<u32>(levels_.size());
+	}
+
+	Texture::MipLevel const &Texture::GetLevel(u32 level) const
+	{
+		Assert(level < levels_.size(), "Error: mip level out of bounds: %d",
+		  level);
+		return levels_[level];
+	}
+
+	bool Texture::HasPixels() const
+	{
+		return pixels_ != nullptr;
+	}
+
+	u8 const *Texture::GetLevelPixels(u32 level) const
+	{
+		Assert(pixels_, "Error: texture pixels were released when it was built.");
+		return pixels_.get() + GetLevel(level).offset;
+	}
+
 	std::shared_ptr<Texture> Texture::LoadTGA(std::string const &path)
 	{
 		// STB image handles the type based on the format itself
@@ -117,13 +192,20 @@ namespace Graphics
 
 	std::shared_ptr<Texture> Texture::LoadPNG(std::string const &relative)
 	{
+		// a warm cache skips decoding the image entirely
+		u64 const parameters = TextureCache::HashParameters("rgb8-srgb-mips");
+		if (std::shared_ptr<Texture> cached = TextureCache::Load(relative,
+		  parameters))
+			return cached;
+
 		// convert relative path (to textures) to a fully qualified relative path
 		// (relative to the executable itself)
 		std::string path = GetFilePath(relative);
 
 		// attempt to load a PNG/TGA file using STB Image
 		int width = 0, height = 0, bpp = 0;
-		void *data = stbi_load(path.c_str(), &width, &height, &bpp, STBI_rgb);
+		PixelBuffer data(stbi_load(path.c_str(), &width, &height, &bpp,
+		  STBI_rgb), stbi_image_free);
 
 		Assert(data, "Error: Unable to read file: textures/%s, reason: %s",
 		  relative.c_str(), stbi_failure_reason());
@@ -136,13 +218,14 @@ namespace Graphics
 		Texture *texture = NULL;
 		if (bpp == 3) // successfully read an image with 3 channels of data
 		{
-			// copy data from loaded STB image buffer to local pixel buffer
-			u8 *pixelData = new u8[width * height * bpp];
-			std::memcpy(pixelData, data, width * height * bpp);
-			texture = new Texture(pixelData, u32(width), u32(height));
+			// build the mip chain of the color image (filtered in linear light)
+			// right in the decoder's buffer, which the texture adopts
+			texture = CreateMipmapped(std::move(data), u32(width), u32(height),
+			  MipmapSettings());
+			if (texture)
+			  TextureCache::Store(relative, parameters, *texture);
 		}
 
-		stbi_image_free(data);
 		return std::shared_ptr<Texture>(texture);
 	}
 
@@ -185,13 +268,24 @@ namespace Graphics
 		TextureWrapType vwType, 
 		TextureWrapType hwType)
 	{
+		// the derived normal map depends on how it was differentiated, so those
+		// settings are part of the cache key
+		u64 parameters = TextureCache::HashParameters("normal-from-height-mips");
+		parameters = Hash::Fnv1aValue(diffMethod, parameters);
+		parameters = Hash::Fnv1aValue(vwType, parameters);
+		parameters = Hash::Fnv1aValue(hwType, parameters);
+		if (std::shared_ptr<Texture> cached = TextureCache::Load(relative,
+		  parameters))
+			return cached;
+
 		// convert relative path (to textures) to a fully qualified relative path
 		// (relative to the executable itself)
 		std::string path = GetFilePath(relative);
 
 		// attempt to load a PNG/TGA file using STB Image
 		int width = 0, height = 0, bpp = 0;
-		void *data = stbi_load(path.c_str(), &width, &height, &bpp, STBI_rgb);
+		PixelBuffer data(stbi_load(path.c_str(), &width, &height, &bpp,
+		  STBI_rgb), stbi_image_free);
 
 		Assert(data, "Error: Unable to read file: textures/%s, reason: %s",
 		  relative.c_str(), stbi_failure_reason());
@@ -203,10 +297,12 @@ namespace Graphics
 		  " No alpha channels supported. Read file with bpp=%d", bpp);
 		if (bpp == 3) // successfully read an image with 3 channels of data
 		{
-			// copy data from loaded STB image buffer to local pixel buffer
-			u8 *pixelData = new u8[width * height * bpp];
-			u8 *normalData = new u8[width * height * 3];
-			std::memcpy(pixelData, data, width * height * bpp);
+			// the heights are read straight from the decoded image; the normals go
+			// into a buffer the texture takes over as the base of its mip chain
+			u8 const *pixelData = data.get();
+			PixelBuffer normals(static_cast<u8 *>(
+			  std::malloc(size_t(width) * height * 3)), std::free);
+			u8 *normalData = normals.get();
 			int const rowSize = width * bpp;
 			for(int i = 0; i < height; ++i)
 			{
@@ -225,10 +321,14 @@ namespace Graphics
 					normalData[i * rowSize + j * bpp + 2] = (u8)colored.z;
 				}
 			}
-			texture = new Texture(normalData, u32(width), u32(height));
-			delete[] pixelData;
+			// normals are filtered as vectors and renormalized on every level
+			MipmapSettings settings;
+			settings.colorSpace = MipmapColorSpace::NormalMap;
+			texture = CreateMipmapped(std::move(normals), u32(width), u32(height),
+			  settings);
+			if (texture)
+			  TextureCache::Store(relative, parameters, *texture);
 		}
-		stbi_image_free(data);
 		return std::shared_ptr<Texture>(texture);
 	}
 }
@@ -0,0 +1,248 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/FileSystem.h"
+#include "framework/Hash.h"
+#include "graphics/Texture.h"
+#include "graphics/TextureCache.h"
+
+namespace
+{
+  // Bump CacheVersion whenever the file layout or any texture processing
+  // changes; old cache files are then ignored and rewritten.
+  static u32 const CacheMagic = 0x31435854; // "TXC1"
+  static u32 const CacheVersion = 1;
+  static size_t const PixelAlignment = 16;
+
+  static bool CacheEnabled = true;
+
+  struct CacheHeader
+  {
+    u32 magic;
+    u32 version;
+    u32 width, height;
+    u32 channelCount;
+    u32 levelCount;
+    u64 parameters;
+    u64 sourceSize;
+    u64 sourceModifiedTime;
+    u64 sourceHash;
+    u64 pixelDataSize;
+  };
+
+  struct CacheLevel
+  {
+    u32 width, height;
+    u64 offset, size;
+  };
+
+  static_assert(sizeof(CacheHeader) == 64, "Texture cache header must be packed.");
+  static_assert(sizeof(CacheLevel) == 24, "Texture cache level must be packed.");
+
+  static std::string GetSourcePath(std::string const &relativePath)
+  {
+    std::stringstream strstr;
+    strstr << ASSET_PATH << "textures/" << relativePath;
+    return strstr.str();
+  }
+
+  static std::string GetCacheDirectory()
+  {
+    std::stringstream strstr;
+    strstr << ASSET_PATH << "cache/";
+    return strstr.str();
+  }
+
+  // Flattens the relative source path into a single file name and appends the
+  // parameter hash so that every derivative of a source gets its own file.
+  static std::string GetCachePath(std::string const &relativePath,
+    u64 parameters)
+  {
+    std::string name = relativePath;
+    for (auto &c : name)
+      if (c == '/' || c == '\\' || c == ':')
+        c = '_';
+
+    char suffix[32];
+    sprintf(suffix, ".%016llx.texcache", parameters);
+    return GetCacheDirectory() + name + suffix;
+  }
+
+  static size_t AlignUp(size_t value, size_t alignment)
+  {
+    return (value + alignment - 1) & ~(alignment - 1);
+  }
+
+  // Hashes the full contents of a file. Returns false if it cannot be read.
+  static bool HashFile(std::string const &path, u64 &hash)
+  {
+    FileSystem::MappedFile file;
+    if (!file.Open(path))
+      return false;
+    hash = Hash::Fnv1a(file.GetData(), file.GetSize());
+    return true;
+  }
+}
+
+namespace Graphics
+{
+  u64 TextureCache::HashParameters(char const *processing)
+  {
+    u64 hash = Hash::Fnv1aValue(CacheVersion);
+    hash = Hash::Fnv1aValue(Texture::ChannelCount, hash);
+    return Hash::Fnv1a(processing, std::strlen(processing), hash);
+  }
+
+  std::shared_ptr<Texture> TextureCache::Load(std::string const &relativePath,
+    u64 parameters)
+  {
+    if (!CacheEnabled)
+      return nullptr;
+
+    FileSystem::MappedFile file;
+    if (!file.Open(GetCachePath(relativePath, parameters)))
+      return nullptr; // never cached
+
+    // validate the header and level table before trusting any offsets
+    u8 const *data = file.GetData();
+    size_t const fileSize = file.GetSize();
+    if (fileSize < sizeof(CacheHeader))
+      return nullptr;
+    CacheHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != CacheMagic || header.version != CacheVersion
+      || header.parameters != parameters
+      || header.channelCount != Texture::ChannelCount
+      || header.levelCount == 0 || header.levelCount > 32)
+      return nullptr;
+
+    size_t const tableEnd = sizeof(CacheHeader)
+      + header.levelCount * sizeof(CacheLevel);
+    size_t const pixelStart = AlignUp(tableEnd, PixelAlignment);
+    if (fileSize < pixelStart
+      || fileSize - pixelStart < header.pixelDataSize)
+      return nullptr;
+
+    std::vector<Texture::MipLevel> levels(header.levelCount);
+    for (u32 i = 0; i < header.levelCount; ++i)
+    {
+      CacheLevel level;
+      std::memcpy(&level, data + sizeof(CacheHeader) + i * sizeof(CacheLevel),
+        sizeof(level));
+      if (level.offset > header.pixelDataSize
+        || level.size > header.pixelDataSize - level.offset
+        || level.size != u64(level.width) * level.height
+          * Texture::ChannelCount)
+        return nullptr;
+      levels[i].width = level.width;
+      levels[i].height = level.height;
+      levels[i].offset = static_cast<size_t>(level.offset);
+      levels[i].size = static_cast<size_t>(level.size);
+    }
+
+    // Make sure the source has not changed since the cache was written. The
+    // cheap size/timestamp check covers the common case; only if that fails
+    // is the source read and hashed (e.g. it was touched, but not modified).
+    std::string const sourcePath = GetSourcePath(relativePath);
+    FileSystem::FileInfo info;
+    bool touched = false;
+    if (FileSystem::GetFileInfo(sourcePath, info)
+      && (info.size != header.sourceSize
+        || info.modifiedTime != header.sourceModifiedTime))
+    {
+      u64 sourceHash = 0;
+      if (info.size != header.sourceSize
+        || !HashFile(sourcePath, sourceHash)
+        || sourceHash != header.sourceHash)
+        return nullptr; // stale
+      touched = true;
+    }
+
+    size_t const pixelDataSize = static_cast<size_t>(header.pixelDataSize);
+    Texture::PixelBuffer pixels(static_cast<u8 *>(std::malloc(pixelDataSize)),
+      std::free);
+    if (!pixels)
+      return nullptr;
+    std::memcpy(pixels.get(), data + pixelStart, pixelDataSize);
+
+    // the contents still match, so record the new timestamp to let the cheap
+    // check pass again on the next load
+    if (touched)
+    {
+      file.Close();
+      FileSystem::PatchFileContents(GetCachePath(relativePath, parameters),
+        offsetof(CacheHeader, sourceModifiedTime), &info.modifiedTime,
+        sizeof(info.modifiedTime));
+    }
+    return std::shared_ptr<Texture>(new Texture(std::move(pixels), levels));
+  }
+
+  bool TextureCache::Store(std::string const &relativePath, u64 parameters,
+    Texture const &texture)
+  {
+    if (!CacheEnabled)
+      return false;
+
+    // fingerprint the source the texture was produced from
+    std::string const sourcePath = GetSourcePath(relativePath);
+    FileSystem::FileInfo info;
+    u64 sourceHash = 0;
+    if (!FileSystem::GetFileInfo(sourcePath, info)
+      || !HashFile(sourcePath, sourceHash))
+      return false;
+
+    u32 const levelCount = texture.GetLevelCount();
+    Texture::MipLevel const &last = texture.GetLevel(levelCount - 1);
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = CacheMagic;
+    header.version = CacheVersion;
+    header.width = texture.GetWidth();
+    header.height = texture.GetHeight();
+    header.channelCount = Texture::ChannelCount;
+    header.levelCount = levelCount;
+    header.parameters = parameters;
+    header.sourceSize = info.size;
+    header.sourceModifiedTime = info.modifiedTime;
+    header.sourceHash = sourceHash;
+    header.pixelDataSize = last.offset + last.size;
+
+    size_t const tableEnd = sizeof(CacheHeader)
+      + levelCount * sizeof(CacheLevel);
+    size_t const pixelStart = AlignUp(tableEnd, PixelAlignment);
+    std::vector<u8> buffer(pixelStart
+      + static_cast<size_t>(header.pixelDataSize), 0);
+
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    for (u32 i = 0; i < levelCount; ++i)
+    {
+      Texture::MipLevel const &source = texture.GetLevel(i);
+      CacheLevel level;
+      level.width = source.width;
+      level.height = source.height;
+      level.offset = source.offset;
+      level.size = source.size;
+      std::memcpy(buffer.data() + sizeof(CacheHeader) + i * sizeof(CacheLevel),
+        &level, sizeof(level));
+    }
+    std::memcpy(buffer.data() + pixelStart, texture.GetLevelPixels(0),
+      static_cast<size_t>(header.pixelDataSize));
+
+    FileSystem::MakeDirectory(GetCacheDirectory());
+    bool const written = FileSystem::WriteFileContents(
+      GetCachePath(relativePath, parameters), buffer.data(), buffer.size());
+    WarnIf(!written, "Warning: unable to write texture cache for textures/%s",
+      relativePath.c_str());
+    return written;
+  }
+
+  void TextureCache::SetEnabled(bool enabled)
+  {
+    CacheEnabled = enabled;
+  }
+
+  bool TextureCache::IsEnabled()
+  {
+    return CacheEnabled;
+  }
+}
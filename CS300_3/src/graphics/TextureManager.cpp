@@ -29,16 +29,7 @@ namespace Graphics
 		// the specified type or, if one is already associated with that type,
 		// replace it with the newly loaded texture
 
-		auto texture = Texture::LoadTGA(textureFilePath);
-		auto find = textures_.find(type);
-		if (find != textures_.end())
-		{
-			find->second = texture; // replace texture
-			return find->second;    // and return it
-		}
-
-		// new texture: insert(std::pair<TextureType, ...>(type, texture))
-		return textures_.emplace(type, texture).first->second;
+		return SetTexture(type, Texture::LoadTGA(textureFilePath));
 	}
 
 	std::shared_ptr<Texture> const &TextureManager::RegisterNormalMapTexture(TextureType type,
@@ -50,6 +41,12 @@ namespace Graphics
 			TextureWrapType::ClampToZero,
 			TextureWrapType::ClampToZero
 			);
+		return SetTexture(type, texture);
+	}
+
+	std::shared_ptr<Texture> const &TextureManager::SetTexture(TextureType type,
+	  std::shared_ptr<Texture> const &texture)
+	{
 		auto find = textures_.find(type);
 		if (find != textures_.end())
 		{
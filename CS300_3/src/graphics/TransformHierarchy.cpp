@@ -0,0 +1,414 @@
+#include "Precompiled.h"
+#include "framework/Debug.h"
+#include "framework/Simd.h"
+#include "framework/ThreadPool.h"
+#include "graphics/TransformHierarchy.h"
+
+namespace
+{
+  using Math::Vector3;
+
+  // Groups of four nodes updated per ParallelFor chunk.
+  static size_t const UpdateGrain = 256;
+
+  u32 RoundUpToFour(u32 value)
+  {
+    return (value + 3) & ~3u;
+  }
+}
+
+namespace Graphics
+{
+  TransformHierarchy::Depth::Depth()
+    : count(0), dirtyCount(0), changedCount(0)
+  {
+  }
+
+  TransformHierarchy::TransformHierarchy()
+    : freeSlot_(InvalidNode), nodeCount_(0)
+  {
+    std::memset(&stats_, 0, sizeof(stats_));
+  }
+
+  void TransformHierarchy::resize(Depth &depth, u32 count)
+  {
+    u32 const padded = RoundUpToFour(count);
+    depth.count = count;
+    depth.handle.resize(count);
+    depth.childCount.resize(count);
+    depth.parent.resize(padded, 0);
+    for (u32 c = 0; c < 3; ++c)
+    {
+      depth.position[c].resize(padded, 0.f);
+      depth.rotation[c].resize(padded, 0.f);
+      depth.scale[c].resize(padded, 1.f);
+    }
+    for (u32 e = 0; e < 12; ++e)
+    {
+      depth.local[e].resize(padded, 0.f);
+      depth.world[e].resize(padded, 0.f);
+    }
+    depth.localDirty.resize(padded, 0);
+    depth.worldChanged.resize(padded, 0);
+  }
+
+  void TransformHierarchy::markDirty(Depth &depth, u32 index)
+  {
+    if (!depth.localDirty[index])
+    {
+      depth.localDirty[index] = 1;
+      ++depth.dirtyCount;
+    }
+  }
+
+  u32 TransformHierarchy::Create(u32 parent)
+  {
+    u32 depthIndex = 0, parentIndex = 0;
+    if (parent != InvalidNode)
+    {
+      Assert(parent < slots_.size() && slots_[parent].depth != InvalidNode,
+        "Error: invalid parent transform: %d", parent);
+      depthIndex = slots_[parent].depth + 1;
+      parentIndex = slots_[parent].index;
+      ++depths_[depthIndex - 1].childCount[parentIndex];
+    }
+    if (depthIndex == depths_.size())
+      depths_.push_back(Depth());
+
+    u32 node = freeSlot_;
+    if (node != InvalidNode)
+      freeSlot_ = slots_[node].index;
+    else
+    {
+      node = u32(slots_.size());
+      slots_.push_back(Slot());
+    }
+
+    Depth &depth = depths_[depthIndex];
+    u32 const index = depth.count;
+    resize(depth, depth.count + 1);
+    depth.handle[index] = node;
+    depth.parent[index] = parentIndex;
+    depth.childCount[index] = 0;
+    for (u32 c = 0; c < 3; ++c)
+    {
+      depth.position[c][index] = 0.f;
+      depth.rotation[c][index] = 0.f;
+      depth.scale[c][index] = 1.f;
+    }
+    depth.worldChanged[index] = 0;
+    markDirty(depth, index);
+
+    slots_[node].depth = depthIndex;
+    slots_[node].index = index;
+    ++nodeCount_;
+    return node;
+  }
+
+  void TransformHierarchy::Destroy(u32 node)
+  {
+    Assert(node < slots_.size() && slots_[node].depth != InvalidNode,
+      "Error: invalid transform: %d", node);
+    u32 const depthIndex = slots_[node].depth;
+    u32 const index = slots_[node].index;
+    Depth &depth = depths_[depthIndex];
+    Assert(depth.childCount[index] == 0,
+      "Error: cannot destroy a transform with children: %d", node);
+    if (depthIndex > 0)
+      --depths_[depthIndex - 1].childCount[depth.parent[index]];
+    if (depth.localDirty[index])
+      --depth.dirtyCount;
+
+    // move the last node of the depth into the hole, and point its children
+    // at its new place
+    u32 const last = depth.count - 1;
+    if (index != last)
+    {
+      depth.handle[index] = depth.handle[last];
+      depth.parent[index] = depth.parent[last];
+      depth.childCount[index] = depth.childCount[last];
+      for (u32 c = 0; c < 3; ++c)
+      {
+        depth.position[c][index] = depth.position[c][last];
+        depth.rotation[c][index] = depth.rotation[c][last];
+        depth.scale[c][index] = depth.scale[c][last];
+      }
+      for (u32 e = 0; e < 12; ++e)
+      {
+        depth.local[e][index] = depth.local[e][last];
+        depth.world[e][index] = depth.world[e][last];
+      }
+      depth.localDirty[index] = depth.localDirty[last];
+      depth.worldChanged[index] = depth.worldChanged[last];
+      slots_[depth.handle[index]].index = index;
+      if (depth.childCount[index] && depthIndex + 1 < depths_.size())
+      {
+        Depth &below = depths_[depthIndex + 1];
+        for (u32 i = 0; i < below.count; ++i)
+          if (below.parent[i] == last)
+            below.parent[i] = index;
+      }
+    }
+    depth.parent[last] = 0;
+    depth.localDirty[last] = 0;
+    depth.worldChanged[last] = 0;
+    resize(depth, last);
+    while (!depths_.empty() && depths_.back().count == 0)
+      depths_.pop_back();
+
+    slots_[node].depth = InvalidNode;
+    slots_[node].index = freeSlot_;
+    freeSlot_ = node;
+    --nodeCount_;
+  }
+
+  void TransformHierarchy::SetLocal(u32 node, Vector3 const &position,
+    Vector3 const &rotation, Vector3 const &scale)
+  {
+    SetPosition(node, position);
+    SetRotation(node, rotation);
+    SetScale(node, scale);
+  }
+
+  void TransformHierarchy::SetPosition(u32 node, Vector3 const &position)
+  {
+    Assert(node < slots_.size() && slots_[node].depth != InvalidNode,
+      "Error: invalid transform: %d", node);
+    Depth &depth = depths_[slots_[node].depth];
+    u32 const index = slots_[node].index;
+    if (depth.position[0][index] == position.x
+      && depth.position[1][index] == position.y
+      && depth.position[2][index] == position.z)
+      return;
+    depth.position[0][index] = position.x;
+    depth.position[1][index] = position.y;
+    depth.position[2][index] = position.z;
+    markDirty(depth, index);
+  }
+
+  void TransformHierarchy::SetRotation(u32 node, Vector3 const &rotation)
+  {
+    Assert(node < slots_.size() && slots_[node].depth != InvalidNode,
+      "Error: invalid transform: %d", node);
+    Depth &depth = depths_[slots_[node].depth];
+    u32 const index = slots_[node].index;
+    if (depth.rotation[0][index] == rotation.x
+      && depth.rotation[1][index] == rotation.y
+      && depth.rotation[2][index] == rotation.z)
+      return;
+    depth.rotation[0][index] = rotation.x;
+    depth.rotation[1][index] = rotation.y;
+    depth.rotation[2][index] = rotation.z;
+    markDirty(depth, index);
+  }
+
+  void TransformHierarchy::SetScale(u32 node, Vector3 const &scale)
+  {
+    Assert(node < slots_.size() && slots_[node].depth != InvalidNode,
+      "Error: invalid transform: %d", node);
+    Depth &depth = depths_[slots_[node].depth];
+    u32 const index = slots_[node].index;
+    if (depth.scale[0][index] == scale.x && depth.scale[1][index] == scale.y
+      && depth.scale[2][index] == scale.z)
+      return;
+    depth.scale[0][index] = scale.x;
+    depth.scale[1][index] = scale.y;
+    depth.scale[2][index] = scale.z;
+    markDirty(depth, index);
+  }
+
+  Vector3 TransformHierarchy::GetPosition(u32 node) const
+  {
+    Depth const &depth = depths_[slots_[node].depth];
+    u32 const index = slots_[node].index;
+    return Vector3(depth.position[0][index], depth.position[1][index],
+      depth.position[2][index]);
+  }
+
+  Vector3 TransformHierarchy::GetRotation(u32 node) const
+  {
+    Depth const &depth = depths_[slots_[node].depth];
+    u32 const index = slots_[node].index;
+    return Vector3(depth.rotation[0][index], depth.rotation[1][index],
+      depth.rotation[2][index]);
+  }
+
+  Vector3 TransformHierarchy::GetScale(u32 node) const
+  {
+    Depth const &depth = depths_[slots_[node].depth];
+    u32 const index = slots_[node].index;
+    return Vector3(depth.scale[0][index], depth.scale[1][index],
+      depth.scale[2][index]);
+  }
+
+  u32 TransformHierarchy::GetParent(u32 node) const
+  {
+    Assert(node < slots_.size() && slots_[node].depth != InvalidNode,
+      "Error: invalid transform: %d", node);
+    u32 const depthIndex = slots_[node].depth;
+    if (depthIndex == 0)
+      return InvalidNode;
+    return depths_[depthIndex - 1].handle[
+      depths_[depthIndex].parent[slots_[node].index]];
+  }
+
+  Math::Matrix4 TransformHierarchy::GetWorld(u32 node) const
+  {
+    Assert(node < slots_.size() && slots_[node].depth != InvalidNode,
+      "Error: invalid transform: %d", node);
+    Depth const &depth = depths_[slots_[node].depth];
+    u32 const i = slots_[node].index;
+    return Math::Matrix4(
+      depth.world[0][i], depth.world[1][i], depth.world[2][i], depth.world[3][i],
+      depth.world[4][i], depth.world[5][i], depth.world[6][i], depth.world[7][i],
+      depth.world[8][i], depth.world[9][i], depth.world[10][i], depth.world[11][i],
+      0.f, 0.f, 0.f, 1.f);
+  }
+
+  u32 TransformHierarchy::updateGroups(u32 depthIndex, u32 begin, u32 end)
+  {
+    Depth &depth = depths_[depthIndex];
+    Depth const *above = depthIndex > 0 ? &depths_[depthIndex - 1] : nullptr;
+    u32 updated = 0;
+    for (u32 group = begin; group < end; ++group)
+    {
+      u32 const first = group * 4;
+      u32 mask = 0;
+      for (u32 lane = 0; lane < 4 && first + lane < depth.count; ++lane)
+      {
+        u32 const i = first + lane;
+        bool const parentChanged = above
+          && above->worldChanged[depth.parent[i]];
+        if (depth.localDirty[i])
+        {
+          // Translate * RotateEuler(z, x, y) * Scale, where the rotation is
+          // Ry * Rx * Rz
+          f32 const sx = std::sin(depth.rotation[0][i]);
+          f32 const cx = std::cos(depth.rotation[0][i]);
+          f32 const sy = std::sin(depth.rotation[1][i]);
+          f32 const cy = std::cos(depth.rotation[1][i]);
+          f32 const sz = std::sin(depth.rotation[2][i]);
+          f32 const cz = std::cos(depth.rotation[2][i]);
+          f32 const rotation[3][3] = {
+            { cy * cz + sy * sx * sz, sy * sx * cz - cy * sz, sy * cx },
+            { cx * sz, cx * cz, -sx },
+            { cy * sx * sz - sy * cz, sy * sz + cy * sx * cz, cy * cx }
+          };
+          for (u32 r = 0; r < 3; ++r)
+          {
+            for (u32 c = 0; c < 3; ++c)
+              depth.local[r * 4 + c][i] = rotation[r][c] * depth.scale[c][i];
+            depth.local[r * 4 + 3][i] = depth.position[r][i];
+          }
+          depth.localDirty[i] = 0;
+          mask |= 1u << lane;
+        }
+        else if (parentChanged)
+          mask |= 1u << lane;
+      }
+      if (!mask)
+        continue;
+
+      // world = parent world * local; roots have no parent
+      if (!above)
+      {
+        for (u32 e = 0; e < 12; ++e)
+          for (u32 lane = 0; lane < 4; ++lane)
+            depth.world[e][first + lane] = depth.local[e][first + lane];
+      }
+      else
+      {
+#if USE_SSE
+        u32 const *parents = &depth.parent[first];
+        __m128 parent[12];
+        for (u32 e = 0; e < 12; ++e)
+          parent[e] = _mm_set_ps(above->world[e][parents[3]],
+            above->world[e][parents[2]], above->world[e][parents[1]],
+            above->world[e][parents[0]]);
+        __m128 local[12];
+        for (u32 e = 0; e < 12; ++e)
+          local[e] = _mm_loadu_ps(&depth.local[e][first]);
+        for (u32 r = 0; r < 3; ++r)
+        {
+          for (u32 c = 0; c < 4; ++c)
+          {
+            __m128 value = _mm_add_ps(_mm_add_ps(
+              _mm_mul_ps(parent[r * 4], local[c]),
+              _mm_mul_ps(parent[r * 4 + 1], local[4 + c])),
+              _mm_mul_ps(parent[r * 4 + 2], local[8 + c]));
+            if (c == 3)
+              value = _mm_add_ps(value, parent[r * 4 + 3]);
+            _mm_storeu_ps(&depth.world[r * 4 + c][first], value);
+          }
+        }
+#else
+        for (u32 lane = 0; lane < 4; ++lane)
+        {
+          u32 const i = first + lane;
+          u32 const p = depth.parent[i];
+          for (u32 r = 0; r < 3; ++r)
+          {
+            for (u32 c = 0; c < 4; ++c)
+            {
+              f32 value = above->world[r * 4][p] * depth.local[c][i]
+                + above->world[r * 4 + 1][p] * depth.local[4 + c][i]
+                + above->world[r * 4 + 2][p] * depth.local[8 + c][i];
+              if (c == 3)
+                value += above->world[r * 4 + 3][p];
+              depth.world[r * 4 + c][i] = value;
+            }
+          }
+        }
+#endif
+      }
+
+      for (u32 lane = 0; lane < 4; ++lane)
+      {
+        depth.worldChanged[first + lane] = u8((mask >> lane) & 1);
+        updated += (mask >> lane) & 1;
+      }
+    }
+    return updated;
+  }
+
+  TransformStats const &TransformHierarchy::Update()
+  {
+    auto const start = std::chrono::high_resolution_clock::now();
+    stats_.nodeCount = u32(nodeCount_);
+    stats_.levelCount = u32(depths_.size());
+    stats_.dirtyNodes = 0;
+    stats_.updatedNodes = 0;
+
+    for (u32 d = 0; d < depths_.size(); ++d)
+    {
+      Depth &depth = depths_[d];
+      bool const parentChanged = d > 0 && depths_[d - 1].changedCount > 0;
+      stats_.dirtyNodes += depth.dirtyCount;
+      depth.changedCount = 0;
+      if (depth.dirtyCount == 0 && !parentChanged)
+        continue;
+
+      std::atomic<u32> updated(0);
+      ThreadPool::GetInstance().ParallelFor(0, (depth.count + 3) / 4,
+        UpdateGrain, [&](size_t begin, size_t end)
+      {
+        updated += updateGroups(d, u32(begin), u32(end));
+      });
+      depth.changedCount = updated;
+      depth.dirtyCount = 0;
+      stats_.updatedNodes += depth.changedCount;
+    }
+
+    // the changes of each depth were only needed by the depth below it
+    for (auto &depth : depths_)
+    {
+      if (depth.changedCount)
+        std::fill(depth.worldChanged.begin(), depth.worldChanged.end(), u8(0));
+    }
+
+    auto const stop = std::chrono::high_resolution_clock::now();
+    stats_.milliseconds = std::chrono::duration<f64, std::milli>(
+      stop - start).count();
+    return stats_;
+  }
+}
@@ -1,5 +1,8 @@
 #include "Precompiled.h"
 #include "framework/Debug.h"
+#include "framework/ThreadPool.h"
+#include "graphics/AmbientOcclusionBaker.h"
+#include "graphics/MeshSimplifier.h"
 #include "graphics/TriangleMesh.h"
 #include "graphics/Vertex.h"
 #include "graphics/Texture.h"
@@ -20,12 +23,22 @@ namespace Graphics
 		, triangles_()
 		, triangleNormals_()
 		, vertexArrayObject_(nullptr)
-		, vaoVertexNormals_(nullptr)
-		, vaoVertexTangents_(nullptr)
-		, vaoVertexBitangents_(nullptr)
-		, vaoFaceNormals_(nullptr)
+		, debugLines_(nullptr)
+		, debugProgram_(nullptr)
 		, textureMappingType_(TextureProjectorFunction::CYLINDRICAL)
+		, vertexFormat_(VertexFormat::Full)
+		, packedPositionTransform_(0.f, 0.f, 0.f, 1.f)
+		, lodTriangles_()
+		, levels_()
+		, meshlets_()
+		, meshletCullers_()
+		, levelRanges_()
+		, meshletLocalIndices_(true)
+		, extraVertexBytes_(0)
+		, visibleRanges_()
+		, bvh_(nullptr)
 	{
+		std::memset(&cullStats_, 0, sizeof(cullStats_));
 	}
 
 	TriangleMesh::~TriangleMesh()
@@ -42,6 +55,208 @@ namespace Graphics
 		triangles_.emplace_back(a, b, c);
 	}
 
+	void TriangleMesh::Reserve(u32 vertexCount, u32 triangleCount)
+	{
+		vertices_.reserve(vertexCount);
+		triangles_.reserve(triangleCount);
+	}
+
+	namespace
+	{
+		// Vertices handled per ParallelFor chunk while welding.
+		static size_t const WeldGrain = 8 * 1024;
+
+		// Hash of a cell of the welding grid, given its integer coordinates.
+		u64 HashCell(s32 x, s32 y, s32 z)
+		{
+			u64 hash = u64(u32(x)) * 0x9E3779B185EBCA87ull;
+			hash ^= u64(u32(y)) * 0xC2B2AE3D27D4EB4Full;
+			hash ^= u64(u32(z)) * 0x165667B19E3779F9ull;
+			return hash ^ (hash >> 29);
+		}
+
+		bool CanWeld(Vertex const &a, Vertex const &b, f32 positionToleranceSq)
+		{
+			return (a.vertex - b.vertex).LengthSq() <= positionToleranceSq;
+		}
+	}
+
+	u32 TriangleMesh::Weld(f32 positionTolerance)
+	{
+		size_t const vertexCount = vertices_.size();
+		if (vertexCount < 2)
+			return 0;
+
+		Vector3 low = vertices_[0].vertex, high = low;
+		for (auto const &vert : vertices_)
+		{
+			for (u32 i = 0; i < 3; ++i)
+			{
+				low[i] = std::min(low[i], vert.vertex[i]);
+				high[i] = std::max(high[i], vert.vertex[i]);
+			}
+		}
+		f32 const diagonal = (high - low).Length();
+		if (diagonal == 0.f)
+			return 0;
+
+		// Vertices are hashed into a grid whose cells are at least twice the
+		// tolerance wide, so the vertices a vertex can be welded to lie in at
+		// most two cells along each axis. Cells are kept to at most a million
+		// along the diagonal so that their coordinates stay small.
+		f32 const tolerance = positionTolerance * diagonal;
+		f32 const cellScale = 1.f / std::max(2.f * tolerance, diagonal / 1e6f);
+		f32 const toleranceSq = tolerance * tolerance;
+		auto const cellOf = [&](f32 value, u32 axis)
+		{
+			return s32(std::floor((value - low[axis]) * cellScale));
+		};
+
+		// Bucket the vertices by the hash of their cell, laid out flat (like a
+		// counting sort) so buckets are contiguous and hold ascending indices.
+		// Different cells may share a bucket; that only costs a few extra
+		// candidate comparisons.
+		size_t bucketCount = 1;
+		while (bucketCount < 2 * vertexCount)
+			bucketCount <<= 1;
+		u64 const bucketMask = bucketCount - 1;
+		ThreadPool &pool = ThreadPool::GetInstance();
+		std::vector<u32> bucketOf(vertexCount);
+		pool.ParallelFor(0, vertexCount, WeldGrain,
+			[&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				Vector3 const &p = vertices_[i].vertex;
+				bucketOf[i] = u32(HashCell(cellOf(p.x, 0), cellOf(p.y, 1),
+					cellOf(p.z, 2)) & bucketMask);
+			}
+		});
+		std::vector<u32> bucketStart(bucketCount + 1, 0);
+		for (size_t i = 0; i < vertexCount; ++i)
+			++bucketStart[bucketOf[i] + 1];
+		for (size_t i = 0; i < bucketCount; ++i)
+			bucketStart[i + 1] += bucketStart[i];
+		std::vector<u32> bucketed(vertexCount);
+		{
+			std::vector<u32> insert(bucketStart.begin(), bucketStart.end() - 1);
+			for (size_t i = 0; i < vertexCount; ++i)
+				bucketed[insert[bucketOf[i]]++] = u32(i);
+		}
+
+		// Each vertex finds the lowest-indexed vertex it can be welded to
+		// (possibly itself). This only reads shared data, so it runs in
+		// parallel.
+		std::vector<u32> remap(vertexCount);
+		pool.ParallelFor(0, vertexCount, WeldGrain,
+			[&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				Vector3 const &p = vertices_[i].vertex;
+				s32 lo[3], hi[3];
+				for (u32 axis = 0; axis < 3; ++axis)
+				{
+					lo[axis] = cellOf(p[axis] - tolerance, axis);
+					hi[axis] = cellOf(p[axis] + tolerance, axis);
+				}
+
+				u32 target = u32(i);
+				for (s32 z = lo[2]; z <= hi[2]; ++z)
+					for (s32 y = lo[1]; y <= hi[1]; ++y)
+						for (s32 x = lo[0]; x <= hi[0]; ++x)
+						{
+							// buckets hold ascending indices, so stop at the first
+							// candidate that could not lower the target
+							u32 const bucket = u32(HashCell(x, y, z) & bucketMask);
+							for (u32 j = bucketStart[bucket]; j < bucketStart[bucket + 1]
+								&& bucketed[j] < target; ++j)
+							{
+								if (CanWeld(vertices_[i], vertices_[bucketed[j]],
+									toleranceSq))
+									target = bucketed[j];
+							}
+						}
+				remap[i] = target;
+			}
+		});
+
+		// Follow chains of welds (a onto b onto c) to the vertex that is kept.
+		// Targets always have lower indices, so one pass in order resolves them;
+		// kept vertices are compacted in their original order.
+		std::vector<Vertex> welded;
+		welded.reserve(vertexCount);
+		for (size_t i = 0; i < vertexCount; ++i)
+		{
+			if (remap[i] == i)
+			{
+				remap[i] = u32(welded.size());
+				welded.push_back(vertices_[i]);
+			}
+			else
+				remap[i] = remap[remap[i]];
+		}
+		u32 const removed = u32(vertexCount - welded.size());
+		if (removed == 0)
+			return 0;
+
+		// remap the triangles, dropping those left with a repeated corner
+		size_t kept = 0;
+		for (auto const &t : triangles_)
+		{
+			u32 const a = remap[t.a], b = remap[t.b], c = remap[t.c];
+			if (a != b && b != c && c != a)
+				triangles_[kept++] = Triangle(a, b, c);
+		}
+		triangles_.erase(triangles_.begin() + kept, triangles_.end());
+		vertices_.swap(welded);
+		triangleNormals_.clear();
+		triangleTangents_.clear();
+		triangleBytangents_.clear();
+		lodTriangles_.clear();
+		levels_.clear();
+		bvh_.reset();
+		return removed;
+	}
+
+	void TriangleMesh::Optimize()
+	{
+		if (triangles_.empty())
+			return;
+		u32 *indices = triangles_[0].indices;
+		size_t const indexCount = triangles_.size() * 3;
+
+		MeshOptimizer::OptimizeVertexCache(indices, indexCount, vertices_.size());
+		MeshOptimizer::OptimizeOverdraw(indices, indexCount, &vertices_[0].vertex,
+			sizeof(Vertex), vertices_.size(), 1.05f);
+
+		std::vector<u32> remap(vertices_.size());
+		size_t const vertexCount = MeshOptimizer::ComputeVertexFetchRemap(
+			remap.data(), indices, indexCount, vertices_.size());
+		MeshOptimizer::RemapIndices(indices, indexCount, remap.data());
+		std::vector<Vertex> fetchOrder(vertexCount);
+		for (size_t i = 0; i < vertices_.size(); ++i)
+		{
+			if (remap[i] != MeshOptimizer::InvalidIndex)
+				fetchOrder[remap[i]] = vertices_[i];
+		}
+		vertices_.swap(fetchOrder);
+
+		triangleNormals_.clear();
+		triangleTangents_.clear();
+		triangleBytangents_.clear();
+		lodTriangles_.clear();
+		levels_.clear();
+		bvh_.reset();
+	}
+
+	VertexCacheStats TriangleMesh::AnalyzeVertexCache() const
+	{
+		return MeshOptimizer::AnalyzeVertexCache(
+			reinterpret_cast<u32 const *>(triangles_.data()), triangles_.size() * 3,
+			vertices_.size());
+	}
+
 	//////////////////////////////////////////////////////////////////////////
 	// various useful steps for preparing this model for rendering; none of
 	// these would be done for a game
@@ -52,14 +267,40 @@ namespace Graphics
 	// vertex normal's direction toward those two faces, which is incorrect)
 	//////////////////////////////////////////////////////////////////////////
 
-	struct VectorLessThan {
-		bool operator()(const Vector3& a, const Vector3& b)
+	namespace
+	{
+		// Triangles and vertices handled per ParallelFor chunk while generating
+		// TBN vectors.
+		static size_t const TBNGrain = 16 * 1024;
+
+		// Sums the distinct vectors among the given faces' vectors. A face vector
+		// equal to one already summed is skipped, so that adjacent coplanar
+		// faces do not bias a vertex toward their direction.
+		// Vertices only touch a handful of faces, so a linear scan of the ones
+		// before beats any set.
+		Vector3 SumDistinct(std::vector<Vector3> const &faceVectors,
+			u32 const *faces, u32 count, u32 &distinctCount)
 		{
-			return a.x < b.x ||
-				a.x == b.x && a.y < b.y ||
-				a.x == b.x && a.y == b.y && a.z < b.z;
+			Vector3 sum(0.f);
+			distinctCount = 0;
+			for (u32 i = 0; i < count; ++i)
+			{
+				Vector3 const &v = faceVectors[faces[i]];
+				bool duplicate = false;
+				for (u32 j = 0; j < i && !duplicate; ++j)
+				{
+					Vector3 const &w = faceVectors[faces[j]];
+					duplicate = v.x == w.x && v.y == w.y && v.z == w.z;
+				}
+				if (!duplicate)
+				{
+					sum += v;
+					++distinctCount;
+				}
+			}
+			return sum;
 		}
-	};
+	}
 
 	void TriangleMesh::generateUV()
 	{
@@ -95,98 +336,104 @@ namespace Graphics
 
 	void TriangleMesh::generateTBN()
 	{
-		// this is where I generate TBN vectors
-		triangleNormals_.reserve(triangles_.size());
-		triangleTangents_.reserve(triangles_.size());
-		triangleBytangents_.reserve(triangles_.size());
-		std::vector<std::set<Vector3, VectorLessThan> > vertexNormalSets(vertices_.size());
-		std::vector<std::set<Vector3, VectorLessThan> > vertexTangentSets(vertices_.size());
-		std::vector<std::set<Vector3, VectorLessThan> > vertexBitangentSets(vertices_.size());
-		for (auto &t : triangles_)
-		{
-			// the formula is correct I think
-			Vector3 v1 = vertices_[t.b].vertex - vertices_[t.a].vertex;
-			Vector3 v2 = vertices_[t.c].vertex - vertices_[t.a].vertex;
-
-			Vector2 t1 = vertices_[t.b].uv - vertices_[t.a].uv;
-			Vector2 t2 = vertices_[t.c].uv - vertices_[t.a].uv;
-
-			Vector3 normal = v1.Cross(v2).Normalized();
-			Vector3 tan = t2.y * v1 - t1.y * v2;
-			Vector3 bitan = t2.x * v1 - t1.x * v2;
-			f32 tanNormalizer = t1.x * t2.y - t1.y * t2.x;
-			if (tanNormalizer == 0.f)
-				tanNormalizer = FLT_EPSILON;
-
-			tan /= tanNormalizer;
-			if (tan.LengthSq() > Math::Sq(100))
-				tan.Normalize();
-
-			bitan /= -tanNormalizer;
-			if (bitan.LengthSq() > Math::Sq(100))
-				bitan.Normalize();
-
-			triangleNormals_.emplace_back(normal);
-			triangleTangents_.emplace_back(tan);
-			triangleBytangents_.emplace_back(bitan);
-
-			f32 c1 = normal.Dot(tan);
-			f32 c2 = normal.Dot(bitan);
-			f32 c3 = bitan.Dot(tan);
-
-			for (auto i = 0; i < 3; ++i)
+		// Face vectors first, in parallel over blocks of triangles; each block
+		// writes only its own triangles' entries.
+		ThreadPool &pool = ThreadPool::GetInstance();
+		size_t const triangleCount = triangles_.size();
+		triangleNormals_.resize(triangleCount);
+		triangleTangents_.resize(triangleCount);
+		triangleBytangents_.resize(triangleCount);
+		pool.ParallelFor(0, triangleCount, TBNGrain, [this](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
 			{
-				vertexNormalSets[t.indices[i]].insert(normal);
-				vertexTangentSets[t.indices[i]].insert(tan);
-				vertexBitangentSets[t.indices[i]].insert(bitan);
+				Triangle const &t = triangles_[i];
+				Vector3 v1 = vertices_[t.b].vertex - vertices_[t.a].vertex;
+				Vector3 v2 = vertices_[t.c].vertex - vertices_[t.a].vertex;
+
+				Vector2 t1 = vertices_[t.b].uv - vertices_[t.a].uv;
+				Vector2 t2 = vertices_[t.c].uv - vertices_[t.a].uv;
+
+				Vector3 normal = v1.Cross(v2).Normalized();
+				Vector3 tan = t2.y * v1 - t1.y * v2;
+				Vector3 bitan = t2.x * v1 - t1.x * v2;
+				f32 tanNormalizer = t1.x * t2.y - t1.y * t2.x;
+				if (tanNormalizer == 0.f)
+					tanNormalizer = FLT_EPSILON;
+
+				tan /= tanNormalizer;
+				if (tan.LengthSq() > Math::Sq(100))
+					tan.Normalize();
+
+				bitan /= -tanNormalizer;
+				if (bitan.LengthSq() > Math::Sq(100))
+					bitan.Normalize();
+
+				triangleNormals_[i] = normal;
+				triangleTangents_[i] = tan;
+				triangleBytangents_[i] = bitan;
 			}
+		});
+
+		// Flat vertex -> face adjacency (counting sort of the corners), so each
+		// vertex can gather its faces without any per-vertex allocation. Faces
+		// stay in ascending order within a vertex.
+		size_t const vertexCount = vertices_.size();
+		std::vector<u32> faceStart(vertexCount + 1, 0);
+		for (auto const &t : triangles_)
+		{
+			for (auto i = 0; i < 3; ++i)
+				++faceStart[t.indices[i] + 1];
+		}
+		for (size_t i = 0; i < vertexCount; ++i)
+			faceStart[i + 1] += faceStart[i];
+		std::vector<u32> faces(faceStart[vertexCount]);
+		std::vector<u32> faceInsert(faceStart.begin(), faceStart.end() - 1);
+		for (size_t i = 0; i < triangleCount; ++i)
+		{
+			for (auto j = 0; j < 3; ++j)
+				faces[faceInsert[triangles_[i].indices[j]]++] = u32(i);
 		}
 
-		for (unsigned i = 0; i < vertices_.size(); ++i)
+		// Then average each vertex's distinct face vectors, in parallel over
+		// blocks of vertices. Every vertex is owned by exactly one block, so
+		// there are no shared sums and nothing to synchronize.
+		pool.ParallelFor(0, vertexCount, TBNGrain,
+			[this, &faceStart, &faces](size_t begin, size_t end)
 		{
-			if (!vertexNormalSets[i].empty())
+			for (size_t i = begin; i < end; ++i)
 			{
-				auto v = Vector3(0, 0, 0);
-				for (auto &n : vertexNormalSets[i])
-					v += n;
-				v /= static_cast<f32>(vertexNormalSets[i].size());
+				u32 const *vertexFaces = faces.data() + faceStart[i];
+				u32 const count = faceStart[i + 1] - faceStart[i];
+				if (count == 0)
+					continue;
+
+				u32 distinct = 0;
+				Vector3 v = SumDistinct(triangleNormals_, vertexFaces, count, distinct);
+				v /= static_cast<f32>(distinct);
 				v.AttemptNormalize();
 				vertices_[i].normal = v;
-			}
 
-			if (!vertexTangentSets[i].empty())
-			{
-				auto v = Vector3(0, 0, 0);
-				for (auto &t : vertexTangentSets[i])
-					v += t;
-				v /= static_cast<f32>(vertexTangentSets[i].size());
-				vertices_[i].tangent = v;
-			}
+				v = SumDistinct(triangleTangents_, vertexFaces, count, distinct);
+				vertices_[i].tangent = v / static_cast<f32>(distinct);
 
-			if (!vertexBitangentSets[i].empty())
-			{
-				auto v = Vector3(0, 0, 0);
-				for (auto &b : vertexBitangentSets[i])
-					v += b;
-				v /= static_cast<f32>(vertexBitangentSets[i].size());
-				vertices_[i].bitangent = v;
+				v = SumDistinct(triangleBytangents_, vertexFaces, count, distinct);
+				vertices_[i].bitangent = v / static_cast<f32>(distinct);
 			}
-
-
-			f32 c1 = vertices_[i].normal.Dot(vertices_[i].tangent);
-			f32 c2 = vertices_[i].normal.Dot(vertices_[i].bitangent);
-			f32 c3 = vertices_[i].bitangent.Dot(vertices_[i].tangent);
-			Assert(true, "%f, %f, %f", c1, c2, c3);
-		}
+		});
 	}
 
 	void TriangleMesh::Preprocess()
 	{
+		Weld();
+		Optimize();
 		centerMesh();
 		normalizeVertices();
 
 		generateUV();
 		generateTBN();
+		generateLevelsOfDetail();
+		bvh_.reset();
 	}
 
 	int TriangleMesh::GetVertexCount() const
@@ -248,115 +495,383 @@ namespace Graphics
 
 	void TriangleMesh::Build(std::shared_ptr<ShaderProgram> program)
 	{
-		// Construct a new VAO using each of the triangles and vertices stored
-		// within this TriangleMesh; this is done in a less efficient way possible.
-		// A simple memcpy could actually be used to copy data from the mesh
-		// directly into the IBO and VBO.
-		vertexArrayObject_ = std::shared_ptr<VertexArrayObject>(new VertexArrayObject(vertices_.size(), triangles_.size()));
+		// Construct a new VAO using the triangles and vertices stored within this
+		// TriangleMesh; both arrays already have the layout of the VBO and IBO,
+		// so they are attached and uploaded straight from here, without a copy
+		// kept by the buffers.
+		static_assert(sizeof(Triangle) == 3 * sizeof(u32),
+			"Triangles must be laid out as consecutive indices.");
+
+		// the debug lines are made from the new geometry when first drawn
+		debugLines_.reset();
+		debugProgram_ = program;
+
+		// split the (already optimized) triangle order of every level into
+		// meshlets for culling; their ranges are relative to the whole IBO
+		meshlets_.clear();
+		std::vector<u32> levelFirstMeshlets(GetLevelCount() + 1);
+		std::vector<Meshlet> levelMeshlets;
+		for (u32 level = 0; level < GetLevelCount(); ++level)
+		{
+			u32 const firstTriangle = getLevelFirstTriangle(level);
+			Triangle const *triangles = level == 0 ? triangles_.data()
+				: lodTriangles_.data() + levels_[level - 1].firstTriangle;
+			MeshletBuilder::Build(levelMeshlets, reinterpret_cast<u32 const *>(triangles),
+				GetLevelTriangleCount(level) * 3,
+				vertices_.empty() ? nullptr : &vertices_[0].vertex, sizeof(Vertex),
+				vertices_.size());
+			for (auto &meshlet : levelMeshlets)
+				meshlet.firstTriangle += firstTriangle;
+			levelFirstMeshlets[level] = u32(meshlets_.size());
+			meshlets_.insert(meshlets_.end(), levelMeshlets.begin(), levelMeshlets.end());
+		}
+		levelFirstMeshlets[GetLevelCount()] = u32(meshlets_.size());
+
+		// past 65536 vertices, indices only fit in 16 bits relative to the
+		// windows of buildMeshletLocalIndices, which copy the vertices they share;
+		// that is only worth it if the copies take less than the 16 bits save
+		size_t const indexCount = (triangles_.size() + lodTriangles_.size()) * 3;
+		size_t const vertexSize = vertexFormat_ == VertexFormat::Packed
+			? sizeof(PackedVertex) : sizeof(Vertex);
+		std::vector<u32> sourceVertices, localIndices; // attached, so kept until uploaded
+		std::vector<Vertex> windowVertices;
+		if (meshletLocalIndices_ && vertices_.size() > 0x10000)
+		{
+			buildMeshletLocalIndices(sourceVertices, localIndices);
+			s64 const addedBytes = (s64(sourceVertices.size()) - s64(vertices_.size()))
+				* s64(vertexSize);
+			if (addedBytes < s64(indexCount * (sizeof(u32) - sizeof(u16))))
+			{
+				windowVertices.reserve(sourceVertices.size());
+				for (u32 source : sourceVertices)
+					windowVertices.push_back(vertices_[source]);
+			}
+			else
+				localIndices.clear();
+		}
+		if (windowVertices.empty())
+		{
+			for (auto &meshlet : meshlets_)
+				meshlet.baseVertex = 0;
+		}
+		std::vector<Vertex> const &bufferVertices = windowVertices.empty()
+			? vertices_ : windowVertices;
+		extraVertexBytes_ = (s32(bufferVertices.size()) - s32(vertices_.size()))
+			* s32(vertexSize);
+
+		vertexArrayObject_ = std::shared_ptr<VertexArrayObject>(new VertexArrayObject(bufferVertices.size(),
+			triangles_.size() + lodTriangles_.size(), Topology::TRIANGLES, vertexFormat_));
 		auto &vbo = vertexArrayObject_->GetVertexBufferObject();
 		auto &ibo = vertexArrayObject_->GetIndexBufferObject();
-		vaoVertexNormals_ = std::shared_ptr<VertexArrayObject>(new VertexArrayObject(vertices_.size() * 2, vertices_.size(), Topology::LINES));
-		auto &VNvbo = vaoVertexNormals_->GetVertexBufferObject();
-		auto &VNibo = vaoVertexNormals_->GetIndexBufferObject();
-		vaoVertexTangents_ = std::shared_ptr<VertexArrayObject>(new VertexArrayObject(vertices_.size() * 2, vertices_.size(), Topology::LINES));
-		auto &VTvbo = vaoVertexTangents_->GetVertexBufferObject();
-		auto &VTibo = vaoVertexTangents_->GetIndexBufferObject();
-		vaoVertexBitangents_ = std::shared_ptr<VertexArrayObject>(new VertexArrayObject(vertices_.size() * 2, vertices_.size(), Topology::LINES));
-		auto &VBvbo = vaoVertexBitangents_->GetVertexBufferObject();
-		auto &VBibo = vaoVertexBitangents_->GetIndexBufferObject();
-		vaoFaceNormals_ = std::shared_ptr<VertexArrayObject>(new VertexArrayObject(triangles_.size() * 2, triangles_.size(), Topology::LINES));
-		auto &FNvbo = vaoFaceNormals_->GetVertexBufferObject();
-		auto &FNibo = vaoFaceNormals_->GetIndexBufferObject();
 
-		for (size_t i = 0; i < vertices_.size(); ++i)
+		std::vector<PackedVertex> packed; // attached, so kept until uploaded
+		if (vertexFormat_ == VertexFormat::Packed)
 		{
-			vbo.AddVertex(vertices_[i]);
-
-			VNvbo.AddVertex(Vertex(vertices_[i].vertex));
-			VNvbo.AddVertex(Vertex(vertices_[i].vertex + vertices_[i].normal * 0.1f));
-			VNibo.AddLine(i * 2, i * 2 + 1);
-
-			VTvbo.AddVertex(Vertex(vertices_[i].vertex));
-			VTvbo.AddVertex(Vertex(vertices_[i].vertex + vertices_[i].tangent * 0.1f));
-			VTibo.AddLine(i * 2, i * 2 + 1);
-
-			VBvbo.AddVertex(Vertex(vertices_[i].vertex));
-			VBvbo.AddVertex(Vertex(vertices_[i].vertex + vertices_[i].bitangent * 0.1f));
-			VBibo.AddLine(i * 2, i * 2 + 1);
+			packed.resize(bufferVertices.size());
+			packedPositionTransform_ = PackVertices(bufferVertices.data(),
+				bufferVertices.size(), packed.data());
+			vbo.AttachVertices(packed.data(), packed.size());
 		}
+		else
+			vbo.AttachVertices(bufferVertices.data(), bufferVertices.size());
 
-		for (size_t i = 0; i < triangles_.size(); ++i)
+		// the IBO stores indices in 16 bits by itself once every one fits
+		if (!windowVertices.empty())
+			ibo.AttachPrimitives(localIndices.data(), indexCount / 3);
+		else
 		{
-			Triangle &tri = triangles_[i];
-			ibo.AddTriangle(tri.a, tri.b, tri.c);
-
-			FNvbo.AddVertex(Vertex((vertices_[tri.a].vertex + vertices_[tri.b].vertex + vertices_[tri.c].vertex) / 3.f));
-			FNvbo.AddVertex(Vertex(((vertices_[tri.a].vertex + vertices_[tri.b].vertex + vertices_[tri.c].vertex) / 3.f) + triangleNormals_[i] * 0.1f));
+			ibo.AttachPrimitives(reinterpret_cast<u32 const *>(triangles_.data()),
+				triangles_.size());
+			ibo.AttachPrimitives(reinterpret_cast<u32 const *>(lodTriangles_.data()),
+				lodTriangles_.size());
+		}
 
-			FNibo.AddLine(i * 2, i * 2 + 1);
+		// every level is drawn whole with one range per base vertex, or culled
+		// meshlet by meshlet
+		meshletCullers_.assign(GetLevelCount(), MeshletCuller());
+		levelRanges_.assign(GetLevelCount(), std::vector<IndexRange>());
+		for (u32 level = 0; level < GetLevelCount(); ++level)
+		{
+			u32 const first = levelFirstMeshlets[level];
+			u32 const count = levelFirstMeshlets[level + 1] - first;
+			meshletCullers_[level].SetMeshlets(count ? &meshlets_[first] : nullptr,
+				count);
+			std::vector<IndexRange> &ranges = levelRanges_[level];
+			for (u32 i = first; i < first + count; ++i)
+			{
+				Meshlet const &meshlet = meshlets_[i];
+				if (!ranges.empty() && ranges.back().baseVertex == meshlet.baseVertex)
+					ranges.back().indexCount += meshlet.triangleCount * 3;
+				else
+					ranges.push_back(IndexRange(meshlet.firstTriangle * 3,
+						meshlet.triangleCount * 3, meshlet.baseVertex));
+			}
 		}
 
 		// upload the contents of the VBO and IBO to the GPU and build the VAO
 		vertexArrayObject_->Build(program);
-		vaoVertexNormals_->Build(program);
-		vaoVertexTangents_->Build(program);
-		vaoVertexBitangents_->Build(program);
-		vaoFaceNormals_->Build(program);
 	}
 
-	void TriangleMesh::Render()
+	void TriangleMesh::Render(u32 level)
 	{
-		// if the VAO has been built for this mesh, bind and render it
+		// if the VAO has been built for this mesh, bind and render the triangles
+		// of the level (the IBO holds all of them, one level after another)
 		if (vertexArrayObject_)
 		{
+			level = std::min(level, GetLevelCount() - 1);
+			std::vector<IndexRange> const &ranges = levelRanges_[level];
 			vertexArrayObject_->Bind();
-			vertexArrayObject_->Render();
+			vertexArrayObject_->RenderRanges(ranges.data(), ranges.size());
 			vertexArrayObject_->Unbind();
 		}
 	}
-	
-	void TriangleMesh::RenderVertexNormals()
+
+	void TriangleMesh::Render(Matrix4 const &modelViewProjection, Vector3 const &eye,
+		bool cullBackFacing, u32 level)
 	{
-		if (vaoVertexNormals_)
+		if (vertexArrayObject_)
 		{
-			vaoVertexNormals_->Bind();
-			vaoVertexNormals_->Render();
-			vaoVertexNormals_->Unbind();
+			level = std::min(level, GetLevelCount() - 1);
+			cullStats_ = meshletCullers_[level].Cull(modelViewProjection, eye,
+				visibleRanges_, cullBackFacing);
+			vertexArrayObject_->Bind();
+			vertexArrayObject_->RenderRanges(visibleRanges_.data(), visibleRanges_.size());
+			vertexArrayObject_->Unbind();
 		}
 	}
 
-	void TriangleMesh::RenderVertexTangents()
+	u32 TriangleMesh::GetIndexSize() const
+	{
+		return vertexArrayObject_ ? u32(vertexArrayObject_->GetIndexBufferObject()
+			.GetIndexSize()) : u32(sizeof(u32));
+	}
+
+	s32 TriangleMesh::GetIndexBytesSaved() const
+	{
+		return vertexArrayObject_ ? s32(vertexArrayObject_->GetIndexBufferObject()
+			.GetBytesSaved()) - extraVertexBytes_ : 0;
+	}
+
+	void TriangleMesh::buildMeshletLocalIndices(std::vector<u32> &sourceVertices,
+		std::vector<u32> &localIndices)
+	{
+		// window[v] is the window vertex v was last copied into, at slot[v]
+		std::vector<u32> window(vertices_.size(), ~0u);
+		std::vector<u32> slot(vertices_.size(), 0);
+		sourceVertices.clear();
+		localIndices.resize((triangles_.size() + lodTriangles_.size()) * 3);
+		u32 const *indices[2] = {
+			reinterpret_cast<u32 const *>(triangles_.data()),
+			reinterpret_cast<u32 const *>(lodTriangles_.data())
+		};
+		u32 const levelZeroIndices = u32(triangles_.size() * 3);
+
+		u32 windowIndex = 0, windowBase = 0;
+		std::vector<u32> missing;
+		missing.reserve(MeshletBuilder::MaxVertices);
+		for (auto &meshlet : meshlets_)
+		{
+			u32 const first = meshlet.firstTriangle * 3;
+			u32 const last = first + meshlet.triangleCount * 3;
+
+			// the meshlet's vertices the window lacks; a meshlet never has more
+			// than MaxVertices, so it always fits in a window of its own
+			missing.clear();
+			for (u32 i = first; i < last; ++i)
+			{
+				u32 const index = i < levelZeroIndices ? indices[0][i]
+					: indices[1][i - levelZeroIndices];
+				if (window[index] != windowIndex && std::find(missing.begin(),
+					missing.end(), index) == missing.end())
+					missing.push_back(index);
+			}
+			if (sourceVertices.size() - windowBase + missing.size() > 0x10000)
+			{
+				++windowIndex;
+				windowBase = u32(sourceVertices.size());
+			}
+
+			meshlet.baseVertex = windowBase;
+			for (u32 i = first; i < last; ++i)
+			{
+				u32 const index = i < levelZeroIndices ? indices[0][i]
+					: indices[1][i - levelZeroIndices];
+				if (window[index] != windowIndex)
+				{
+					window[index] = windowIndex;
+					slot[index] = u32(sourceVertices.size()) - windowBase;
+					sourceVertices.push_back(index);
+				}
+				localIndices[i] = slot[index];
+			}
+		}
+	}
+
+	void TriangleMesh::RenderInstanced(unsigned int instanceBuffer, size_t offset,
+		u32 instanceCount, u32 level)
 	{
-		if (vaoVertexTangents_)
+		if (vertexArrayObject_ && instanceCount)
 		{
-			vaoVertexTangents_->Bind();
-			vaoVertexTangents_->Render();
-			vaoVertexTangents_->Unbind();
+			// the instance attributes are left disabled, so that drawing the mesh
+			// normally never reads the instance buffer
+			level = std::min(level, GetLevelCount() - 1);
+			std::vector<IndexRange> const &ranges = levelRanges_[level];
+			vertexArrayObject_->Bind();
+			vertexArrayObject_->SetInstanceBuffer(instanceBuffer, offset);
+			vertexArrayObject_->RenderRangesInstanced(ranges.data(), ranges.size(),
+				instanceCount);
+			vertexArrayObject_->SetInstanceBuffer(0, 0);
+			vertexArrayObject_->Unbind();
 		}
 	}
 
-	void TriangleMesh::RenderVertexBitangents()
+	Bvh const &TriangleMesh::GetBvh()
 	{
-		if (vaoVertexBitangents_)
+		if (!bvh_)
 		{
-			vaoVertexBitangents_->Bind();
-			vaoVertexBitangents_->Render();
-			vaoVertexBitangents_->Unbind();
+			bvh_ = std::make_shared<Bvh>();
+			bvh_->Build(*this);
 		}
+		return *bvh_;
+	}
+
+	void TriangleMesh::BakeAmbientOcclusion(u32 rayCount, f32 maxDistance)
+	{
+		if (vertices_.empty())
+			return;
+		f32 const diagonal = (maximum_ - minimum_).Length();
+		AmbientOcclusionBaker::BakeVertices(GetBvh(), vertices_.data(),
+			vertices_.size(), rayCount, maxDistance * diagonal);
+	}
+
+	void TriangleMesh::RenderVertexNormals()
+	{
+		renderDebugLines(VertexNormalLines);
+	}
+
+	void TriangleMesh::RenderVertexTangents()
+	{
+		renderDebugLines(VertexTangentLines);
+	}
+
+	void TriangleMesh::RenderVertexBitangents()
+	{
+		renderDebugLines(VertexBitangentLines);
 	}
 
 	void TriangleMesh::RenderFaceNormals()
 	{
-		if (vaoFaceNormals_)
+		renderDebugLines(FaceNormalLines);
+	}
+
+	u32 TriangleMesh::GetLevelTriangleCount(u32 level) const
+	{
+		Assert(level < GetLevelCount(), "Error: level of detail out of bounds: %d",
+			level);
+		return level == 0 ? u32(triangles_.size()) : levels_[level - 1].triangleCount;
+	}
+
+	u32 TriangleMesh::SelectLevelOfDetail(Matrix4 const &modelViewProjection,
+		f32 viewportHeight, f32 pixelError) const
+	{
+		if (levels_.empty())
+			return 0;
+
+		// Clip space w is the view depth under a perspective projection, so the
+		// nearest point of the bounding sphere is at depth w - radius (scaled by
+		// how w changes with distance in model space). Model space lengths map
+		// onto the screen by the length of the matrix's y row over that depth.
+		Matrix4 const &m = modelViewProjection;
+		Vector3 const center = (minimum_ + maximum_) * 0.5f;
+		f32 const radius = (maximum_ - minimum_).Length() * 0.5f;
+		f32 const depth = m.m30 * center.x + m.m31 * center.y + m.m32 * center.z + m.m33
+			- radius * Vector3(m.m30, m.m31, m.m32).Length();
+		if (depth <= 0.f)
+			return 0; // the eye is within the bounds
+		f32 const pixelsPerUnit = Vector3(m.m10, m.m11, m.m12).Length() / depth
+			* viewportHeight * 0.5f;
+
+		u32 level = 0;
+		for (u32 i = 0; i < levels_.size(); ++i)
 		{
-			vaoFaceNormals_->Bind();
-			vaoFaceNormals_->Render();
-			vaoFaceNormals_->Unbind();
+			if (levels_[i].error * pixelsPerUnit <= pixelError)
+				level = i + 1;
 		}
+		return level;
 	}
 
 	/* helper methods */
 
+	void TriangleMesh::buildDebugLines()
+	{
+		// Vertices: the mesh's positions, which every vertex line starts from,
+		// then the ends of the normals, tangents and bitangents, then the
+		// triangle centroids and the ends of the face normals. Each set of lines
+		// is a range of the IBO, in DebugLineSet order.
+		static f32 const LineLength = 0.1f;
+		size_t const vertexCount = vertices_.size();
+		size_t const triangleCount = triangles_.size();
+		std::vector<Vertex> lineVertices;
+		lineVertices.reserve(vertexCount * 4 + triangleCount * 2);
+		for (auto const &vertex : vertices_)
+			lineVertices.push_back(Vertex(vertex.vertex));
+		for (auto const &vertex : vertices_)
+			lineVertices.push_back(Vertex(vertex.vertex + vertex.normal * LineLength));
+		for (auto const &vertex : vertices_)
+			lineVertices.push_back(Vertex(vertex.vertex + vertex.tangent * LineLength));
+		for (auto const &vertex : vertices_)
+			lineVertices.push_back(Vertex(vertex.vertex + vertex.bitangent * LineLength));
+		for (size_t i = 0; i < triangleCount; ++i)
+			lineVertices.push_back(Vertex(GetTriangleCentroid(u32(i))));
+		for (size_t i = 0; i < triangleCount; ++i)
+			lineVertices.push_back(Vertex(GetTriangleCentroid(u32(i))
+				+ triangleNormals_[i] * LineLength));
+
+		std::vector<u32> lineIndices;
+		lineIndices.reserve(vertexCount * 6 + triangleCount * 2);
+		for (u32 set = VertexNormalLines; set <= VertexBitangentLines; ++set)
+		{
+			for (size_t i = 0; i < vertexCount; ++i)
+			{
+				lineIndices.push_back(u32(i));
+				lineIndices.push_back(u32((set + 1) * vertexCount + i));
+			}
+		}
+		for (size_t i = 0; i < triangleCount; ++i)
+		{
+			lineIndices.push_back(u32(vertexCount * 4 + i));
+			lineIndices.push_back(u32(vertexCount * 4 + triangleCount + i));
+		}
+
+		debugLines_ = std::shared_ptr<VertexArrayObject>(new VertexArrayObject(
+			lineVertices.size(), lineIndices.size() / 2, Topology::LINES));
+		debugLines_->GetVertexBufferObject().AttachVertices(lineVertices.data(),
+			lineVertices.size());
+		debugLines_->GetIndexBufferObject().AttachPrimitives(lineIndices.data(),
+			lineIndices.size() / 2);
+		debugLines_->Build(debugProgram_);
+	}
+
+	void TriangleMesh::renderDebugLines(DebugLineSet set)
+	{
+		if (!debugProgram_ || vertices_.empty())
+			return; // not built yet
+		if (!debugLines_)
+			buildDebugLines();
+		u32 const vertexLineIndices = u32(vertices_.size()) * 2;
+		IndexRange const range = set == FaceNormalLines
+			? IndexRange(vertexLineIndices * 3, u32(triangles_.size()) * 2)
+			: IndexRange(vertexLineIndices * u32(set), vertexLineIndices);
+		debugLines_->Bind();
+		debugLines_->RenderRanges(&range, 1);
+		debugLines_->Unbind();
+	}
+
+	u32 TriangleMesh::getLevelFirstTriangle(u32 level) const
+	{
+		return level == 0 ? 0 : u32(triangles_.size()) + levels_[level - 1].firstTriangle;
+	}
+
 	void TriangleMesh::centerMesh()
 	{
 		// find the centroid of the entire mesh (average of all vertices, hoping for
@@ -372,6 +887,40 @@ namespace Graphics
 			vert.vertex += centroid;
 	}
 
+	void TriangleMesh::generateLevelsOfDetail()
+	{
+		static f32 const LevelRatios[] = { 0.5f, 0.25f, 0.1f };
+		static size_t const LevelCount = sizeof(LevelRatios) / sizeof(*LevelRatios);
+
+		lodTriangles_.clear();
+		levels_.clear();
+		if (triangles_.empty())
+			return;
+
+		std::vector<SimplifiedLevel> simplified;
+		MeshSimplifier::BuildLevels(simplified, triangles_[0].indices,
+			triangles_.size() * 3, vertices_.data(), vertices_.size(), LevelRatios,
+			LevelCount);
+		// a level that simplification could not reduce (e.g. every vertex is
+		// locked) would only duplicate the previous one
+		size_t previousCount = triangles_.size();
+		for (auto const &level : simplified)
+		{
+			if (level.indices.size() / 3 >= previousCount)
+				continue;
+			previousCount = level.indices.size() / 3;
+			LevelOfDetail lod;
+			lod.firstTriangle = u32(lodTriangles_.size());
+			lod.triangleCount = u32(level.indices.size() / 3);
+			lod.error = level.error;
+			lod.reserved = 0;
+			levels_.push_back(lod);
+			for (size_t i = 0; i < level.indices.size(); i += 3)
+				lodTriangles_.emplace_back(level.indices[i], level.indices[i + 1],
+					level.indices[i + 2]);
+		}
+	}
+
 	void TriangleMesh::normalizeVertices()
 	{
 		// find the extent of this mesh and normalize all vertices by scaling them
@@ -0,0 +1,134 @@
+#include "Precompiled.h"
+#include "framework/ThreadPool.h"
+#include "graphics/Vertex.h"
+
+namespace
+{
+  using Math::Vector3;
+
+  // Vertices packed per ParallelFor chunk.
+  static size_t const PackGrain = 16 * 1024;
+
+  s16 ToSnorm16(f32 value)
+  {
+    value = std::max(-1.f, std::min(1.f, value));
+    return static_cast<s16>(std::floor(value * 32767.f + 0.5f));
+  }
+
+  // Maps a direction onto the octahedron |x| + |y| + |z| = 1 and unfolds the
+  // lower half over the upper one, giving two components in [-1, 1]. Zero
+  // vectors encode to (0, 0), which decodes to +z.
+  void EncodeOctahedral(Vector3 const &direction, s16 *encoded)
+  {
+    f32 const length = std::abs(direction.x) + std::abs(direction.y)
+      + std::abs(direction.z);
+    f32 x = 0.f, y = 0.f;
+    if (length > 0.f)
+    {
+      x = direction.x / length;
+      y = direction.y / length;
+      if (direction.z < 0.f)
+      {
+        f32 const foldedX = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+        f32 const foldedY = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = foldedX;
+        y = foldedY;
+      }
+    }
+    encoded[0] = ToSnorm16(x);
+    encoded[1] = ToSnorm16(y);
+  }
+
+  // Converts to an IEEE half float, rounding to nearest even. Values too
+  // large become infinity; values too small become (signed) zero or
+  // denormals.
+  u16 ToHalf(f32 value)
+  {
+    u32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    u32 const sign = (bits >> 16) & 0x8000u;
+    u32 const magnitude = bits & 0x7fffffffu;
+    if (magnitude >= 0x7f800000u) // infinity or NaN
+      return u16(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0u));
+    if (magnitude >= 0x477ff000u) // rounds to above the largest half
+      return u16(sign | 0x7c00u);
+    if (magnitude < 0x38800000u) // below the smallest normal half
+    {
+      if (magnitude < 0x33000000u)
+        return u16(sign);
+      u32 const exponent = magnitude >> 23;
+      u32 const mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+      u32 const shift = 126u - exponent;
+      u32 half = mantissa >> shift;
+      u32 const remainder = mantissa & ((1u << shift) - 1u);
+      u32 const halfway = 1u << (shift - 1u);
+      if (remainder > halfway || (remainder == halfway && (half & 1u)))
+        ++half;
+      return u16(sign | half);
+    }
+    u32 half = (magnitude - 0x38000000u) >> 13;
+    u32 const remainder = magnitude & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+      ++half;
+    return u16(sign | half);
+  }
+}
+
+namespace Graphics
+{
+  size_t GetVertexSize(VertexFormat format)
+  {
+    return format == VertexFormat::Packed ? sizeof(PackedVertex)
+      : sizeof(Vertex);
+  }
+
+  Math::Vector4 PackVertices(Vertex const *vertices, size_t count,
+    PackedVertex *packed)
+  {
+    if (count == 0)
+      return Math::Vector4(0.f, 0.f, 0.f, 1.f);
+
+    // one scale for all axes (the largest extent), see PackedVertex
+    Vector3 low = vertices[0].vertex, high = low;
+    for (size_t i = 1; i < count; ++i)
+    {
+      for (u32 axis = 0; axis < 3; ++axis)
+      {
+        low[axis] = std::min(low[axis], vertices[i].vertex[axis]);
+        high[axis] = std::max(high[axis], vertices[i].vertex[axis]);
+      }
+    }
+    Vector3 const extent = high - low;
+    f32 scale = std::max(extent.x, std::max(extent.y, extent.z));
+    if (scale <= 0.f)
+      scale = 1.f;
+    f32 const quantize = 65535.f / scale;
+
+    ThreadPool::GetInstance().ParallelFor(0, count, PackGrain,
+      [&](size_t begin, size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+      {
+        Vertex const &vertex = vertices[i];
+        PackedVertex &out = packed[i];
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+          f32 const q = (vertex.vertex[axis] - low[axis]) * quantize + 0.5f;
+          out.position[axis] = static_cast<u16>(std::min(65535.f,
+            std::max(0.f, q)));
+        }
+        EncodeOctahedral(vertex.normal, out.normal);
+        EncodeOctahedral(vertex.tangent, out.tangent);
+        bool const flipped = vertex.normal.Cross(vertex.tangent)
+          .Dot(vertex.bitangent) < 0.f;
+        out.bitangentSign = flipped ? -32767 : 32767;
+        out.uv[0] = ToHalf(vertex.uv.x);
+        out.uv[1] = ToHalf(vertex.uv.y);
+        out.occlusion = static_cast<u16>(std::floor(
+          std::max(0.f, std::min(1.f, vertex.occlusion)) * 65535.f + 0.5f));
+        out.padding = 0;
+      }
+    });
+    return Math::Vector4(low.x, low.y, low.z, scale);
+  }
+}
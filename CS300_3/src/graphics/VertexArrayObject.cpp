@@ -6,9 +6,10 @@
 namespace Graphics
 {
 	VertexArrayObject::VertexArrayObject(size_t vertexCount,
-	  size_t primitiveCount, Topology topology/* = TRIANGLES*/)
+	  size_t primitiveCount, Topology topology/* = TRIANGLES*/,
+	  VertexFormat format/* = Full*/)
 	  : vertexArrayHandle_(NULL), ibo_(topology, primitiveCount),
-	  vbo_(vertexCount)
+	  vbo_(vertexCount, format)
 	{
 	}
 
@@ -29,8 +30,9 @@ namespace Graphics
 		program->Bind();
 		Bind();
 		{
-			// count the size of a vertex using the Vertex structure
-			size_t const vertexSize = sizeof(Vertex);
+			// count the size of a vertex using the Vertex structure (or
+			// PackedVertex)
+			size_t const vertexSize = GetVertexSize(vbo_.GetFormat());
 
 			// build VBO
 			vbo_.Build();
@@ -47,6 +49,21 @@ namespace Graphics
 			size_t offset = 0;
 			for (size_t i = 0; i < AttributeCount; ++i)
 			{
+				if (vbo_.GetFormat() == VertexFormat::Packed)
+				{
+					// Packed attributes are integers (and half floats) which OpenGL
+					// converts to floats for the shader; normalized ones are mapped to
+					// [0, 1] (unsigned) or [-1, 1] (signed). See PackedVertex.
+					PackedAttribute const &attribute = PackedAttributes[i];
+					glEnableVertexAttribArray(static_cast<GLuint>(i));
+					glVertexAttribPointer(static_cast<GLuint>(i),
+					  attribute.elementCount, attribute.glType,
+					  attribute.normalized ? GL_TRUE : GL_FALSE, vertexSize,
+					  reinterpret_cast<GLvoid *>(attribute.offset));
+					CheckGL();
+					continue;
+				}
+
 				// Tells OpenGL to accept input vertices for a layout with this index;
 				// think of GLSL code like: layout(location = 0) in vec3 vVertex; The
 				// number portion of this code corresponds to 'i' in this for-loop.
@@ -98,8 +115,98 @@ namespace Graphics
 		// OpenGL behavior before IBOs existed. Specifying NULL tells OpenGL to use
 		// the currently bound GL_ELEMENT_ARRAY_BUFFER instead of copying over
 		// memory from the CPU-side each draw call.
+		// The indices are 16 or 32 bits wide, as chosen by the IBO.
 		glDrawElements(ibo_.GetTopology() == Topology::TRIANGLES
-		  ? GL_TRIANGLES : GL_LINES, ibo_.GetIndexCount(), GL_UNSIGNED_INT, NULL);
+		  ? GL_TRIANGLES : GL_LINES, ibo_.GetIndexCount(), ibo_.GetGLIndexType(),
+		  NULL);
+	}
+
+	void VertexArrayObject::RenderRanges(IndexRange const *ranges,
+	  size_t rangeCount)
+	{
+		// glMultiDrawElements behaves like one glDrawElements per range, except
+		// that the offsets are byte offsets into the bound IBO
+		rangeCounts_.resize(rangeCount);
+		rangeOffsets_.resize(rangeCount);
+		rangeBaseVertices_.resize(rangeCount);
+		bool rebased = false;
+		for (size_t i = 0; i < rangeCount; ++i)
+		{
+			Assert(ranges[i].firstIndex + ranges[i].indexCount
+			  <= ibo_.GetIndexCount(), "Error: index range out of bounds.");
+			rangeCounts_[i] = static_cast<GLsizei>(ranges[i].indexCount);
+			rangeOffsets_[i] = reinterpret_cast<GLvoid const *>(
+			  size_t(ranges[i].firstIndex) * ibo_.GetIndexSize());
+			rangeBaseVertices_[i] = static_cast<GLint>(ranges[i].baseVertex);
+			rebased |= ranges[i].baseVertex != 0;
+		}
+		if (rangeCount == 0)
+			return;
+		GLenum const mode = ibo_.GetTopology() == Topology::TRIANGLES
+		  ? GL_TRIANGLES : GL_LINES;
+		if (rebased)
+			glMultiDrawElementsBaseVertex(mode, rangeCounts_.data(),
+			  ibo_.GetGLIndexType(), rangeOffsets_.data(),
+			  static_cast<GLsizei>(rangeCount), rangeBaseVertices_.data());
+		else
+			glMultiDrawElements(mode, rangeCounts_.data(), ibo_.GetGLIndexType(),
+			  rangeOffsets_.data(), static_cast<GLsizei>(rangeCount));
+	}
+
+	void VertexArrayObject::SetInstanceBuffer(unsigned int buffer,
+	  size_t offset)
+	{
+		// glVertexAttribPointer reads from the bound array buffer, so bind the
+		// instance buffer for it and put back whatever was bound before
+		GLint previousBuffer = 0;
+		if (buffer)
+		{
+			glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previousBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		}
+
+		// a mat4 attribute takes one location per column; glVertexAttribDivisor
+		// makes each location advance once per instance rather than per vertex
+		for (size_t i = 0; i < InstanceAttributeCount; ++i)
+		{
+			GLuint const location = static_cast<GLuint>(InstanceAttribute + i);
+			if (!buffer)
+			{
+				glDisableVertexAttribArray(location);
+				continue;
+			}
+			glEnableVertexAttribArray(location);
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE,
+			  16 * sizeof(f32), reinterpret_cast<GLvoid const *>(
+			  offset + i * 4 * sizeof(f32)));
+			glVertexAttribDivisor(location, 1);
+		}
+		if (buffer)
+			glBindBuffer(GL_ARRAY_BUFFER, static_cast<GLuint>(previousBuffer));
+		CheckGL();
+	}
+
+	void VertexArrayObject::RenderRangesInstanced(IndexRange const *ranges,
+	  size_t rangeCount, u32 instanceCount)
+	{
+		GLenum const mode = ibo_.GetTopology() == Topology::TRIANGLES
+		  ? GL_TRIANGLES : GL_LINES;
+		for (size_t i = 0; i < rangeCount; ++i)
+		{
+			Assert(ranges[i].firstIndex + ranges[i].indexCount
+			  <= ibo_.GetIndexCount(), "Error: index range out of bounds.");
+			GLvoid const *offset = reinterpret_cast<GLvoid const *>(
+			  size_t(ranges[i].firstIndex) * ibo_.GetIndexSize());
+			if (ranges[i].baseVertex)
+				glDrawElementsInstancedBaseVertex(mode,
+				  static_cast<GLsizei>(ranges[i].indexCount), ibo_.GetGLIndexType(),
+				  offset, static_cast<GLsizei>(instanceCount),
+				  static_cast<GLint>(ranges[i].baseVertex));
+			else
+				glDrawElementsInstanced(mode,
+				  static_cast<GLsizei>(ranges[i].indexCount), ibo_.GetGLIndexType(),
+				  offset, static_cast<GLsizei>(instanceCount));
+		}
 	}
 
 	void VertexArrayObject::Unbind()
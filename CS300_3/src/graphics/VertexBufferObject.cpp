@@ -4,13 +4,14 @@
 
 namespace Graphics
 {
-  // Constructs a new VBO using all these parameters, including the actual data
-  // buffer used to store vertices. Notice how the buffer size is based on the
-  // size of the Vertex structure, as well as the number of vertices specified.
-  VertexBufferObject::VertexBufferObject(size_t vertexCount)
-    : vertexCount_(vertexCount), insertOffset_(0),
-    bufferSize_(sizeof(Vertex) * vertexCount),
-    buffer_(new char[bufferSize_]), glHandle_(0)
+  // Constructs a new VBO using all these parameters. Notice how the buffer
+  // size is based on the size of the Vertex structure, as well as the number
+  // of vertices specified. The data buffer used to stage vertices is only
+  // allocated once one is added (see getStaging).
+  VertexBufferObject::VertexBufferObject(size_t vertexCount,
+    VertexFormat format) : format_(format), vertexCount_(vertexCount),
+    insertOffset_(0), bufferSize_(GetVertexSize(format) * vertexCount),
+    buffer_(nullptr), sources_(), glHandle_(0)
   {
   }
 
@@ -23,17 +24,87 @@ namespace Graphics
 
   bool VertexBufferObject::AddVertex(Vertex const &vertex)
   {
+    Assert(format_ == VertexFormat::Full, "Error: adding a full vertex to a"
+      " packed vertex buffer.");
     // Can this VBO hold one more vertex?
     if (insertOffset_ + 1 > vertexCount_)
       return false;
 
     // Treat the buffer as a contiguous array of Vertices and simply copy a
     // vertex into it.
-    Vertex *vertexBuffer = reinterpret_cast<Vertex *>(buffer_);
+    Vertex *vertexBuffer = reinterpret_cast<Vertex *>(getStaging());
     vertexBuffer[insertOffset_++] = vertex;
     return true;
   }
 
+  bool VertexBufferObject::AddVertices(Vertex const *vertices, size_t count)
+  {
+    Assert(format_ == VertexFormat::Full, "Error: adding full vertices to a"
+      " packed vertex buffer.");
+    // Can this VBO hold all of them?
+    if (count > vertexCount_ - insertOffset_)
+      return false;
+
+    // Vertex is plain data laid out exactly as in the buffer, so the whole
+    // array is copied at once.
+    std::memcpy(getStaging() + insertOffset_ * sizeof(Vertex), vertices,
+      count * sizeof(Vertex));
+    insertOffset_ += count;
+    return true;
+  }
+
+  bool VertexBufferObject::AddVertices(PackedVertex const *vertices,
+    size_t count)
+  {
+    Assert(format_ == VertexFormat::Packed, "Error: adding packed vertices to"
+      " a full vertex buffer.");
+    if (count > vertexCount_ - insertOffset_)
+      return false;
+
+    std::memcpy(getStaging() + insertOffset_ * sizeof(PackedVertex), vertices,
+      count * sizeof(PackedVertex));
+    insertOffset_ += count;
+    return true;
+  }
+
+  bool VertexBufferObject::AttachVertices(Vertex const *vertices, size_t count)
+  {
+    Assert(format_ == VertexFormat::Full, "Error: attaching full vertices to a"
+      " packed vertex buffer.");
+    return attach(vertices, count);
+  }
+
+  bool VertexBufferObject::AttachVertices(PackedVertex const *vertices,
+    size_t count)
+  {
+    Assert(format_ == VertexFormat::Packed, "Error: attaching packed vertices"
+      " to a full vertex buffer.");
+    return attach(vertices, count);
+  }
+
+  bool VertexBufferObject::attach(void const *vertices, size_t count)
+  {
+    Assert(!glHandle_, "Error: attaching vertices to a built vertex buffer.");
+    if (count > vertexCount_ - insertOffset_)
+      return false;
+
+    // only remember where they are; Build copies them to the GPU
+    size_t const vertexSize = GetVertexSize(format_);
+    BufferSource source = { insertOffset_ * vertexSize, vertices,
+      count * vertexSize };
+    sources_.push_back(source);
+    insertOffset_ += count;
+    return true;
+  }
+
+  char *VertexBufferObject::getStaging()
+  {
+    Assert(!glHandle_, "Error: adding vertices to a built vertex buffer.");
+    if (!buffer_)
+      buffer_ = new char[bufferSize_];
+    return buffer_;
+  }
+
   size_t VertexBufferObject::GetBufferSize() const
   {
     return bufferSize_;
@@ -59,10 +130,27 @@ namespace Graphics
     // GL_STATIC_DRAW hints to the driver that we are only going to initialize
     // this buffer, never modify it, and only use it to draw. It allows for a
     // potential speed boost while rendering by storing the VBO contents in
-    // actual VRAM (not guaranteed).
+    // actual VRAM (not guaranteed). A buffer made of a single attached array
+    // is uploaded straight from it; otherwise the staged vertices (if any) are
+    // uploaded first and the attached arrays copied over their ranges.
     Bind();
-    glBufferData(GL_ARRAY_BUFFER, bufferSize_, buffer_, GL_STATIC_DRAW);
+    bool const direct = !buffer_ && sources_.size() == 1
+      && sources_[0].size == bufferSize_;
+    glBufferData(GL_ARRAY_BUFFER, bufferSize_,
+      direct ? sources_[0].data : buffer_, GL_STATIC_DRAW);
+    if (!direct)
+    {
+      for (auto const &source : sources_)
+        glBufferSubData(GL_ARRAY_BUFFER, source.offset, source.size,
+          source.data);
+    }
     CheckGL();
+
+    // the GPU now holds the only copy needed
+    delete[] buffer_;
+    buffer_ = nullptr;
+    sources_.clear();
+    sources_.shrink_to_fit();
   }
 
   void VertexBufferObject::Bind() const
@@ -86,5 +174,6 @@ namespace Graphics
 
     // deletes an array of buffers, but we only have one to delete
     glDeleteBuffers(1, &glHandle_);
+    glHandle_ = 0;
   }
 }
@@ -24,12 +24,17 @@
 #include <GL/glut.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <vector>
 extern "C" {
 #include <jpeglib.h>
 #include <jerror.h>
 }
 
 #include "shader.h"
+#include "graphics/FramebufferReader.h"
+#include "graphics/MipmapGenerator.h"
 
 #define		NUM_TEXTURES 10
 
@@ -100,6 +105,36 @@ int		load_texture(const char * filename,
 	return 0;
 }
 
+/*
+** Builds the mip chain of a texture on the CPU (in linear light, see
+** MipmapGenerator) and uploads every level to the bound texture.
+*/
+void		upload_mipmaps(const unsigned char * pixels,
+	const int format,
+	const unsigned int size)
+{
+	Graphics::MipmapSettings		settings;
+	std::vector<Graphics::MipmapLevel>	levels;
+	std::vector<unsigned char>		chain;
+	const unsigned int	channels = (GL_RGB == format ? 3 : 1);
+
+	/* alpha is coverage rather than color, so it is filtered as is */
+	if (GL_ALPHA == format)
+		settings.colorSpace = Graphics::MipmapColorSpace::Linear;
+
+	chain.resize(Graphics::MipmapGenerator::ComputeLayout(size, size,
+		channels, settings, levels));
+	memcpy(&chain[0], pixels, levels[0].size);
+	Graphics::MipmapGenerator::Generate(&chain[0], levels, channels, settings);
+
+	/* small levels of RGB and single channel textures are not 4-byte aligned */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (unsigned int level = 0; level < levels.size(); ++level)
+		glTexImage2D(GL_TEXTURE_2D, level, format,
+			levels[level].width, levels[level].height, 0,
+			format, GL_UNSIGNED_BYTE, &chain[levels[level].offset]);
+}
+
 /*
 ** Just a teapot
 */
@@ -110,6 +145,42 @@ void		Teapot(void)
 	glutSolidTeapot(0.4);
 }
 
+BOOL invert = FALSE;
+Graphics::Image inverted_frame; /* kept to reuse its pixels every frame */
+
+/*
+** Inverts the colors of an image read back from the framebuffer
+*/
+void		invert_pixels(Graphics::Image &image)
+{
+	u8 *pixels = image.GetPixels();
+	for (size_t i = 0; i < image.GetSize(); ++i)
+		pixels[i] = 255 - pixels[i];
+}
+
+/*
+** Replaces the rendered frame by its inverted colors
+*/
+void		present_inverted(void)
+{
+	/* One bulk read of the whole viewport, instead of one per pixel */
+	Graphics::FramebufferReader::ReadViewport(3, inverted_frame);
+	invert_pixels(inverted_frame);
+
+	/* the image is top-down, so draw it downwards from the top left corner */
+	glPushAttrib(GL_ENABLE_BIT | GL_PIXEL_MODE_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_BLEND);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelZoom(1, -1);
+	glWindowPos2i(0, inverted_frame.GetHeight());
+	glDrawPixels(inverted_frame.GetWidth(), inverted_frame.GetHeight(),
+		GL_RGB, GL_UNSIGNED_BYTE, inverted_frame.GetPixels());
+	glPopAttrib();
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
 /*
 ** Function called to update rendering
 */
@@ -210,6 +281,9 @@ void		DisplayFunc(void)
 	Teapot();
 	glPopMatrix();
 
+	if (invert)
+		present_inverted();
+
 	/* End */
 	glFlush();
 	glutSwapBuffers();
@@ -230,7 +304,6 @@ void		ReshapeFunc(int width, int height)
 	glutPostRedisplay();
 }
 
-BOOL invert = FALSE;
 /*
 ** Function called when a key is hit
 */
@@ -243,15 +316,8 @@ void		KeyboardFunc(unsigned char key, int x, int y)
 
 	if ('w' == key || 'W' == key)
 	{
-		invert = TRUE;
-		for (int i = 0; i < 640; i++)
-		{
-			for (int j = 0; j < 480; j++)
-			{
-				unsigned char pixel[4];
-				glReadPixels(i, j, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, pixel);
-			}
-		}
+		invert = !invert;
+		glutPostRedisplay();
 	}
 }
 
@@ -337,12 +403,12 @@ int		main(int argc, char **argv)
 			return 1;
 
 		glBindTexture(GL_TEXTURE_2D, textures[i]);
-		gluBuild2DMipmaps(GL_TEXTURE_2D, textures_info[i].format,
-			textures_info[i].size, textures_info[i].size,
+		upload_mipmaps(texture[i],
 			textures_info[i].format,
-			GL_UNSIGNED_BYTE, texture[i]);
+			textures_info[i].size);
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);